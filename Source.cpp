@@ -1,5 +1,14 @@
 #include <iostream>         // cout, cerr
 #include <cstdlib>          // EXIT_FAILURE
+#include <cstdio>           // snprintf
+#include <cstring>          // memset, strncpy
+#include <chrono>           // steady_clock
+#include <string>
+#include <fstream>          // ofstream
+#include <sstream>          // ostringstream
+#include <algorithm>        // max
+#include <cmath>            // ceil, sqrt
+#include <map>
 #include <GL/glew.h>        // GLEW library
 #include <GLFW/glfw3.h>     // GLFW library
 #define STB_IMAGE_IMPLEMENTATION
@@ -11,6 +20,26 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include <learnOpengl/camera.h> // Camera class
+#include "headless.h"       // Offscreen context and framebuffer
+#include "benchmark.h"      // Camera paths and frame timing
+#include "gputimer.h"       // GPU timestamp queries
+#include "profiler.h"       // CPU scope timers and Chrome trace export
+#include "uniforms.h"       // Uniform reflection
+#include "renderqueue.h"    // Sorted draw packets and bind filtering
+#include "vertexarena.h"    // Shared vertex buffer for static meshes
+#include "multidraw.h"      // Indirect multi-draw batches
+#include "meshopt.h"        // Vertex welding and cache statistics
+#include "meshfile.h"       // Memory-mapped binary mesh files
+#include "objloader.h"      // Multithreaded OBJ loading
+#include "gltfdocument.h"   // glTF binary parsing, without GL
+#include "lathe.h"          // Surfaces of revolution
+#include "lod.h"            // Mesh simplification and level of detail selection
+#include "culling.h"        // SIMD frustum culling of object bounds
+#include "bvh.h"            // Bounding volume hierarchy over object bounds
+#include "trianglebvh.h"    // Per-mesh triangle hierarchy for picking rays
+#include "gpucull.h"        // Compute shader frustum and occlusion culling into indirect commands
+#include "occlusion.h"      // CPU depth rasterizer of large occluders for occlusion culling
+#include "objectid.h"       // Asynchronous readback of the object id attachment
 
 
 using namespace std; // Standard namespace
@@ -19,6 +48,10 @@ using namespace std; // Standard namespace
 #ifndef GLSL
 #define GLSL(Version, Source) "#version " #Version " core \n" #Source
 #endif
+/*Shader source without a #version line, for declarations shared by several shaders*/
+#ifndef GLSL_SHARED
+#define GLSL_SHARED(Source) #Source "\n"
+#endif
 
 // Unnamed namespace
 namespace
@@ -29,27 +62,90 @@ namespace
     const int WINDOW_WIDTH = 800;
     const int WINDOW_HEIGHT = 600;
 
+    // Levels of detail of one mesh, finest first; level 0 is the mesh's own range and every level draws its vertices
+    struct GLMeshLods
+    {
+        vector<MeshRange> levels;
+        vector<float> errors;       // object-space error of each level
+        glm::vec3 center;           // bounding sphere in object space, for the distance to the camera
+        float radius = 0.0f;
+    };
+
     // Stores the GL data relative to a given mesh
     struct GLMesh
     {
-        GLuint tableVAO;         // Handle for the vertex array object
-        GLuint planeVAO;         
-        GLuint carpetVAO;
-        GLuint windowVAO;
-        GLuint teacupVAO;
-        GLuint saucerVAO;
-        GLuint tableVBO;         // Handle for the vertex buffer object
-        GLuint planeVBO;         
-        GLuint carpetVBO;
-        GLuint windowVBO;
-        GLuint teacupVBO;
-        GLuint saucerVBO;
-        GLuint tableVertices;    // Number of indices of the mesh
-        GLuint planeVertices;   
-        GLuint carpetVertices;
-        GLuint windowVertices;
-        GLuint teacupVertices;
-        GLuint saucerVertices;
+        VertexArena arena;       // One vertex buffer and VAO shared by every mesh
+        MeshRange table;         // Vertices of each mesh inside the arena
+        MeshRange plane;
+        MeshRange carpet;
+        MeshRange window;
+        MeshRange teacup;
+        MeshRange saucer;
+        GLMeshLods teacupLods;   // Drawn instead of teacup and saucer, at the level picked per object and frame
+        GLMeshLods saucerLods;
+    };
+
+    // Uniforms used by the scene shaders, resolved once when a program is linked
+    enum UniformSlot
+    {
+        UNIFORM_MODEL,
+        UNIFORM_UV_SCALE,
+        UNIFORM_TEXTURE,
+        UNIFORM_COUNT
+    };
+    const char* const UNIFORM_NAMES[UNIFORM_COUNT] = { "model", "uvScale", "uTexture" };
+
+    // Camera and lighting state shared by every draw of a frame (std140 layout of the FrameData block)
+    const GLuint FRAME_UNIFORM_BINDING = 0;
+    struct FrameUniforms
+    {
+        glm::mat4 view;
+        glm::mat4 projection;
+        glm::vec3 viewPosition;   float pad0;
+        glm::vec3 keyLightColor;  float pad1;
+        glm::vec3 keyLightPos;    float pad2;
+        glm::vec3 fillLightColor; float pad3;
+        glm::vec3 fillLightPos;   float pad4;
+        glm::vec3 objectColor;    float pad5;
+    };
+    static_assert(sizeof(FrameUniforms) == 224, "FrameUniforms must match the std140 layout of FrameData");
+
+    // Per-object and per-material storage buffers of the multi-draw scene program (std430 layouts of ObjectData and MaterialData)
+    const GLuint OBJECT_BUFFER_BINDING = 1;
+    const GLuint MATERIAL_BUFFER_BINDING = 2;
+    // Vertex attribute and vertex buffer binding that carry the object index of each instance
+    const GLuint OBJECT_INDEX_ATTRIB = 3;
+    const GLuint OBJECT_INDEX_BINDING = 1;
+    struct ObjectUniforms
+    {
+        glm::mat4 model;
+        GLuint material;
+        GLuint pad[3];
+    };
+    static_assert(sizeof(ObjectUniforms) == 80, "ObjectUniforms must match the std430 layout of ObjectData");
+    struct MaterialUniforms
+    {
+        float textureLayer;   // layer of gSceneTextureArray
+        float keyAmbient;     // key light ambient strength
+        float keySpecular;    // key light specular strength
+        float unlit;          // 1 for the windows, drawn plain white
+    };
+    static_assert(sizeof(MaterialUniforms) == 16, "MaterialUniforms must match the std430 layout of MaterialData");
+    enum SceneMaterial
+    {
+        MATERIAL_PLANE,
+        MATERIAL_CARPET,
+        MATERIAL_TABLE,
+        MATERIAL_CERAMIC,
+        MATERIAL_WINDOW,
+        MATERIAL_COUNT
+    };
+
+    // A linked shader program and the locations of its uniforms (-1 when the program does not use one)
+    struct GLProgram
+    {
+        GLuint id;
+        GLint uniforms[UNIFORM_COUNT];
     };
 
     // Main GLFW window
@@ -65,11 +161,103 @@ namespace
     GLint gTexWrapMode = GL_REPEAT;
 
     // Shader programs
-    GLuint gTableProgramId;
-    GLuint gCarpetProgramId;
-    GLuint gLampProgramId;
-    GLuint gCeramicProgramId;
-    GLuint gPlaneProgramId;
+    GLProgram gTableProgram;
+    GLProgram gCarpetProgram;
+    GLProgram gLampProgram;
+    GLProgram gCeramicProgram;
+    GLProgram gPlaneProgram;
+
+    // Uniform buffer holding the FrameData block, bound at FRAME_UNIFORM_BINDING
+    GLuint gFrameUniformBuffer;
+
+    // Whole scene in one glMultiDrawElementsIndirect call (--multi-draw)
+    bool gMultiDraw = false;
+    // Post-transform cache size the mesh index buffers are optimized for, 0 keeps the welded order (--vertex-cache N)
+    unsigned int gVertexCacheSize = 32;
+    // Cluster ACMR allowed when reordering triangles against overdraw, 0 skips the pass (--overdraw-threshold F)
+    float gOverdrawThreshold = 1.05f;
+    // Report the overdraw ratio of every mesh before and after optimization (--measure-overdraw)
+    bool gMeasureOverdraw = false;
+    // Binary mesh file to load the scene meshes from instead of the built-in arrays (--mesh-file F),
+    // and where to save the built-in meshes once welded and optimized (--write-mesh-file F)
+    string gMeshFileName;
+    string gWriteMeshFileName;
+    // OBJ model loaded in place of the built-in teacup (--obj F)
+    string gObjFileName;
+    // glTF binary model loaded in place of the built-in teacup (--gltf F)
+    string gGltfFileName;
+    // Tessellation of the lathed teacup and saucer: segments around the axis (--lathe-segments N)
+    // and between two control points of the profile curve (--lathe-profile-segments N)
+    unsigned int gLatheRadialSegments = 32;
+    unsigned int gLatheProfileSegments = 4;
+    // Levels in the teacup and saucer LOD chains, 1 draws full detail only (--lod-levels N), and the error in pixels
+    // a level may show on screen (--lod-error PX). Coarsening waits until a level is LOD_HYSTERESIS under budget.
+    unsigned int gLodLevels = 4;
+    float gLodPixelError = 1.0f;
+    const float LOD_HYSTERESIS = 0.25f;
+    // Objects whose world bounds are entirely outside the view frustum are not drawn (--no-cull draws everything).
+    // The scene batch tests every box (SIMD) or walks its bounding volume hierarchy (--bvh-cull).
+    bool gCulling = true;
+    bool gBvhCulling = false;
+    Frustum gFrustum;   // of the current frame's projection * view
+    glm::mat4 gViewProjection;
+    // Objects inside the frustum but behind the floor, carpet or table top are not drawn either (--occlusion-cull).
+    // Those occluders are rasterized on the CPU each frame into a depth buffer a quarter of the window's size.
+    bool gOcclusionCulling = false;
+    OcclusionRasterizer gOcclusion;
+    // Level drawn last frame for the objects outside the scene batch
+    unsigned int gTeacupLod = 0;
+    unsigned int gSaucerLod = 0;
+
+    // Instanced stress scene: this many extra teacup and saucer pairs on a grid (--stress N)
+    int gStressCount = 0;
+    // Cull the scene batch in a compute shader against the frustum and last frame's depth, and draw what survives
+    // from the commands it writes, without the CPU touching per-object visibility (--gpu-cull)
+    bool gGpuCulling = false;
+    GpuCuller gGpuCuller;
+    GLuint gGpuCullProgram = 0;
+    GLuint gGpuCompactProgram = 0;
+    GLuint gDepthPyramidProgram = 0;
+    // All of these draw the scene batch through the scene program instead of the render queue
+    bool gSceneBatchMode = false;
+    GLProgram gSceneProgram;
+    GLuint gSceneTextureArray = 0;
+    GLuint gObjectBuffer = 0;
+    GLuint gMaterialBuffer = 0;
+    MultiDrawBatch gSceneBatch;
+    vector<ObjectUniforms> gSceneObjects;
+    // Instances of one mesh in the scene batch, which are culled and pick their level of detail per frame: the mesh
+    // has one command per level, and the visible instances are regrouped so each command draws the ones at its level
+    const unsigned int SCENE_CULLED = ~0u;
+    struct SceneGroup
+    {
+        const GLMeshLods* lods;        // NULL for meshes drawn at full detail only
+        size_t levelCount;
+        size_t firstCommand;
+        GLuint firstObject;
+        vector<glm::mat4> models;
+        vector<unsigned int> levels;   // of every instance as drawn last frame, SCENE_CULLED if it was not
+    };
+    vector<SceneGroup> gSceneGroups;
+    // World bounds of every scene batch object, in object index order, and which passed the frustum test this frame
+    FrustumCuller gSceneCuller;
+    vector<unsigned char> gSceneVisible;
+    // The same boxes in a hierarchy, by object index, for culling and spatial queries
+    ObjectBvh gSceneBvh;
+    // What a click can hit, by the same object index: the full-detail mesh and placement of every scene batch
+    // object, or of the render queue's objects in submission order
+    struct PickObject
+    {
+        MeshRange range;
+        glm::mat4 model;
+    };
+    vector<PickObject> gPickObjects;
+    // Triangle hierarchies of the meshes clicked so far, by their first index in the arena
+    map<GLuint, TriangleBvh> gTriangleBvhs;
+    // Pick from an object id attachment the scene program fills while drawing (object index + 1, 0 for the
+    // background) instead of casting rays, so no geometry has to stay on the CPU (--id-buffer)
+    bool gObjectIdBuffer = false;
+    ObjectIdReadback gObjectIdReadback;
 
     // Camera
     Camera gCamera(glm::vec3(0.0f, 1.0f, 5.0f));
@@ -82,6 +270,62 @@ namespace
     float gDeltaTime = 0.0f; // time between current frame and last frame
     float gLastFrame = 0.0f;
 
+    // Frames to render in headless and benchmark runs (--frames)
+    int  gFrameCount = 300;
+
+    // Headless offscreen rendering (--headless)
+    bool gHeadless = false;
+    const char* gFrameDumpDir = nullptr;
+    HeadlessContext gHeadlessContext;
+    // The frame in headless runs, and in a window with --id-buffer, where it is copied to the back buffer
+    OffscreenTarget gOffscreenTarget;
+
+    // Draw blocks of URender, used to attribute the frame time
+    enum RenderPass
+    {
+        PASS_PLANE,
+        PASS_CARPET,
+        PASS_TABLE,
+        PASS_TEACUP,
+        PASS_SAUCER,
+        PASS_WINDOW1,
+        PASS_WINDOW2,
+        PASS_SCENE_BATCH,
+        PASS_GPU_CULL,
+        PASS_DEPTH_PYRAMID,
+        PASS_COUNT
+    };
+    const char* const RENDER_PASS_NAMES[PASS_COUNT] = { "plane", "carpet", "table", "teacup", "saucer", "window1", "window2", "sceneBatch",
+        "gpuCull", "depthPyramid" };
+
+    // Benchmark runs (--benchmark) replay a camera path with a fixed time step
+    bool gBenchmarkMode = false;
+    string gBenchmarkPathName;
+    const char* gBenchmarkOutFile = nullptr;
+    CameraPath gBenchmarkPath;
+    FrameBenchmark gBenchmark(RENDER_PASS_NAMES, PASS_COUNT);
+    RenderStats gRenderStats;
+
+    // GPU time per draw block (--gpu-timers, always on for benchmarks)
+    bool gGpuTimers = false;
+    GpuTimer gGpuTimer;
+    double gGpuPassTotals[PASS_COUNT] = {};
+    int gGpuPassSamples[PASS_COUNT] = {};
+    int gGpuReportFrames = 0;
+
+    // Chrome trace of CPU scopes and GPU passes (--trace)
+    const char* gTraceFile = nullptr;
+    long long gPassStartNs[PASS_COUNT] = {};
+
+    // Draws of the frame, sorted by state and depth before submission
+    RenderQueue gRenderQueue;
+    RenderStateCache gStateCache;
+
+    // Camera recording (--record-path)
+    const char* gRecordPathFile = nullptr;
+    CameraPath gRecordedPath;
+    float gRecordStartTime = 0.0f;
+
     // Table position and scale
     glm::vec3 gTablePosition(0.0f, 0.0f, 0.0f);
     glm::vec3 gTableScale(2.0f);
@@ -109,21 +353,89 @@ namespace
  * redraw graphics on the window when resized,
  * and render graphics on the screen
  */
+bool UParseArguments(int argc, char* argv[]);
 bool UInitialize(int, char* [], GLFWwindow** window);
+bool UInitializeHeadless();
+void URunHeadless();
+void URunBenchmark();
+void UBeginPass(RenderPass pass);
+void UEndPass(RenderPass pass);
+void UCollectGpuTimings();
+void UUseProgram(GLuint programId);
+void UBindVertexArray(GLuint vao);
+void UBindTexture(GLuint textureId);
+void UDrawElements(GLuint firstIndex, GLsizei count, GLint baseVertex);
+void USubmitDraw(RenderPass pass, const GLProgram& program, GLuint textureId, const MeshRange& range, glm::vec3 gPos, glm::vec3 gScale);
+void UDrawRenderQueue();
+void UAddSceneObject(const MeshRange& range, SceneMaterial material, glm::vec3 gPos, glm::vec3 gScale);
+void UAddSceneInstances(const MeshRange& range, SceneMaterial material, const vector<glm::mat4>& models, const GLMeshLods* lods = NULL);
+void UUpdateSceneBatch();
+bool UCreateGpuCulling();
+void UCullSceneOnGpu();
+void UReadGpuCullStats(RenderStats& stats, bool wait);
+void UBuildDepthPyramid();
+void UCreateOccluders();
+void URasterizeOccluders();
+unsigned int USelectLod(const GLMeshLods& lods, const glm::mat4& model, unsigned int level);
+bool UCreateSceneBatch();
+void UDestroySceneBatch();
+void UDrawSceneBatch();
 void UResizeWindow(GLFWwindow* window, int width, int height);
 void UProcessInput(GLFWwindow* window);
 void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos);
 void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset);
 void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
+void UCreatePickScene();
+bool UClickPosition(GLFWwindow* window, float& x, float& y);
+void UPickObject(GLFWwindow* window);
+void URequestObjectId(GLFWwindow* window);
+void UResolveObjectId();
+const TriangleBvh& UTriangleBvh(const MeshRange& range);
+const char* UMeshName(const MeshRange& range);
 void UCreateMesh(GLMesh& mesh);
+IndexedMesh UWeldMesh(const char* name, const float* vertices, size_t floatCount);
+LatheOptions ULatheOptions();
+IndexedMesh UBuildTeacup(const char* name);
+IndexedMesh UBuildSaucer(const char* name);
+bool UCheckOverdrawMeasure();
+void UOptimizeMeshes(const char* const* names, vector<IndexedMesh>& meshes);
+void UBuildLods(const char* const* names, vector<IndexedMesh>& meshes, GLMeshLods* const* lods, vector<vector<LodLevel>>& chains);
+bool ULoadMeshFile(const char* path, const char* const* names, MeshRange* const* ranges, GLMeshLods* const* lods, int meshCount, VertexArena& arena);
+bool ULoadObjModel(const char* path, IndexedMesh& target);
+bool ULoadGltfModel(const char* path, IndexedMesh& target);
+void UFitModel(IndexedMesh& model, const IndexedMesh& target);
+bool UWriteMeshFile(const char* path, const char* const* names, MeshRange* const* ranges, GLMeshLods* const* lods, int meshCount, const VertexArena& arena);
 void UDestroyMesh(GLMesh& mesh);
 bool UCreateTexture(const char* filename, GLuint& textureId);
+bool UCreateTextureArray(const GLuint* textureIds, int count, GLuint& arrayId);
 void UDestroyTexture(GLuint textureId);
 void URender();
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId);
+bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLProgram& program);
+bool UCreateComputeProgram(const char* source, GLuint& programId);
 void UDestroyShaderProgram(GLuint programId);
 int  UCreateTexturePrograms();
-void USetShaderProgram(GLuint programId, glm::vec3 gPos, glm::vec3 gScale);
+void UCreateFrameUniformBuffer();
+void UUpdateFrameUniforms();
+void USetUniform(GLint location, const glm::mat4& value);
+void USetUniform(GLint location, const glm::vec3& value);
+void USetUniform(GLint location, const glm::vec2& value);
+string UWithFrameData(const char* source);
+
+/* FrameData Uniform Block Source Code: per-frame camera and lighting state (std140, matches FrameUniforms), written
+   once and inserted after the #version line of every vertex and fragment shader by UCreateShaderProgram*/
+const GLchar* frameDataBlockSource = GLSL_SHARED(
+layout(std140, binding = 0) uniform FrameData
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPosition;
+    vec3 keyLightColor;
+    vec3 keyLightPos;
+    vec3 fillLightColor;
+    vec3 fillLightPos;
+    vec3 objectColor;
+};
+);
 
 // Carpet
 //-----------------------------------
@@ -140,8 +452,7 @@ out vec2 vertexTextureCoordinate;
 
 //Uniform / Global variables for the  transform matrices
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// FrameData block: view, projection, viewPosition, lights, objectColor (frameDataBlockSource, added by UCreateShaderProgram)
 
 void main()
 {
@@ -164,12 +475,7 @@ in vec2 vertexTextureCoordinate;
 out vec4 fragmentColor; // For outgoing cube color to the GPU
 
 // Uniform / Global variables for object color, light color, light position, and camera/view position
-uniform vec3 objectColor;
-uniform vec3 fillLightColor;
-uniform vec3 fillLightPos;
-uniform vec3 keyLightColor;
-uniform vec3 keyLightPos;
-uniform vec3 viewPosition;
+// FrameData block: view, projection, viewPosition, lights, objectColor (frameDataBlockSource, added by UCreateShaderProgram)
 uniform sampler2D uTexture; // Useful when working with multiple textures
 uniform vec2 uvScale;
 
@@ -237,8 +543,7 @@ out vec2 vertexTextureCoordinate;
 
 //Uniform / Global variables for the  transform matrices
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// FrameData block: view, projection, viewPosition, lights, objectColor (frameDataBlockSource, added by UCreateShaderProgram)
 
 void main()
 {
@@ -261,12 +566,7 @@ in vec2 vertexTextureCoordinate;
 out vec4 fragmentColor; // For outgoing cube color to the GPU
 
 // Uniform / Global variables for object color, light color, light position, and camera/view position
-uniform vec3 objectColor;
-uniform vec3 fillLightColor;
-uniform vec3 fillLightPos;
-uniform vec3 keyLightColor;
-uniform vec3 keyLightPos;
-uniform vec3 viewPosition;
+// FrameData block: view, projection, viewPosition, lights, objectColor (frameDataBlockSource, added by UCreateShaderProgram)
 uniform sampler2D uTexture; // Useful when working with multiple textures
 uniform vec2 uvScale;
 
@@ -340,8 +640,7 @@ out vec2 vertexTextureCoordinate;
 
 //Uniform / Global variables for the  transform matrices
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// FrameData block: view, projection, viewPosition, lights, objectColor (frameDataBlockSource, added by UCreateShaderProgram)
 
 void main()
 {
@@ -365,12 +664,7 @@ in vec2 vertexTextureCoordinate;
 out vec4 fragmentColor; // For outgoing cube color to the GPU
 
 // Uniform / Global variables for object color, light color, light position, and camera/view position
-uniform vec3 objectColor;
-uniform vec3 fillLightColor;
-uniform vec3 fillLightPos;
-uniform vec3 keyLightColor;
-uniform vec3 keyLightPos;
-uniform vec3 viewPosition;
+// FrameData block: view, projection, viewPosition, lights, objectColor (frameDataBlockSource, added by UCreateShaderProgram)
 uniform sampler2D uTexture; // Useful when working with multiple textures
 uniform vec2 uvScale;
 
@@ -439,8 +733,7 @@ const GLchar* lampVertexShaderSource = GLSL(440,
 
         //Uniform / Global variables for the  transform matrices
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// FrameData block: view, projection, viewPosition, lights, objectColor (frameDataBlockSource, added by UCreateShaderProgram)
 
 void main()
 {
@@ -475,8 +768,7 @@ out vec2 vertexTextureCoordinate;
 
 //Uniform / Global variables for the  transform matrices
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// FrameData block: view, projection, viewPosition, lights, objectColor (frameDataBlockSource, added by UCreateShaderProgram)
 
 void main()
 {
@@ -500,12 +792,7 @@ in vec2 vertexTextureCoordinate;
 out vec4 fragmentColor; // For outgoing cube color to the GPU
 
 // Uniform / Global variables for object color, light color, light position, and camera/view position
-uniform vec3 objectColor;
-uniform vec3 fillLightColor;
-uniform vec3 fillLightPos;
-uniform vec3 keyLightColor;
-uniform vec3 keyLightPos;
-uniform vec3 viewPosition;
+// FrameData block: view, projection, viewPosition, lights, objectColor (frameDataBlockSource, added by UCreateShaderProgram)
 uniform sampler2D uTexture; // Useful when working with multiple textures
 uniform vec2 uvScale;
 
@@ -568,6 +855,328 @@ void main()
 
 
 // Images are loaded with Y axis going down, but OpenGL's Y axis goes up, so let's flip it
+/* Scene Vertex Shader Source Code: every object of the multi-draw path, indexed by its object index*/
+const GLchar* sceneVertexShaderSource = GLSL(440,
+
+layout(location = 0) in vec3 position; // VAP position 0 for vertex position data
+layout(location = 1) in vec3 normal; // VAP position 1 for normals
+layout(location = 2) in vec2 textureCoordinate;
+layout(location = 3) in uint objectIndex; // Instanced: BaseInstance + gl_InstanceID of the indirect draw
+
+out vec3 vertexNormal; // For outgoing normals to fragment shader
+out vec3 vertexFragmentPos; // For outgoing color / pixels to fragment shader
+out vec2 vertexTextureCoordinate;
+flat out uint vertexMaterial;
+flat out uint vertexObjectId;
+
+struct ObjectData
+{
+    mat4 model;
+    uint material;
+};
+layout(std430, binding = 1) readonly buffer ObjectBuffer // Per-object transforms and materials
+{
+    ObjectData objects[];
+};
+// FrameData block: view, projection, viewPosition, lights, objectColor (frameDataBlockSource, added by UCreateShaderProgram)
+
+void main()
+{
+    mat4 model = objects[objectIndex].model;
+    gl_Position = projection * view * model * vec4(position, 1.0f); // Transforms vertices into clip coordinates
+
+    vertexFragmentPos = vec3(model * vec4(position, 1.0f)); // Gets fragment / pixel position in world space only (exclude view and projection)
+
+    vertexNormal = mat3(transpose(inverse(model))) * normal; // get normal vectors in world space only and exclude normal translation properties
+    vertexTextureCoordinate = textureCoordinate;
+    vertexMaterial = objects[objectIndex].material;
+    vertexObjectId = objectIndex + 1u; // 0 is left for the background
+}
+);
+
+
+/* Scene Fragment Shader Source Code: the textured and ceramic Phong shading selected by material, windows unlit*/
+const GLchar* sceneFragmentShaderSource = GLSL(440,
+
+in vec3 vertexNormal; // For incoming normals
+in vec3 vertexFragmentPos; // For incoming fragment position
+in vec2 vertexTextureCoordinate;
+flat in uint vertexMaterial;
+flat in uint vertexObjectId;
+
+layout(location = 0) out vec4 fragmentColor; // For outgoing cube color to the GPU
+layout(location = 1) out uint fragmentObjectId; // For the object id attachment, ignored without one
+
+struct MaterialData
+{
+    float textureLayer;
+    float keyAmbient;
+    float keySpecular;
+    float unlit;
+};
+layout(std430, binding = 2) readonly buffer MaterialBuffer
+{
+    MaterialData materials[];
+};
+// FrameData block: view, projection, viewPosition, lights, objectColor (frameDataBlockSource, added by UCreateShaderProgram)
+uniform sampler2DArray uTexture; // One layer per scene texture
+uniform vec2 uvScale;
+
+void main()
+{
+    fragmentObjectId = vertexObjectId;
+    MaterialData material = materials[vertexMaterial];
+    if (material.unlit > 0.5)
+    {
+        fragmentColor = vec4(1.0f); // Windows are plain white like the lamp shader
+        return;
+    }
+
+    //Calculate Key Lamp lighting*/
+    vec3 keyAmbient = material.keyAmbient * keyLightColor; // Generate ambient light color
+    vec3 norm = normalize(vertexNormal); // Normalize vectors to 1 unit
+    vec3 lightDirection = normalize(keyLightPos - vertexFragmentPos); // Calculate distance (light direction) between light source and fragments/pixels on cube
+    float impact = max(dot(norm, lightDirection), 0.1);// Calculate diffuse impact by generating dot product of normal and light
+    vec3 keyDiffuse = impact * keyLightColor; // Generate diffuse light color
+    float highlightSize = 16.0f; // Set specular highlight size
+    vec3 viewDir = normalize(viewPosition - vertexFragmentPos); // Calculate view direction
+    vec3 reflectDir = reflect(-lightDirection, norm); // Calculate reflection vector
+    float specularComponent = pow(max(dot(viewDir, reflectDir), 0.0), highlightSize);
+    vec3 keySpecular = material.keySpecular * specularComponent * keyLightColor;
+
+    //Calculate Fill Lamp lighting*/
+    vec3 fillAmbient = 1.0f * fillLightColor; // Generate ambient light color
+    lightDirection = normalize(fillLightPos - vertexFragmentPos); // Calculate distance (light direction) between light source and fragments/pixels on cube
+    impact = max(dot(norm, lightDirection), 0.1);// Calculate diffuse impact by generating dot product of normal and light
+    vec3 fillDiffuse = impact * fillLightColor; // Generate diffuse light color
+    reflectDir = reflect(-lightDirection, norm); // Calculate reflection vector
+    specularComponent = pow(max(dot(viewDir, reflectDir), 0.0), highlightSize);
+    vec3 fillSpecular = 5.0f * specularComponent * fillLightColor;
+
+    // Texture holds the color to be used for all three components
+    vec3 textureColor = texture(uTexture, vec3(vertexTextureCoordinate * uvScale, material.textureLayer)).xyz;
+
+    // Calculate phong result
+    vec3 fillResult = (fillAmbient + fillDiffuse + fillSpecular);
+    vec3 keyResult = (keyAmbient + keyDiffuse + keySpecular);
+    vec3 lightingResult = fillResult + keyResult;
+    vec3 phong = lightingResult * textureColor;
+
+    fragmentColor = vec4(phong, 1.0); // Send lighting results to GPU
+}
+);
+
+// GPU culling
+//-----------------------------------
+/* Culling Compute Shader Source Code: one invocation per object appends it to the command of its mesh and level*/
+const GLchar* gpuCullComputeShaderSource = GLSL(440,
+
+layout(local_size_x = 64) in;
+
+struct CullObject
+{
+    vec3 center;
+    uint group;
+    vec3 extent;
+    float scale;
+};
+struct CullGroup
+{
+    uint firstCommand;
+    uint levelCount;
+    float radius;
+    uint pad;
+    float errors[8];
+};
+layout(std140, binding = 1) uniform CullData // Per-frame culling state (GpuCullUniforms)
+{
+    vec4 planes[6]; // Current frustum, inside where dot(xyz, p) + w >= 0
+    mat4 previousViewProjection; // That the depth pyramid was rendered with
+    vec4 camera; // Position, and pixels per unit at distance 1 (everywhere when orthographic)
+    vec4 lod; // Pixel error budget, hysteresis, 1 when orthographic
+    uint objectCount;
+    uint commandCount;
+    uint pyramidLevels; // 0 until there is a depth pyramid
+    uint pad0;
+    vec2 pyramidScale; // Texels of pyramid level 0 per unit of screen uv
+};
+struct DrawCommand // DrawElementsIndirectCommand
+{
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+layout(std430, binding = 3) readonly buffer ObjectBuffer { CullObject objects[]; };
+layout(std430, binding = 4) readonly buffer GroupBuffer { CullGroup groups[]; };
+layout(std430, binding = 5) buffer LevelBuffer { uint levels[]; }; // Of every object when it was last visible
+layout(std430, binding = 6) buffer CommandBuffer { DrawCommand commands[]; };
+layout(std430, binding = 7) writeonly buffer InstanceBuffer { uint instances[]; };
+layout(std430, binding = 8) buffer StatsBuffer
+{
+    uint visibleCount;
+    uint frustumCulledCount;
+    uint occludedCount;
+    uint triangleCount;
+};
+layout(binding = 0) uniform sampler2D depthPyramid; // Farthest depth of the previous frame under each texel
+
+bool insideFrustum(vec3 center, vec3 extent)
+{
+    for (int p = 0; p < 6; ++p)
+    {
+        if (dot(planes[p].xyz, center) + planes[p].w + dot(abs(planes[p].xyz), extent) < 0.0)
+            return false;
+    }
+    return true;
+}
+
+// Whether the box lies behind everything drawn over its screen rectangle last frame
+bool occluded(vec3 center, vec3 extent)
+{
+    if (pyramidLevels == 0u)
+        return false;
+    vec2 screenMin = vec2(1.0);
+    vec2 screenMax = vec2(0.0);
+    float nearest = 1.0;
+    for (int corner = 0; corner < 8; ++corner)
+    {
+        vec3 offset = vec3((corner & 1) != 0 ? 1.0 : -1.0, (corner & 2) != 0 ? 1.0 : -1.0, (corner & 4) != 0 ? 1.0 : -1.0);
+        vec4 clip = previousViewProjection * vec4(center + offset * extent, 1.0);
+        if (clip.w <= 0.0)
+            return false; // Crosses the camera plane
+        vec3 ndc = clip.xyz / clip.w;
+        screenMin = min(screenMin, ndc.xy * 0.5 + 0.5);
+        screenMax = max(screenMax, ndc.xy * 0.5 + 0.5);
+        nearest = min(nearest, ndc.z * 0.5 + 0.5);
+    }
+    // Nothing is known about what was off screen
+    if (any(lessThan(screenMin, vec2(0.0))) || any(greaterThan(screenMax, vec2(1.0))))
+        return false;
+
+    // The level at which the rectangle spans at most 2x2 texels
+    vec2 size = (screenMax - screenMin) * pyramidScale;
+    int level = min(int(ceil(log2(max(max(size.x, size.y), 1.0)))), int(pyramidLevels) - 1);
+    ivec2 levelSize = textureSize(depthPyramid, level);
+    ivec2 low = min(ivec2(screenMin * pyramidScale) >> level, levelSize - 1);
+    ivec2 high = min(ivec2(screenMax * pyramidScale) >> level, levelSize - 1);
+    float farthest = max(max(texelFetch(depthPyramid, low, level).r, texelFetch(depthPyramid, ivec2(high.x, low.y), level).r),
+        max(texelFetch(depthPyramid, ivec2(low.x, high.y), level).r, texelFetch(depthPyramid, high, level).r));
+    return nearest > farthest;
+}
+
+// The coarsest level whose error stays within budget on screen, as USelectLod does
+uint selectLevel(uint objectIndex, CullObject object, CullGroup group)
+{
+    if (group.levelCount <= 1u)
+        return 0u;
+    float pixelsPerUnit = object.scale * camera.w;
+    if (lod.z == 0.0)
+        pixelsPerUnit /= max(length(object.center - camera.xyz) - group.radius * object.scale, 0.1);
+    uint level = min(levels[objectIndex], group.levelCount - 1u);
+    while (level > 0u && group.errors[level] * pixelsPerUnit > lod.x)
+        --level;
+    while (level + 1u < group.levelCount && group.errors[level + 1u] * pixelsPerUnit <= lod.x * (1.0 - lod.y))
+        ++level;
+    return level;
+}
+
+void main()
+{
+    uint objectIndex = gl_GlobalInvocationID.x;
+    if (objectIndex >= objectCount)
+        return;
+    CullObject object = objects[objectIndex];
+    if (!insideFrustum(object.center, object.extent))
+    {
+        atomicAdd(frustumCulledCount, 1u);
+        return;
+    }
+    if (occluded(object.center, object.extent))
+    {
+        atomicAdd(occludedCount, 1u);
+        return;
+    }
+
+    CullGroup group = groups[object.group];
+    uint level = selectLevel(objectIndex, object, group);
+    levels[objectIndex] = level;
+    uint command = group.firstCommand + level;
+    uint slot = atomicAdd(commands[command].instanceCount, 1u);
+    instances[commands[command].baseInstance + slot] = objectIndex;
+    atomicAdd(visibleCount, 1u);
+    atomicAdd(triangleCount, commands[command].count / 3u);
+}
+);
+
+/* Command Compaction Compute Shader Source Code: packs the commands that draw anything for glMultiDrawElementsIndirectCountARB*/
+const GLchar* gpuCompactComputeShaderSource = GLSL(440,
+
+layout(local_size_x = 64) in;
+
+layout(std140, binding = 1) uniform CullData // Per-frame culling state (GpuCullUniforms)
+{
+    vec4 planes[6]; // Current frustum, inside where dot(xyz, p) + w >= 0
+    mat4 previousViewProjection; // That the depth pyramid was rendered with
+    vec4 camera; // Position, and pixels per unit at distance 1 (everywhere when orthographic)
+    vec4 lod; // Pixel error budget, hysteresis, 1 when orthographic
+    uint objectCount;
+    uint commandCount;
+    uint pyramidLevels; // 0 until there is a depth pyramid
+    uint pad0;
+    vec2 pyramidScale; // Texels of pyramid level 0 per unit of screen uv
+};
+struct DrawCommand // DrawElementsIndirectCommand
+{
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+layout(std430, binding = 6) readonly buffer CommandBuffer { DrawCommand commands[]; };
+layout(std430, binding = 9) writeonly buffer CompactCommandBuffer { DrawCommand compactCommands[]; };
+layout(std430, binding = 10) buffer DrawCountBuffer { uint drawCount; };
+
+void main()
+{
+    uint command = gl_GlobalInvocationID.x;
+    if (command < commandCount && commands[command].instanceCount > 0u)
+        compactCommands[atomicAdd(drawCount, 1u)] = commands[command];
+}
+);
+
+/* Depth Pyramid Compute Shader Source Code: one level of the max-depth mip chain from the level (or depth copy) above*/
+const GLchar* depthPyramidComputeShaderSource = GLSL(440,
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(binding = 0) uniform sampler2D source;
+layout(binding = 0, r32f) writeonly uniform image2D destination;
+layout(location = 0) uniform int sourceLevel;
+layout(location = 1) uniform ivec2 sourceSize;
+
+void main()
+{
+    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 size = imageSize(destination);
+    if (any(greaterThanEqual(texel, size)))
+        return;
+    // The 2x2 source texels under this one, plus the row or column an odd size leaves over at the far edges
+    ivec2 first = texel * 2;
+    ivec2 last = min(first + 1 + ivec2(equal(texel, size - 1)) * (sourceSize & 1), sourceSize - 1);
+    float farthest = 0.0;
+    for (int y = first.y; y <= last.y; ++y)
+    {
+        for (int x = first.x; x <= last.x; ++x)
+            farthest = max(farthest, texelFetch(source, ivec2(x, y), sourceLevel).r);
+    }
+    imageStore(destination, texel, vec4(farthest));
+}
+);
+
+
 void flipImageVertically(unsigned char* image, int width, int height, int channels)
 {
     for (int j = 0; j < height / 2; ++j)
@@ -589,51 +1198,133 @@ void flipImageVertically(unsigned char* image, int width, int height, int channe
 
 int main(int argc, char* argv[])
 {
-    if (!UInitialize(argc, argv, &gWindow))
+    if (!UParseArguments(argc, argv))
+        return EXIT_FAILURE;
+
+    if (gTraceFile)
+    {
+        Profiler::SetEnabled(true);
+        Profiler::SetThreadName("Main");
+    }
+
+    if (gHeadless)
+    {
+        if (!UInitializeHeadless())
+            return EXIT_FAILURE;
+    }
+    else if (!UInitialize(argc, argv, &gWindow))
         return EXIT_FAILURE;
 
     // Create the mesh
     UCreateMesh(gMesh); // Calls the function to create the Vertex Buffer Object
+    if (gOcclusionCulling)
+        UCreateOccluders();
 
     // Create the shader programs
-    if (!UCreateShaderProgram(tableVertexShaderSource, tableFragmentShaderSource, gTableProgramId))
+    if (!UCreateShaderProgram(tableVertexShaderSource, tableFragmentShaderSource, gTableProgram))
         return EXIT_FAILURE;
 
-    if (!UCreateShaderProgram(lampVertexShaderSource, lampFragmentShaderSource, gLampProgramId))
+    if (!UCreateShaderProgram(lampVertexShaderSource, lampFragmentShaderSource, gLampProgram))
         return EXIT_FAILURE;
 
-    if (!UCreateShaderProgram(carpetVertexShaderSource, carpetFragmentShaderSource, gCarpetProgramId))
+    if (!UCreateShaderProgram(carpetVertexShaderSource, carpetFragmentShaderSource, gCarpetProgram))
         return EXIT_FAILURE;
 
-    if (!UCreateShaderProgram(planeVertexShaderSource, planeFragmentShaderSource, gPlaneProgramId))
+    if (!UCreateShaderProgram(planeVertexShaderSource, planeFragmentShaderSource, gPlaneProgram))
         return EXIT_FAILURE;
 
-    if (!UCreateShaderProgram(ceramicVertexShaderSource, ceramicFragmentShaderSource, gCeramicProgramId))
+    if (!UCreateShaderProgram(ceramicVertexShaderSource, ceramicFragmentShaderSource, gCeramicProgram))
         return EXIT_FAILURE;
 
     UCreateTexturePrograms();
 
+    // Uber-program and draw list for the multi-draw and instanced paths
+    gSceneBatchMode = gMultiDraw || gStressCount > 0 || gGpuCulling || gObjectIdBuffer;
+    if (gSceneBatchMode)
+    {
+        if (!UCreateShaderProgram(sceneVertexShaderSource, sceneFragmentShaderSource, gSceneProgram))
+            return EXIT_FAILURE;
+        if (!UCreateSceneBatch())
+            return EXIT_FAILURE;
+        if (gGpuCulling && !UCreateGpuCulling())
+            return EXIT_FAILURE;
+    }
+    else
+        UCreatePickScene();
+
+    // Per-frame camera and lighting uniforms shared by all programs
+    UCreateFrameUniformBuffer();
+
+    // The object id attachment needs a framebuffer object, which in a window stands in for the back buffer
+    if (gObjectIdBuffer)
+    {
+        if (!gHeadless)
+        {
+            int width = 0, height = 0;
+            glfwGetFramebufferSize(gWindow, &width, &height);
+            if (!gOffscreenTarget.Create(width, height, true))
+                return EXIT_FAILURE;
+        }
+        gObjectIdReadback.Create();
+    }
+
+    // GPU timestamp queries around each draw block
+    if (gGpuTimers || gBenchmarkMode || gTraceFile)
+    {
+        gGpuTimers = gGpuTimer.Create(PASS_COUNT);
+        if (!gGpuTimers)
+            cout << "WARNING: GPU timer queries are not supported, GPU pass times are disabled" << endl;
+    }
+
     // Sets the background color of the window to black (it will be implicitely used by glClear)
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 
     // render loop
     // -----------
-    while (!glfwWindowShouldClose(gWindow))
+    if (gBenchmarkMode)
+        URunBenchmark();
+    else if (gHeadless)
+        URunHeadless();
+    else
     {
-        // per-frame timing
-        // --------------------
-        float currentFrame = glfwGetTime();
-        gDeltaTime = currentFrame - gLastFrame;
-        gLastFrame = currentFrame;
-
-        // input
-        // -----
-        UProcessInput(gWindow);
-
-        // Render this frame
-        URender();
+        while (!glfwWindowShouldClose(gWindow))
+        {
+            PROFILE_SCOPE("Frame");
+
+            // per-frame timing
+            // --------------------
+            float currentFrame = glfwGetTime();
+            gDeltaTime = currentFrame - gLastFrame;
+            gLastFrame = currentFrame;
+
+            // input
+            // -----
+            UProcessInput(gWindow);
+
+            // record the camera so the session can be replayed with --benchmark
+            if (gRecordPathFile)
+            {
+                if (gRecordedPath.Keys.empty())
+                    gRecordStartTime = currentFrame;
+                gRecordedPath.Keys.push_back({ currentFrame - gRecordStartTime, gCamera.Position, gCamera.Yaw, gCamera.Pitch, gCamera.Zoom });
+            }
+
+            // Render this frame
+            URender();
+
+            // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
+            {
+                PROFILE_SCOPE("glfwSwapBuffers");
+                glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
+            }
+            {
+                PROFILE_SCOPE("glfwPollEvents");
+                glfwPollEvents();
+            }
+        }
 
-        glfwPollEvents();
+        if (gRecordPathFile)
+            gRecordedPath.Save(gRecordPathFile);
     }
 
     // Release mesh data
@@ -646,19 +1337,172 @@ int main(int argc, char* argv[])
     UDestroyTexture(gCeramicTextureId);
 
     // Release shader programs
-    UDestroyShaderProgram(gTableProgramId);
-    UDestroyShaderProgram(gPlaneProgramId);
-    UDestroyShaderProgram(gLampProgramId);
-    UDestroyShaderProgram(gCarpetProgramId);
-    UDestroyShaderProgram(gCeramicProgramId);
+    UDestroyShaderProgram(gTableProgram.id);
+    UDestroyShaderProgram(gPlaneProgram.id);
+    UDestroyShaderProgram(gLampProgram.id);
+    UDestroyShaderProgram(gCarpetProgram.id);
+    UDestroyShaderProgram(gCeramicProgram.id);
+    glDeleteBuffers(1, &gFrameUniformBuffer);
+    if (gSceneBatchMode)
+    {
+        UDestroySceneBatch();
+        UDestroyShaderProgram(gSceneProgram.id);
+    }
+    if (gGpuCulling)
+    {
+        gGpuCuller.Destroy();
+        UDestroyShaderProgram(gGpuCullProgram);
+        UDestroyShaderProgram(gGpuCompactProgram);
+        UDestroyShaderProgram(gDepthPyramidProgram);
+    }
+
+    // Release GPU timer queries
+    if (gGpuTimers)
+        gGpuTimer.Destroy();
+
+    // Write the CPU/GPU timeline
+    if (gTraceFile && Profiler::WriteChromeTrace(gTraceFile))
+        cout << "INFO: Trace written to " << gTraceFile << endl;
 
+    // Release the offscreen framebuffer and context
+    if (gObjectIdBuffer)
+        gObjectIdReadback.Destroy();
+    if (gHeadless || gObjectIdBuffer)
+        gOffscreenTarget.Destroy();
+    if (gHeadless)
+        gHeadlessContext.Destroy();
 
     exit(EXIT_SUCCESS); // Terminates the program successfully
 }
 
+// Parse the command line options
+//   --headless          render offscreen without a window (EGL surfaceless, works on Mesa llvmpipe)
+//   --frames N          number of frames to render in headless and benchmark runs
+//   --dump-frames DIR   write every headless frame to DIR/frame_NNNN.ppm
+//   --benchmark PATH    replay a recorded camera path ("orbit" for the built-in one) and report timings as JSON
+//   --benchmark-out F   write the benchmark JSON to F instead of stdout
+//   --record-path F     record the interactive camera to F for later benchmark runs
+//   --gpu-timers        measure the GPU time of each draw block and print it periodically
+//   --trace F           record CPU scopes and GPU draw blocks and write them to F as Chrome trace JSON
+//   --multi-draw        draw the whole scene with one glMultiDrawElementsIndirect call
+//   --stress N          add N instanced teacup and saucer pairs on a grid, drawn with one call per mesh
+//   --vertex-cache N    optimize the mesh index buffers for an N-entry post-transform cache (0 disables)
+//   --overdraw-threshold F  let the overdraw reordering cost up to F times the cache-optimized ACMR (0 disables)
+//   --measure-overdraw  print the overdraw ratio of every mesh from sample viewpoints before and after optimization
+//   --mesh-file F       map the scene meshes from binary mesh file F instead of building them from the built-in arrays
+//   --write-mesh-file F write the built-in meshes, welded and optimized, to F for later --mesh-file runs
+//   --obj F             load the OBJ model F in place of the teacup, scaled into its bounds, and report load throughput
+//   --gltf F            load the scene of glTF binary F in place of the teacup, scaled into its bounds
+//   --lathe-segments N  build the teacup and saucer with N segments around their axis
+//   --lathe-profile-segments N  and N segments between two points of their profile curves
+//   --lod-levels N      simplify the teacup and saucer into chains of N levels of detail (1 disables, 8 at most with --gpu-cull)
+//   --lod-error PX      draw the coarsest level whose error stays within PX pixels on screen
+//   --no-cull           draw every object, including those outside the view frustum
+//   --bvh-cull          cull the scene batch by walking its bounding volume hierarchy instead of testing every object
+//   --gpu-cull          cull the scene batch on the GPU against the frustum and last frame's depth (implies the scene batch)
+//   --occlusion-cull    also skip objects hidden behind the floor, carpet or table top, rasterized on the CPU
+//   --id-buffer         pick objects by reading an object id attachment back instead of casting rays (implies the scene batch)
+bool UParseArguments(int argc, char* argv[])
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const string arg = argv[i];
+
+        if (arg == "--headless")
+            gHeadless = true;
+        else if (arg == "--frames" && i + 1 < argc)
+        {
+            // the averages and percentiles need at least one frame
+            gFrameCount = atoi(argv[++i]);
+            if (gFrameCount < 1)
+            {
+                cout << "Invalid frame count " << argv[i] << ", expected a number of at least 1" << endl;
+                return false;
+            }
+        }
+        else if (arg == "--dump-frames" && i + 1 < argc)
+            gFrameDumpDir = argv[++i];
+        else if (arg == "--benchmark" && i + 1 < argc)
+        {
+            gBenchmarkMode = true;
+            gBenchmarkPathName = argv[++i];
+        }
+        else if (arg == "--benchmark-out" && i + 1 < argc)
+            gBenchmarkOutFile = argv[++i];
+        else if (arg == "--record-path" && i + 1 < argc)
+            gRecordPathFile = argv[++i];
+        else if (arg == "--gpu-timers")
+            gGpuTimers = true;
+        else if (arg == "--trace" && i + 1 < argc)
+            gTraceFile = argv[++i];
+        else if (arg == "--multi-draw")
+            gMultiDraw = true;
+        else if (arg == "--stress" && i + 1 < argc)
+            gStressCount = max(atoi(argv[++i]), 0);
+        else if (arg == "--vertex-cache" && i + 1 < argc)
+            gVertexCacheSize = (unsigned int)max(atoi(argv[++i]), 0);
+        else if (arg == "--overdraw-threshold" && i + 1 < argc)
+            gOverdrawThreshold = max((float)atof(argv[++i]), 0.0f);
+        else if (arg == "--measure-overdraw")
+            gMeasureOverdraw = true;
+        else if (arg == "--mesh-file" && i + 1 < argc)
+            gMeshFileName = argv[++i];
+        else if (arg == "--write-mesh-file" && i + 1 < argc)
+            gWriteMeshFileName = argv[++i];
+        else if (arg == "--obj" && i + 1 < argc)
+            gObjFileName = argv[++i];
+        else if (arg == "--gltf" && i + 1 < argc)
+            gGltfFileName = argv[++i];
+        else if (arg == "--lathe-segments" && i + 1 < argc)
+            gLatheRadialSegments = (unsigned int)max(atoi(argv[++i]), 3);
+        else if (arg == "--lathe-profile-segments" && i + 1 < argc)
+            gLatheProfileSegments = (unsigned int)max(atoi(argv[++i]), 1);
+        else if (arg == "--lod-levels" && i + 1 < argc)
+            gLodLevels = (unsigned int)max(atoi(argv[++i]), 1);
+        else if (arg == "--lod-error" && i + 1 < argc)
+            gLodPixelError = max((float)atof(argv[++i]), 0.0f);
+        else if (arg == "--no-cull")
+            gCulling = false;
+        else if (arg == "--bvh-cull")
+            gBvhCulling = true;
+        else if (arg == "--gpu-cull")
+            gGpuCulling = true;
+        else if (arg == "--occlusion-cull")
+            gOcclusionCulling = true;
+        else if (arg == "--id-buffer")
+            gObjectIdBuffer = true;
+        else
+        {
+            cout << "Unknown option " << arg << endl;
+            return false;
+        }
+    }
+
+    // the culling shader knows a fixed number of levels per mesh; clamped here so the GPU path draws the same
+    // chains the CPU path would
+    if (gGpuCulling && gLodLevels > GpuCullGroup::MAX_LEVELS)
+    {
+        cout << "WARNING: --gpu-cull supports at most " << (unsigned int)GpuCullGroup::MAX_LEVELS << " levels of detail, using "
+             << (unsigned int)GpuCullGroup::MAX_LEVELS << " instead of " << gLodLevels << endl;
+        gLodLevels = GpuCullGroup::MAX_LEVELS;
+    }
+
+    // the built-in path circles the table setting at eye height
+    if (gBenchmarkMode)
+    {
+        if (gBenchmarkPathName == "orbit")
+            gBenchmarkPath = CameraPath::Orbit(glm::vec3(0.0f, -0.3f, 0.0f), 4.0f, 1.0f, 10.0f);
+        else if (!gBenchmarkPath.Load(gBenchmarkPathName))
+            return false;
+    }
+    return true;
+}
+
 // Initialize GLFW, GLEW, and create a window
 bool UInitialize(int argc, char* argv[], GLFWwindow** window)
 {
+    PROFILE_SCOPE("UInitialize");
+
     // GLFW: initialize and configure
     // ------------------------------
     glfwInit();
@@ -706,35 +1550,436 @@ bool UInitialize(int argc, char* argv[], GLFWwindow** window)
     return true;
 }
 
-// process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
-void UProcessInput(GLFWwindow* window)
+// Create an offscreen OpenGL context and framebuffer, no window or display required
+bool UInitializeHeadless()
 {
-    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
-        glfwSetWindowShouldClose(window, true);
+    PROFILE_SCOPE("UInitializeHeadless");
 
-    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(FORWARD, gDeltaTime);
-    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(BACKWARD, gDeltaTime);
-    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(LEFT, gDeltaTime);
-    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(RIGHT, gDeltaTime);
-    if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(UP, gDeltaTime); 
-    if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)
-        gCamera.ProcessKeyboard(DOWN, gDeltaTime); 
+    if (!gHeadlessContext.Create(4, 4))
+        return false;
 
-    if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS && ortho != true)
-        ortho = true;
-    else if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS && ortho == true)
-        ortho = false;
+    // GLEW: initialize
+    // ----------------
+    glewExperimental = GL_TRUE;
+    GLenum GlewInitResult = glewInit();
+
+    // GLEW builds for GLX report the missing X display after the core entry points are loaded
+    if (GLEW_OK != GlewInitResult && GLEW_ERROR_NO_GLX_DISPLAY != GlewInitResult)
+    {
+        std::cerr << glewGetErrorString(GlewInitResult) << std::endl;
+        return false;
+    }
+
+    // Displays GPU OpenGL version
+    cout << "INFO: OpenGL Version: " << glGetString(GL_VERSION) << endl;
+    cout << "INFO: OpenGL Renderer: " << glGetString(GL_RENDERER) << endl;
+
+    // The framebuffer object takes the place of the window's back buffer
+    return gOffscreenTarget.Create(WINDOW_WIDTH, WINDOW_HEIGHT, gObjectIdBuffer);
 }
 
-// glfw: whenever the window size changed (by OS or user resize) this callback function executes
-void UResizeWindow(GLFWwindow* window, int width, int height)
+// Render a fixed number of frames into the offscreen framebuffer and report the throughput
+void URunHeadless()
 {
-    glViewport(0, 0, width, height);
+    gOffscreenTarget.Bind();
+    gDeltaTime = 1.0f / 60.0f; // fixed time step, there is no input to react to
+
+    const auto start = chrono::steady_clock::now();
+
+    for (int frame = 0; frame < gFrameCount; ++frame)
+    {
+        PROFILE_SCOPE("Frame");
+        URender();
+
+        if (gFrameDumpDir)
+        {
+            char path[512];
+            snprintf(path, sizeof(path), "%s/frame_%04d.ppm", gFrameDumpDir, frame);
+            gOffscreenTarget.WritePPM(path);
+        }
+    }
+
+    glFinish(); // wait for the GPU so the timing covers the whole workload
+
+    const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "INFO: Rendered " << gFrameCount << " headless frames in " << seconds << " s ("
+         << gFrameCount / seconds << " fps, " << 1000.0 * seconds / gFrameCount << " ms/frame"
+         << (gFrameDumpDir ? ", including frame dumps" : "") << ")" << endl;
+}
+
+// Replay the benchmark camera path with a fixed time step and write the timing summary as JSON
+void URunBenchmark()
+{
+    if (gHeadless)
+        gOffscreenTarget.Bind();
+
+    // fixed time step: the camera position of every frame depends only on the frame number
+    gDeltaTime = 1.0f / 60.0f;
+
+    for (int frame = 0; frame < gFrameCount; ++frame)
+    {
+        PROFILE_SCOPE("Frame");
+        const CameraKeyframe pose = gBenchmarkPath.Sample(frame * gDeltaTime);
+        gCamera.Position = pose.Position;
+        gCamera.Yaw = pose.Yaw;
+        gCamera.Pitch = pose.Pitch;
+        gCamera.ProcessMouseMovement(0.0f, 0.0f); // recomputes the camera vectors from the new angles
+        gCamera.Zoom = pose.Zoom;
+
+        gRenderStats = RenderStats();
+        gBenchmark.BeginFrame();
+
+        URender();
+
+        {
+            PROFILE_SCOPE("glFinish");
+            glFinish(); // the frame time covers the GPU work, not just command submission
+        }
+
+        // stopped before presenting, so waiting for vsync is not part of the frame time
+        gBenchmark.EndFrame(gRenderStats);
+
+        if (!gHeadless)
+        {
+            PROFILE_SCOPE("glfwSwapBuffers");
+            glfwSwapBuffers(gWindow);
+            glfwPollEvents();
+        }
+    }
+
+    // the last few frames are still in the query ring; waiting is fine once the run is over
+    if (gGpuTimers)
+    {
+        gGpuTimer.Flush();
+        UCollectGpuTimings();
+    }
+    // so are the GPU culling counts of the last frames
+    if (gGpuCulling)
+    {
+        RenderStats late;
+        UReadGpuCullStats(late, true);
+        gBenchmark.AddStats(late);
+    }
+
+    // median full rebuild and refit of the scene hierarchy over its current boxes, as after objects are added or
+    // moved; --stress N makes the scene large enough for this to matter
+    ostringstream bvhTimes;
+    if (gSceneBatchMode && gSceneBvh.Count() > 0)
+    {
+        const int BVH_RUNS = 11;
+        vector<double> buildMs, refitMs;
+        for (int run = 0; run < BVH_RUNS; ++run)
+        {
+            const auto start = chrono::steady_clock::now();
+            gSceneBvh.Build();
+            const auto built = chrono::steady_clock::now();
+            gSceneBvh.Refit();
+            buildMs.push_back(chrono::duration<double, milli>(built - start).count());
+            refitMs.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - built).count());
+        }
+        bvhTimes << ", \"bvhObjects\": " << gSceneBvh.Count() << ", \"bvhBuildMs\": " << FrameBenchmark::Percentile(buildMs, 50.0)
+                 << ", \"bvhRefitMs\": " << FrameBenchmark::Percentile(refitMs, 50.0);
+    }
+
+    ostringstream extra;
+    extra << "\"path\": " << FrameBenchmark::JsonString(gBenchmarkPathName) << ", \"deltaTime\": " << gDeltaTime
+          << ", \"headless\": " << (gHeadless ? "true" : "false")
+          << ", \"multiDraw\": " << (gMultiDraw ? "true" : "false")
+          << ", \"stressInstances\": " << gStressCount
+          << ", \"renderer\": " << FrameBenchmark::JsonString((const char*)glGetString(GL_RENDERER)) << bvhTimes.str();
+
+    if (gBenchmarkOutFile)
+    {
+        ofstream out(gBenchmarkOutFile);
+        gBenchmark.WriteJson(out, extra.str());
+        cout << "INFO: Benchmark results written to " << gBenchmarkOutFile << endl;
+    }
+    else
+        gBenchmark.WriteJson(cout, extra.str());
+}
+
+// Mark the start of a draw block for the benchmark and GPU timings
+void UBeginPass(RenderPass pass)
+{
+    if (Profiler::Enabled())
+        gPassStartNs[pass] = Profiler::Now();
+    if (gBenchmarkMode)
+        gBenchmark.BeginPass(pass);
+    if (gGpuTimers)
+        gGpuTimer.BeginPass(pass);
+}
+
+// Mark the end of a draw block for the benchmark and GPU timings
+void UEndPass(RenderPass pass)
+{
+    if (gGpuTimers)
+        gGpuTimer.EndPass(pass);
+    if (gBenchmarkMode)
+        gBenchmark.EndPass(pass);
+    if (Profiler::Enabled())
+        Profiler::Record(RENDER_PASS_NAMES[pass], gPassStartNs[pass], Profiler::Now());
+}
+
+// Hand the GPU pass times that became available to the benchmark and trace, or print their averages every 120 frames
+void UCollectGpuTimings()
+{
+    for (const GpuPassSample& sample : gGpuTimer.Resolved)
+    {
+        if (gBenchmarkMode)
+            gBenchmark.AddGpuPass(sample.Pass, sample.Frame, sample.StartMs, sample.DurationMs);
+        Profiler::RecordGpu(RENDER_PASS_NAMES[sample.Pass], sample.StartMs, sample.DurationMs);
+
+        gGpuPassTotals[sample.Pass] += sample.DurationMs;
+        ++gGpuPassSamples[sample.Pass];
+    }
+    gGpuTimer.Resolved.clear();
+
+    if (gBenchmarkMode || ++gGpuReportFrames < 120)
+        return;
+    gGpuReportFrames = 0;
+
+    cout << "GPU ms/frame:";
+    for (int pass = 0; pass < PASS_COUNT; ++pass)
+    {
+        if (gGpuPassSamples[pass] > 0)
+            cout << " " << RENDER_PASS_NAMES[pass] << "=" << gGpuPassTotals[pass] / gGpuPassSamples[pass];
+        gGpuPassTotals[pass] = 0.0;
+        gGpuPassSamples[pass] = 0;
+    }
+    cout << endl;
+}
+
+// State change helpers: issue the GL call unless the state is already bound, and count it for the frame statistics
+void UUseProgram(GLuint programId)
+{
+    if (gStateCache.UseProgram(programId))
+        ++gRenderStats.ProgramBinds;
+    else
+        ++gRenderStats.SkippedBinds;
+}
+
+void UBindVertexArray(GLuint vao)
+{
+    if (gStateCache.BindVertexArray(vao))
+        ++gRenderStats.VertexArrayBinds;
+    else
+        ++gRenderStats.SkippedBinds;
+}
+
+void UBindTexture(GLuint textureId)
+{
+    if (gStateCache.BindTexture(textureId))
+        ++gRenderStats.TextureBinds;
+    else
+        ++gRenderStats.SkippedBinds;
+}
+
+void UDrawElements(GLuint firstIndex, GLsizei count, GLint baseVertex)
+{
+    glDrawElementsBaseVertex(GL_TRIANGLES, count, GL_UNSIGNED_INT, (const void*)(firstIndex * sizeof(GLuint)), baseVertex);
+    ++gRenderStats.DrawCalls;
+    gRenderStats.Triangles += count / 3;
+}
+
+// process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
+void UProcessInput(GLFWwindow* window)
+{
+    PROFILE_SCOPE("UProcessInput");
+
+    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
+        glfwSetWindowShouldClose(window, true);
+
+    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
+        gCamera.ProcessKeyboard(FORWARD, gDeltaTime);
+    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
+        gCamera.ProcessKeyboard(BACKWARD, gDeltaTime);
+    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
+        gCamera.ProcessKeyboard(LEFT, gDeltaTime);
+    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
+        gCamera.ProcessKeyboard(RIGHT, gDeltaTime);
+    if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)
+        gCamera.ProcessKeyboard(UP, gDeltaTime); 
+    if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)
+        gCamera.ProcessKeyboard(DOWN, gDeltaTime); 
+
+    if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS && ortho != true)
+        ortho = true;
+    else if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS && ortho == true)
+        ortho = false;
+}
+
+// glfw: whenever the window size changed (by OS or user resize) this callback function executes
+void UResizeWindow(GLFWwindow* window, int width, int height)
+{
+    glViewport(0, 0, width, height);
+
+    // The frame is drawn offscreen at the size of the window; nothing to draw while it is minimized
+    if (gObjectIdBuffer && width > 0 && height > 0)
+    {
+        gOffscreenTarget.Destroy();
+        gOffscreenTarget.Create(width, height, true);
+    }
+}
+
+// The render queue's objects in the order USubmitDraw sees them, and a hierarchy over their boxes for picking;
+// the scene batch builds both itself
+void UCreatePickScene()
+{
+    const MeshRange* const ranges[] = { &gMesh.plane, &gMesh.carpet, &gMesh.table, &gMesh.teacup, &gMesh.saucer, &gMesh.window, &gMesh.window };
+    const glm::vec3 positions[] = { gTablePosition, gCarpetPosition, gTablePosition, gTeacupPosition, gSaucerPosition, gWindowLightPosition, gLampLightPosition };
+    const glm::vec3 scales[] = { gTableScale, gCarpetScale, gTableScale, gTeacupScale, gSaucerScale, gTableScale, gTableScale };
+
+    FrustumCuller boxes;
+    gPickObjects.clear();
+    gSceneBvh.Clear();
+    for (int i = 0; i < 7; ++i)
+    {
+        PickObject pick;
+        pick.range = *ranges[i];
+        pick.model = glm::translate(positions[i]) * glm::scale(scales[i]);
+        gPickObjects.push_back(pick);
+        boxes.Add(glm::make_vec3(pick.range.BoundsMin), glm::make_vec3(pick.range.BoundsMax), pick.model);
+
+        glm::vec3 boundsMin, boundsMax;
+        boxes.Bounds(i, boundsMin, boundsMax);
+        gSceneBvh.Add(boundsMin, boundsMax);
+    }
+    gSceneBvh.Build();
+}
+
+// Where a click points, as fractions of the window from its top left corner: the cursor, or the middle of the
+// window while the cursor is captured for mouse look. False while the window is minimized.
+bool UClickPosition(GLFWwindow* window, float& x, float& y)
+{
+    int width = 0, height = 0;
+    glfwGetWindowSize(window, &width, &height);
+    if (width <= 0 || height <= 0)
+        return false;
+    double cursorX = width * 0.5, cursorY = height * 0.5;
+    if (glfwGetInputMode(window, GLFW_CURSOR) == GLFW_CURSOR_NORMAL)
+        glfwGetCursorPos(window, &cursorX, &cursorY);
+    x = (float)(cursorX / width);
+    y = (float)(cursorY / height);
+    return true;
+}
+
+// Cast a ray through the click position and report the nearest object and triangle it hits. Objects are found
+// through the scene hierarchy and their triangles through their mesh's hierarchy, in object space; nothing is read
+// back from the GPU.
+void UPickObject(GLFWwindow* window)
+{
+    PROFILE_SCOPE("UPickObject");
+
+    float x = 0.0f, y = 0.0f;
+    if (!UClickPosition(window, x, y))
+        return;
+
+    // Unproject the click onto the near and far planes of last frame's camera
+    const glm::mat4 toWorld = glm::inverse(gViewProjection);
+    const float ndcX = 2.0f * x - 1.0f, ndcY = 1.0f - 2.0f * y;
+    const glm::vec4 nearPoint = toWorld * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+    const glm::vec4 farPoint = toWorld * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+    const glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+    const glm::vec3 end = glm::vec3(farPoint) / farPoint.w;
+    const glm::vec3 direction = glm::normalize(end - origin);
+
+    const unsigned int NONE = ~0u;
+    unsigned int pickedObject = NONE, pickedTriangle = NONE;
+    const float distance = gSceneBvh.Raycast(origin, direction, glm::length(end - origin), [&](unsigned int object, float& maxDistance) {
+        // Object space keeps distances along the ray, so every mesh is tested against the same maxDistance
+        const PickObject& pick = gPickObjects[object];
+        const glm::mat4 toObject = glm::inverse(pick.model);
+        const glm::vec3 localOrigin = glm::vec3(toObject * glm::vec4(origin, 1.0f));
+        const glm::vec3 localDirection = glm::vec3(toObject * glm::vec4(direction, 0.0f));
+        const TriangleBvh& triangles = UTriangleBvh(pick.range);
+        if (!triangles.Empty())
+        {
+            unsigned int triangle = NONE;
+            if (triangles.Raycast(localOrigin, localDirection, maxDistance, triangle))
+            {
+                pickedObject = object;
+                pickedTriangle = triangle;
+            }
+            return;
+        }
+        // A mapped mesh file has no triangles on the CPU: its box is as close as picking gets
+        const glm::vec3 inverse = ObjectBvh::InverseDirection(localDirection);
+        const float entry = ObjectBvh::RayEnters(localOrigin, inverse, glm::make_vec3(pick.range.BoundsMin), glm::make_vec3(pick.range.BoundsMax), maxDistance);
+        if (entry <= maxDistance)
+        {
+            maxDistance = entry;
+            pickedObject = object;
+            pickedTriangle = NONE;
+        }
+    });
+
+    if (pickedObject == NONE)
+        cout << "INFO: Picked nothing" << endl;
+    else if (pickedTriangle == NONE)
+        cout << "INFO: Picked " << UMeshName(gPickObjects[pickedObject].range) << " (object " << pickedObject << ") by its bounds, "
+             << distance << " units away" << endl;
+    else
+        cout << "INFO: Picked " << UMeshName(gPickObjects[pickedObject].range) << " (object " << pickedObject << "), triangle "
+             << pickedTriangle << ", " << distance << " units away" << endl;
+}
+
+// Start reading the object id under the click position from the frame last drawn; UResolveObjectId reports it once
+// the copy has finished, so the frame never waits for the GPU
+void URequestObjectId(GLFWwindow* window)
+{
+    PROFILE_SCOPE("URequestObjectId");
+
+    float x = 0.0f, y = 0.0f;
+    if (!UClickPosition(window, x, y))
+        return;
+    // The window is measured in screen coordinates, the attachment in pixels, and its rows go up
+    const int pixelX = min((int)(x * gOffscreenTarget.Width), gOffscreenTarget.Width - 1);
+    const int pixelY = min((int)((1.0f - y) * gOffscreenTarget.Height), gOffscreenTarget.Height - 1);
+    gObjectIdReadback.Request(gOffscreenTarget.FBO, GL_COLOR_ATTACHMENT1, max(pixelX, 0), max(pixelY, 0));
+}
+
+// Report the object of the last click once its id has been read back
+void UResolveObjectId()
+{
+    GLuint objectId = 0;
+    if (!gObjectIdReadback.Poll(objectId))
+        return;
+    if (objectId == 0 || objectId > gPickObjects.size())
+        cout << "INFO: Picked nothing" << endl;
+    else
+        cout << "INFO: Picked " << UMeshName(gPickObjects[objectId - 1].range) << " (object " << objectId - 1 << ") from the object id buffer" << endl;
+}
+
+// The triangle hierarchy of a mesh, built the first time a ray reaches it; empty when the arena kept no CPU copy
+const TriangleBvh& UTriangleBvh(const MeshRange& range)
+{
+    map<GLuint, TriangleBvh>::iterator found = gTriangleBvhs.find(range.FirstIndex);
+    if (found != gTriangleBvhs.end())
+        return found->second;
+
+    TriangleBvh& bvh = gTriangleBvhs[range.FirstIndex];
+    const VertexArena& arena = gMesh.arena;
+    if (arena.Vertices.empty() || arena.Indices.empty())
+        return bvh;
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    bvh.Build(&arena.Vertices[(size_t)range.BaseVertex * VertexArena::FLOATS_PER_VERTEX], VertexArena::FLOATS_PER_VERTEX,
+        &arena.Indices[range.FirstIndex], (size_t)range.Count);
+    cout << "INFO: Built the picking hierarchy of " << UMeshName(range) << ": " << bvh.TriangleCount() << " triangles, "
+         << bvh.NodeCount() << " nodes in " << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() << " ms" << endl;
+    return bvh;
+}
+
+// Which of the built-in meshes a range belongs to, for messages
+const char* UMeshName(const MeshRange& range)
+{
+    const char* const names[] = { "teacup", "table", "plane", "window", "carpet", "saucer" };
+    const MeshRange* const ranges[] = { &gMesh.teacup, &gMesh.table, &gMesh.plane, &gMesh.window, &gMesh.carpet, &gMesh.saucer };
+    for (int i = 0; i < 6; ++i)
+    {
+        if (ranges[i]->FirstIndex == range.FirstIndex)
+            return names[i];
+    }
+    return "mesh";
 }
 
 // glfw: whenever the mouse moves, this callback is called
@@ -772,8 +2017,10 @@ void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
     {
     case GLFW_MOUSE_BUTTON_LEFT:
     {
-        if (action == GLFW_PRESS)
-            cout << "Left mouse button pressed" << endl;
+        if (action == GLFW_PRESS && gObjectIdBuffer)
+            URequestObjectId(window);
+        else if (action == GLFW_PRESS)
+            UPickObject(window);
         else
             cout << "Left mouse button released" << endl;
     }
@@ -805,6 +2052,8 @@ void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
 
 int UCreateTexturePrograms()
 {
+    PROFILE_SCOPE("UCreateTexturePrograms");
+
     // Load textures
     // Table
     //--------------
@@ -816,9 +2065,11 @@ int UCreateTexturePrograms()
         return EXIT_FAILURE;
     }
     // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
-    glUseProgram(gTableProgramId);
+    glUseProgram(gTableProgram.id);
     // We set the texture as texture unit 0
-    glUniform1i(glGetUniformLocation(gTableProgramId, "uTexture"), 0);
+    glUniform1i(gTableProgram.uniforms[UNIFORM_TEXTURE], 0);
+    // The UV scale never changes, so it is set once as well
+    glUniform2fv(gTableProgram.uniforms[UNIFORM_UV_SCALE], 1, glm::value_ptr(gUVScale));
 
     // Carpet
     //----------------
@@ -830,9 +2081,11 @@ int UCreateTexturePrograms()
         return EXIT_FAILURE;
     }
     // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
-    glUseProgram(gCarpetProgramId);
+    glUseProgram(gCarpetProgram.id);
     // We set the texture as texture unit 0
-    glUniform1i(glGetUniformLocation(gCarpetProgramId, "uTexture"), 0);
+    glUniform1i(gCarpetProgram.uniforms[UNIFORM_TEXTURE], 0);
+    // The UV scale never changes, so it is set once as well
+    glUniform2fv(gCarpetProgram.uniforms[UNIFORM_UV_SCALE], 1, glm::value_ptr(gUVScale));
 
 
     // Table Setting
@@ -845,9 +2098,11 @@ int UCreateTexturePrograms()
         return EXIT_FAILURE;
     }
     // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
-    glUseProgram(gCeramicProgramId);
+    glUseProgram(gCeramicProgram.id);
     // We set the texture as texture unit 0
-    glUniform1i(glGetUniformLocation(gCeramicProgramId, "uTexture"), 0);
+    glUniform1i(gCeramicProgram.uniforms[UNIFORM_TEXTURE], 0);
+    // The UV scale never changes, so it is set once as well
+    glUniform2fv(gCeramicProgram.uniforms[UNIFORM_UV_SCALE], 1, glm::value_ptr(gUVScale));
 
     // Floor
     //-----------------
@@ -859,158 +2114,619 @@ int UCreateTexturePrograms()
         return EXIT_FAILURE;
     }
     // tell opengl for each sampler to which texture unit it belongs to (only has to be done once)
-    glUseProgram(gPlaneProgramId);
+    glUseProgram(gPlaneProgram.id);
     // We set the texture as texture unit 0
-    glUniform1i(glGetUniformLocation(gPlaneProgramId, "uTexture"), 0);
+    glUniform1i(gPlaneProgram.uniforms[UNIFORM_TEXTURE], 0);
+    // The UV scale never changes, so it is set once as well
+    glUniform2fv(gPlaneProgram.uniforms[UNIFORM_UV_SCALE], 1, glm::value_ptr(gUVScale));
 };
 
-void USetShaderProgram(GLuint programId, glm::vec3 gPos, glm::vec3 gScale)
+// Queue a draw of an object; the packet key groups draws by program, texture and VAO, then front to back
+void USubmitDraw(RenderPass pass, const GLProgram& program, GLuint textureId, const MeshRange& range, glm::vec3 gPos, glm::vec3 gScale)
+{
+    // Model matrix: transformations are applied right-to-left order
+    const glm::mat4 model = glm::translate(gPos) * glm::scale(gScale);
+    if (gCulling)
+    {
+        const glm::vec3 boundsMin = glm::make_vec3(range.BoundsMin), boundsMax = glm::make_vec3(range.BoundsMax);
+        const glm::vec3 center = glm::vec3(model * glm::vec4((boundsMin + boundsMax) * 0.5f, 1.0f));
+        const glm::vec3 extent = glm::abs(gScale) * (boundsMax - boundsMin) * 0.5f;
+        if (!gFrustum.IsVisible(center, extent))
+        {
+            ++gRenderStats.CulledObjects;
+            return;
+        }
+        if (gOcclusionCulling && !gOcclusion.IsVisible(center - extent, center + extent))
+        {
+            ++gRenderStats.CulledObjects;
+            ++gRenderStats.OccludedObjects;
+            return;
+        }
+    }
+    ++gRenderStats.VisibleObjects;
+
+    DrawPacket packet;
+    packet.Program = program.id;
+    packet.ModelLocation = program.uniforms[UNIFORM_MODEL];
+    packet.Texture = textureId;
+    packet.VAO = gMesh.arena.VAO;
+    packet.FirstIndex = range.FirstIndex;
+    packet.Count = range.Count;
+    packet.BaseVertex = range.BaseVertex;
+    packet.Model = model;
+    packet.Tag = pass;
+    // Distance to the camera over the far plane
+    float depth = glm::length(gPos - gCamera.Position) / 100.0f;
+    packet.Key = RenderQueue::MakeKey(packet.Program, packet.Texture, packet.VAO, depth);
+    gRenderQueue.Submit(packet);
+}
+
+// Sort the queued draws and issue them, skipping binds of state that is already current
+void UDrawRenderQueue()
+{
+    PROFILE_SCOPE("UDrawRenderQueue");
+
+    gRenderQueue.Sort();
+    // Programs may have been bound outside the queue (e.g. while setting up uniforms), so start from unknown state
+    gStateCache.Reset();
+    glActiveTexture(GL_TEXTURE0);
+
+    const vector<DrawPacket>& packets = gRenderQueue.Packets();
+    for (unsigned int index : gRenderQueue.Order())
+    {
+        const DrawPacket& packet = packets[index];
+        UBeginPass((RenderPass)packet.Tag);
+        UUseProgram(packet.Program);
+        // Camera and lighting come from the FrameData block, only the model matrix changes per draw
+        USetUniform(packet.ModelLocation, packet.Model);
+        UBindVertexArray(packet.VAO);
+        // Untextured programs leave whatever texture is bound
+        if (packet.Texture != 0)
+            UBindTexture(packet.Texture);
+        UDrawElements(packet.FirstIndex, packet.Count, packet.BaseVertex);
+        UEndPass((RenderPass)packet.Tag);
+    }
+}
+
+// Append an object to the scene batch: one command plus its entry in the object buffer
+void UAddSceneObject(const MeshRange& range, SceneMaterial material, glm::vec3 gPos, glm::vec3 gScale)
 {
-    // Activate Program
-    glUseProgram(programId);
     // Model matrix: transformations are applied right-to-left order
-    glm::mat4 model = glm::translate(gPos) * glm::scale(gScale);
+    UAddSceneInstances(range, material, vector<glm::mat4>(1, glm::translate(gPos) * glm::scale(gScale)));
+}
+
+// Append copies of a mesh sharing one material: an instanced command per level of detail (just one without lods),
+// one object buffer entry and one culling box per copy. All copies start at full detail until UUpdateSceneBatch
+// regroups them.
+void UAddSceneInstances(const MeshRange& range, SceneMaterial material, const vector<glm::mat4>& models, const GLMeshLods* lods)
+{
+    SceneGroup group;
+    group.lods = lods;
+    group.levelCount = lods != NULL ? max(lods->levels.size(), (size_t)1) : 1;
+    group.firstCommand = gSceneBatch.Commands.size();
+    group.firstObject = gSceneBatch.ObjectCount();
+    group.models = models;
+    group.levels.assign(models.size(), 0);
+    gSceneBatch.Add(range, (GLuint)models.size());
+    for (size_t level = 1; level < group.levelCount; ++level)
+        gSceneBatch.Add(lods->levels[level], 0);
+    gSceneGroups.push_back(group);
+
+    const glm::vec3 boundsMin = glm::make_vec3(range.BoundsMin), boundsMax = glm::make_vec3(range.BoundsMax);
+    for (const glm::mat4& model : models)
+    {
+        ObjectUniforms object = {};
+        object.model = model;
+        object.material = material;
+        gSceneObjects.push_back(object);
+        gSceneCuller.Add(boundsMin, boundsMax, model);
+        PickObject pick;
+        pick.range = range;
+        pick.model = model;
+        gPickObjects.push_back(pick);
+    }
+    gSceneVisible.resize(gSceneCuller.Count());
+}
+
+// Cull every object of the scene batch against the frustum and pick the level of the visible ones. Where that
+// changes anything for a mesh, its visible instances are sorted by level and each level's command is pointed at its
+// share; culled instances are left out of every command.
+void UUpdateSceneBatch()
+{
+    PROFILE_SCOPE("UUpdateSceneBatch");
+
+    // Refits after objects moved, rebuilds after some were added, and does nothing while the scene stands still
+    gSceneBvh.Update();
+    size_t visibleCount = gSceneVisible.size();
+    if (!gCulling)
+        fill(gSceneVisible.begin(), gSceneVisible.end(), 1);
+    else if (gBvhCulling)
+        visibleCount = gSceneBvh.Cull(gFrustum, gSceneVisible.data());
+    else
+        visibleCount = gSceneCuller.Cull(gFrustum, gSceneVisible.data());
+    if (gCulling && gOcclusionCulling)
+    {
+        // Only the boxes the frustum kept are tested
+        const size_t occluded = gOcclusion.Cull(gSceneVisible.size(),
+            [](size_t object, glm::vec3& boundsMin, glm::vec3& boundsMax) { gSceneCuller.Bounds(object, boundsMin, boundsMax); }, gSceneVisible.data());
+        visibleCount -= occluded;
+        gRenderStats.OccludedObjects += (unsigned int)occluded;
+    }
+    gRenderStats.VisibleObjects += (unsigned int)visibleCount;
+    gRenderStats.CulledObjects += (unsigned int)(gSceneVisible.size() - visibleCount);
+
+    bool changed = false;
+    vector<GLuint> order, counts;
+    for (SceneGroup& group : gSceneGroups)
+    {
+        bool groupChanged = false;
+        for (size_t i = 0; i < group.models.size(); ++i)
+        {
+            unsigned int level = SCENE_CULLED;
+            if (gSceneVisible[group.firstObject + i])
+                level = group.lods != NULL ? USelectLod(*group.lods, group.models[i], group.levels[i]) : 0;
+            groupChanged = groupChanged || level != group.levels[i];
+            group.levels[i] = level;
+        }
+        if (!groupChanged)
+            continue;
+
+        // counting sort of the visible instances by level
+        counts.assign(group.levelCount + 1, 0);
+        for (unsigned int level : group.levels)
+        {
+            if (level != SCENE_CULLED)
+                ++counts[level + 1];
+        }
+        for (size_t level = 0; level < group.levelCount; ++level)
+        {
+            DrawElementsIndirectCommand& command = gSceneBatch.Commands[group.firstCommand + level];
+            command.InstanceCount = counts[level + 1];
+            command.BaseInstance = group.firstObject + counts[level];
+            counts[level + 1] += counts[level];
+        }
+        order.resize(counts[group.levelCount]);
+        for (size_t i = 0; i < group.models.size(); ++i)
+        {
+            if (group.levels[i] != SCENE_CULLED)
+                order[counts[group.levels[i]]++] = group.firstObject + (GLuint)i;
+        }
+        if (!order.empty())
+        {
+            gSceneBatch.SetObjectOrder(group.firstObject, order.data(), (GLuint)order.size());
+            ++gRenderStats.BufferUploads;
+        }
+        changed = true;
+    }
+    if (changed)
+    {
+        gSceneBatch.UpdateCommands();
+        ++gRenderStats.BufferUploads;
+    }
+}
+
+// Compile the GPU culling programs and upload the scene batch as the culling shader sees it: the world box and
+// mesh of every object, and one command per mesh and level with room for every instance of the mesh
+bool UCreateGpuCulling()
+{
+    if (!UCreateComputeProgram(gpuCullComputeShaderSource, gGpuCullProgram) ||
+        !UCreateComputeProgram(gpuCompactComputeShaderSource, gGpuCompactProgram) ||
+        !UCreateComputeProgram(depthPyramidComputeShaderSource, gDepthPyramidProgram))
+        return false;
+    gGpuCuller.Create(gGpuCullProgram, gGpuCompactProgram, gDepthPyramidProgram);
+
+    vector<GpuCullObject> objects;
+    vector<GpuCullGroup> groups;
+    vector<DrawElementsIndirectCommand> commands;
+    GLuint slots = 0;
+    for (const SceneGroup& sceneGroup : gSceneGroups)
+    {
+        GpuCullGroup group = {};
+        group.FirstCommand = (GLuint)commands.size();
+        group.LevelCount = (GLuint)min(sceneGroup.levelCount, (size_t)GpuCullGroup::MAX_LEVELS);
+        if (group.LevelCount < sceneGroup.levelCount)
+            cout << "WARNING: GPU culling draws only the first " << group.LevelCount << " of " << sceneGroup.levelCount
+                 << " levels of detail of a mesh" << endl;
+        group.Radius = sceneGroup.lods != NULL ? sceneGroup.lods->radius : 0.0f;
+        for (GLuint level = 0; level < group.LevelCount; ++level)
+        {
+            DrawElementsIndirectCommand command = gSceneBatch.Commands[sceneGroup.firstCommand + level];
+            command.InstanceCount = 0;
+            command.BaseInstance = slots;
+            commands.push_back(command);
+            group.Errors[level] = sceneGroup.lods != NULL ? sceneGroup.lods->errors[level] : 0.0f;
+            slots += (GLuint)sceneGroup.models.size();
+        }
+
+        for (size_t i = 0; i < sceneGroup.models.size(); ++i)
+        {
+            const glm::mat4& model = sceneGroup.models[i];
+            glm::vec3 boundsMin, boundsMax;
+            gSceneCuller.Bounds(sceneGroup.firstObject + i, boundsMin, boundsMax);
+            GpuCullObject object;
+            object.Center = (boundsMin + boundsMax) * 0.5f;
+            object.Group = (GLuint)groups.size();
+            object.Extent = (boundsMax - boundsMin) * 0.5f;
+            object.Scale = max(glm::length(glm::vec3(model[0])), max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+            objects.push_back(object);
+        }
+        groups.push_back(group);
+    }
+    gGpuCuller.SetScene(objects, groups, commands, slots);
+
+    cout << "INFO: GPU culling: " << objects.size() << " objects, " << commands.size() << " commands, "
+         << (gGpuCuller.IndirectCount ? "compacted with ARB_indirect_parameters" : "drawn uncompacted (no ARB_indirect_parameters)") << endl;
+    return true;
+}
+
+// Let the culling shader write this frame's commands, and collect the counts of a frame that has finished since
+void UCullSceneOnGpu()
+{
+    UBeginPass(PASS_GPU_CULL);
+    GpuCullUniforms uniforms = {};
+    // Pixels per object unit as in USelectLod, before the perspective division by distance
+    const float pixelsPerUnit = ortho ? WINDOW_HEIGHT / 10.0f : WINDOW_HEIGHT / (2.0f * tan(glm::radians(gCamera.Zoom) * 0.5f));
+    uniforms.Camera = glm::vec4(gCamera.Position, pixelsPerUnit);
+    uniforms.Lod = glm::vec4(gLodPixelError, LOD_HYSTERESIS, ortho ? 1.0f : 0.0f, 0.0f);
+    // --no-cull: planes every box is inside of
+    Frustum everything;
+    for (glm::vec4& plane : everything.Planes)
+        plane = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    gGpuCuller.Cull(gCulling ? gFrustum : everything, uniforms);
+    UEndPass(PASS_GPU_CULL);
+
+    UReadGpuCullStats(gRenderStats, false);
+}
+
+// Add the culling counts of every frame the GPU has finished since the last call to stats, whichever frame they
+// belong to, so none are lost over a run; wait collects the frames still in flight too
+void UReadGpuCullStats(RenderStats& stats, bool wait)
+{
+    GpuCullStats counts;
+    if (gGpuCuller.ReadStats(counts, wait))
+    {
+        stats.VisibleObjects += counts.Visible;
+        stats.CulledObjects += counts.FrustumCulled + counts.Occluded;
+        stats.OccludedObjects += counts.Occluded;
+        stats.Triangles += counts.Triangles;
+    }
+}
+
+// Reduce this frame's depth buffer to the pyramid next frame's culling tests against
+void UBuildDepthPyramid()
+{
+    UBeginPass(PASS_DEPTH_PYRAMID);
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    gGpuCuller.BuildDepthPyramid(viewport[2], viewport[3], gViewProjection);
+    UEndPass(PASS_DEPTH_PYRAMID);
+}
+
+// The occluders are the large flat parts of the built-in scene, written down from the vertex data in UCreateMesh:
+// the floor, the carpet, and the table top as a solid slab (the table's own bounds would take in the room between
+// its legs). A mesh file brings its own shapes, so it gets no occluders and nothing is occlusion culled.
+void UCreateOccluders()
+{
+    gOcclusion.Resize(WINDOW_WIDTH / 4, WINDOW_HEIGHT / 4);
+    gOcclusion.ClearOccluders();
+    if (!gMeshFileName.empty())
+    {
+        cout << "INFO: Occlusion culling has no occluders for a mesh file" << endl;
+        return;
+    }
+
+    const glm::mat4 table = glm::translate(gTablePosition) * glm::scale(gTableScale);
+    const glm::mat4 carpet = glm::translate(gCarpetPosition) * glm::scale(gCarpetScale);
+    gOcclusion.AddQuad(glm::vec3(table * glm::vec4(-5.0f, -0.9f, -5.0f, 1.0f)), glm::vec3(table * glm::vec4(5.0f, -0.9f, -5.0f, 1.0f)),
+        glm::vec3(table * glm::vec4(5.0f, -0.9f, 5.0f, 1.0f)), glm::vec3(table * glm::vec4(-5.0f, -0.9f, 5.0f, 1.0f)));
+    gOcclusion.AddQuad(glm::vec3(carpet * glm::vec4(-1.5f, -0.8f, -1.5f, 1.0f)), glm::vec3(carpet * glm::vec4(1.5f, -0.8f, -1.5f, 1.0f)),
+        glm::vec3(carpet * glm::vec4(1.5f, -0.8f, 1.5f, 1.0f)), glm::vec3(carpet * glm::vec4(-1.5f, -0.8f, 1.5f, 1.0f)));
+    gOcclusion.AddBox(glm::vec3(-1.0f, -0.1f, -0.25f), glm::vec3(1.0f, 0.0f, 0.25f), table);
+}
+
+// Render this frame's occluder depth, before any object is tested against it
+void URasterizeOccluders()
+{
+    PROFILE_SCOPE("URasterizeOccluders");
+    gOcclusion.Render(gViewProjection);
+}
+
+// Level of detail to draw an object at this frame, given the level it was drawn at last frame
+unsigned int USelectLod(const GLMeshLods& lods, const glm::mat4& model, unsigned int level)
+{
+    if (lods.levels.size() <= 1)
+        return 0;
+
+    // pixels covered by one object unit around the object: the viewport height spans 2 * distance * tan(fovy / 2)
+    // in perspective, and the 10 units of the orthographic volume otherwise
+    const float scale = max(glm::length(glm::vec3(model[0])), max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+    float pixelsPerUnit = scale * WINDOW_HEIGHT / 10.0f;
+    if (!ortho)
+    {
+        const glm::vec3 center(model * glm::vec4(lods.center, 1.0f));
+        const float distance = max(glm::length(center - gCamera.Position) - lods.radius * scale, 0.1f);
+        pixelsPerUnit = scale * WINDOW_HEIGHT / (2.0f * distance * tan(glm::radians(gCamera.Zoom) * 0.5f));
+    }
+    return LodSelector::Select(lods.errors.data(), (unsigned int)lods.levels.size(), pixelsPerUnit, level, gLodPixelError, LOD_HYSTERESIS);
+}
+
+// Build the static draw list, object and material buffers, and texture array of the scene program
+bool UCreateSceneBatch()
+{
+    PROFILE_SCOPE("UCreateSceneBatch");
+
+    // Every scene texture becomes a layer of one array texture so a single program can sample all of them
+    const GLuint textures[] = { gPlaneTextureId, gCarpetTextureId, gTableTextureId, gCeramicTextureId };
+    if (!UCreateTextureArray(textures, 4, gSceneTextureArray))
+    {
+        cout << "ERROR::SCENE::Failed to create the scene texture array" << endl;
+        return false;
+    }
+    // The same strengths the table/carpet/plane and ceramic fragment shaders hard-code
+    const MaterialUniforms materials[MATERIAL_COUNT] = {
+        { 0.0f, 1.0f, 5.0f, 0.0f }, // plane
+        { 1.0f, 1.0f, 5.0f, 0.0f }, // carpet
+        { 2.0f, 1.0f, 5.0f, 0.0f }, // table
+        { 3.0f, 0.5f, 1.0f, 0.0f }, // ceramic
+        { 0.0f, 0.0f, 0.0f, 1.0f }, // window
+    };
+
+    gSceneBatch.Clear();
+    gSceneObjects.clear();
+    gSceneGroups.clear();
+    gSceneCuller.Clear();
+    gSceneBvh.Clear();
+    gPickObjects.clear();
+    UAddSceneObject(gMesh.plane, MATERIAL_PLANE, gTablePosition, gTableScale);
+    UAddSceneObject(gMesh.carpet, MATERIAL_CARPET, gCarpetPosition, gCarpetScale);
+    UAddSceneObject(gMesh.table, MATERIAL_TABLE, gTablePosition, gTableScale);
+
+    // The table setting plus the stress grid: every teacup and every saucer is one instanced command
+    vector<glm::mat4> teacups(1, glm::translate(gTeacupPosition) * glm::scale(gTeacupScale));
+    vector<glm::mat4> saucers(1, glm::translate(gSaucerPosition) * glm::scale(gSaucerScale));
+    const int columns = (int)ceil(sqrt((double)gStressCount));
+    const float spacing = 0.8f;
+    for (int i = 0; i < gStressCount; ++i)
+    {
+        // Rows spread out in front of the original cup, centred on it
+        glm::vec3 offset((i % columns - columns / 2) * spacing, 0.0f, (i / columns + 1) * spacing);
+        teacups.push_back(glm::translate(gTeacupPosition + offset) * glm::scale(gTeacupScale));
+        saucers.push_back(glm::translate(gSaucerPosition + offset) * glm::scale(gSaucerScale));
+    }
+    UAddSceneInstances(gMesh.teacup, MATERIAL_CERAMIC, teacups, &gMesh.teacupLods);
+    UAddSceneInstances(gMesh.saucer, MATERIAL_CERAMIC, saucers, &gMesh.saucerLods);
+
+    // Both windows share the mesh, so they are two instances of one draw
+    vector<glm::mat4> windows;
+    windows.push_back(glm::translate(gWindowLightPosition) * glm::scale(gTableScale));
+    windows.push_back(glm::translate(gLampLightPosition) * glm::scale(gTableScale));
+    UAddSceneInstances(gMesh.window, MATERIAL_WINDOW, windows);
+
+    for (size_t i = 0; i < gSceneCuller.Count(); ++i)
+    {
+        glm::vec3 boundsMin, boundsMax;
+        gSceneCuller.Bounds(i, boundsMin, boundsMax);
+        gSceneBvh.Add(boundsMin, boundsMax);
+    }
+    gSceneBvh.Build();
+    gSceneBatch.Upload(gMesh.arena, OBJECT_INDEX_ATTRIB, OBJECT_INDEX_BINDING);
+
+    glGenBuffers(1, &gObjectBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gObjectBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, gSceneObjects.size() * sizeof(ObjectUniforms), gSceneObjects.data(), GL_STATIC_DRAW);
+    glGenBuffers(1, &gMaterialBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, gMaterialBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(materials), materials, GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, OBJECT_BUFFER_BINDING, gObjectBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MATERIAL_BUFFER_BINDING, gMaterialBuffer);
+
+    // The array texture is on unit 0 and the UV scale never changes, so both are set once
+    glUseProgram(gSceneProgram.id);
+    glUniform1i(gSceneProgram.uniforms[UNIFORM_TEXTURE], 0);
+    glUniform2fv(gSceneProgram.uniforms[UNIFORM_UV_SCALE], 1, glm::value_ptr(gUVScale));
+    glUseProgram(0);
+
+    cout << "INFO: Scene batch: " << gSceneBatch.Commands.size() << " meshes, " << gSceneBatch.ObjectCount() << " objects, "
+         << (gMultiDraw ? "1 multi-draw call" : "one instanced call per mesh") << ", " << gSceneBvh.Nodes().size() << " BVH nodes" << endl;
+    return true;
+}
+
+void UDestroySceneBatch()
+{
+    gSceneBatch.Destroy();
+    gSceneObjects.clear();
+    glDeleteBuffers(1, &gObjectBuffer);
+    glDeleteBuffers(1, &gMaterialBuffer);
+    glDeleteTextures(1, &gSceneTextureArray);
+}
+
+// The whole scene in one multi-draw call or one instanced call per mesh: the CPU cost does not depend on the object count
+void UDrawSceneBatch()
+{
+    UBeginPass(PASS_SCENE_BATCH);
+    gStateCache.Reset();
+    UUseProgram(gSceneProgram.id);
+    UBindVertexArray(gMesh.arena.VAO);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, gSceneTextureArray);
+    ++gRenderStats.TextureBinds;
+    if (gGpuCulling)
+    {
+        // Triangle counts come back with the culling statistics
+        gGpuCuller.Draw(OBJECT_INDEX_BINDING);
+        ++gRenderStats.DrawCalls;
+    }
+    else if (gMultiDraw)
+    {
+        gSceneBatch.Draw();
+        ++gRenderStats.DrawCalls;
+        gRenderStats.Triangles += gSceneBatch.TriangleCount();
+    }
+    else
+    {
+        gRenderStats.DrawCalls += gSceneBatch.DrawInstanced();
+        gRenderStats.Triangles += gSceneBatch.TriangleCount();
+    }
+    UEndPass(PASS_SCENE_BATCH);
+}
+
+// Create the uniform buffer behind the FrameData block and attach it to its binding point
+void UCreateFrameUniformBuffer()
+{
+    glGenBuffers(1, &gFrameUniformBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, gFrameUniformBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_UNIFORM_BINDING, gFrameUniformBuffer);
+}
+
+// Upload the camera and lighting state once for the whole frame
+void UUpdateFrameUniforms()
+{
+    FrameUniforms frame;
     // camera/view transformation
-    glm::mat4 view = gCamera.GetViewMatrix();
+    frame.view = gCamera.GetViewMatrix();
     // Creates a perspective projection
-    glm::mat4 projection;
-
     if (ortho == false)
-        projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
-    else if (ortho == true)
-        projection = glm::ortho(-5.0f, 5.0f, -5.0f, 5.0f, 0.1f, 100.0f);
-
-    // Retrieves and passes transform matrices to the Shader program
-    GLint modelLoc = glGetUniformLocation(programId, "model");
-    GLint viewLoc = glGetUniformLocation(programId, "view");
-    GLint projLoc = glGetUniformLocation(programId, "projection");
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-    // Reference matrix uniforms from the Cube Shader program for the cub color, light color, light position, and camera position
-    GLint colorLoc = glGetUniformLocation(programId, "objectColor");
-    GLint windowLightColorLoc = glGetUniformLocation(programId, "keyLightColor");
-    GLint windowLightPositionLoc = glGetUniformLocation(programId, "keyLightPos");
-    GLint lampLightColorLoc = glGetUniformLocation(programId, "fillLightColor");
-    GLint lampLightPositionLoc = glGetUniformLocation(programId, "fillLightPos");
-    GLint viewPositionLoc = glGetUniformLocation(programId, "viewPosition"); 
-    // Pass color, light, and camera data to the Cube Shader program's corresponding uniforms
-    glUniform3f(colorLoc, gObjectColor.r, gObjectColor.g, gObjectColor.b);
-    glUniform3f(windowLightColorLoc, gLampLightColor.r, gLampLightColor.g, gLampLightColor.b);
-    glUniform3f(windowLightPositionLoc, gLampLightPosition.x, gLampLightPosition.y, gLampLightPosition.z);
-    glUniform3f(lampLightColorLoc, gWindowLightColor.r, gWindowLightColor.g, gWindowLightColor.b);
-    glUniform3f(lampLightPositionLoc, gWindowLightPosition.x, gWindowLightPosition.y, gWindowLightPosition.z);
-    const glm::vec3 cameraPosition = gCamera.Position;
-    glUniform3f(viewPositionLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
-    GLint UVScaleLoc = glGetUniformLocation(programId, "uvScale");
-    glUniform2fv(UVScaleLoc, 1, glm::value_ptr(gUVScale));
-};
+        frame.projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
+    else
+        frame.projection = glm::ortho(-5.0f, 5.0f, -5.0f, 5.0f, 0.1f, 100.0f);
+
+    // color, light, and camera data
+    frame.viewPosition = gCamera.Position;
+    frame.keyLightColor = gLampLightColor;
+    frame.keyLightPos = gLampLightPosition;
+    frame.fillLightColor = gWindowLightColor;
+    frame.fillLightPos = gWindowLightPosition;
+    frame.objectColor = gObjectColor;
+    gViewProjection = frame.projection * frame.view;
+    gFrustum = Frustum::FromMatrix(gViewProjection);
+
+    glBindBuffer(GL_UNIFORM_BUFFER, gFrameUniformBuffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameUniforms), &frame);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    ++gRenderStats.BufferUploads;
+}
+
+// Typed uniform setters taking a location resolved at link time; programs that lack the uniform get -1 and are skipped
+void USetUniform(GLint location, const glm::mat4& value)
+{
+    if (location < 0)
+        return;
+    glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
+    ++gRenderStats.UniformUploads;
+}
+
+void USetUniform(GLint location, const glm::vec3& value)
+{
+    if (location < 0)
+        return;
+    glUniform3fv(location, 1, glm::value_ptr(value));
+    ++gRenderStats.UniformUploads;
+}
+
+void USetUniform(GLint location, const glm::vec2& value)
+{
+    if (location < 0)
+        return;
+    glUniform2fv(location, 1, glm::value_ptr(value));
+    ++gRenderStats.UniformUploads;
+}
 
 // Functioned called to render a frame
 void URender()
 {
+    PROFILE_SCOPE("URender");
+
+    if (gGpuTimers)
+        gGpuTimer.BeginFrame();
+
     // Enable z-depth
     glEnable(GL_DEPTH_TEST);
 
+    // Camera and lighting for every draw of this frame
+    UUpdateFrameUniforms();
+    // The GPU culling pass has its own occlusion test
+    if (gOcclusionCulling && gCulling && !gGpuCulling)
+        URasterizeOccluders();
+
+    // A click of an earlier frame may have arrived
+    if (gObjectIdBuffer)
+        UResolveObjectId();
+    // In a window the object ids need the offscreen frame too
+    if (gObjectIdBuffer && !gHeadless)
+        gOffscreenTarget.Bind();
+
     // Clear the frame and z buffers
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (gObjectIdBuffer)
+    {
+        const GLuint background[4] = { 0, 0, 0, 0 };
+        glClearBufferuiv(GL_COLOR, 1, background);
+    }
 
-    // DRAW PLANE
-    // ----------
-    USetShaderProgram(gPlaneProgramId, gTablePosition, gTableScale);
-    // Activate Plane VAO and set the shader to be used
-    glBindVertexArray(gMesh.planeVAO);
-    glUseProgram(gPlaneProgramId);
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gPlaneTextureId);
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLES, 0, gMesh.planeVertices);
-    glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
-    
-    // DRAW CARPET
-    // ----------
-    USetShaderProgram(gCarpetProgramId, gCarpetPosition, gCarpetScale);
-    // Activate Plane VAO and set the shader to be used
-    glBindVertexArray(gMesh.carpetVAO);
-    glUseProgram(gCarpetProgramId);
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gCarpetTextureId);
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLES, 0, gMesh.carpetVertices);
-    glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
-
-    // DRAW TABLE
-    // -----------
-    USetShaderProgram(gTableProgramId, gTablePosition, gTableScale);
-    // Activate the pyramid VAO and set the shader to be used
-    glBindVertexArray(gMesh.tableVAO);
-    glUseProgram(gTableProgramId);
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gTableTextureId);
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLES, 0, gMesh.tableVertices);
-    glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
-
-    // DRAW TEACUP
-    //------------
-    USetShaderProgram(gCeramicProgramId, gTeacupPosition, gTeacupScale);
-    // Activate the pyramid VAO and set the shader to be used
-    glUseProgram(gCeramicProgramId);
-    glBindVertexArray(gMesh.teacupVAO);
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gCeramicTextureId);
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLES, 0, gMesh.teacupVertices);
-    glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
-
-    // DRAW SAUCER
-    //------------
-    USetShaderProgram(gCeramicProgramId, gSaucerPosition, gSaucerScale);
-    // Activate the pyramid VAO and set the shader to be used
-    glUseProgram(gCeramicProgramId);
-    glBindVertexArray(gMesh.saucerVAO);
-    // bind textures on corresponding texture units
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, gCeramicTextureId);
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLES, 0, gMesh.teacupVertices);
-    glBindTexture(GL_TEXTURE_2D, 0); // Unbind the texture
-
-    // DRAW WINDOW 1
-    //-------------
-    USetShaderProgram(gLampProgramId, gWindowLightPosition, gTableScale);
-    // Activate the pyramid VAO and set the shader to be used
-    glUseProgram(gLampProgramId);
-    glBindVertexArray(gMesh.windowVAO);
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLES, 0, gMesh.windowVertices);
-
-
-    // DRAW WINDOW 2
-    //----------------
-    USetShaderProgram(gLampProgramId, gLampLightPosition, gTableScale);
-    // Activate the pyramid VAO and set the shader to be used
-    glUseProgram(gLampProgramId);
-    glBindVertexArray(gMesh.windowVAO);
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLES, 0, gMesh.windowVertices);
+    if (gSceneBatchMode)
+    {
+        if (gGpuCulling)
+            UCullSceneOnGpu();
+        else
+            UUpdateSceneBatch();
+        UDrawSceneBatch();
+        // What this frame drew occludes next frame's objects
+        if (gGpuCulling && gCulling)
+            UBuildDepthPyramid();
+    }
+    else
+    {
+        // Every object submits a draw packet, the queue decides the order
+        gRenderQueue.Clear();
+        USubmitDraw(PASS_PLANE, gPlaneProgram, gPlaneTextureId, gMesh.plane, gTablePosition, gTableScale);
+        USubmitDraw(PASS_CARPET, gCarpetProgram, gCarpetTextureId, gMesh.carpet, gCarpetPosition, gCarpetScale);
+        USubmitDraw(PASS_TABLE, gTableProgram, gTableTextureId, gMesh.table, gTablePosition, gTableScale);
+        gTeacupLod = USelectLod(gMesh.teacupLods, glm::translate(gTeacupPosition) * glm::scale(gTeacupScale), gTeacupLod);
+        gSaucerLod = USelectLod(gMesh.saucerLods, glm::translate(gSaucerPosition) * glm::scale(gSaucerScale), gSaucerLod);
+        USubmitDraw(PASS_TEACUP, gCeramicProgram, gCeramicTextureId, gMesh.teacupLods.levels[gTeacupLod], gTeacupPosition, gTeacupScale);
+        USubmitDraw(PASS_SAUCER, gCeramicProgram, gCeramicTextureId, gMesh.saucerLods.levels[gSaucerLod], gSaucerPosition, gSaucerScale);
+        USubmitDraw(PASS_WINDOW1, gLampProgram, 0, gMesh.window, gWindowLightPosition, gTableScale);
+        USubmitDraw(PASS_WINDOW2, gLampProgram, 0, gMesh.window, gLampLightPosition, gTableScale);
+        UDrawRenderQueue();
+    }
 
     // Deactivate the Vertex Array Object and shader program
     glBindVertexArray(0);
     glUseProgram(0);
 
-    // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
-    glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
+    if (gObjectIdBuffer && !gHeadless)
+        gOffscreenTarget.Present();
+
+    if (gGpuTimers)
+    {
+        gGpuTimer.EndFrame();
+        UCollectGpuTimings();
+    }
 }
 
 // Implements the UCreateMesh function
 void UCreateMesh(GLMesh& mesh)
 {
+    PROFILE_SCOPE("UCreateMesh");
+
+    // Every mesh shares the position/normal/uv layout, so they all go into one buffer
+    const char* const names[] = { "teacup", "table", "plane", "window", "carpet", "saucer" };
+    MeshRange* const ranges[] = { &mesh.teacup, &mesh.table, &mesh.plane, &mesh.window, &mesh.carpet, &mesh.saucer };
+    GLMeshLods* const lods[] = { &mesh.teacupLods, NULL, NULL, NULL, NULL, &mesh.saucerLods };
+    const int meshCount = sizeof(names) / sizeof(names[0]);
+
+    // a mesh file replaces the arrays below entirely, they are not even initialized
+    if (!gMeshFileName.empty())
+    {
+        if (ULoadMeshFile(gMeshFileName.c_str(), names, ranges, lods, meshCount, mesh.arena))
+            return;
+        cout << "INFO: Falling back to the built-in meshes" << endl;
+    }
+
     // Position and Color data
     GLfloat tableVerts[] = {
         //Positions          //Normals
@@ -1202,506 +2918,378 @@ void UCreateMesh(GLMesh& mesh)
          1.0f,  0.0f, -5.0f,  0.0f, -1.0f,  0.0f,   1.0, 1.0
     };
 
-    GLfloat teacupVerts[] = {
-        //base
-         0.0f,  1.0f,  0.0f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
-        -0.1f,  1.0f, -0.2f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-         0.1f,  1.0f, -0.2f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-
-         0.0f,  1.0f,  0.0f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
-         0.2f,  1.0f, -0.1f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-         0.1f,  1.0f, -0.2f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-
-         0.0f,  1.0f,  0.0f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
-         0.2f,  1.0f,  0.1f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-         0.2f,  1.0f, -0.1f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-
-         0.0f,  1.0f,  0.0f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
-         0.2f,  1.0f,  0.1f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-         0.1f,  1.0f,  0.2f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         
-         0.0f,  1.0f,  0.0f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
-        -0.1f,  1.0f,  0.2f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-         0.1f,  1.0f,  0.2f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-
-         0.0f,  1.0f,  0.0f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
-        -0.2f,  1.0f, -0.1f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-        -0.1f,  1.0f, -0.2f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-
-         0.0f,  1.0f,  0.0f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
-        -0.2f,  1.0f,  0.1f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-        -0.2f,  1.0f, -0.1f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-
-         0.0f,  1.0f,  0.0f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
-        -0.2f,  1.0f,  0.1f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-        -0.1f,  1.0f,  0.2f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-
-        //sides 1
-         0.00f,  1.1f, -0.25f,  0.0f, -1.0f,  0.0f,   1.0, 1.0, //back
-        -0.10f,  1.0f, -0.20f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.10f,  1.0f, -0.20f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-
-         0.17f,  1.1f, -0.17f,  0.0f, -1.0f,  0.0f,   1.0, 1.0, 
-         0.20f,  1.0f, -0.10f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.10f,  1.0f, -0.20f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-
-         0.25f,  1.1f,  0.00f,  0.0f, -1.0f,  0.0f,   1.0, 1.0, //right
-         0.20f,  1.0f,  0.10f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.20f,  1.0f, -0.10f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-
-         0.17f,  1.1f,  0.17f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
-         0.20f,  1.0f,  0.10f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.10f,  1.0f,  0.20f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-
-         0.00f,  1.1f,  0.25f,  0.0f, -1.0f,  0.0f,   1.0, 1.0, //front
-        -0.10f,  1.0f,  0.20f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.10f,  1.0f,  0.20f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-
-        -0.17f,  1.1f,  0.17f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
-        -0.20f,  1.0f,  0.10f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-        -0.10f,  1.0f,  0.20f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-
-        -0.25f,  1.1f,  0.00f,  0.0f, -1.0f,  0.0f,   1.0, 1.0, //left
-        -0.20f,  1.0f,  0.10f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-        -0.20f,  1.0f, -0.10f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-
-        -0.17f,  1.1f, -0.17f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
-        -0.20f,  1.0f, -0.10f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-        -0.10f,  1.0f, -0.20f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-
-         //sides 2
-         0.10f,  1.0f, -0.20f,  0.0f, -1.0f,  0.0f,   1.0, 1.0, //right
-         0.00f,  1.1f, -0.25f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.17f,  1.1f, -0.17f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-        
-         0.25f,  1.1f,  0.00f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
-         0.20f,  1.0f, -0.10f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-         0.17f,  1.1f, -0.17f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-
-         0.25f,  1.1f,  0.00f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
-         0.20f,  1.0f,  0.10f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-         0.17f,  1.1f,  0.17f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-
-         0.10f,  1.0f,  0.20f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
-         0.00f,  1.1f,  0.25f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.17f,  1.1f,  0.17f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-
-        -0.10f,  1.0f, -0.20f,  0.0f, -1.0f,  0.0f,   1.0, 1.0, //left
-         0.00f,  1.1f, -0.25f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-        -0.17f,  1.1f, -0.17f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-
-        -0.25f,  1.1f,  0.00f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
-        -0.20f,  1.0f, -0.10f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-        -0.17f,  1.1f, -0.17f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-
-        -0.25f,  1.1f,  0.00f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
-        -0.20f,  1.0f,  0.10f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-        -0.17f,  1.1f,  0.17f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-
-        -0.10f,  1.0f,  0.20f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
-         0.00f,  1.1f,  0.25f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-        -0.17f,  1.1f,  0.17f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-
-        //sides 3
-         0.10f,  1.6f, -0.20f,  0.0f, -1.0f,  0.0f,   1.0, 1.0, 
-         0.00f,  1.1f, -0.25f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.17f,  1.1f, -0.17f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-        
-         0.25f,  1.1f,  0.00f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
-         0.20f,  1.6f, -0.10f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-         0.17f,  1.1f, -0.17f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-
-         0.25f,  1.1f,  0.00f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
-         0.20f,  1.6f,  0.10f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-         0.17f,  1.1f,  0.17f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-
-         0.10f,  1.6f,  0.20f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
-         0.00f,  1.1f,  0.25f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.17f,  1.1f,  0.17f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-
-        -0.10f,  1.6f, -0.20f,  0.0f, -1.0f,  0.0f,   1.0, 1.0, 
-        -0.00f,  1.1f, -0.25f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-        -0.17f,  1.1f, -0.17f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-        
-        -0.25f,  1.1f,  0.00f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
-        -0.20f,  1.6f, -0.10f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-        -0.17f,  1.1f, -0.17f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-
-        -0.25f,  1.1f,  0.00f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
-        -0.20f,  1.6f,  0.10f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-        -0.17f,  1.1f,  0.17f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-
-        -0.10f,  1.6f,  0.20f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
-        -0.00f,  1.1f,  0.25f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-        -0.17f,  1.1f,  0.17f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-
-        //sides 4
-         0.00f,  1.1f, -0.25f,  0.0f, -1.0f,  0.0f,   1.0, 1.0, //back
-        -0.10f,  1.6f, -0.20f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.00f,  1.6f, -0.20f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-
-         0.17f,  1.1f, -0.17f,  0.0f, -1.0f,  0.0f,   1.0, 1.0, 
-         0.20f,  1.6f, -0.10f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.10f,  1.6f, -0.20f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-
-         0.25f,  1.1f,  0.00f,  0.0f, -1.0f,  0.0f,   1.0, 1.0, //right
-         0.20f,  1.6f,  0.10f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.20f,  1.6f, -0.10f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-
-         0.17f,  1.1f,  0.17f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
-         0.20f,  1.6f,  0.10f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.10f,  1.6f,  0.20f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-
-         0.00f,  1.1f,  0.25f,  0.0f, -1.0f,  0.0f,   1.0, 1.0, //front
-        -0.10f,  1.6f,  0.20f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.10f,  1.6f,  0.20f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-
-        -0.17f,  1.1f,  0.17f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
-        -0.20f,  1.6f,  0.10f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-        -0.10f,  1.6f,  0.20f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-
-        -0.25f,  1.1f,  0.00f,  0.0f, -1.0f,  0.0f,   1.0, 1.0, //left
-        -0.20f,  1.6f,  0.10f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-        -0.20f,  1.6f, -0.10f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-
-        -0.17f,  1.1f, -0.17f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
-        -0.20f,  1.6f, -0.10f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-        -0.10f,  1.6f, -0.20f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-
-         0.00f,  1.1f, -0.25f,  0.0f, -1.0f,  0.0f,   1.0, 1.0, //back
-         0.10f,  1.6f, -0.20f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.00f,  1.6f, -0.20f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-
-        //handle
-        -0.05f,  1.20f,  0.20f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.05f,  1.20f,  0.20f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-         0.00f,  1.20f,  0.40f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-
-         0.05f,  1.20f,  0.20f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.05f,  1.25f,  0.20f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-         0.05f,  1.22f,  0.40f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-
-        -0.05f,  1.20f,  0.20f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-        -0.05f,  1.25f,  0.20f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-        -0.05f,  1.22f,  0.40f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-
-        -0.05f,  1.25f,  0.20f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.05f,  1.25f,  0.20f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-         0.00f,  1.25f,  0.40f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-
-         0.05f,  1.20f,  0.20f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.00f,  1.20f,  0.40f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-         0.05f,  1.22f,  0.40f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-
-        -0.05f,  1.20f,  0.20f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.00f,  1.20f,  0.40f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-        -0.05f,  1.22f,  0.40f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-
-         0.05f,  1.25f,  0.20f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.00f,  1.25f,  0.40f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-         0.05f,  1.22f,  0.40f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-
-        -0.05f,  1.25f,  0.20f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.00f,  1.25f,  0.40f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-        -0.05f,  1.22f,  0.40f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-
-        //handle upright
-        -0.05f,  1.22f,  0.40f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.00f,  1.20f,  0.40f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-         0.05f,  1.22f,  0.40f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-
-        -0.05f,  1.22f,  0.40f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.05f,  1.52f,  0.40f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-         0.05f,  1.22f,  0.40f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-
-        -0.05f,  1.52f,  0.40f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.05f,  1.52f,  0.40f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-        -0.05f,  1.22f,  0.40f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-
-        -0.05f,  1.22f,  0.37f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.05f,  1.52f,  0.37f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-         0.05f,  1.22f,  0.37f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-
-        -0.05f,  1.52f,  0.37f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.05f,  1.52f,  0.37f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-        -0.05f,  1.22f,  0.37f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-            //
-         0.05f,  1.22f,  0.37f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.05f,  1.52f,  0.40f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-         0.05f,  1.22f,  0.40f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-
-         0.05f,  1.52f,  0.37f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.05f,  1.52f,  0.40f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-         0.05f,  1.22f,  0.37f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-
-        -0.05f,  1.22f,  0.37f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-        -0.05f,  1.52f,  0.40f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-        -0.05f,  1.22f,  0.40f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-
-        -0.05f,  1.52f,  0.37f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-        -0.05f,  1.52f,  0.40f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-        -0.05f,  1.22f,  0.37f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-            //
-        -0.05f,  1.52f,  0.40f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.00f,  1.55f,  0.40f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-         0.05f,  1.52f,  0.40f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-
-        //handle
-        -0.05f,  1.50f,  0.20f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.05f,  1.50f,  0.20f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-         0.00f,  1.50f,  0.40f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-
-         0.05f,  1.50f,  0.20f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.05f,  1.55f,  0.20f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-         0.05f,  1.52f,  0.40f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-
-        -0.05f,  1.50f,  0.20f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-        -0.05f,  1.55f,  0.20f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-        -0.05f,  1.52f,  0.40f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-
-        -0.05f,  1.55f,  0.20f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.05f,  1.55f,  0.20f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-         0.00f,  1.55f,  0.40f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-
-         0.05f,  1.50f,  0.20f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.00f,  1.50f,  0.40f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-         0.05f,  1.52f,  0.40f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-
-        -0.05f,  1.50f,  0.20f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.00f,  1.50f,  0.40f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-        -0.05f,  1.52f,  0.40f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-
-         0.05f,  1.55f,  0.20f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.00f,  1.55f,  0.40f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-         0.05f,  1.52f,  0.40f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-
-        -0.05f,  1.55f,  0.20f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-         0.00f,  1.55f,  0.40f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-        -0.05f,  1.52f,  0.40f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-    };
+    // welded into indexed triangles; the teacup and saucer are lathed from their profile curves instead
+    vector<IndexedMesh> welded;
+    welded.push_back(UBuildTeacup(names[0]));
+    welded.push_back(UWeldMesh(names[1], tableVerts, sizeof(tableVerts) / sizeof(tableVerts[0])));
+    welded.push_back(UWeldMesh(names[2], planeVerts, sizeof(planeVerts) / sizeof(planeVerts[0])));
+    welded.push_back(UWeldMesh(names[3], windowVerts, sizeof(windowVerts) / sizeof(windowVerts[0])));
+    welded.push_back(UWeldMesh(names[4], carpetVerts, sizeof(carpetVerts) / sizeof(carpetVerts[0])));
+    welded.push_back(UBuildSaucer(names[5]));
+
+    // a scanned model can stand in for the lathed teacup
+    if (!gObjFileName.empty())
+        ULoadObjModel(gObjFileName.c_str(), welded[0]);
+    else if (!gGltfFileName.empty())
+        ULoadGltfModel(gGltfFileName.c_str(), welded[0]);
+
+    UOptimizeMeshes(names, welded);
+    // simplified from the final vertex order, since every level shares the vertices of the full mesh
+    vector<vector<LodLevel>> chains;
+    UBuildLods(names, welded, lods, chains);
+
+    for (size_t i = 0; i < welded.size(); ++i)
+    {
+        *ranges[i] = mesh.arena.Add(welded[i].Vertices.data(), welded[i].VertexCount(), welded[i].Indices.data(), welded[i].Indices.size());
+        if (lods[i] == NULL)
+            continue;
+        lods[i]->levels.assign(1, *ranges[i]);
+        for (size_t level = 1; level < chains[i].size(); ++level)
+            lods[i]->levels.push_back(mesh.arena.AddIndices(*ranges[i], chains[i][level].Indices.data(), chains[i][level].Indices.size()));
+    }
+    mesh.arena.Upload();
 
-    GLfloat saucerVerts[] = {
-    //base
-     0.0f,  1.0f,  0.0f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
-    -0.1f,  1.0f, -0.2f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-     0.1f,  1.0f, -0.2f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
+    if (!gWriteMeshFileName.empty())
+        UWriteMeshFile(gWriteMeshFileName.c_str(), names, ranges, lods, meshCount, mesh.arena);
+}
+
+// Map a mesh file and upload it into the arena without parsing; fails if a mesh is missing or the layout differs
+bool ULoadMeshFile(const char* path, const char* const* names, MeshRange* const* ranges, GLMeshLods* const* lods, int meshCount, VertexArena& arena)
+{
+    PROFILE_SCOPE("ULoadMeshFile");
 
-     0.0f,  1.0f,  0.0f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-     0.2f,  1.0f, -0.1f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-     0.1f,  1.0f, -0.2f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
+    MeshFile file;
+    if (!file.Open(path))
+        return false;
+
+    for (int i = 0; i < meshCount; ++i)
+    {
+        const MeshFileEntry* entry = file.Find(names[i]);
+        if (entry == NULL)
+        {
+            cout << "ERROR::MESHFILE::" << path << " has no mesh named " << names[i] << endl;
+            return false;
+        }
+        ranges[i]->FirstIndex = entry->FirstIndex;
+        ranges[i]->Count = (GLsizei)entry->IndexCount;
+        ranges[i]->BaseVertex = entry->BaseVertex;
+        ranges[i]->VertexCount = (GLsizei)entry->VertexCount;
+        memcpy(ranges[i]->BoundsMin, entry->BoundsMin, sizeof(entry->BoundsMin));
+        memcpy(ranges[i]->BoundsMax, entry->BoundsMax, sizeof(entry->BoundsMax));
+
+        // coarser levels are optional and named after the mesh: teacup@1, teacup@2, ...
+        if (lods[i] == NULL)
+            continue;
+        lods[i]->levels.assign(1, *ranges[i]);
+        lods[i]->errors.assign(1, 0.0f);
+        const glm::vec3 boundsMin = glm::make_vec3(entry->BoundsMin), boundsMax = glm::make_vec3(entry->BoundsMax);
+        lods[i]->center = (boundsMin + boundsMax) * 0.5f;
+        lods[i]->radius = glm::length(boundsMax - boundsMin) * 0.5f;
+        for (int level = 1; ; ++level)
+        {
+            const MeshFileEntry* levelEntry = file.Find((string(names[i]) + "@" + to_string(level)).c_str());
+            if (levelEntry == NULL)
+                break;
+            MeshRange range = *ranges[i];
+            range.FirstIndex = levelEntry->FirstIndex;
+            range.Count = (GLsizei)levelEntry->IndexCount;
+            lods[i]->levels.push_back(range);
+            lods[i]->errors.push_back(levelEntry->Error);
+        }
+    }
+    if (!arena.Upload(file))
+        return false;
 
-     0.0f,  1.0f,  0.0f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-     0.2f,  1.0f,  0.1f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-     0.2f,  1.0f, -0.1f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
+    cout << "INFO: Mapped " << file.Header().MeshCount << " meshes from " << path << " ("
+         << file.Header().VertexDataSize + file.Header().IndexDataSize << " bytes of vertices and indices)" << endl;
+    return true;
+}
 
-     0.0f,  1.0f,  0.0f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-     0.2f,  1.0f,  0.1f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-     0.1f,  1.0f,  0.2f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
+// Load an OBJ model and put it where target is: uniformly scaled to fit target's bounding box, standing on its bottom
+bool ULoadObjModel(const char* path, IndexedMesh& target)
+{
+    PROFILE_SCOPE("ULoadObjModel");
 
-     0.0f,  1.0f,  0.0f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
-    -0.1f,  1.0f,  0.2f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-     0.1f,  1.0f,  0.2f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
+    IndexedMesh model;
+    ObjLoadStats stats;
+    if (!ObjLoader::Load(path, model, &stats) || model.VertexCount() == 0)
+        return false;
+    cout << "INFO: Loaded " << path << ": " << stats.Triangles << " triangles, " << stats.Vertices << " vertices, "
+         << stats.Bytes / (1024.0 * 1024.0) << " MB in " << stats.Seconds << " s on " << stats.Threads << " threads ("
+         << stats.MegabytesPerSecond() << " MB/s)" << endl;
 
-     0.0f,  1.0f,  0.0f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-    -0.2f,  1.0f, -0.1f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-    -0.1f,  1.0f, -0.2f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
+    UFitModel(model, target);
+    target = model;
+    return true;
+}
 
-     0.0f,  1.0f,  0.0f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-    -0.2f,  1.0f,  0.1f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-    -0.2f,  1.0f, -0.1f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
+// Flatten the default scene of a glTF binary into one mesh, in place of target and scaled into its bounds
+bool ULoadGltfModel(const char* path, IndexedMesh& target)
+{
+    PROFILE_SCOPE("ULoadGltfModel");
 
-     0.0f,  1.0f,  0.0f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-    -0.2f,  1.0f,  0.1f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-    -0.1f,  1.0f,  0.2f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
+    const auto start = chrono::steady_clock::now();
+    GltfDocument document;
+    IndexedMesh model;
+    if (!document.Open(path))
+        return false;
+    if (!document.DecodeScene(model))
+    {
+        cout << "ERROR::GLTF::" << path << " has no triangles to draw" << endl;
+        return false;
+    }
+    const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "INFO: Loaded " << path << ": " << model.Indices.size() / 3 << " triangles, " << model.VertexCount() << " vertices in "
+         << seconds << " s" << endl;
 
-    //sides 1
-     0.00f,  1.1f, -0.45f,  0.0f, -1.0f,  0.0f,   1.0, 1.0, //back
-    -0.10f,  1.0f, -0.20f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-     0.10f,  1.0f, -0.20f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
+    UFitModel(model, target);
+    target = model;
+    return true;
+}
 
-     0.27f,  1.1f, -0.27f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
-     0.20f,  1.0f, -0.10f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-     0.10f,  1.0f, -0.20f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
+// Scale and move a loaded model so it stands where target stands, as large as fits in target's bounds
+void UFitModel(IndexedMesh& model, const IndexedMesh& target)
+{
+    auto bounds = [](const IndexedMesh& mesh, glm::vec3& lo, glm::vec3& hi) {
+        lo = hi = glm::vec3(mesh.Vertices[0], mesh.Vertices[1], mesh.Vertices[2]);
+        for (size_t v = 0; v < mesh.VertexCount(); ++v)
+        {
+            glm::vec3 p(mesh.Vertices[v * mesh.FloatsPerVertex], mesh.Vertices[v * mesh.FloatsPerVertex + 1], mesh.Vertices[v * mesh.FloatsPerVertex + 2]);
+            lo = glm::min(lo, p);
+            hi = glm::max(hi, p);
+        }
+    };
+    glm::vec3 targetLo, targetHi, modelLo, modelHi;
+    bounds(target, targetLo, targetHi);
+    bounds(model, modelLo, modelHi);
+    const glm::vec3 targetSize = targetHi - targetLo, modelSize = glm::max(modelHi - modelLo, glm::vec3(1e-6f));
+    const float scale = min(targetSize.x / modelSize.x, min(targetSize.y / modelSize.y, targetSize.z / modelSize.z));
+    const glm::vec3 modelBase((modelLo.x + modelHi.x) * 0.5f, modelLo.y, (modelLo.z + modelHi.z) * 0.5f);
+    const glm::vec3 targetBase((targetLo.x + targetHi.x) * 0.5f, targetLo.y, (targetLo.z + targetHi.z) * 0.5f);
+    for (size_t v = 0; v < model.VertexCount(); ++v)
+    {
+        float* position = &model.Vertices[v * model.FloatsPerVertex];
+        glm::vec3 p = (glm::vec3(position[0], position[1], position[2]) - modelBase) * scale + targetBase;
+        position[0] = p.x;
+        position[1] = p.y;
+        position[2] = p.z;
+    }
+}
 
-     0.45f,  1.1f,  0.00f,  0.0f, -1.0f,  0.0f,   1.0, 1.0, //right
-     0.20f,  1.0f,  0.10f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-     0.20f,  1.0f, -0.10f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
+// Save the arena's meshes so later runs can map them with --mesh-file
+bool UWriteMeshFile(const char* path, const char* const* names, MeshRange* const* ranges, GLMeshLods* const* lods, int meshCount, const VertexArena& arena)
+{
+    vector<MeshFileEntry> entries;
+    auto addEntry = [&entries](const string& name, const MeshRange& range, float error) {
+        MeshFileEntry entry;
+        memset(&entry, 0, sizeof(MeshFileEntry));
+        strncpy(entry.Name, name.c_str(), sizeof(entry.Name) - 1);
+        entry.FirstIndex = range.FirstIndex;
+        entry.IndexCount = (uint32_t)range.Count;
+        entry.BaseVertex = range.BaseVertex;
+        entry.VertexCount = (uint32_t)range.VertexCount;
+        entry.Error = error;
+        entries.push_back(entry);
+    };
+    for (int i = 0; i < meshCount; ++i)
+    {
+        addEntry(names[i], *ranges[i], 0.0f);
+        for (size_t level = 1; lods[i] != NULL && level < lods[i]->levels.size(); ++level)
+            addEntry(string(names[i]) + "@" + to_string(level), lods[i]->levels[level], lods[i]->errors[level]);
+    }
+    if (!MeshFile::Write(path, entries, VertexArena::FileLayout(), VertexArena::FILE_ATTRIBUTE_COUNT, VertexArena::FLOATS_PER_VERTEX * sizeof(float), 0,
+            arena.Vertices.data(), arena.Vertices.size() * sizeof(float), arena.Indices.data(), arena.Indices.size() * sizeof(GLuint), sizeof(GLuint)))
+        return false;
 
-     0.27f,  1.1f,  0.27f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
-     0.20f,  1.0f,  0.10f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-     0.10f,  1.0f,  0.20f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
+    cout << "INFO: Wrote " << meshCount << " meshes (" << entries.size() << " with their levels of detail) to " << path << endl;
+    return true;
+}
 
-     0.00f,  1.1f,  0.45f,  0.0f, -1.0f,  0.0f,   1.0, 1.0, //front
-    -0.10f,  1.0f,  0.20f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-     0.10f,  1.0f,  0.20f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
+// Simplify the meshes that have a LOD chain into gLodLevels levels, one task per mesh, and report the chains.
+// chains[i] stays empty for meshes without one.
+void UBuildLods(const char* const* names, vector<IndexedMesh>& meshes, GLMeshLods* const* lods, vector<vector<LodLevel>>& chains)
+{
+    PROFILE_SCOPE("UBuildLods");
 
-    -0.27f,  1.1f,  0.27f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
-    -0.20f,  1.0f,  0.10f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-    -0.10f,  1.0f,  0.20f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
+    chains.assign(meshes.size(), vector<LodLevel>());
+    MeshOptimizer::ForEachParallel(meshes, [&meshes, &chains, lods](IndexedMesh& mesh) {
+        const size_t i = &mesh - meshes.data();
+        if (lods[i] != NULL)
+            chains[i] = MeshSimplifier::BuildLodChain(mesh, gLodLevels, 0.5f, 0.05f, gVertexCacheSize);
+    });
 
-    -0.45f,  1.1f,  0.00f,  0.0f, -1.0f,  0.0f,   1.0, 1.0, //left
-    -0.20f,  1.0f,  0.10f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-    -0.20f,  1.0f, -0.10f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
+    for (size_t i = 0; i < meshes.size(); ++i)
+    {
+        if (lods[i] == NULL)
+            continue;
+        glm::vec3 lo(3.0e38f), hi(-3.0e38f);
+        for (size_t v = 0; v < meshes[i].VertexCount(); ++v)
+        {
+            const glm::vec3 p = glm::make_vec3(&meshes[i].Vertices[v * meshes[i].FloatsPerVertex]);
+            lo = glm::min(lo, p);
+            hi = glm::max(hi, p);
+        }
+        lods[i]->center = (lo + hi) * 0.5f;
+        lods[i]->radius = glm::length(hi - lo) * 0.5f;
+        lods[i]->errors.clear();
 
-    -0.27f,  1.1f, -0.27f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
-    -0.20f,  1.0f, -0.10f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-    -0.10f,  1.0f, -0.20f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
+        cout << "INFO: LOD chain of " << names[i] << ":";
+        for (const LodLevel& level : chains[i])
+        {
+            lods[i]->errors.push_back(level.Error);
+            cout << " " << level.Indices.size() / 3 << " triangles (error " << level.Error << ")";
+        }
+        cout << endl;
+    }
+}
 
-    //sides 2
-     0.00f,  1.1f, -0.45f,  0.0f, -1.0f,  0.0f,   1.0, 1.0, //back right
-     0.10f,  1.0f, -0.20f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-     0.27f,  1.1f, -0.27f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
+// Weld a triangle soup into an indexed mesh and report what indexing saves
+IndexedMesh UWeldMesh(const char* name, const float* vertices, size_t floatCount)
+{
+    const size_t soupVertices = floatCount / VertexArena::FLOATS_PER_VERTEX;
+    IndexedMesh welded = MeshOptimizer::WeldVertices(vertices, soupVertices, VertexArena::FLOATS_PER_VERTEX);
+
+    // glDrawArrays runs the vertex shader once per soup vertex; indexed draws only on post-transform cache misses
+    const size_t transforms = MeshOptimizer::CountVertexTransforms(welded.Indices.data(), welded.Indices.size(), welded.VertexCount());
+    cout << "INFO: Welded " << name << ": " << soupVertices << " -> " << welded.VertexCount() << " vertices ("
+         << (float)soupVertices / max(welded.VertexCount(), (size_t)1) << "x fewer), vertex shader invocations "
+         << soupVertices << " -> " << transforms << " (" << (float)soupVertices / max(transforms, (size_t)1) << "x fewer)" << endl;
+    return welded;
+}
 
-     0.27f,  1.1f, -0.27f,  0.0f, -1.0f,  0.0f,   1.0, 1.0, //right back
-     0.45f,  1.1f,  0.00f,  0.0f, -1.0f,  0.0f,   1.0, 1.0, 
-     0.20f,  1.0f, -0.10f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
+// Lathe options at the tessellation picked on the command line
+LatheOptions ULatheOptions()
+{
+    LatheOptions options;
+    options.RadialSegments = gLatheRadialSegments;
+    options.ProfileSegments = gLatheProfileSegments;
+    return options;
+}
 
-     0.45f,  1.1f,  0.00f,  0.0f, -1.0f,  0.0f,   1.0, 1.0, //right
-     0.20f,  1.0f,  0.10f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-     0.27f,  1.1f,  0.27f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
+// Teacup: a walled cup turned from its profile, with a half-torus handle whose ends sit inside the wall
+IndexedMesh UBuildTeacup(const char* name)
+{
+    // up the outside from the centre of the base, over the rim, and down the inside
+    const vector<LathePoint> cup = {
+        { 0.0f, 1.0f, true }, { 0.2f, 1.0f, true }, { 0.25f, 1.12f }, { 0.245f, 1.4f }, { 0.224f, 1.6f, true },
+        { 0.205f, 1.6f, true }, { 0.225f, 1.4f }, { 0.22f, 1.14f }, { 0.18f, 1.06f, true }, { 0.0f, 1.06f, true }
+    };
+    IndexedMesh teacup = Lathe::Build(cup, ULatheOptions());
 
-     0.27f,  1.1f,  0.27f,  0.0f, -1.0f,  0.0f,   1.0, 1.0, //right front
-     0.10f,  1.0f,  0.20f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-     0.00f,  1.1f,  0.45f,  0.0f, -1.0f,  0.0f,   1.0, 1.0, 
+    // the handle is a tube lathed half a turn around an axis along x, behind the cup at +z
+    vector<LathePoint> tube;
+    const int tubePoints = 6;
+    for (int i = 0; i < tubePoints; ++i)
+    {
+        const float angle = glm::two_pi<float>() * i / tubePoints;
+        tube.push_back(LathePoint(0.16f + 0.025f * cos(angle), 0.025f * sin(angle)));
+    }
+    LatheOptions handleOptions = ULatheOptions();
+    handleOptions.RadialSegments = max(gLatheRadialSegments / 2, 3u);
+    handleOptions.StartAngle = -glm::half_pi<float>();
+    handleOptions.SweepAngle = glm::pi<float>();
+    handleOptions.ClosedProfile = true;
+    IndexedMesh handle = Lathe::Build(tube, handleOptions);
+    Lathe::Transform(handle, glm::translate(glm::vec3(0.0f, 1.375f, 0.22f)) * glm::rotate(glm::half_pi<float>(), glm::vec3(0.0f, 0.0f, 1.0f)));
+    Lathe::Append(teacup, handle);
+
+    cout << "INFO: Lathed " << name << ": " << teacup.VertexCount() << " vertices, " << teacup.Indices.size() / 3 << " triangles" << endl;
+    return teacup;
+}
 
-     0.00f,  1.1f,  0.45f,  0.0f, -1.0f,  0.0f,   1.0, 1.0, //front left
-    -0.10f,  1.0f,  0.20f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-    -0.27f,  1.1f,  0.27f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
+// Saucer: a shallow dish with a flat foot
+IndexedMesh UBuildSaucer(const char* name)
+{
+    const vector<LathePoint> saucer = {
+        { 0.0f, 1.0f, true }, { 0.224f, 1.0f, true }, { 0.45f, 1.1f, true },
+        { 0.43f, 1.1f, true }, { 0.224f, 1.02f, true }, { 0.0f, 1.02f, true }
+    };
+    IndexedMesh mesh = Lathe::Build(saucer, ULatheOptions());
 
-    -0.27f,  1.1f,  0.27f,  0.0f, -1.0f,  0.0f,   1.0, 1.0, //left front
-    -0.20f,  1.0f,  0.10f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
-    -0.45f,  1.1f,  0.00f,  0.0f, -1.0f,  0.0f,   1.0, 1.0, 
+    cout << "INFO: Lathed " << name << ": " << mesh.VertexCount() << " vertices, " << mesh.Indices.size() / 3 << " triangles" << endl;
+    return mesh;
+}
 
-    -0.45f,  1.1f,  0.00f,  0.0f, -1.0f,  0.0f,   1.0, 1.0, //left back
-    -0.20f,  1.0f, -0.10f,  0.0f, -1.0f,  0.0f,   0.0, 1.0,
-    -0.27f,  1.1f, -0.27f,  0.0f, -1.0f,  0.0f,   1.0, 1.0,
+// Measure two stacked unit quads facing +z, whose overdraw is known: drawn nearest first, every pixel is shaded
+// once from every viewpoint (exactly 1); drawn farthest first, the near quad shades again wherever it overlaps.
+bool UCheckOverdrawMeasure()
+{
+    const float positions[] = { 0, 0, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 0, 0, 1, 1, 0, 1, 1, 1, 1, 0, 1, 1 };
+    const unsigned int nearFirst[] = { 4, 5, 6, 4, 6, 7, 0, 1, 2, 0, 2, 3 };
+    const unsigned int farFirst[] = { 0, 1, 2, 0, 2, 3, 4, 5, 6, 4, 6, 7 };
+    const float nearRatio = MeshOptimizer::MeasureOverdraw(nearFirst, 12, positions, 3, 8);
+    const float farRatio = MeshOptimizer::MeasureOverdraw(farFirst, 12, positions, 3, 8);
+    if (nearRatio != 1.0f || farRatio <= 1.0f)
+    {
+        cout << "ERROR::OVERDRAW::Two stacked quads measured " << nearRatio << " drawn nearest first and " << farRatio
+             << " farthest first, expected 1 and more than 1" << endl;
+        return false;
+    }
+    cout << "INFO: Overdraw check, two stacked quads: " << nearRatio << " nearest first, " << farRatio << " farthest first" << endl;
+    return true;
+}
 
-    -0.27f,  1.1f, -0.27f,  0.0f, -1.0f,  0.0f,   1.0, 1.0, //back left
-     0.00f,  1.1f, -0.45f,  0.0f, -1.0f,  0.0f,   1.0, 1.0, 
-    -0.10f,  1.0f, -0.20f,  0.0f, -1.0f,  0.0f,   1.0, 0.0,
+// Reorder the triangles of every mesh for the post-transform cache and then against overdraw, and the vertices
+// into first-use order so vertex fetch reads memory sequentially; one task per mesh. Reports ACMR/ATVR and,
+// with --measure-overdraw, the overdraw ratio from sample viewpoints.
+void UOptimizeMeshes(const char* const* names, vector<IndexedMesh>& meshes)
+{
+    PROFILE_SCOPE("UOptimizeMeshes");
+
+    vector<float> overdrawBefore(meshes.size()), overdrawAfter(meshes.size());
+    auto measureOverdraw = [&meshes](vector<float>& ratios) {
+        MeshOptimizer::ForEachParallel(meshes, [&meshes, &ratios](IndexedMesh& welded) {
+            ratios[&welded - meshes.data()] = MeshOptimizer::MeasureOverdraw(welded.Indices.data(), welded.Indices.size(),
+                welded.Vertices.data(), welded.FloatsPerVertex, welded.VertexCount());
+        });
+    };
+    if (gMeasureOverdraw)
+    {
+        UCheckOverdrawMeasure();
+        measureOverdraw(overdrawBefore);
+    }
 
-};
+    if (gVertexCacheSize > 0)
+    {
+        vector<pair<VertexCacheStats, VertexCacheStats>> stats = MeshOptimizer::OptimizeVertexCacheParallel(meshes, gVertexCacheSize);
+        MeshOptimizer::ForEachParallel(meshes, [](IndexedMesh& welded) {
+            if (gOverdrawThreshold > 0.0f)
+                MeshOptimizer::OptimizeOverdraw(welded.Indices.data(), welded.Indices.size(), welded.Vertices.data(), welded.FloatsPerVertex,
+                    welded.VertexCount(), gVertexCacheSize, gOverdrawThreshold);
+            MeshOptimizer::OptimizeVertexFetch(welded);
+        });
+
+        for (size_t i = 0; i < meshes.size(); ++i)
+        {
+            const VertexCacheStats reordered = MeshOptimizer::AnalyzeVertexCache(meshes[i].Indices.data(), meshes[i].Indices.size(),
+                meshes[i].VertexCount(), gVertexCacheSize);
+            cout << "INFO: Vertex cache (" << gVertexCacheSize << " entries) " << names[i]
+                 << ": ACMR " << stats[i].first.ACMR << " -> " << stats[i].second.ACMR
+                 << ", ATVR " << stats[i].first.ATVR << " -> " << stats[i].second.ATVR;
+            if (gOverdrawThreshold > 0.0f)
+                cout << ", after overdraw reordering ACMR " << reordered.ACMR;
+            cout << endl;
+        }
+    }
 
-    const GLuint floatsPerVertex = 3;
-    const GLuint floatsPerNormal = 3;
-    const GLuint floatsPerUV = 2;
-
-    //Generate Teacup Vertex buffers
-    //------------------------------
-    mesh.teacupVertices = sizeof(teacupVerts) / (sizeof(teacupVerts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-    glGenVertexArrays(1, &mesh.teacupVAO); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(mesh.teacupVAO);
-    // Create 2 buffers: first one for the vertex data; second one for the indices
-    glGenBuffers(1, &mesh.teacupVBO);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.teacupVBO); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(teacupVerts), teacupVerts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-    // Strides between vertex coordinates is 6 (x, y, z, r, g, b, a). A tightly packed stride is 0.
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerNormal + floatsPerUV);// The number of floats before each
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float)* floatsPerVertex));
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float)* (floatsPerVertex + floatsPerNormal)));
-    glEnableVertexAttribArray(2);
-
-    //Generate Table Vertex buffers
-    //------------------------------
-    mesh.tableVertices = sizeof(tableVerts) / (sizeof(tableVerts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-    glGenVertexArrays(1, &mesh.tableVAO); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(mesh.tableVAO);
-    // Create 2 buffers: first one for the vertex data; second one for the indices
-    glGenBuffers(1, &mesh.tableVBO);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.tableVBO); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(tableVerts), tableVerts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-    glEnableVertexAttribArray(2);
-
-    //Generate Plane Vertex buffers
-    //------------------------------
-    mesh.planeVertices = sizeof(planeVerts) / (sizeof(planeVerts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-    glGenVertexArrays(1, &mesh.planeVAO); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(mesh.planeVAO);
-    // Create 2 buffers: first one for the vertex data; second one for the indices
-    glGenBuffers(1, &mesh.planeVBO);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.planeVBO); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(planeVerts), planeVerts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * floatsPerVertex));
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * (floatsPerVertex + floatsPerNormal)));
-    glEnableVertexAttribArray(2);
-    
-    //Generate Window Vertex buffers
-    //------------------------------
-    mesh.windowVertices = sizeof(windowVerts) / (sizeof(windowVerts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-    glGenVertexArrays(1, &mesh.windowVAO); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(mesh.windowVAO);
-    // Create 2 buffers: first one for the vertex data; second one for the indices
-    glGenBuffers(1, &mesh.windowVBO);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.windowVBO); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(windowVerts), windowVerts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float)* floatsPerVertex));
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float)* (floatsPerVertex + floatsPerNormal)));
-    glEnableVertexAttribArray(2);
-
-    //Generate Carpet Vertex buffers
-    //------------------------------
-    mesh.carpetVertices = sizeof(carpetVerts) / (sizeof(carpetVerts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-    glGenVertexArrays(1, &mesh.carpetVAO); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(mesh.carpetVAO);
-    // Create 2 buffers: first one for the vertex data; second one for the indices
-    glGenBuffers(1, &mesh.carpetVBO);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.carpetVBO); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(carpetVerts), carpetVerts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float)* floatsPerVertex));
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float)* (floatsPerVertex + floatsPerNormal)));
-    glEnableVertexAttribArray(2);
-
-    //Generate Saucer Vertex buffers
-    //------------------------------
-    mesh.saucerVertices = sizeof(saucerVerts) / (sizeof(saucerVerts[0]) * (floatsPerVertex + floatsPerNormal + floatsPerUV));
-    glGenVertexArrays(1, &mesh.saucerVAO); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(mesh.saucerVAO);
-    // Create 2 buffers: first one for the vertex data; second one for the indices
-    glGenBuffers(1, &mesh.saucerVBO);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.saucerVBO); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(saucerVerts), saucerVerts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, floatsPerNormal, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float)* floatsPerVertex));
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(2, floatsPerUV, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float)* (floatsPerVertex + floatsPerNormal)));
-    glEnableVertexAttribArray(2);
+    if (gMeasureOverdraw)
+    {
+        measureOverdraw(overdrawAfter);
+        for (size_t i = 0; i < meshes.size(); ++i)
+            cout << "INFO: Overdraw " << names[i] << ": " << overdrawBefore[i] << " -> " << overdrawAfter[i] << endl;
+    }
 }
 
 void UDestroyMesh(GLMesh& mesh)
 {
-    glDeleteVertexArrays(1, &mesh.tableVAO);
-    glDeleteBuffers(1, &mesh.tableVBO);
-    glDeleteVertexArrays(1, &mesh.planeVAO);
-    glDeleteBuffers(1, &mesh.planeVBO);
+    mesh.arena.Destroy();
 }
 
 /*Generate and load the texture*/
 bool UCreateTexture(const char* filename, GLuint& textureId)
 {
+    PROFILE_SCOPE("UCreateTexture");
+
     int width, height, channels;
     unsigned char* image = stbi_load(filename, &width, &height, &channels, 0);
     if (image)
@@ -1740,28 +3328,85 @@ bool UCreateTexture(const char* filename, GLuint& textureId)
     return false;
 }
 
+// Copy 2D textures into the layers of a new array texture, scaled to the largest of them
+bool UCreateTextureArray(const GLuint* textureIds, int count, GLuint& arrayId)
+{
+    PROFILE_SCOPE("UCreateTextureArray");
+
+    vector<GLint> widths(count), heights(count);
+    GLint width = 0, height = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        glBindTexture(GL_TEXTURE_2D, textureIds[i]);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &widths[i]);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &heights[i]);
+        width = max(width, widths[i]);
+        height = max(height, heights[i]);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    if (width == 0 || height == 0)
+        return false;
+
+    glGenTextures(1, &arrayId);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, arrayId);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGBA8, width, height, count);
+    // same sampling as UCreateTexture
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    // Scale each texture into its layer with a framebuffer blit, then restore the caller's framebuffers
+    GLint readFramebuffer = 0, drawFramebuffer = 0;
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer);
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFramebuffer);
+    GLuint framebuffers[2];
+    glGenFramebuffers(2, framebuffers);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffers[0]);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffers[1]);
+    for (int i = 0; i < count; ++i)
+    {
+        if (widths[i] == 0)
+            continue; // texture failed to load, the layer stays black
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textureIds[i], 0);
+        glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, arrayId, 0, i);
+        glBlitFramebuffer(0, 0, widths[i], heights[i], 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    }
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, drawFramebuffer);
+    glDeleteFramebuffers(2, framebuffers);
+    return true;
+}
+
 void UDestroyTexture(GLuint textureId)
 {
     glGenTextures(1, &textureId);
 }
 
 // Implements the UCreateShaders function
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId)
+bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLProgram& program)
 {
+    PROFILE_SCOPE("UCreateShaderProgram");
+
     // Compilation and linkage error reporting
     int success = 0;
     char infoLog[512];
 
     // Create a Shader program object.
-    programId = glCreateProgram();
+    GLuint programId = glCreateProgram();
+    program.id = programId;
 
     // Create the vertex and fragment shader objects
     GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
     GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
 
-    // Retrive the shader source
-    glShaderSource(vertexShaderId, 1, &vtxShaderSource, NULL);
-    glShaderSource(fragmentShaderId, 1, &fragShaderSource, NULL);
+    // Retrive the shader source, both stages declaring the FrameData block the same way
+    const string vertexCode = UWithFrameData(vtxShaderSource), fragmentCode = UWithFrameData(fragShaderSource);
+    const GLchar* vertexSource = vertexCode.c_str();
+    const GLchar* fragmentSource = fragmentCode.c_str();
+    glShaderSource(vertexShaderId, 1, &vertexSource, NULL);
+    glShaderSource(fragmentShaderId, 1, &fragmentSource, NULL);
 
     // Compile the vertex shader, and print compilation errors (if any)
     glCompileShader(vertexShaderId); // compile the vertex shader
@@ -1801,11 +3446,63 @@ bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSou
         return false;
     }
 
+    // Attach the FrameData block to its binding point (matches the layout qualifier, kept explicit for drivers that ignore it)
+    GLuint frameBlockIndex = glGetUniformBlockIndex(programId, "FrameData");
+    if (frameBlockIndex != GL_INVALID_INDEX)
+        glUniformBlockBinding(programId, frameBlockIndex, FRAME_UNIFORM_BINDING);
+
+    // Reflect the active uniforms once so draws never look a name up
+    UniformTable uniforms(programId);
+    for (int slot = 0; slot < UNIFORM_COUNT; ++slot)
+        program.uniforms[slot] = uniforms.Find(UNIFORM_NAMES[slot]);
+
     glUseProgram(programId);    // Uses the shader program
 
     return true;
 }
 
+// Insert the FrameData block after the #version line of a shader source
+string UWithFrameData(const char* source)
+{
+    string code = source;
+    const size_t versionLine = code.find("#version");
+    const size_t lineEnd = versionLine == string::npos ? string::npos : code.find('\n', versionLine);
+    code.insert(lineEnd == string::npos ? 0 : lineEnd + 1, frameDataBlockSource);
+    return code;
+}
+
+// Compile and link a program of one compute shader
+bool UCreateComputeProgram(const char* source, GLuint& programId)
+{
+    int success = 0;
+    char infoLog[512];
+
+    GLuint shaderId = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(shaderId, 1, &source, NULL);
+    glCompileShader(shaderId);
+    glGetShaderiv(shaderId, GL_COMPILE_STATUS, &success);
+    if (!success)
+    {
+        glGetShaderInfoLog(shaderId, sizeof(infoLog), NULL, infoLog);
+        std::cout << "ERROR::SHADER::COMPUTE::COMPILATION_FAILED\n" << infoLog << std::endl;
+        glDeleteShader(shaderId);
+        return false;
+    }
+
+    programId = glCreateProgram();
+    glAttachShader(programId, shaderId);
+    glLinkProgram(programId);
+    glDeleteShader(shaderId);
+    glGetProgramiv(programId, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        glGetProgramInfoLog(programId, sizeof(infoLog), NULL, infoLog);
+        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+        return false;
+    }
+    return true;
+}
+
 void UDestroyShaderProgram(GLuint programId)
 {
     glDeleteProgram(programId);
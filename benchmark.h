@@ -0,0 +1,377 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Camera pose at a point in time along a camera path
+struct CameraKeyframe {
+	float Time;
+	glm::vec3 Position;
+	float Yaw;
+	float Pitch;
+	float Zoom;
+};
+
+// A recorded or scripted camera path, sampled with linear interpolation between keyframes
+class CameraPath
+{
+public:
+	std::vector<CameraKeyframe> Keys;
+
+	// loads a path written by Save (one "time x y z yaw pitch zoom" keyframe per line, '#' starts a comment)
+	bool Load(const std::string& path)
+	{
+		std::ifstream file(path);
+		if (!file.is_open())
+		{
+			std::cout << "ERROR::BENCHMARK::Failed to open camera path " << path << std::endl;
+			return false;
+		}
+
+		Keys.clear();
+		std::string line;
+		while (std::getline(file, line))
+		{
+			if (line.empty() || line[0] == '#')
+				continue;
+			std::istringstream stream(line);
+			CameraKeyframe key;
+			if (stream >> key.Time >> key.Position.x >> key.Position.y >> key.Position.z >> key.Yaw >> key.Pitch >> key.Zoom)
+				Keys.push_back(key);
+		}
+
+		if (Keys.empty())
+		{
+			std::cout << "ERROR::BENCHMARK::Camera path " << path << " has no keyframes" << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	// writes the keyframes in the format read by Load
+	bool Save(const std::string& path) const
+	{
+		std::ofstream file(path);
+		if (!file.is_open())
+		{
+			std::cout << "ERROR::BENCHMARK::Failed to open " << path << " for writing" << std::endl;
+			return false;
+		}
+		file << "# time x y z yaw pitch zoom\n";
+		for (const CameraKeyframe& key : Keys)
+			file << key.Time << ' ' << key.Position.x << ' ' << key.Position.y << ' ' << key.Position.z << ' '
+			     << key.Yaw << ' ' << key.Pitch << ' ' << key.Zoom << '\n';
+		return true;
+	}
+
+	// scripted path: circles the target once, looking at it, over the given duration
+	static CameraPath Orbit(glm::vec3 target, float radius, float height, float duration, int steps = 64)
+	{
+		CameraPath path;
+		for (int i = 0; i <= steps; ++i)
+		{
+			float t = (float)i / steps;
+			float angle = t * 6.28318530718f;
+			CameraKeyframe key;
+			key.Time = t * duration;
+			key.Position = target + glm::vec3(radius * std::cos(angle), height, radius * std::sin(angle));
+			// face the target: yaw/pitch follow the convention of Camera::updateCameraVectors
+			glm::vec3 dir = target - key.Position;
+			key.Yaw = glm::degrees(std::atan2(dir.z, dir.x));
+			key.Pitch = glm::degrees(std::atan2(dir.y, std::sqrt(dir.x * dir.x + dir.z * dir.z)));
+			key.Zoom = 45.0f;
+			path.Keys.push_back(key);
+		}
+		return path;
+	}
+
+	float Duration() const
+	{
+		return Keys.empty() ? 0.0f : Keys.back().Time;
+	}
+
+	// pose at time t; the path loops when t runs past the last keyframe
+	CameraKeyframe Sample(float t) const
+	{
+		if (Keys.size() == 1 || Duration() <= 0.0f)
+			return Keys.front();
+
+		t = std::fmod(t, Duration());
+		size_t next = 1;
+		while (next < Keys.size() - 1 && Keys[next].Time < t)
+			++next;
+
+		const CameraKeyframe& a = Keys[next - 1];
+		const CameraKeyframe& b = Keys[next];
+		float span = b.Time - a.Time;
+		float f = span > 0.0f ? std::min(std::max((t - a.Time) / span, 0.0f), 1.0f) : 0.0f;
+
+		CameraKeyframe key;
+		key.Time = t;
+		key.Position = a.Position + (b.Position - a.Position) * f;
+		key.Yaw = a.Yaw + (b.Yaw - a.Yaw) * f;
+		key.Pitch = a.Pitch + (b.Pitch - a.Pitch) * f;
+		key.Zoom = a.Zoom + (b.Zoom - a.Zoom) * f;
+		return key;
+	}
+};
+
+// Driver work issued during a frame
+struct RenderStats {
+	unsigned int DrawCalls = 0;
+	unsigned int ProgramBinds = 0;
+	unsigned int VertexArrayBinds = 0;
+	unsigned int TextureBinds = 0;
+	unsigned int UniformUploads = 0;
+	unsigned int BufferUploads = 0;
+	unsigned int SkippedBinds = 0;    // binds dropped because the state was already current
+	unsigned int Triangles = 0;       // submitted, counting every instance
+	unsigned int VisibleObjects = 0;  // that passed the frustum test
+	unsigned int CulledObjects = 0;   // skipped by it
+	unsigned int OccludedObjects = 0; // of those, inside the frustum but hidden by closer geometry
+
+	// state changes are every bind that is not a draw
+	unsigned int StateChanges() const
+	{
+		return ProgramBinds + VertexArrayBinds + TextureBinds;
+	}
+};
+
+// RenderStats summed over a run, wide enough that millions of triangles a frame do not wrap
+struct RenderTotals {
+	unsigned long long DrawCalls = 0;
+	unsigned long long ProgramBinds = 0;
+	unsigned long long VertexArrayBinds = 0;
+	unsigned long long TextureBinds = 0;
+	unsigned long long UniformUploads = 0;
+	unsigned long long BufferUploads = 0;
+	unsigned long long SkippedBinds = 0;
+	unsigned long long Triangles = 0;
+	unsigned long long VisibleObjects = 0;
+	unsigned long long CulledObjects = 0;
+	unsigned long long OccludedObjects = 0;
+
+	void Add(const RenderStats& stats)
+	{
+		DrawCalls += stats.DrawCalls;
+		ProgramBinds += stats.ProgramBinds;
+		VertexArrayBinds += stats.VertexArrayBinds;
+		TextureBinds += stats.TextureBinds;
+		UniformUploads += stats.UniformUploads;
+		BufferUploads += stats.BufferUploads;
+		SkippedBinds += stats.SkippedBinds;
+		Triangles += stats.Triangles;
+		VisibleObjects += stats.VisibleObjects;
+		CulledObjects += stats.CulledObjects;
+		OccludedObjects += stats.OccludedObjects;
+	}
+
+	unsigned long long StateChanges() const
+	{
+		return ProgramBinds + VertexArrayBinds + TextureBinds;
+	}
+};
+
+// Collects per-frame and per-pass CPU timings and writes a JSON summary
+class FrameBenchmark
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	FrameBenchmark() {}
+
+	FrameBenchmark(const char* const* passNames, int passCount)
+	{
+		PassNames.assign(passNames, passNames + passCount);
+		passTimes.assign(passCount, std::vector<double>());
+		gpuTimes.assign(passCount, std::vector<double>());
+		passStart.assign(passCount, Clock::time_point());
+		passAccum.assign(passCount, 0.0);
+		passOffset.assign(passCount, -1.0);
+	}
+
+	std::vector<std::string> PassNames;
+
+	void BeginFrame()
+	{
+		std::fill(passAccum.begin(), passAccum.end(), 0.0);
+		std::fill(passOffset.begin(), passOffset.end(), -1.0);
+		frameStart = Clock::now();
+	}
+
+	void BeginPass(int pass)
+	{
+		passStart[pass] = Clock::now();
+		if (passOffset[pass] < 0.0)
+			passOffset[pass] = std::chrono::duration<double, std::milli>(passStart[pass] - frameStart).count();
+	}
+
+	void EndPass(int pass)
+	{
+		passAccum[pass] += std::chrono::duration<double, std::milli>(Clock::now() - passStart[pass]).count();
+	}
+
+	void EndFrame(const RenderStats& stats)
+	{
+		frameTimes.push_back(std::chrono::duration<double, std::milli>(Clock::now() - frameStart).count());
+		frameStartMs.push_back(std::chrono::duration<double, std::milli>(frameStart.time_since_epoch()).count());
+		for (size_t i = 0; i < passAccum.size(); ++i)
+			passTimes[i].push_back(passAccum[i]);
+		passOffsets.insert(passOffsets.end(), passOffset.begin(), passOffset.end());
+		totals.Add(stats);
+	}
+
+	// counts that arrive after the frame they belong to has ended, such as GPU culling read back late
+	void AddStats(const RenderStats& stats)
+	{
+		totals.Add(stats);
+	}
+
+	// GPU interval of a pass, measured by GpuTimer on the steady_clock timeline (startMs since the clock epoch)
+	void AddGpuPass(int pass, unsigned long long frame, double startMs, double durationMs)
+	{
+		gpuTimes[pass].push_back(durationMs);
+		if (frame >= frameStartMs.size())
+			return;
+		if (frame != gpuFrame)
+		{
+			gpuFrame = frame;
+			gpuOffset.assign(PassNames.size(), -1.0);
+			gpuDuration.assign(PassNames.size(), 0.0);
+		}
+		gpuOffset[pass] = startMs - frameStartMs[frame];
+		gpuDuration[pass] = durationMs;
+	}
+
+	size_t FrameCount() const
+	{
+		return frameTimes.size();
+	}
+
+	// nearest-rank percentile, p in [0, 100]
+	static double Percentile(std::vector<double> values, double p)
+	{
+		if (values.empty())
+			return 0.0;
+		std::sort(values.begin(), values.end());
+		size_t rank = (size_t)std::ceil(p / 100.0 * values.size());
+		return values[std::min(std::max(rank, (size_t)1), values.size()) - 1];
+	}
+
+	// value as a quoted JSON string, with quotes, backslashes and control characters escaped
+	static std::string JsonString(const std::string& value)
+	{
+		std::string quoted = "\"";
+		for (char c : value)
+		{
+			if (c == '"' || c == '\\')
+			{
+				quoted += '\\';
+				quoted += c;
+			}
+			else if ((unsigned char)c < 0x20)
+			{
+				char escaped[8];
+				snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned int)(unsigned char)c);
+				quoted += escaped;
+			}
+			else
+				quoted += c;
+		}
+		return quoted + "\"";
+	}
+
+	// writes the summary; extra is inserted verbatim as additional top-level members (e.g. "\"path\": \"orbit\"")
+	void WriteJson(std::ostream& out, const std::string& extra = std::string()) const
+	{
+		const double frames = (double)std::max(FrameCount(), (size_t)1);
+
+		out << "{\n";
+		if (!extra.empty())
+			out << "  " << extra << ",\n";
+		out << "  \"frames\": " << FrameCount() << ",\n";
+		out << "  \"frameTimeMs\": ";
+		writeDistribution(out, frameTimes);
+		out << ",\n  \"passes\": [\n";
+		for (size_t i = 0; i < PassNames.size(); ++i)
+		{
+			out << "    { \"name\": " << JsonString(PassNames[i]) << ", \"cpuSubmitMs\": ";
+			writeDistribution(out, passTimes[i]);
+			if (!gpuTimes[i].empty())
+			{
+				out << ", \"gpuMs\": ";
+				writeDistribution(out, gpuTimes[i]);
+			}
+			out << " }" << (i + 1 < PassNames.size() ? "," : "") << "\n";
+		}
+		out << "  ],\n";
+
+		// CPU and GPU intervals of the last frame with GPU results, relative to that frame's CPU start
+		if (gpuFrame < frameStartMs.size())
+		{
+			out << "  \"timeline\": { \"frame\": " << gpuFrame << ", \"passes\": [\n";
+			for (size_t i = 0; i < PassNames.size(); ++i)
+			{
+				out << "    { \"name\": " << JsonString(PassNames[i])
+				    << ", \"cpuStartMs\": " << passOffsets[gpuFrame * PassNames.size() + i]
+				    << ", \"cpuMs\": " << passTimes[i][gpuFrame]
+				    << ", \"gpuStartMs\": " << gpuOffset[i]
+				    << ", \"gpuMs\": " << gpuDuration[i] << " }" << (i + 1 < PassNames.size() ? "," : "") << "\n";
+			}
+			out << "  ] },\n";
+		}
+		out << "  \"perFrame\": { \"drawCalls\": " << totals.DrawCalls / frames
+		    << ", \"stateChanges\": " << totals.StateChanges() / frames
+		    << ", \"programBinds\": " << totals.ProgramBinds / frames
+		    << ", \"vertexArrayBinds\": " << totals.VertexArrayBinds / frames
+		    << ", \"textureBinds\": " << totals.TextureBinds / frames
+		    << ", \"uniformUploads\": " << totals.UniformUploads / frames
+		    << ", \"bufferUploads\": " << totals.BufferUploads / frames
+		    << ", \"skippedBinds\": " << totals.SkippedBinds / frames
+		    << ", \"triangles\": " << totals.Triangles / frames
+		    << ", \"visibleObjects\": " << totals.VisibleObjects / frames
+		    << ", \"culledObjects\": " << totals.CulledObjects / frames
+		    << ", \"occludedObjects\": " << totals.OccludedObjects / frames << " }\n";
+		out << "}\n";
+	}
+
+private:
+	std::vector<double> frameTimes;
+	std::vector<std::vector<double>> passTimes;
+	std::vector<std::vector<double>> gpuTimes;
+	std::vector<Clock::time_point> passStart;
+	std::vector<double> passAccum;
+	std::vector<double> passOffset;
+	std::vector<double> passOffsets;   // first CPU start of each pass, per frame
+	std::vector<double> frameStartMs;
+	std::vector<double> gpuOffset;
+	std::vector<double> gpuDuration;
+	unsigned long long gpuFrame = ~0ull;
+	Clock::time_point frameStart;
+	RenderTotals totals;
+
+	static void writeDistribution(std::ostream& out, const std::vector<double>& values)
+	{
+		double mean = 0.0;
+		for (double v : values)
+			mean += v;
+		mean = values.empty() ? 0.0 : mean / values.size();
+
+		out << "{ \"mean\": " << mean
+		    << ", \"p50\": " << Percentile(values, 50.0)
+		    << ", \"p95\": " << Percentile(values, 95.0)
+		    << ", \"p99\": " << Percentile(values, 99.0)
+		    << ", \"max\": " << Percentile(values, 100.0) << " }";
+	}
+};
+#endif
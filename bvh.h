@@ -0,0 +1,508 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+
+#include "culling.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <future>
+#include <thread>
+#include <vector>
+
+// Node of an ObjectBvh: a box around everything below it. Inner nodes have Count 0 and their two children at
+// First and First + 1; leaves list Count objects starting at First in the hierarchy's object order.
+struct BvhNode {
+	glm::vec3 BoundsMin;
+	unsigned int First = 0;
+	glm::vec3 BoundsMax;
+	unsigned int Count = 0;
+
+	bool IsLeaf() const
+	{
+		return Count != 0;
+	}
+};
+
+// Bounding volume hierarchy over the world boxes of scene objects, for the queries that would otherwise walk every
+// object: frustum culling, picking rays and light volumes. Built top-down with the surface area heuristic over
+// binned centroids; the subtrees of large nodes build on their own threads. Moving objects only refit the boxes,
+// and adding objects rebuilds the tree on the next Update.
+class ObjectBvh
+{
+public:
+	enum : unsigned int {
+		MAX_LEAF_SIZE = 4,
+		BIN_COUNT = 16,
+		PARALLEL_MIN_OBJECTS = 4096   // smaller subtrees are not worth a thread
+	};
+
+	void Clear()
+	{
+		boundsMin.clear();
+		boundsMax.clear();
+		nodes.clear();
+		objects.clear();
+		slots.clear();
+		structureChanged = boundsChanged = false;
+	}
+
+	size_t Count() const
+	{
+		return boundsMin.size();
+	}
+
+	// adds an object with the given world box and returns its index; the tree is rebuilt on the next Update
+	size_t Add(const glm::vec3& objectMin, const glm::vec3& objectMax)
+	{
+		slots.push_back((unsigned int)objects.size());
+		objects.push_back((unsigned int)Count());
+		boundsMin.push_back(objectMin);
+		boundsMax.push_back(objectMax);
+		structureChanged = true;
+		return Count() - 1;
+	}
+
+	// moves object `index`; the tree is refitted on the next Update
+	void Set(size_t index, const glm::vec3& objectMin, const glm::vec3& objectMax)
+	{
+		boundsMin[slots[index]] = objectMin;
+		boundsMax[slots[index]] = objectMax;
+		boundsChanged = true;
+	}
+
+	// rebuilds after adds, refits after moves, and rebuilds anyway once refitting has let the tree grow
+	// REBUILD_COST_RATIO times as expensive to traverse as when it was built
+	void Update(unsigned int threadCount = 0)
+	{
+		if (structureChanged)
+			Build(threadCount);
+		else if (boundsChanged)
+		{
+			const float REBUILD_COST_RATIO = 1.5f;
+			Refit();
+			if (Cost() > builtCost * REBUILD_COST_RATIO)
+				Build(threadCount);
+		}
+	}
+
+	// threadCount 0 uses every hardware thread
+	void Build(unsigned int threadCount = 0)
+	{
+		structureChanged = boundsChanged = false;
+		const size_t count = Count();
+		nodes.assign(std::max<size_t>(count * 2, 2) - 1, BvhNode());
+		if (count == 0)
+		{
+			nodes.clear();
+			builtCost = 0.0f;
+			return;
+		}
+
+		// the build partitions copies of the boxes in place, so every pass over a node reads memory in order
+		references.resize(count);
+		for (size_t i = 0; i < count; ++i)
+			references[i] = { boundsMin[i], objects[i], boundsMax[i], boundsMin[i] + boundsMax[i] };
+		if (threadCount == 0)
+			threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+		nodeCount = 1;
+		buildNode(0, 0, measure(0, (unsigned int)count), 0, threadCount);
+		nodes.resize(nodeCount);
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			boundsMin[i] = references[i].BoundsMin;
+			boundsMax[i] = references[i].BoundsMax;
+			objects[i] = references[i].Object;
+			slots[objects[i]] = (unsigned int)i;
+		}
+		references.clear();
+		builtCost = Cost();
+	}
+
+	// recomputes every box from the objects' current bounds, leaves first: children are always stored after their parent
+	void Refit()
+	{
+		boundsChanged = false;
+		for (size_t n = nodes.size(); n-- > 0;)
+		{
+			BvhNode& node = nodes[n];
+			if (node.IsLeaf())
+			{
+				node.BoundsMin = glm::vec3(3.0e38f);
+				node.BoundsMax = glm::vec3(-3.0e38f);
+				for (unsigned int i = node.First; i < node.First + node.Count; ++i)
+				{
+					node.BoundsMin = glm::min(node.BoundsMin, boundsMin[i]);
+					node.BoundsMax = glm::max(node.BoundsMax, boundsMax[i]);
+				}
+			}
+			else
+			{
+				node.BoundsMin = glm::min(nodes[node.First].BoundsMin, nodes[node.First + 1].BoundsMin);
+				node.BoundsMax = glm::max(nodes[node.First].BoundsMax, nodes[node.First + 1].BoundsMax);
+			}
+		}
+	}
+
+	// expected cost of a query, in box tests per unit of root surface area: nodes weigh 1, objects in leaves 1 each
+	float Cost() const
+	{
+		if (nodes.empty())
+			return 0.0f;
+		float cost = 0.0f;
+		for (const BvhNode& node : nodes)
+			cost += area(node.BoundsMin, node.BoundsMax) * (node.IsLeaf() ? (float)node.Count : 1.0f);
+		return cost / std::max(area(nodes[0].BoundsMin, nodes[0].BoundsMax), 1e-20f);
+	}
+
+	const std::vector<BvhNode>& Nodes() const
+	{
+		return nodes;
+	}
+
+	// the object at a position of the hierarchy's object order, which leaves' First and Count refer to
+	unsigned int Object(unsigned int position) const
+	{
+		return objects[position];
+	}
+
+	// 1 / direction for RayEnters, with zero components replaced by a huge finite value of the same sign: an
+	// infinite one gives 0 * inf = NaN in the slab test whenever the origin lies on a slab plane, and the ray misses
+	static glm::vec3 InverseDirection(const glm::vec3& direction)
+	{
+		glm::vec3 inverse;
+		for (int k = 0; k < 3; ++k)
+			inverse[k] = std::fabs(direction[k]) > 1e-30f ? 1.0f / direction[k] : std::copysign(1e30f, direction[k]);
+		return inverse;
+	}
+
+	// distance along the ray where it enters the box (0 if it starts inside), or past maxDistance if it misses (slab
+	// test); inverse comes from InverseDirection
+	static float RayEnters(const glm::vec3& origin, const glm::vec3& inverse, const glm::vec3& boxMin, const glm::vec3& boxMax, float maxDistance)
+	{
+		const glm::vec3 t0 = (boxMin - origin) * inverse, t1 = (boxMax - origin) * inverse;
+		const glm::vec3 entry = glm::min(t0, t1), leave = glm::max(t0, t1);
+		const float enter = std::max(std::max(entry.x, entry.y), std::max(entry.z, 0.0f));
+		const float exit = std::min(std::min(leave.x, leave.y), std::min(leave.z, maxDistance));
+		return enter <= exit ? enter : 3.0e38f;
+	}
+
+	// visible[i] becomes 1 for every object whose box is at least partly inside the frustum and 0 for the others;
+	// returns the number visible. Planes a node lies entirely inside of are not tested again below it.
+	size_t Cull(const Frustum& frustum, unsigned char* visible) const
+	{
+		std::fill(visible, visible + Count(), (unsigned char)0);
+		if (nodes.empty())
+			return 0;
+
+		size_t visibleCount = 0;
+		unsigned int stack[STACK_SIZE], masks[STACK_SIZE];
+		int top = 0;
+		stack[top] = 0;
+		masks[top++] = ALL_PLANES;
+		while (top > 0)
+		{
+			--top;
+			const BvhNode& node = nodes[stack[top]];
+			unsigned int mask = masks[top];
+			if (mask != 0 && !planesInside(frustum, node.BoundsMin, node.BoundsMax, mask))
+				continue;
+			if (node.IsLeaf())
+			{
+				for (unsigned int i = node.First; i < node.First + node.Count; ++i)
+				{
+					unsigned int objectMask = mask;
+					if (mask == 0 || planesInside(frustum, boundsMin[i], boundsMax[i], objectMask))
+					{
+						visible[objects[i]] = 1;
+						++visibleCount;
+					}
+				}
+				continue;
+			}
+			stack[top] = node.First;
+			masks[top++] = mask;
+			stack[top] = node.First + 1;
+			masks[top++] = mask;
+		}
+		return visibleCount;
+	}
+
+	// calls visit(object) for every object whose box overlaps the box queryMin..queryMax
+	template <typename Visit>
+	void ForEachInBox(const glm::vec3& queryMin, const glm::vec3& queryMax, Visit visit) const
+	{
+		traverse([&](const glm::vec3& nodeMin, const glm::vec3& nodeMax) { return overlaps(nodeMin, nodeMax, queryMin, queryMax); }, visit);
+	}
+
+	// calls visit(object) for every object whose box the sphere touches, e.g. the objects a point light reaches
+	template <typename Visit>
+	void ForEachInSphere(const glm::vec3& center, float radius, Visit visit) const
+	{
+		traverse([&](const glm::vec3& nodeMin, const glm::vec3& nodeMax) {
+			const glm::vec3 offset = center - glm::clamp(center, nodeMin, nodeMax);
+			return glm::dot(offset, offset) <= radius * radius;
+		}, visit);
+	}
+
+	// walks the boxes the ray origin + t * direction enters for t in [0, maxDistance], nearest child first, calling
+	// hit(object, maxDistance) for each of their objects; hit shortens maxDistance when it finds a closer surface,
+	// which prunes the boxes further away. Returns the final maxDistance.
+	template <typename Hit>
+	float Raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, Hit hit) const
+	{
+		if (nodes.empty())
+			return maxDistance;
+		const glm::vec3 inverse = InverseDirection(direction);
+
+		unsigned int stack[STACK_SIZE];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0)
+		{
+			const BvhNode& node = nodes[stack[--top]];
+			if (RayEnters(origin, inverse, node.BoundsMin, node.BoundsMax, maxDistance) > maxDistance)
+				continue;
+			if (node.IsLeaf())
+			{
+				for (unsigned int i = node.First; i < node.First + node.Count; ++i)
+				{
+					if (RayEnters(origin, inverse, boundsMin[i], boundsMax[i], maxDistance) <= maxDistance)
+						hit(objects[i], maxDistance);
+				}
+				continue;
+			}
+			// the nearer child goes on top of the stack
+			const float left = RayEnters(origin, inverse, nodes[node.First].BoundsMin, nodes[node.First].BoundsMax, maxDistance);
+			const float right = RayEnters(origin, inverse, nodes[node.First + 1].BoundsMin, nodes[node.First + 1].BoundsMax, maxDistance);
+			const unsigned int nearChild = left <= right ? node.First : node.First + 1;
+			if (std::max(left, right) <= maxDistance)
+				stack[top++] = nearChild == node.First ? node.First + 1 : node.First;
+			if (std::min(left, right) <= maxDistance)
+				stack[top++] = nearChild;
+		}
+		return maxDistance;
+	}
+
+private:
+	enum : unsigned int {
+		ALL_PLANES = 0x3F,
+		MAX_SAH_DEPTH = 64,   // below this, nodes split at the median so the depth stays within STACK_SIZE
+		STACK_SIZE = 128
+	};
+
+	// object boxes in leaf order, so refits and leaf tests read them in sequence
+	std::vector<glm::vec3> boundsMin, boundsMax;
+	std::vector<unsigned int> objects;   // index of the object at each leaf order position
+	std::vector<unsigned int> slots;     // and the position of each object index
+	std::vector<BvhNode> nodes;
+
+	struct Reference {
+		glm::vec3 BoundsMin;
+		unsigned int Object;
+		glm::vec3 BoundsMax;
+		glm::vec3 Centroid;   // doubled: BoundsMin + BoundsMax
+	};
+	std::vector<Reference> references;   // during Build only
+	std::atomic<unsigned int> nodeCount{ 0 };
+	bool structureChanged = false;
+	bool boundsChanged = false;
+	float builtCost = 0.0f;
+
+	// box around some objects; bins sum them up so children get theirs from the split without another pass
+	struct Bin {
+		glm::vec3 BoundsMin = glm::vec3(3.0e38f);
+		glm::vec3 BoundsMax = glm::vec3(-3.0e38f);
+		unsigned int Count = 0;
+
+		void Add(const Reference& reference)
+		{
+			BoundsMin = glm::min(BoundsMin, reference.BoundsMin);
+			BoundsMax = glm::max(BoundsMax, reference.BoundsMax);
+			++Count;
+		}
+
+		void Add(const Bin& bin)
+		{
+			BoundsMin = glm::min(BoundsMin, bin.BoundsMin);
+			BoundsMax = glm::max(BoundsMax, bin.BoundsMax);
+			Count += bin.Count;
+		}
+	};
+
+	static float area(const glm::vec3& a, const glm::vec3& b)
+	{
+		const glm::vec3 d = glm::max(b - a, glm::vec3(0.0f));
+		return d.x * d.y + d.y * d.z + d.z * d.x;
+	}
+
+	Bin measure(unsigned int first, unsigned int count) const
+	{
+		Bin bin;
+		for (unsigned int i = first; i < first + count; ++i)
+			bin.Add(references[i]);
+		return bin;
+	}
+
+	// fills node `index` with the objects [first, first + bounds.Count), splitting it if that is expected to pay off
+	void buildNode(unsigned int index, unsigned int first, const Bin& bounds, unsigned int depth, unsigned int threads)
+	{
+		BvhNode& node = nodes[index];
+		const unsigned int count = bounds.Count;
+		node.BoundsMin = bounds.BoundsMin;
+		node.BoundsMax = bounds.BoundsMax;
+		node.First = first;
+		node.Count = count;
+		if (count <= MAX_LEAF_SIZE)
+			return;
+
+		// cheapest split between bins on any axis: area of each side times its object count. All three axes are
+		// binned in one pass, over the node's box rather than its centroids' so no pass is needed to measure them;
+		// centroids are doubled, as is the box. Where they all fall in one bin there is no split.
+		const glm::vec3 centroidMin = bounds.BoundsMin * 2.0f, extent = bounds.BoundsMax * 2.0f - centroidMin;
+		glm::vec3 scale;
+		for (int axis = 0; axis < 3; ++axis)
+			scale[axis] = extent[axis] > 0.0f ? BIN_COUNT / extent[axis] : 0.0f;
+		Bin bins[3][BIN_COUNT];
+		if (depth < MAX_SAH_DEPTH)
+		{
+			for (unsigned int i = first; i < first + count; ++i)
+			{
+				const Reference& reference = references[i];
+				for (int axis = 0; axis < 3; ++axis)
+					bins[axis][binOf(reference.Centroid[axis], centroidMin[axis], scale[axis])].Add(reference);
+			}
+		}
+
+		int bestAxis = -1;
+		unsigned int bestSplit = 0;
+		float bestCost = 3.0e38f;
+		for (int axis = 0; axis < 3 && depth < MAX_SAH_DEPTH; ++axis)
+		{
+			float leftCost[BIN_COUNT];
+			Bin left;
+			for (unsigned int b = 0; b + 1 < BIN_COUNT; ++b)
+			{
+				if (bins[axis][b].Count > 0)
+					left.Add(bins[axis][b]);
+				leftCost[b] = left.Count > 0 ? area(left.BoundsMin, left.BoundsMax) * left.Count : 0.0f;
+			}
+			Bin right;
+			for (unsigned int b = BIN_COUNT - 1; b > 0; --b)
+			{
+				if (bins[axis][b].Count == 0)
+					continue;
+				right.Add(bins[axis][b]);
+				const float cost = leftCost[b - 1] + area(right.BoundsMin, right.BoundsMax) * right.Count;
+				if (right.Count > 0 && right.Count < count && cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = b;
+				}
+			}
+		}
+
+		unsigned int middle;
+		Bin leftBounds, rightBounds;
+		if (bestAxis >= 0)
+		{
+			const float origin = centroidMin[bestAxis], axisScale = scale[bestAxis];
+			middle = (unsigned int)(std::partition(references.begin() + first, references.begin() + first + count, [&](const Reference& reference) {
+				return binOf(reference.Centroid[bestAxis], origin, axisScale) < bestSplit;
+			}) - references.begin());
+			for (unsigned int b = 0; b < BIN_COUNT; ++b)
+				(b < bestSplit ? leftBounds : rightBounds).Add(bins[bestAxis][b]);
+		}
+		else
+		{
+			// too deep, or the centroids too close together: halve along the longest axis
+			const int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+			middle = first + count / 2;
+			std::nth_element(references.begin() + first, references.begin() + middle, references.begin() + first + count,
+				[axis](const Reference& a, const Reference& b) { return a.Centroid[axis] < b.Centroid[axis]; });
+			leftBounds = measure(first, middle - first);
+			rightBounds = measure(middle, first + count - middle);
+		}
+
+		const unsigned int children = nodeCount.fetch_add(2);
+		node.First = children;
+		node.Count = 0;
+
+		if (threads > 1 && count >= PARALLEL_MIN_OBJECTS)
+		{
+			std::future<void> task = std::async(std::launch::async, [this, children, first, &leftBounds, depth, threads]() {
+				buildNode(children, first, leftBounds, depth + 1, threads / 2);
+			});
+			buildNode(children + 1, middle, rightBounds, depth + 1, threads - threads / 2);
+			task.get();
+		}
+		else
+		{
+			buildNode(children, first, leftBounds, depth + 1, 1);
+			buildNode(children + 1, middle, rightBounds, depth + 1, 1);
+		}
+	}
+
+	static unsigned int binOf(float centroid, float origin, float scale)
+	{
+		return std::min((unsigned int)((centroid - origin) * scale), (unsigned int)BIN_COUNT - 1);
+	}
+
+	// false if the box is entirely outside one of the planes in mask; otherwise clears the planes it is entirely inside of
+	static bool planesInside(const Frustum& frustum, const glm::vec3& boxMin, const glm::vec3& boxMax, unsigned int& mask)
+	{
+		const glm::vec3 center = (boxMin + boxMax) * 0.5f, extent = (boxMax - boxMin) * 0.5f;
+		for (int p = 0; p < 6; ++p)
+		{
+			if ((mask & (1u << p)) == 0)
+				continue;
+			const glm::vec4& plane = frustum.Planes[p];
+			const float distance = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w;
+			const float radius = std::fabs(plane.x) * extent.x + std::fabs(plane.y) * extent.y + std::fabs(plane.z) * extent.z;
+			if (distance + radius < 0.0f)
+				return false;
+			if (distance - radius >= 0.0f)
+				mask &= ~(1u << p);
+		}
+		return true;
+	}
+
+	static bool overlaps(const glm::vec3& aMin, const glm::vec3& aMax, const glm::vec3& bMin, const glm::vec3& bMax)
+	{
+		return aMin.x <= bMax.x && aMax.x >= bMin.x && aMin.y <= bMax.y && aMax.y >= bMin.y && aMin.z <= bMax.z && aMax.z >= bMin.z;
+	}
+
+	// depth-first walk of the nodes that pass test, calling visit(object) for the objects that pass it too
+	template <typename Test, typename Visit>
+	void traverse(Test test, Visit& visit) const
+	{
+		if (nodes.empty())
+			return;
+		unsigned int stack[STACK_SIZE];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0)
+		{
+			const BvhNode& node = nodes[stack[--top]];
+			if (!test(node.BoundsMin, node.BoundsMax))
+				continue;
+			if (!node.IsLeaf())
+			{
+				stack[top++] = node.First;
+				stack[top++] = node.First + 1;
+				continue;
+			}
+			for (unsigned int i = node.First; i < node.First + node.Count; ++i)
+			{
+				if (test(boundsMin[i], boundsMax[i]))
+					visit(objects[i]);
+			}
+		}
+	}
+};
+#endif
@@ -0,0 +1,182 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+// 8 boxes per instruction with AVX, 4 with SSE, one at a time elsewhere
+#if defined(__AVX__)
+#include <immintrin.h>
+#define CULLING_AVX 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CULLING_SSE 1
+#endif
+
+// The six planes of a view volume, normals pointing inwards and normalized so plane distances are in world units
+struct Frustum {
+	glm::vec4 Planes[6];   // left, right, bottom, top, near, far: inside where dot(xyz, p) + w >= 0
+
+	// Gribb-Hartmann extraction from projection * view (or projection * view * model for object-space planes)
+	static Frustum FromMatrix(const glm::mat4& m)
+	{
+		const glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+		const glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+		const glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+		const glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+		Frustum frustum;
+		frustum.Planes[0] = row3 + row0;
+		frustum.Planes[1] = row3 - row0;
+		frustum.Planes[2] = row3 + row1;
+		frustum.Planes[3] = row3 - row1;
+		frustum.Planes[4] = row3 + row2;
+		frustum.Planes[5] = row3 - row2;
+		for (glm::vec4& plane : frustum.Planes)
+		{
+			const float length = std::sqrt(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+			if (length > 0.0f)
+				plane = plane / length;
+		}
+		return frustum;
+	}
+
+	// false only if the box centre +- extent lies entirely outside one of the planes
+	bool IsVisible(const glm::vec3& center, const glm::vec3& extent) const
+	{
+		for (const glm::vec4& plane : Planes)
+		{
+			const float distance = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w;
+			const float radius = std::fabs(plane.x) * extent.x + std::fabs(plane.y) * extent.y + std::fabs(plane.z) * extent.z;
+			if (distance + radius < 0.0f)
+				return false;
+		}
+		return true;
+	}
+};
+
+// World-space bounding boxes of many objects kept as structure of arrays (centre and half extent per axis), so a
+// frustum test runs on a whole register of boxes per plane. The test is conservative: a box straddling the corner
+// outside two planes counts as visible.
+class FrustumCuller
+{
+public:
+	void Clear()
+	{
+		resize(0);
+	}
+
+	size_t Count() const
+	{
+		return centerX.size();
+	}
+
+	// adds the object-space box boundsMin..boundsMax placed by model and returns its index
+	size_t Add(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& model)
+	{
+		resize(Count() + 1);
+		Set(Count() - 1, boundsMin, boundsMax, model);
+		return Count() - 1;
+	}
+
+	// moves box `index`: the world box of a transformed box has the transformed centre, and an extent that sums
+	// the absolute matrix entries times the object extent (Arvo)
+	void Set(size_t index, const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& model)
+	{
+		const glm::vec3 center = (boundsMin + boundsMax) * 0.5f, extent = (boundsMax - boundsMin) * 0.5f;
+		const glm::vec4 worldCenter = model * glm::vec4(center, 1.0f);
+		glm::vec3 worldExtent(0.0f);
+		for (int column = 0; column < 3; ++column)
+			for (int row = 0; row < 3; ++row)
+				worldExtent[row] += std::fabs(model[column][row]) * extent[column];
+		centerX[index] = worldCenter.x;
+		centerY[index] = worldCenter.y;
+		centerZ[index] = worldCenter.z;
+		extentX[index] = worldExtent.x;
+		extentY[index] = worldExtent.y;
+		extentZ[index] = worldExtent.z;
+	}
+
+	// the world box of object `index`
+	void Bounds(size_t index, glm::vec3& boundsMin, glm::vec3& boundsMax) const
+	{
+		const glm::vec3 center(centerX[index], centerY[index], centerZ[index]), extent(extentX[index], extentY[index], extentZ[index]);
+		boundsMin = center - extent;
+		boundsMax = center + extent;
+	}
+
+	// visible[i] becomes 1 for every box at least partly inside the frustum and 0 for the others; returns the number visible
+	size_t Cull(const Frustum& frustum, unsigned char* visible) const
+	{
+		const size_t count = Count();
+		size_t i = 0, visibleCount = 0;
+#if defined(CULLING_AVX)
+		for (; i + 8 <= count; i += 8)
+		{
+			const __m256 cx = _mm256_loadu_ps(&centerX[i]), cy = _mm256_loadu_ps(&centerY[i]), cz = _mm256_loadu_ps(&centerZ[i]);
+			const __m256 ex = _mm256_loadu_ps(&extentX[i]), ey = _mm256_loadu_ps(&extentY[i]), ez = _mm256_loadu_ps(&extentZ[i]);
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (const glm::vec4& plane : frustum.Planes)
+			{
+				const __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.x), cx), _mm256_mul_ps(_mm256_set1_ps(plane.y), cy)),
+					_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.z), cz), _mm256_set1_ps(plane.w)));
+				const __m256 radius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(std::fabs(plane.x)), ex), _mm256_mul_ps(_mm256_set1_ps(std::fabs(plane.y)), ey)),
+					_mm256_mul_ps(_mm256_set1_ps(std::fabs(plane.z)), ez));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), _mm256_setzero_ps(), _CMP_GE_OQ));
+			}
+			visibleCount += writeMask(_mm256_movemask_ps(inside), 8, visible + i);
+		}
+#elif defined(CULLING_SSE)
+		for (; i + 4 <= count; i += 4)
+		{
+			const __m128 cx = _mm_loadu_ps(&centerX[i]), cy = _mm_loadu_ps(&centerY[i]), cz = _mm_loadu_ps(&centerZ[i]);
+			const __m128 ex = _mm_loadu_ps(&extentX[i]), ey = _mm_loadu_ps(&extentY[i]), ez = _mm_loadu_ps(&extentZ[i]);
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (const glm::vec4& plane : frustum.Planes)
+			{
+				const __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), cx), _mm_mul_ps(_mm_set1_ps(plane.y), cy)),
+					_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.z), cz), _mm_set1_ps(plane.w)));
+				const __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(std::fabs(plane.x)), ex), _mm_mul_ps(_mm_set1_ps(std::fabs(plane.y)), ey)),
+					_mm_mul_ps(_mm_set1_ps(std::fabs(plane.z)), ez));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+			}
+			visibleCount += writeMask(_mm_movemask_ps(inside), 4, visible + i);
+		}
+#endif
+		for (; i < count; ++i)
+		{
+			visible[i] = frustum.IsVisible(glm::vec3(centerX[i], centerY[i], centerZ[i]), glm::vec3(extentX[i], extentY[i], extentZ[i])) ? 1 : 0;
+			visibleCount += visible[i];
+		}
+		return visibleCount;
+	}
+
+private:
+	std::vector<float> centerX, centerY, centerZ;
+	std::vector<float> extentX, extentY, extentZ;
+
+	void resize(size_t count)
+	{
+		centerX.resize(count);
+		centerY.resize(count);
+		centerZ.resize(count);
+		extentX.resize(count);
+		extentY.resize(count);
+		extentZ.resize(count);
+	}
+
+	static size_t writeMask(int mask, int lanes, unsigned char* visible)
+	{
+		size_t count = 0;
+		for (int lane = 0; lane < lanes; ++lane)
+		{
+			visible[lane] = (unsigned char)((mask >> lane) & 1);
+			count += visible[lane];
+		}
+		return count;
+	}
+};
+#endif
@@ -0,0 +1,275 @@
+#ifndef GLTF_H
+#define GLTF_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include "gltfdocument.h"
+#include "mesh.h"
+#include "stb_image.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+// A loaded glTF mesh placed in the scene by a node
+struct GltfInstance {
+	unsigned int MeshIndex;  // into GltfModel::Meshes
+	glm::mat4 Transform;
+};
+
+// glTF 2.0 binary (.glb) importer producing Mesh objects. The BIN chunk is handed to glBufferStorage straight
+// from the mapped file, and every triangle primitive whose accessors GL can read as they are gets a VAO whose
+// attribute pointers and element buffer are the accessors' offsets into that one buffer; only its indices are
+// read on the CPU, to check they stay within the vertices. Primitives GL cannot draw directly (no indices, no
+// normals, sparse accessors, indices past the last vertex) are decoded into Vertex arrays instead. Base color
+// and normal textures become texture_diffuse1 and texture_normal1 slots. Embedded images are decoded from the
+// mapping with stb_image (the flip-on-load setting applies: glTF expects the first row at the top, i.e. no flip).
+class GltfModel
+{
+public:
+	std::vector<Mesh> Meshes;              // one per triangle primitive
+	std::vector<GltfInstance> Instances;   // default scene, with node transforms applied
+	GLuint Buffer = 0;                     // the BIN chunk
+	std::vector<GLuint> VertexArrays;      // of the zero-copy meshes
+	std::vector<GLuint> Textures;
+
+	// how many primitives went through each path, for load reports
+	unsigned int ZeroCopyPrimitives = 0;
+	unsigned int DecodedPrimitives = 0;
+
+	bool Load(const char* path)
+	{
+		GltfDocument document;
+		if (!document.Open(path))
+			return false;
+
+		if (document.Bin())
+		{
+			glGenBuffers(1, &Buffer);
+			glBindBuffer(GL_ARRAY_BUFFER, Buffer);
+			glBufferStorage(GL_ARRAY_BUFFER, document.BinLength(), document.Bin(), 0);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+		}
+		const JsonValue& json = document.Json();
+		textureIds.assign(json["textures"].Size(), 0);
+
+		// primitives in order, remembering where each glTF mesh starts so nodes can refer to them
+		std::vector<unsigned int> firstPrimitive;
+		const JsonValue& meshes = json["meshes"];
+		for (size_t m = 0; m < meshes.Size(); ++m)
+		{
+			firstPrimitive.push_back((unsigned int)Meshes.size());
+			const JsonValue& primitives = meshes[m]["primitives"];
+			for (size_t p = 0; p < primitives.Size(); ++p)
+				loadPrimitive(document, primitives[p]);
+		}
+		firstPrimitive.push_back((unsigned int)Meshes.size());
+
+		std::vector<GltfDocument::MeshInstance> placed;
+		document.Instances(placed);
+		for (const GltfDocument::MeshInstance& instance : placed)
+		{
+			for (unsigned int i = firstPrimitive[instance.Mesh]; i < firstPrimitive[instance.Mesh + 1]; ++i)
+				Instances.push_back({ i, instance.Transform });
+		}
+		return true;
+	}
+
+	// draws every instance; the shader's model matrix uniform is set per instance
+	void Draw(Shader& shader, const std::string& modelUniform = "model")
+	{
+		for (const GltfInstance& instance : Instances)
+		{
+			shader.setMat4(modelUniform, instance.Transform);
+			Meshes[instance.MeshIndex].Draw(shader);
+		}
+	}
+
+	void Destroy()
+	{
+		glDeleteBuffers(1, &Buffer);
+		if (!VertexArrays.empty())
+			glDeleteVertexArrays((GLsizei)VertexArrays.size(), VertexArrays.data());
+		if (!Textures.empty())
+			glDeleteTextures((GLsizei)Textures.size(), Textures.data());
+		Buffer = 0;
+		VertexArrays.clear();
+		Textures.clear();
+		Meshes.clear();
+		Instances.clear();
+	}
+
+private:
+	typedef GltfDocument::AccessorView AccessorView;
+
+	std::vector<GLuint> textureIds;  // per glTF texture, 0 until first used
+
+	void loadPrimitive(const GltfDocument& document, const JsonValue& primitive)
+	{
+		const JsonValue& attributes = primitive["attributes"];
+		std::vector<Texture> textures = materialTextures(document, primitive["material"].Int());
+
+		AccessorView position, normal, texCoord, tangent, indices;
+		const bool hasPosition = document.Accessor(attributes["POSITION"].Int(), position) && position.Components == 3;
+		const bool hasNormal = document.Accessor(attributes["NORMAL"].Int(), normal) && normal.Count == position.Count;
+		const bool hasTexCoord = document.Accessor(attributes["TEXCOORD_0"].Int(), texCoord) && texCoord.Count == position.Count;
+		const bool hasTangent = document.Accessor(attributes["TANGENT"].Int(), tangent) && tangent.Count == position.Count;
+		const bool hasIndices = document.Accessor(primitive["indices"].Int(), indices) && indices.Components == 1;
+		const int mode = primitive["mode"].Int(GL_TRIANGLES);
+		// points, lines and strips are not drawn by Mesh
+		if (!hasPosition || mode != GL_TRIANGLES)
+			return;
+
+		// zero-copy: tightly indexed triangles whose element buffer GL can read in place, and whose indices all
+		// name a vertex; a malformed file would otherwise have the GPU fetch past the attribute arrays
+		const unsigned int indexSize = GltfDocument::ComponentSize(indices.ComponentType);
+		const bool indicesReadable = hasIndices && indexSize != 0 && indices.Stride == indexSize && indices.Offset % indexSize == 0 &&
+			document.MaxIndex(indices) < position.Count;
+		if (hasNormal && indicesReadable)
+		{
+			GLuint vao;
+			glGenVertexArrays(1, &vao);
+			glBindVertexArray(vao);
+			glBindBuffer(GL_ARRAY_BUFFER, Buffer);
+			bindAttribute(0, position);
+			bindAttribute(1, normal);
+			if (hasTexCoord)
+				bindAttribute(2, texCoord);
+			if (hasTangent)
+				bindAttribute(3, tangent);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, Buffer);
+			glBindVertexArray(0);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+			VertexArrays.push_back(vao);
+			Meshes.push_back(Mesh(vao, (GLenum)indices.ComponentType, indices.Offset, indices.Count, textures));
+			++ZeroCopyPrimitives;
+			return;
+		}
+
+		// decoded: gather the attributes into Vertex structs, with flat-shaded normals where the file has none
+		vector<Vertex> vertices(position.Count);
+		for (unsigned int i = 0; i < position.Count; ++i)
+		{
+			Vertex& vertex = vertices[i];
+			vertex.Position = glm::vec3(document.ReadComponent(position, i, 0), document.ReadComponent(position, i, 1), document.ReadComponent(position, i, 2));
+			vertex.Normal = hasNormal ? glm::vec3(document.ReadComponent(normal, i, 0), document.ReadComponent(normal, i, 1), document.ReadComponent(normal, i, 2)) : glm::vec3(0.0f);
+			vertex.TexCoords = hasTexCoord ? glm::vec2(document.ReadComponent(texCoord, i, 0), document.ReadComponent(texCoord, i, 1)) : glm::vec2(0.0f);
+			vertex.Tangent = hasTangent ? glm::vec3(document.ReadComponent(tangent, i, 0), document.ReadComponent(tangent, i, 1), document.ReadComponent(tangent, i, 2)) : glm::vec3(0.0f);
+			vertex.Bitangent = glm::vec3(0.0f);
+		}
+		vector<unsigned int> triangleIndices;
+		if (hasIndices)
+		{
+			for (unsigned int i = 0; i < indices.Count; ++i)
+				triangleIndices.push_back(std::min(document.ReadIndex(indices, i), position.Count - 1));
+		}
+		else
+		{
+			for (unsigned int i = 0; i < position.Count; ++i)
+				triangleIndices.push_back(i);
+		}
+		if (!hasNormal)
+		{
+			for (size_t t = 0; t + 2 < triangleIndices.size(); t += 3)
+			{
+				Vertex& a = vertices[triangleIndices[t]];
+				Vertex& b = vertices[triangleIndices[t + 1]];
+				Vertex& c = vertices[triangleIndices[t + 2]];
+				glm::vec3 n = glm::cross(b.Position - a.Position, c.Position - a.Position);
+				a.Normal = a.Normal + n;
+				b.Normal = b.Normal + n;
+				c.Normal = c.Normal + n;
+			}
+			for (Vertex& vertex : vertices)
+			{
+				if (glm::dot(vertex.Normal, vertex.Normal) > 0.0f)
+					vertex.Normal = glm::normalize(vertex.Normal);
+			}
+		}
+		Meshes.push_back(Mesh(vertices, triangleIndices, textures));
+		++DecodedPrimitives;
+	}
+
+	// glTF accessors map one to one onto glVertexAttribPointer into the BIN chunk buffer
+	static void bindAttribute(GLuint location, const AccessorView& view)
+	{
+		glEnableVertexAttribArray(location);
+		glVertexAttribPointer(location, (GLint)view.Components, (GLenum)view.ComponentType, view.Normalized ? GL_TRUE : GL_FALSE,
+			(GLsizei)view.Stride, (void*)view.Offset);
+	}
+
+	std::vector<Texture> materialTextures(const GltfDocument& document, int materialIndex)
+	{
+		std::vector<Texture> textures;
+		const JsonValue& material = document.Json()["materials"][materialIndex];
+		if (materialIndex < 0 || material.IsNull())
+			return textures;
+
+		const int baseColor = material["pbrMetallicRoughness"]["baseColorTexture"]["index"].Int();
+		const int normalMap = material["normalTexture"]["index"].Int();
+		if (baseColor >= 0 && texture(document, baseColor) != 0)
+			textures.push_back({ texture(document, baseColor), "texture_diffuse", "" });
+		if (normalMap >= 0 && texture(document, normalMap) != 0)
+			textures.push_back({ texture(document, normalMap), "texture_normal", "" });
+		return textures;
+	}
+
+	// GL texture of a glTF texture, decoded on first use; 0 if the image cannot be read
+	GLuint texture(const GltfDocument& document, int textureIndex)
+	{
+		const JsonValue& json = document.Json();
+		if (textureIndex < 0 || (size_t)textureIndex >= textureIds.size())
+			return 0;
+		if (textureIds[textureIndex] != 0)
+			return textureIds[textureIndex];
+
+		const JsonValue& image = json["images"][json["textures"][textureIndex]["source"].Int()];
+		int width = 0, height = 0, channels = 0;
+		unsigned char* pixels = NULL;
+		if (!image["bufferView"].IsNull())
+		{
+			const JsonValue& view = json["bufferViews"][image["bufferView"].Int()];
+			size_t offset = (size_t)view["byteOffset"].Number(0.0), length = (size_t)view["byteLength"].Number(0.0);
+			if (document.Bin() && offset + length <= document.BinLength())
+				pixels = stbi_load_from_memory(document.Bin() + offset, (int)length, &width, &height, &channels, 0);
+		}
+		else if (image["uri"].type == JsonValue::JSON_STRING && image["uri"].string.compare(0, 5, "data:") != 0)
+		{
+			pixels = stbi_load((document.Directory() + image["uri"].string).c_str(), &width, &height, &channels, 0);
+		}
+		if (pixels == NULL)
+		{
+			std::cout << "ERROR::GLTF::Could not decode image of texture " << textureIndex << std::endl;
+			return 0;
+		}
+
+		const GLenum formats[] = { GL_RED, GL_RED, GL_RG, GL_RGB, GL_RGBA };
+		GLuint id;
+		glGenTextures(1, &id);
+		glBindTexture(GL_TEXTURE_2D, id);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexImage2D(GL_TEXTURE_2D, 0, formats[channels], width, height, 0, formats[channels], GL_UNSIGNED_BYTE, pixels);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glGenerateMipmap(GL_TEXTURE_2D);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		stbi_image_free(pixels);
+
+		Textures.push_back(id);
+		textureIds[textureIndex] = id;
+		return id;
+	}
+};
+#endif
@@ -0,0 +1,574 @@
+#ifndef GLTFDOCUMENT_H
+#define GLTFDOCUMENT_H
+
+#include <glm/glm.hpp>
+
+#include "mappedfile.h"
+#include "meshopt.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Just enough JSON for glTF: a parsed value tree
+class JsonValue
+{
+public:
+	enum Type { JSON_NULL, JSON_BOOL, JSON_NUMBER, JSON_STRING, JSON_ARRAY, JSON_OBJECT };
+
+	Type type = JSON_NULL;
+	double number = 0.0;
+	std::string string;
+	std::vector<JsonValue> array;
+	std::vector<std::pair<std::string, JsonValue>> object;
+
+	// member of an object, or a null value if absent
+	const JsonValue& operator[](const char* key) const
+	{
+		for (const std::pair<std::string, JsonValue>& member : object)
+		{
+			if (member.first == key)
+				return member.second;
+		}
+		return null();
+	}
+
+	// element of an array, or a null value if out of range
+	const JsonValue& operator[](int index) const
+	{
+		return index >= 0 && (size_t)index < array.size() ? array[index] : null();
+	}
+
+	size_t Size() const
+	{
+		return type == JSON_ARRAY ? array.size() : object.size();
+	}
+
+	bool IsNull() const
+	{
+		return type == JSON_NULL;
+	}
+
+	double Number(double fallback = 0.0) const
+	{
+		return type == JSON_NUMBER ? number : fallback;
+	}
+
+	int Int(int fallback = -1) const
+	{
+		return type == JSON_NUMBER ? (int)number : fallback;
+	}
+
+	// parses a whole document; returns false on malformed input
+	static bool Parse(const char* text, size_t length, JsonValue& value)
+	{
+		const char* p = text;
+		const char* end = text + length;
+		if (!parseValue(p, end, value, 0))
+			return false;
+		skipSpace(p, end);
+		return p == end;
+	}
+
+private:
+	static const JsonValue& null()
+	{
+		static const JsonValue value;
+		return value;
+	}
+
+	static void skipSpace(const char*& p, const char* end)
+	{
+		while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+			++p;
+	}
+
+	static bool parseString(const char*& p, const char* end, std::string& out)
+	{
+		if (p >= end || *p != '"')
+			return false;
+		for (++p; p < end && *p != '"'; ++p)
+		{
+			if (*p != '\\')
+			{
+				out += *p;
+				continue;
+			}
+			if (++p >= end)
+				return false;
+			switch (*p)
+			{
+			case 'b': out += '\b'; break;
+			case 'f': out += '\f'; break;
+			case 'n': out += '\n'; break;
+			case 'r': out += '\r'; break;
+			case 't': out += '\t'; break;
+			case 'u':
+			{
+				if (end - p < 5)
+					return false;
+				unsigned int code = (unsigned int)std::strtoul(std::string(p + 1, p + 5).c_str(), NULL, 16);
+				p += 4;
+				// UTF-8; surrogate pairs are kept as two code points, which only matters for names
+				if (code < 0x80)
+					out += (char)code;
+				else if (code < 0x800)
+				{
+					out += (char)(0xC0 | (code >> 6));
+					out += (char)(0x80 | (code & 0x3F));
+				}
+				else
+				{
+					out += (char)(0xE0 | (code >> 12));
+					out += (char)(0x80 | ((code >> 6) & 0x3F));
+					out += (char)(0x80 | (code & 0x3F));
+				}
+				break;
+			}
+			default: out += *p; break;
+			}
+		}
+		if (p >= end)
+			return false;
+		++p;
+		return true;
+	}
+
+	static bool parseValue(const char*& p, const char* end, JsonValue& value, int depth)
+	{
+		skipSpace(p, end);
+		if (p >= end || depth > 64)
+			return false;
+
+		if (*p == '{')
+		{
+			value.type = JSON_OBJECT;
+			++p;
+			skipSpace(p, end);
+			if (p < end && *p == '}')
+			{
+				++p;
+				return true;
+			}
+			while (true)
+			{
+				skipSpace(p, end);
+				std::pair<std::string, JsonValue> member;
+				if (!parseString(p, end, member.first))
+					return false;
+				skipSpace(p, end);
+				if (p >= end || *p++ != ':')
+					return false;
+				if (!parseValue(p, end, member.second, depth + 1))
+					return false;
+				value.object.push_back(std::move(member));
+				skipSpace(p, end);
+				if (p < end && *p == ',')
+				{
+					++p;
+					continue;
+				}
+				if (p < end && *p == '}')
+				{
+					++p;
+					return true;
+				}
+				return false;
+			}
+		}
+		if (*p == '[')
+		{
+			value.type = JSON_ARRAY;
+			++p;
+			skipSpace(p, end);
+			if (p < end && *p == ']')
+			{
+				++p;
+				return true;
+			}
+			while (true)
+			{
+				value.array.push_back(JsonValue());
+				if (!parseValue(p, end, value.array.back(), depth + 1))
+					return false;
+				skipSpace(p, end);
+				if (p < end && *p == ',')
+				{
+					++p;
+					continue;
+				}
+				if (p < end && *p == ']')
+				{
+					++p;
+					return true;
+				}
+				return false;
+			}
+		}
+		if (*p == '"')
+		{
+			value.type = JSON_STRING;
+			return parseString(p, end, value.string);
+		}
+		if (end - p >= 4 && std::strncmp(p, "true", 4) == 0)
+		{
+			value.type = JSON_BOOL;
+			value.number = 1.0;
+			p += 4;
+			return true;
+		}
+		if (end - p >= 5 && std::strncmp(p, "false", 5) == 0)
+		{
+			value.type = JSON_BOOL;
+			p += 5;
+			return true;
+		}
+		if (end - p >= 4 && std::strncmp(p, "null", 4) == 0)
+		{
+			p += 4;
+			return true;
+		}
+
+		// number: copy the token so strtod cannot run past the end of the chunk
+		const char* start = p;
+		while (p < end && (std::strchr("+-0123456789.eE", *p) != NULL))
+			++p;
+		if (p == start)
+			return false;
+		value.type = JSON_NUMBER;
+		value.number = std::strtod(std::string(start, p).c_str(), NULL);
+		return true;
+	}
+};
+
+// A mapped glTF 2.0 binary (.glb): its JSON and BIN chunks, the accessors into the BIN chunk and the meshes the
+// default scene places. Nothing here needs a GL context: GltfModel in gltf.h uploads a document for drawing,
+// DecodeScene flattens one into a single mesh.
+class GltfDocument
+{
+public:
+	// accessor component types and primitive modes as glTF spells them, which are the GL enum values
+	enum : int { BYTE = 5120, UNSIGNED_BYTE = 5121, SHORT = 5122, UNSIGNED_SHORT = 5123, UNSIGNED_INT = 5125, FLOAT = 5126 };
+	enum : int { TRIANGLES = 4 };
+
+	// Where an accessor's elements live in the BIN chunk
+	struct AccessorView {
+		size_t Offset;
+		unsigned int Stride;
+		unsigned int Count;
+		unsigned int Components;
+		int ComponentType;
+		bool Normalized;
+	};
+
+	// A glTF mesh placed by a node of the default scene
+	struct MeshInstance {
+		int Mesh;
+		glm::mat4 Transform;
+	};
+
+	bool Open(const char* path)
+	{
+		Close();
+		if (!file.Open(path))
+			return false;
+		directory = std::string(path);
+		size_t slash = directory.find_last_of("/\\");
+		directory = slash == std::string::npos ? std::string() : directory.substr(0, slash + 1);
+
+		// 12-byte header, then the JSON chunk and an optional BIN chunk, each with a length and type
+		const unsigned char* data = file.Data();
+		const size_t size = file.Size();
+		if (size < 20 || std::memcmp(data, "glTF", 4) != 0 || read32(data + 4) != 2)
+		{
+			std::cout << "ERROR::GLTF::" << path << " is not a glTF 2.0 binary" << std::endl;
+			Close();
+			return false;
+		}
+		const size_t jsonLength = read32(data + 12);
+		if (read32(data + 16) != 0x4E4F534A || 20 + jsonLength > size)
+		{
+			std::cout << "ERROR::GLTF::" << path << " has no JSON chunk" << std::endl;
+			Close();
+			return false;
+		}
+		if (!JsonValue::Parse((const char*)data + 20, jsonLength, json))
+		{
+			std::cout << "ERROR::GLTF::" << path << " has malformed JSON" << std::endl;
+			Close();
+			return false;
+		}
+		const size_t binHeader = 20 + ((jsonLength + 3) & ~(size_t)3);
+		if (binHeader + 8 <= size && read32(data + binHeader + 4) == 0x004E4942)
+		{
+			bin = data + binHeader + 8;
+			binLength = std::min<size_t>(read32(data + binHeader), size - binHeader - 8);
+		}
+		return true;
+	}
+
+	void Close()
+	{
+		json = JsonValue();
+		bin = NULL;
+		binLength = 0;
+		file.Close();
+	}
+
+	const JsonValue& Json() const
+	{
+		return json;
+	}
+
+	// the BIN chunk, NULL if the file has none
+	const unsigned char* Bin() const
+	{
+		return bin;
+	}
+
+	size_t BinLength() const
+	{
+		return binLength;
+	}
+
+	// of the file, with a trailing slash, for images referenced by URI
+	const std::string& Directory() const
+	{
+		return directory;
+	}
+
+	// false if the accessor is sparse, not in the BIN chunk or out of its bounds
+	bool Accessor(int accessorIndex, AccessorView& view) const
+	{
+		const JsonValue& accessor = json["accessors"][accessorIndex];
+		if (accessorIndex < 0 || accessor.IsNull() || !accessor["sparse"].IsNull() || bin == NULL)
+			return false;
+		const JsonValue& bufferView = json["bufferViews"][accessor["bufferView"].Int()];
+		if (bufferView.IsNull() || bufferView["buffer"].Int(0) != 0)
+			return false;
+
+		view.Count = (unsigned int)accessor["count"].Int(0);
+		view.Components = componentCount(accessor["type"].string);
+		view.ComponentType = accessor["componentType"].Int(0);
+		view.Normalized = accessor["normalized"].type == JsonValue::JSON_BOOL && accessor["normalized"].number != 0.0;
+		const unsigned int elementSize = view.Components * ComponentSize(view.ComponentType);
+		view.Stride = (unsigned int)bufferView["byteStride"].Int(0);
+		if (view.Stride == 0)
+			view.Stride = elementSize;
+		view.Offset = (size_t)bufferView["byteOffset"].Number(0.0) + (size_t)accessor["byteOffset"].Number(0.0);
+		const size_t viewEnd = (size_t)bufferView["byteOffset"].Number(0.0) + (size_t)bufferView["byteLength"].Number(0.0);
+		return elementSize > 0 && view.Count > 0 && viewEnd <= binLength &&
+		       view.Offset + (size_t)view.Stride * (view.Count - 1) + elementSize <= viewEnd;
+	}
+
+	// component k of element i as a float, with the glTF normalization rules for integer types
+	float ReadComponent(const AccessorView& view, unsigned int i, unsigned int k) const
+	{
+		const unsigned char* p = bin + view.Offset + (size_t)view.Stride * i + ComponentSize(view.ComponentType) * k;
+		switch (view.ComponentType)
+		{
+		case FLOAT: { float f; std::memcpy(&f, p, 4); return f; }
+		case UNSIGNED_BYTE: return view.Normalized ? *p / 255.0f : *p;
+		case BYTE: return view.Normalized ? std::max(*(const int8_t*)p / 127.0f, -1.0f) : *(const int8_t*)p;
+		case UNSIGNED_SHORT: { uint16_t v; std::memcpy(&v, p, 2); return view.Normalized ? v / 65535.0f : v; }
+		case SHORT: { int16_t v; std::memcpy(&v, p, 2); return view.Normalized ? std::max(v / 32767.0f, -1.0f) : v; }
+		case UNSIGNED_INT: { uint32_t v; std::memcpy(&v, p, 4); return (float)v; }
+		default: return 0.0f;
+		}
+	}
+
+	unsigned int ReadIndex(const AccessorView& view, unsigned int i) const
+	{
+		const unsigned char* p = bin + view.Offset + (size_t)view.Stride * i;
+		switch (view.ComponentType)
+		{
+		case UNSIGNED_BYTE: return *p;
+		case UNSIGNED_SHORT: { uint16_t v; std::memcpy(&v, p, 2); return v; }
+		default: { uint32_t v; std::memcpy(&v, p, 4); return v; }
+		}
+	}
+
+	// largest index of an index accessor; the file's indices can only be drawn as they are if it names a vertex
+	unsigned int MaxIndex(const AccessorView& view) const
+	{
+		unsigned int largest = 0;
+		for (unsigned int i = 0; i < view.Count; ++i)
+			largest = std::max(largest, ReadIndex(view, i));
+		return largest;
+	}
+
+	static unsigned int ComponentSize(int componentType)
+	{
+		switch (componentType)
+		{
+		case BYTE: case UNSIGNED_BYTE: return 1;
+		case SHORT: case UNSIGNED_SHORT: return 2;
+		case UNSIGNED_INT: case FLOAT: return 4;
+		default: return 0;
+		}
+	}
+
+	// the meshes placed by the default scene's node hierarchies, with their world transforms; every mesh once
+	// if the file has no scene
+	void Instances(std::vector<MeshInstance>& instances) const
+	{
+		const JsonValue& scene = json["scenes"][std::max(json["scene"].Int(0), 0)];
+		if (scene.IsNull())
+		{
+			for (size_t m = 0; m < json["meshes"].Size(); ++m)
+				instances.push_back({ (int)m, glm::mat4(1.0f) });
+		}
+		for (size_t n = 0; n < scene["nodes"].Size(); ++n)
+			addNode(scene["nodes"][n].Int(), glm::mat4(1.0f), instances, 0);
+	}
+
+	// Every triangle primitive of every instance in world space, in the 8-float position/normal/uv layout, with
+	// smooth normals where the file has none and indices clamped to their primitive's vertices. False if there
+	// is nothing to draw.
+	bool DecodeScene(IndexedMesh& mesh) const
+	{
+		mesh.FloatsPerVertex = 8;
+		mesh.Vertices.clear();
+		mesh.Indices.clear();
+		std::vector<MeshInstance> instances;
+		Instances(instances);
+		for (const MeshInstance& instance : instances)
+		{
+			const glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(instance.Transform)));
+			const JsonValue& primitives = json["meshes"][instance.Mesh]["primitives"];
+			for (size_t p = 0; p < primitives.Size(); ++p)
+			{
+				const JsonValue& attributes = primitives[p]["attributes"];
+				AccessorView position, normal, texCoord, indices;
+				if (!Accessor(attributes["POSITION"].Int(), position) || position.Components != 3 || primitives[p]["mode"].Int(TRIANGLES) != TRIANGLES)
+					continue;
+				const bool hasNormal = Accessor(attributes["NORMAL"].Int(), normal) && normal.Count == position.Count && normal.Components == 3;
+				const bool hasTexCoord = Accessor(attributes["TEXCOORD_0"].Int(), texCoord) && texCoord.Count == position.Count && texCoord.Components >= 2;
+				const bool hasIndices = Accessor(primitives[p]["indices"].Int(), indices) && indices.Components == 1;
+
+				const unsigned int base = (unsigned int)mesh.VertexCount();
+				for (unsigned int i = 0; i < position.Count; ++i)
+				{
+					const glm::vec4 world = instance.Transform * glm::vec4(ReadComponent(position, i, 0), ReadComponent(position, i, 1), ReadComponent(position, i, 2), 1.0f);
+					glm::vec3 n(0.0f);
+					if (hasNormal)
+					{
+						n = normalMatrix * glm::vec3(ReadComponent(normal, i, 0), ReadComponent(normal, i, 1), ReadComponent(normal, i, 2));
+						if (glm::dot(n, n) > 0.0f)
+							n = glm::normalize(n);
+					}
+					const float vertex[8] = { world.x, world.y, world.z, n.x, n.y, n.z,
+						hasTexCoord ? ReadComponent(texCoord, i, 0) : 0.0f, hasTexCoord ? ReadComponent(texCoord, i, 1) : 0.0f };
+					mesh.Vertices.insert(mesh.Vertices.end(), vertex, vertex + 8);
+				}
+				const size_t firstIndex = mesh.Indices.size();
+				const unsigned int cornerCount = hasIndices ? indices.Count - indices.Count % 3 : position.Count - position.Count % 3;
+				for (unsigned int i = 0; i < cornerCount; ++i)
+					mesh.Indices.push_back(base + (hasIndices ? std::min(ReadIndex(indices, i), position.Count - 1) : i));
+				if (!hasNormal)
+					smoothNormals(mesh, firstIndex, base);
+			}
+		}
+		return !mesh.Indices.empty();
+	}
+
+private:
+	MappedFile file;
+	JsonValue json;
+	const unsigned char* bin = NULL;
+	size_t binLength = 0;
+	std::string directory;
+
+	static uint32_t read32(const unsigned char* p)
+	{
+		return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+	}
+
+	static unsigned int componentCount(const std::string& type)
+	{
+		if (type == "SCALAR") return 1;
+		if (type == "VEC2") return 2;
+		if (type == "VEC3") return 3;
+		if (type == "VEC4") return 4;
+		if (type == "MAT4") return 16;
+		return 0;
+	}
+
+	// area-weighted normals of the vertices from firstVertex on, from the triangles from firstIndex on
+	static void smoothNormals(IndexedMesh& mesh, size_t firstIndex, unsigned int firstVertex)
+	{
+		std::vector<float>& v = mesh.Vertices;
+		for (size_t t = firstIndex; t + 2 < mesh.Indices.size(); t += 3)
+		{
+			const float* a = &v[(size_t)mesh.Indices[t] * 8];
+			const float* b = &v[(size_t)mesh.Indices[t + 1] * 8];
+			const float* c = &v[(size_t)mesh.Indices[t + 2] * 8];
+			const glm::vec3 n = glm::cross(glm::vec3(b[0] - a[0], b[1] - a[1], b[2] - a[2]), glm::vec3(c[0] - a[0], c[1] - a[1], c[2] - a[2]));
+			for (int k = 0; k < 3; ++k)
+			{
+				float* normal = &v[(size_t)mesh.Indices[t + k] * 8 + 3];
+				normal[0] += n.x;
+				normal[1] += n.y;
+				normal[2] += n.z;
+			}
+		}
+		for (size_t vertex = firstVertex; vertex < mesh.VertexCount(); ++vertex)
+		{
+			float* normal = &v[vertex * 8 + 3];
+			const float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+			if (length > 0.0f)
+			{
+				normal[0] /= length;
+				normal[1] /= length;
+				normal[2] /= length;
+			}
+		}
+	}
+
+	// node transform: an explicit matrix, or translation * rotation * scale
+	static glm::mat4 nodeTransform(const JsonValue& node)
+	{
+		glm::mat4 transform(1.0f);
+		const JsonValue& matrix = node["matrix"];
+		if (matrix.Size() == 16)
+		{
+			for (int column = 0; column < 4; ++column)
+				for (int row = 0; row < 4; ++row)
+					transform[column][row] = (float)matrix[(column * 4 + row)].Number();
+			return transform;
+		}
+
+		const JsonValue& t = node["translation"];
+		const JsonValue& r = node["rotation"];
+		const JsonValue& s = node["scale"];
+		const float x = (float)r[0].Number(0.0), y = (float)r[1].Number(0.0), z = (float)r[2].Number(0.0), w = (float)r[3].Number(1.0);
+		// rotation matrix of the unit quaternion, column-major
+		transform[0] = glm::vec4(1 - 2 * (y * y + z * z), 2 * (x * y + z * w), 2 * (x * z - y * w), 0.0f);
+		transform[1] = glm::vec4(2 * (x * y - z * w), 1 - 2 * (x * x + z * z), 2 * (y * z + x * w), 0.0f);
+		transform[2] = glm::vec4(2 * (x * z + y * w), 2 * (y * z - x * w), 1 - 2 * (x * x + y * y), 0.0f);
+		for (int axis = 0; axis < 3; ++axis)
+			transform[axis] = transform[axis] * (float)s[axis].Number(1.0);
+		transform[3] = glm::vec4((float)t[0].Number(0.0), (float)t[1].Number(0.0), (float)t[2].Number(0.0), 1.0f);
+		return transform;
+	}
+
+	void addNode(int nodeIndex, const glm::mat4& parent, std::vector<MeshInstance>& instances, int depth) const
+	{
+		const JsonValue& node = json["nodes"][nodeIndex];
+		if (nodeIndex < 0 || node.IsNull() || depth > 64)
+			return;
+		const glm::mat4 transform = parent * nodeTransform(node);
+		const int mesh = node["mesh"].Int();
+		if (mesh >= 0 && (size_t)mesh < json["meshes"].Size())
+			instances.push_back({ mesh, transform });
+		for (size_t c = 0; c < node["children"].Size(); ++c)
+			addNode(node["children"][c].Int(), transform, instances, depth + 1);
+	}
+};
+#endif
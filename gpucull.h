@@ -0,0 +1,402 @@
+#ifndef GPUCULL_H
+#define GPUCULL_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "culling.h"
+#include "multidraw.h"
+
+// One object as the culling shader sees it (std430 layout of CullObject): its world box and the mesh it draws
+struct GpuCullObject {
+	glm::vec3 Center;
+	GLuint Group;    // index into the groups
+	glm::vec3 Extent;
+	float Scale;     // largest axis scale of the model matrix, for level of detail selection
+};
+static_assert(sizeof(GpuCullObject) == 32, "GpuCullObject must match the std430 layout of CullObject");
+
+// A mesh and its levels of detail (std430 layout of CullGroup). Level l draws with command FirstCommand + l.
+struct GpuCullGroup {
+	enum : unsigned int { MAX_LEVELS = 8 };
+
+	GLuint FirstCommand;
+	GLuint LevelCount;
+	float Radius;    // of the object-space bounds, which projected errors are measured from
+	GLuint Pad;
+	float Errors[MAX_LEVELS];
+};
+static_assert(sizeof(GpuCullGroup) == 48, "GpuCullGroup must match the std430 layout of CullGroup");
+
+// Per-frame inputs of the culling shader (std140 layout of the CullData block)
+struct GpuCullUniforms {
+	glm::vec4 Planes[6];                 // of the current frustum, as in Frustum
+	glm::mat4 PreviousViewProjection;    // the depth pyramid was rendered with
+	glm::vec4 Camera;                    // position, and pixels per unit at distance 1 (perspective) or anywhere (orthographic)
+	glm::vec4 Lod;                       // pixel error budget, hysteresis, 1 for orthographic, unused
+	GLuint ObjectCount;
+	GLuint CommandCount;
+	GLuint PyramidLevels;                // 0 while there is no depth pyramid: no occlusion test
+	GLuint Pad0;
+	glm::vec2 PyramidScale;              // viewport size over 2: texels of pyramid level 0 per unit of screen uv
+	glm::vec2 Pad1;
+};
+static_assert(sizeof(GpuCullUniforms) == 224, "GpuCullUniforms must match the std140 layout of CullData");
+
+// Objects counted by the culling shader in one frame
+struct GpuCullStats {
+	GLuint Visible;
+	GLuint FrustumCulled;
+	GLuint Occluded;
+	GLuint Triangles;
+};
+
+// GPU-driven culling of a MultiDrawBatch-style scene. Every frame a compute shader tests each object's world box
+// against the frustum and against a depth pyramid (a max-depth mip chain) built from the previous frame's depth
+// buffer, picks its level of detail, and appends its object index to the instance range of the command for that
+// mesh and level. A second pass compacts the commands that drew anything, and the draw reads its count from the
+// GPU (ARB_indirect_parameters); without the extension every command is drawn and empty ones cost nothing.
+// The CPU never sees which objects are visible; counts come back through a ring of fenced buffers, a few frames late.
+//
+// Occlusion uses the previous frame's depth with the previous frame's matrices, so a static object is tested
+// exactly where it was drawn. Something the camera uncovers this frame was occluded last frame and shows up one
+// frame late; objects crossing the near plane are never occluded.
+//
+// The shaders are compiled by the caller; the buffer bindings below must match their layout qualifiers.
+class GpuCuller
+{
+public:
+	// shader storage binding points
+	enum : GLuint {
+		OBJECT_BINDING = 3,
+		GROUP_BINDING = 4,
+		LEVEL_BINDING = 5,
+		COMMAND_BINDING = 6,
+		INSTANCE_BINDING = 7,
+		STATS_BINDING = 8,
+		COMPACT_COMMAND_BINDING = 9,
+		DRAW_COUNT_BINDING = 10
+	};
+	// uniform block binding point of CullData
+	enum : GLuint { UNIFORM_BINDING = 1 };
+	enum : GLuint { WORKGROUP_SIZE = 64 };
+	static const int STATS_LATENCY = 3;
+
+	bool IndirectCount = false;   // ARB_indirect_parameters draws only the compacted commands
+
+	// takes the linked cull, compact and depth pyramid compute programs
+	void Create(GLuint cullProgram, GLuint compactProgram, GLuint pyramidProgram)
+	{
+		this->cullProgram = cullProgram;
+		this->compactProgram = compactProgram;
+		this->pyramidProgram = pyramidProgram;
+		IndirectCount = GLEW_ARB_indirect_parameters != 0;
+
+		GLuint* buffers[] = { &objectBuffer, &groupBuffer, &levelBuffer, &templateBuffer, &CommandBuffer, &InstanceBuffer,
+			&CompactCommandBuffer, &DrawCountBuffer, &uniformBuffer };
+		for (GLuint* buffer : buffers)
+			glGenBuffers(1, buffer);
+		glGenBuffers(STATS_LATENCY, statsBuffers);
+		for (int i = 0; i < STATS_LATENCY; ++i)
+		{
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, statsBuffers[i]);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GpuCullStats), NULL, GL_DYNAMIC_READ);
+			statsFences[i] = 0;
+		}
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, DrawCountBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, uniformBuffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(GpuCullUniforms), NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	// Uploads the scene. commands hold every mesh and level with InstanceCount 0 and BaseInstance at the start of
+	// their range of instance slots, which must fit every object that may pick them.
+	void SetScene(const std::vector<GpuCullObject>& objects, const std::vector<GpuCullGroup>& groups,
+		const std::vector<DrawElementsIndirectCommand>& commands, GLuint instanceSlots)
+	{
+		objectCount = (GLuint)objects.size();
+		commandCount = (GLuint)commands.size();
+		upload(GL_SHADER_STORAGE_BUFFER, objectBuffer, objects.data(), objects.size() * sizeof(GpuCullObject), GL_STATIC_DRAW);
+		upload(GL_SHADER_STORAGE_BUFFER, groupBuffer, groups.data(), groups.size() * sizeof(GpuCullGroup), GL_STATIC_DRAW);
+		const std::vector<GLuint> levels(objects.size(), 0);
+		upload(GL_SHADER_STORAGE_BUFFER, levelBuffer, levels.data(), levels.size() * sizeof(GLuint), GL_DYNAMIC_DRAW);
+		upload(GL_COPY_READ_BUFFER, templateBuffer, commands.data(), commands.size() * sizeof(DrawElementsIndirectCommand), GL_STATIC_DRAW);
+		upload(GL_DRAW_INDIRECT_BUFFER, CommandBuffer, commands.data(), commands.size() * sizeof(DrawElementsIndirectCommand), GL_DYNAMIC_DRAW);
+		upload(GL_DRAW_INDIRECT_BUFFER, CompactCommandBuffer, commands.data(), commands.size() * sizeof(DrawElementsIndirectCommand), GL_DYNAMIC_DRAW);
+		upload(GL_ARRAY_BUFFER, InstanceBuffer, NULL, std::max<size_t>(instanceSlots, 1) * sizeof(GLuint), GL_DYNAMIC_DRAW);
+	}
+
+	// Culls against frustum and the depth pyramid of the last BuildDepthPyramid, and writes this frame's commands.
+	// uniforms holds the camera and level of detail fields; the rest is filled in here.
+	void Cull(const Frustum& frustum, GpuCullUniforms uniforms)
+	{
+		for (int p = 0; p < 6; ++p)
+			uniforms.Planes[p] = frustum.Planes[p];
+		uniforms.PreviousViewProjection = previousViewProjection;
+		uniforms.ObjectCount = objectCount;
+		uniforms.CommandCount = commandCount;
+		uniforms.PyramidLevels = pyramidValid ? pyramidLevels : 0;
+		uniforms.PyramidScale = glm::vec2(depthWidth * 0.5f, depthHeight * 0.5f);
+		glBindBuffer(GL_UNIFORM_BUFFER, uniformBuffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(GpuCullUniforms), &uniforms);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+		// instance counts start from the templates' zeros; the counters of this frame's ring slot from zero
+		glBindBuffer(GL_COPY_READ_BUFFER, templateBuffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, CommandBuffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, commandCount * sizeof(DrawElementsIndirectCommand));
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		const int slot = (int)(frame % STATS_LATENCY);
+		if (statsFences[slot] != 0)
+		{
+			// never read back: waited for and carried over to the next ReadStats rather than dropped
+			readSlot(slot, carriedStats, true);
+			hasCarriedStats = true;
+		}
+		const GLuint zero = 0;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, statsBuffers[slot]);
+		glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, DrawCountBuffer);
+		glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BINDING, uniformBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, OBJECT_BINDING, objectBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, GROUP_BINDING, groupBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LEVEL_BINDING, levelBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, COMMAND_BINDING, CommandBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INSTANCE_BINDING, InstanceBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, STATS_BINDING, statsBuffers[slot]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, COMPACT_COMMAND_BINDING, CompactCommandBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_COUNT_BINDING, DrawCountBuffer);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, pyramidTexture);
+
+		glUseProgram(cullProgram);
+		glDispatchCompute((objectCount + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+		if (IndirectCount)
+		{
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+			glUseProgram(compactProgram);
+			glDispatchCompute((commandCount + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+		statsFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		++frame;
+	}
+
+	// draws this frame's commands; the arena VAO and the program must be bound. The instance slots feed the object
+	// index attribute through vertex buffer binding `binding` of the VAO.
+	void Draw(GLuint binding) const
+	{
+		glBindVertexBuffer(binding, InstanceBuffer, 0, sizeof(GLuint));
+		if (IndirectCount)
+		{
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, CompactCommandBuffer);
+			glBindBuffer(GL_PARAMETER_BUFFER_ARB, DrawCountBuffer);
+			glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, GL_UNSIGNED_INT, 0, 0, (GLsizei)commandCount, 0);
+			glBindBuffer(GL_PARAMETER_BUFFER_ARB, 0);
+		}
+		else
+		{
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, CommandBuffer);
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0, (GLsizei)commandCount, 0);
+		}
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+	// Copies the depth buffer of the bound draw framebuffer (the viewport's width x height) and reduces it to the
+	// max-depth pyramid the next Cull tests against; viewProjection is what this frame was drawn with.
+	void BuildDepthPyramid(int width, int height, const glm::mat4& viewProjection)
+	{
+		if (width <= 1 || height <= 1)
+			return;
+		if (width != depthWidth || height != depthHeight)
+			createPyramid(width, height);
+
+		GLint drawFramebuffer = 0, readFramebuffer = 0;
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFramebuffer);
+		glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, drawFramebuffer);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, depthTexture);
+		glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, width, height);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+
+		// each level keeps the farthest depth under its texels; level 0 halves the depth copy
+		glUseProgram(pyramidProgram);
+		int sourceWidth = width, sourceHeight = height;
+		for (GLuint level = 0; level < pyramidLevels; ++level)
+		{
+			const int levelWidth = std::max(sourceWidth / 2, 1), levelHeight = std::max(sourceHeight / 2, 1);
+			glBindTexture(GL_TEXTURE_2D, level == 0 ? depthTexture : pyramidTexture);
+			glUniform1i(PYRAMID_SOURCE_LEVEL_LOCATION, level == 0 ? 0 : (GLint)level - 1);
+			glUniform2i(PYRAMID_SOURCE_SIZE_LOCATION, sourceWidth, sourceHeight);
+			glBindImageTexture(0, pyramidTexture, (GLint)level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+			glDispatchCompute((levelWidth + 7) / 8, (levelHeight + 7) / 8, 1);
+			glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+			sourceWidth = levelWidth;
+			sourceHeight = levelHeight;
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+		previousViewProjection = viewProjection;
+		pyramidValid = true;
+	}
+
+	// the counts of every frame whose culling has finished on the GPU since the last call, summed, oldest first; never
+	// waits unless `wait`, which collects every frame culled so far, e.g. at the end of a run. False if there were none.
+	bool ReadStats(GpuCullStats& stats, bool wait = false)
+	{
+		stats = carriedStats;
+		bool read = hasCarriedStats;
+		carriedStats = GpuCullStats();
+		hasCarriedStats = false;
+		for (unsigned long long age = STATS_LATENCY; age > 0; --age)
+		{
+			if (frame < age)
+				continue;
+			const int slot = (int)((frame - age) % STATS_LATENCY);
+			if (statsFences[slot] == 0)
+				continue;
+			if (!readSlot(slot, stats, wait))
+				break; // later frames cannot have finished either
+			read = true;
+		}
+		return read;
+	}
+
+	// forgets the depth pyramid, e.g. after a camera cut, so the next frames only frustum cull until a new one exists
+	void InvalidateDepthPyramid()
+	{
+		pyramidValid = false;
+	}
+
+	void Destroy()
+	{
+		GLuint buffers[] = { objectBuffer, groupBuffer, levelBuffer, templateBuffer, CommandBuffer, InstanceBuffer,
+			CompactCommandBuffer, DrawCountBuffer, uniformBuffer };
+		glDeleteBuffers(9, buffers);
+		glDeleteBuffers(STATS_LATENCY, statsBuffers);
+		for (int i = 0; i < STATS_LATENCY; ++i)
+		{
+			if (statsFences[i] != 0)
+				glDeleteSync(statsFences[i]);
+			statsFences[i] = 0;
+		}
+		carriedStats = GpuCullStats();
+		hasCarriedStats = false;
+		glDeleteTextures(1, &depthTexture);
+		glDeleteTextures(1, &pyramidTexture);
+		objectBuffer = groupBuffer = levelBuffer = templateBuffer = CommandBuffer = InstanceBuffer = 0;
+		CompactCommandBuffer = DrawCountBuffer = uniformBuffer = depthTexture = pyramidTexture = 0;
+		depthWidth = depthHeight = 0;
+		pyramidValid = false;
+	}
+
+	GLuint CommandBuffer = 0;          // every command, with this frame's instance counts
+	GLuint CompactCommandBuffer = 0;   // the commands that draw anything, first DrawCount of them
+	GLuint DrawCountBuffer = 0;
+	GLuint InstanceBuffer = 0;         // object index of every instance slot
+
+private:
+	// explicit uniform locations of the depth pyramid program
+	enum : GLint {
+		PYRAMID_SOURCE_LEVEL_LOCATION = 0,
+		PYRAMID_SOURCE_SIZE_LOCATION = 1
+	};
+
+	GLuint cullProgram = 0, compactProgram = 0, pyramidProgram = 0;
+	GLuint objectBuffer = 0, groupBuffer = 0, levelBuffer = 0, templateBuffer = 0, uniformBuffer = 0;
+	GLuint statsBuffers[STATS_LATENCY] = {};
+	GLsync statsFences[STATS_LATENCY] = {};
+	GpuCullStats carriedStats = {};    // read by Cull when it needed the slot back, not yet returned by ReadStats
+	bool hasCarriedStats = false;
+	GLuint objectCount = 0, commandCount = 0;
+	unsigned long long frame = 0;
+
+	GLuint depthTexture = 0, pyramidTexture = 0;
+	int depthWidth = 0, depthHeight = 0;
+	GLuint pyramidLevels = 0;
+	bool pyramidValid = false;
+	glm::mat4 previousViewProjection = glm::mat4(1.0f);
+
+	static void upload(GLenum target, GLuint buffer, const void* data, size_t size, GLenum usage)
+	{
+		glBindBuffer(target, buffer);
+		glBufferData(target, size, data, usage);
+		glBindBuffer(target, 0);
+	}
+
+	// adds the counts of ring slot `slot` to total and frees its fence, once the GPU is done with it; false, leaving
+	// the slot alone, if it is not done and `wait` is not set (or, freeing it, if waiting failed)
+	bool readSlot(int slot, GpuCullStats& total, bool wait)
+	{
+		if (wait)
+		{
+			GLenum result = glClientWaitSync(statsFences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+			while (result == GL_TIMEOUT_EXPIRED)
+				result = glClientWaitSync(statsFences[slot], 0, 1000000000ull);
+			if (result == GL_WAIT_FAILED)
+			{
+				glDeleteSync(statsFences[slot]);
+				statsFences[slot] = 0;
+				return false;
+			}
+		}
+		else
+		{
+			GLint status = GL_UNSIGNALED;
+			glGetSynciv(statsFences[slot], GL_SYNC_STATUS, 1, NULL, &status);
+			if (status != GL_SIGNALED)
+				return false;
+		}
+		glDeleteSync(statsFences[slot]);
+		statsFences[slot] = 0;
+
+		GpuCullStats stats;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, statsBuffers[slot]);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GpuCullStats), &stats);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		total.Visible += stats.Visible;
+		total.FrustumCulled += stats.FrustumCulled;
+		total.Occluded += stats.Occluded;
+		total.Triangles += stats.Triangles;
+		return true;
+	}
+
+	void createPyramid(int width, int height)
+	{
+		glDeleteTextures(1, &depthTexture);
+		glDeleteTextures(1, &pyramidTexture);
+		depthWidth = width;
+		depthHeight = height;
+
+		glGenTextures(1, &depthTexture);
+		glBindTexture(GL_TEXTURE_2D, depthTexture);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, width, height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+		const int baseWidth = std::max(width / 2, 1), baseHeight = std::max(height / 2, 1);
+		pyramidLevels = 1;
+		while ((baseWidth >> pyramidLevels) > 0 || (baseHeight >> pyramidLevels) > 0)
+			++pyramidLevels;
+		glGenTextures(1, &pyramidTexture);
+		glBindTexture(GL_TEXTURE_2D, pyramidTexture);
+		glTexStorage2D(GL_TEXTURE_2D, pyramidLevels, GL_R32F, baseWidth, baseHeight);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		pyramidValid = false;
+	}
+};
+#endif
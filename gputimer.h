@@ -0,0 +1,132 @@
+#ifndef GPUTIMER_H
+#define GPUTIMER_H
+
+#include <GL/glew.h>
+
+#include <chrono>
+#include <vector>
+
+// GPU execution interval of one render pass, expressed on the CPU steady_clock timeline
+struct GpuPassSample {
+	int Pass;
+	unsigned long long Frame;
+	double StartMs;    // milliseconds since the steady_clock epoch
+	double DurationMs;
+};
+
+// Ring-buffered GL_TIMESTAMP queries around render passes.
+// Results are read FRAME_LATENCY frames after they were issued, when the GPU has long finished them,
+// so timing never stalls the pipeline. A result that is still not available is dropped instead of waited on.
+class GpuTimer
+{
+public:
+	static const int FRAME_LATENCY = 4;
+
+	// resolved samples, appended as frames retire; the caller consumes and clears them
+	std::vector<GpuPassSample> Resolved;
+	unsigned int DroppedSamples = 0;
+
+	bool Create(int passCount)
+	{
+		GLint bits = 0;
+		glGetQueryiv(GL_TIMESTAMP, GL_QUERY_COUNTER_BITS, &bits);
+		if (bits == 0)
+			return false;
+
+		this->passCount = passCount;
+		queries.resize(FRAME_LATENCY * passCount * 2);
+		issued.assign(FRAME_LATENCY * passCount, false);
+		glGenQueries((GLsizei)queries.size(), queries.data());
+		Calibrate();
+		return true;
+	}
+
+	void Destroy()
+	{
+		if (!queries.empty())
+			glDeleteQueries((GLsizei)queries.size(), queries.data());
+		queries.clear();
+		issued.clear();
+	}
+
+	// maps GPU timestamps onto the CPU clock; drift is small, so doing this now and then is enough
+	void Calibrate()
+	{
+		GLint64 gpuNow = 0;
+		glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+		double cpuNow = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		gpuToCpuOffsetMs = cpuNow - gpuNow * 1e-6;
+	}
+
+	// retires the oldest frame in the ring, then starts recording into its slot
+	void BeginFrame()
+	{
+		slot = (int)(frame % FRAME_LATENCY);
+		resolve(slot, frame - FRAME_LATENCY, false);
+		if (frame % 600 == 0)
+			Calibrate();
+	}
+
+	void BeginPass(int pass)
+	{
+		glQueryCounter(query(slot, pass, 0), GL_TIMESTAMP);
+	}
+
+	void EndPass(int pass)
+	{
+		glQueryCounter(query(slot, pass, 1), GL_TIMESTAMP);
+		issued[slot * passCount + pass] = true;
+	}
+
+	void EndFrame()
+	{
+		++frame;
+	}
+
+	// waits for every outstanding query; only for the end of a run, never per frame
+	void Flush()
+	{
+		for (unsigned long long f = frame > FRAME_LATENCY ? frame - FRAME_LATENCY : 0; f < frame; ++f)
+			resolve((int)(f % FRAME_LATENCY), f, true);
+	}
+
+private:
+	std::vector<GLuint> queries;
+	std::vector<bool> issued;
+	int passCount = 0;
+	int slot = 0;
+	unsigned long long frame = 0;
+	double gpuToCpuOffsetMs = 0.0;
+
+	GLuint query(int slot, int pass, int end) const
+	{
+		return queries[(slot * passCount + pass) * 2 + end];
+	}
+
+	void resolve(int slot, unsigned long long issuedFrame, bool wait)
+	{
+		for (int pass = 0; pass < passCount; ++pass)
+		{
+			if (!issued[slot * passCount + pass])
+				continue;
+			issued[slot * passCount + pass] = false;
+
+			if (!wait)
+			{
+				GLint available = 0;
+				glGetQueryObjectiv(query(slot, pass, 1), GL_QUERY_RESULT_AVAILABLE, &available);
+				if (!available)
+				{
+					++DroppedSamples;
+					continue;
+				}
+			}
+
+			GLuint64 begin = 0, end = 0;
+			glGetQueryObjectui64v(query(slot, pass, 0), GL_QUERY_RESULT, &begin);
+			glGetQueryObjectui64v(query(slot, pass, 1), GL_QUERY_RESULT, &end);
+			Resolved.push_back({ pass, issuedFrame, begin * 1e-6 + gpuToCpuOffsetMs, (end - begin) * 1e-6 });
+		}
+	}
+};
+#endif
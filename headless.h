@@ -0,0 +1,233 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <GL/glew.h>
+
+#if !defined(_WIN32)
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <iostream>
+
+// Creates an OpenGL 4.4 core context without a window or display server (EGL surfaceless platform).
+// Works with Mesa's llvmpipe, so the scene can be rendered on CI boxes and display-less render nodes.
+class HeadlessContext
+{
+public:
+	HeadlessContext() {}
+
+	// creates the context and makes it current; returns false if the platform has no surfaceless EGL
+	bool Create(int major = 4, int minor = 4)
+	{
+#if defined(_WIN32)
+		std::cout << "ERROR::HEADLESS::EGL surfaceless contexts are not supported on this platform" << std::endl;
+		return false;
+#else
+		// prefer the surfaceless platform so no X11/Wayland connection is attempted
+		PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+			(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (getPlatformDisplay)
+			display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+		if (display == EGL_NO_DISPLAY)
+			display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+		EGLint eglMajor = 0, eglMinor = 0;
+		if (display == EGL_NO_DISPLAY || !eglInitialize(display, &eglMajor, &eglMinor))
+		{
+			std::cout << "ERROR::HEADLESS::Failed to initialize EGL display" << std::endl;
+			return false;
+		}
+
+		if (!eglBindAPI(EGL_OPENGL_API))
+		{
+			std::cout << "ERROR::HEADLESS::EGL display does not support desktop OpenGL" << std::endl;
+			Destroy();
+			return false;
+		}
+
+		// we never render to an EGL surface, so any OpenGL-capable config (or none at all) will do
+		const EGLint configAttribs[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+		EGLConfig config = EGL_NO_CONFIG_KHR;
+		EGLint numConfigs = 0;
+		if (!eglChooseConfig(display, configAttribs, &config, 1, &numConfigs) || numConfigs == 0)
+			config = EGL_NO_CONFIG_KHR;
+
+		const EGLint contextAttribs[] = {
+			EGL_CONTEXT_MAJOR_VERSION, major,
+			EGL_CONTEXT_MINOR_VERSION, minor,
+			EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+			EGL_NONE
+		};
+		context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+		if (context == EGL_NO_CONTEXT)
+		{
+			std::cout << "ERROR::HEADLESS::Failed to create OpenGL " << major << "." << minor << " core context" << std::endl;
+			Destroy();
+			return false;
+		}
+
+		// surfaceless: all rendering goes to framebuffer objects
+		if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+		{
+			std::cout << "ERROR::HEADLESS::Failed to make the context current (EGL_KHR_surfaceless_context missing?)" << std::endl;
+			Destroy();
+			return false;
+		}
+
+		std::cout << "INFO: EGL Version: " << eglMajor << "." << eglMinor << std::endl;
+		return true;
+#endif
+	}
+
+	// releases the context and terminates the display connection
+	void Destroy()
+	{
+#if !defined(_WIN32)
+		if (display != EGL_NO_DISPLAY)
+		{
+			eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+			if (context != EGL_NO_CONTEXT)
+				eglDestroyContext(display, context);
+			eglTerminate(display);
+		}
+		display = EGL_NO_DISPLAY;
+		context = EGL_NO_CONTEXT;
+#endif
+	}
+
+private:
+#if !defined(_WIN32)
+	EGLDisplay display = EGL_NO_DISPLAY;
+	EGLContext context = EGL_NO_CONTEXT;
+#endif
+};
+
+// Framebuffer object with color and depth textures that stands in for the window's back buffer, optionally with an
+// R32UI object id texture on the second color attachment
+class OffscreenTarget
+{
+public:
+	GLuint FBO = 0;
+	GLuint ColorTexture = 0;
+	GLuint DepthTexture = 0;
+	GLuint ObjectIdTexture = 0;
+	int Width = 0;
+	int Height = 0;
+
+	// allocates the attachments; returns false if the framebuffer is incomplete
+	bool Create(int width, int height, bool objectIds = false)
+	{
+		Width = width;
+		Height = height;
+
+		glGenTextures(1, &ColorTexture);
+		glBindTexture(GL_TEXTURE_2D, ColorTexture);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+		glGenTextures(1, &DepthTexture);
+		glBindTexture(GL_TEXTURE_2D, DepthTexture);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT24, width, height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+		if (objectIds)
+		{
+			glGenTextures(1, &ObjectIdTexture);
+			glBindTexture(GL_TEXTURE_2D, ObjectIdTexture);
+			glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32UI, width, height);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		glGenFramebuffers(1, &FBO);
+		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, ColorTexture, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, DepthTexture, 0);
+		if (objectIds)
+		{
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, ObjectIdTexture, 0);
+			const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+			glDrawBuffers(2, drawBuffers);
+		}
+
+		GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		if (status != GL_FRAMEBUFFER_COMPLETE)
+		{
+			std::cout << "ERROR::FRAMEBUFFER::Incomplete framebuffer (0x" << std::hex << status << std::dec << ")" << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	// makes the target the destination of all following draws
+	void Bind() const
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+		glViewport(0, 0, Width, Height);
+	}
+
+	// copies the color attachment to the window's back buffer, of the same size, and leaves that bound
+	void Present() const
+	{
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, FBO);
+		glReadBuffer(GL_COLOR_ATTACHMENT0);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		glBlitFramebuffer(0, 0, Width, Height, 0, 0, Width, Height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	// reads the color attachment back as tightly packed RGB rows, top row first
+	void ReadPixels(std::vector<unsigned char>& pixels) const
+	{
+		const size_t rowSize = (size_t)Width * 3;
+		std::vector<unsigned char> flipped(rowSize * Height);
+
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, FBO);
+		glReadBuffer(GL_COLOR_ATTACHMENT0);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glReadPixels(0, 0, Width, Height, GL_RGB, GL_UNSIGNED_BYTE, flipped.data());
+
+		// OpenGL's Y axis goes up, image files expect the first row at the top
+		pixels.resize(flipped.size());
+		for (int y = 0; y < Height; ++y)
+			std::copy(flipped.begin() + (Height - 1 - y) * rowSize, flipped.begin() + (Height - y) * rowSize, pixels.begin() + y * rowSize);
+	}
+
+	// writes the color attachment to a binary PPM image
+	bool WritePPM(const std::string& path) const
+	{
+		std::vector<unsigned char> pixels;
+		ReadPixels(pixels);
+
+		FILE* file = fopen(path.c_str(), "wb");
+		if (!file)
+		{
+			std::cout << "ERROR::FRAMEBUFFER::Failed to open " << path << " for writing" << std::endl;
+			return false;
+		}
+		fprintf(file, "P6\n%d %d\n255\n", Width, Height);
+		fwrite(pixels.data(), 1, pixels.size(), file);
+		fclose(file);
+		return true;
+	}
+
+	// releases the framebuffer and its attachments
+	void Destroy()
+	{
+		glDeleteFramebuffers(1, &FBO);
+		glDeleteTextures(1, &ColorTexture);
+		glDeleteTextures(1, &DepthTexture);
+		glDeleteTextures(1, &ObjectIdTexture);
+		FBO = ColorTexture = DepthTexture = ObjectIdTexture = 0;
+	}
+};
+#endif
@@ -0,0 +1,222 @@
+#ifndef LATHE_H
+#define LATHE_H
+
+#include <glm/glm.hpp>
+
+#include "meshopt.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Control point of a lathe profile: distance from the axis and height along it. Corner points end the smooth
+// curve there: the surface gets a hard edge with separate normals on either side.
+struct LathePoint {
+	glm::vec2 Position;
+	bool Corner = false;
+
+	LathePoint(float radius, float height, bool corner = false) : Position(radius, height), Corner(corner) {}
+};
+
+// Tessellation and extent of a lathe mesh
+struct LatheOptions {
+	unsigned int RadialSegments = 32;   // around the axis, over the whole sweep
+	unsigned int ProfileSegments = 4;   // along the profile, between two control points
+	float StartAngle = 0.0f;            // radians; the sweep starts on +z and turns towards +x
+	float SweepAngle = 6.28318531f;     // a full turn closes the surface
+	bool ClosedProfile = false;         // the last control point connects back to the first, e.g. a torus
+	float TextureRepeat = 1.0f;         // u wraps this many times around the sweep; v runs 0..1 along the profile
+};
+
+// Surfaces of revolution: a 2D profile swept around the y axis into an indexed mesh in the 8-float
+// position/normal/uv layout (see IndexedMesh; UnpackVertices in mesh.h makes Mesh vertices of it).
+// Between corners the profile is a Catmull-Rom spline through the control points, so the same few points
+// give a coarse or a smooth mesh depending on the segment counts alone.
+// Profiles run so the surface faces to the right of the direction of travel in the (radius, height) plane:
+// for a cup, from the centre of the base outwards, up the outside, and down the inside.
+class Lathe
+{
+public:
+	static IndexedMesh Build(const std::vector<LathePoint>& points, const LatheOptions& options = LatheOptions())
+	{
+		IndexedMesh mesh;
+		mesh.FloatsPerVertex = 8;
+		const size_t pointCount = points.size();
+		if (pointCount < 2 || options.RadialSegments == 0)
+			return mesh;
+
+		std::vector<Sample> samples = sampleProfile(points, options);
+
+		// v follows the arc length
+		std::vector<float> arc(samples.size(), 0.0f);
+		for (size_t i = 1; i < samples.size(); ++i)
+			arc[i] = arc[i - 1] + glm::length(samples[i].Position - samples[i - 1].Position);
+		const float totalArc = std::max(arc.back(), 1e-6f);
+
+		// one ring of vertices per sample side: corners have a ring for the incoming and one for the outgoing normal
+		const unsigned int columns = options.RadialSegments + 1;
+		std::vector<unsigned int> ringBefore(samples.size()), ringAfter(samples.size());
+		unsigned int ringCount = 0;
+		for (size_t i = 0; i < samples.size(); ++i)
+		{
+			ringBefore[i] = ringCount;
+			appendRing(mesh, samples[i].Position, samples[i].NormalBefore, arc[i] / totalArc, options);
+			++ringCount;
+			ringAfter[i] = ringBefore[i];
+			if (samples[i].Split)
+			{
+				ringAfter[i] = ringCount;
+				appendRing(mesh, samples[i].Position, samples[i].NormalAfter, arc[i] / totalArc, options);
+				++ringCount;
+			}
+		}
+
+		for (size_t i = 0; i + 1 < samples.size(); ++i)
+		{
+			const unsigned int a = ringAfter[i] * columns, b = ringBefore[i + 1] * columns;
+			const bool aOnAxis = samples[i].Position.x <= 1e-7f, bOnAxis = samples[i + 1].Position.x <= 1e-7f;
+			for (unsigned int j = 0; j < options.RadialSegments; ++j)
+			{
+				// the triangle with two corners on the axis has no area
+				if (!bOnAxis)
+					pushTriangle(mesh, a + j, b + j + 1, b + j);
+				if (!aOnAxis)
+					pushTriangle(mesh, a + j, a + j + 1, b + j + 1);
+			}
+		}
+		return mesh;
+	}
+
+	// applies transform to the positions and its inverse transpose to the normals
+	static void Transform(IndexedMesh& mesh, const glm::mat4& transform)
+	{
+		const glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(transform)));
+		for (size_t v = 0; v < mesh.VertexCount(); ++v)
+		{
+			float* vertex = &mesh.Vertices[v * mesh.FloatsPerVertex];
+			glm::vec4 p = transform * glm::vec4(vertex[0], vertex[1], vertex[2], 1.0f);
+			glm::vec3 n = glm::normalize(normalMatrix * glm::vec3(vertex[3], vertex[4], vertex[5]));
+			vertex[0] = p.x;
+			vertex[1] = p.y;
+			vertex[2] = p.z;
+			vertex[3] = n.x;
+			vertex[4] = n.y;
+			vertex[5] = n.z;
+		}
+	}
+
+	// appends the vertices and triangles of one mesh to another with the same layout
+	static void Append(IndexedMesh& mesh, const IndexedMesh& part)
+	{
+		const unsigned int base = (unsigned int)mesh.VertexCount();
+		mesh.Vertices.insert(mesh.Vertices.end(), part.Vertices.begin(), part.Vertices.end());
+		for (unsigned int index : part.Indices)
+			mesh.Indices.push_back(base + index);
+	}
+
+private:
+	struct Sample {
+		glm::vec2 Position;
+		glm::vec2 NormalBefore;  // from the curve arriving here
+		glm::vec2 NormalAfter;   // for the curve leaving, differs at corners
+		bool Split;
+	};
+
+	// uniform Catmull-Rom segment from p1 to p2 and its derivative
+	static glm::vec2 catmullRom(const glm::vec2& p0, const glm::vec2& p1, const glm::vec2& p2, const glm::vec2& p3, float t)
+	{
+		const float t2 = t * t, t3 = t2 * t;
+		return 0.5f * ((2.0f * p1) + (p2 - p0) * t + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 + (3.0f * p1 - p0 - 3.0f * p2 + p3) * t3);
+	}
+
+	static glm::vec2 catmullRomTangent(const glm::vec2& p0, const glm::vec2& p1, const glm::vec2& p2, const glm::vec2& p3, float t)
+	{
+		const float t2 = t * t;
+		return 0.5f * ((p2 - p0) + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * (2.0f * t) + (3.0f * p1 - p0 - 3.0f * p2 + p3) * (3.0f * t2));
+	}
+
+	// the surface faces right of the direction of travel
+	static glm::vec2 profileNormal(const glm::vec2& tangent)
+	{
+		glm::vec2 n(tangent.y, -tangent.x);
+		float length = glm::length(n);
+		return length > 0.0f ? n / length : glm::vec2(0.0f, 1.0f);
+	}
+
+	static std::vector<Sample> sampleProfile(const std::vector<LathePoint>& points, const LatheOptions& options)
+	{
+		const size_t count = points.size();
+		const size_t spans = options.ClosedProfile ? count : count - 1;
+		const unsigned int steps = std::max(options.ProfileSegments, 1u);
+		auto point = [&](size_t i) { return points[i % count].Position; };
+
+		std::vector<Sample> samples;
+		for (size_t span = 0; span < spans; ++span)
+		{
+			const size_t i1 = span, i2 = span + 1;
+			const glm::vec2 p1 = point(i1), p2 = point(i2);
+			// past a corner or an open end the neighbour is mirrored, which keeps the end of the span straight
+			const bool startsSharp = points[i1 % count].Corner || (!options.ClosedProfile && i1 == 0);
+			const bool endsSharp = points[i2 % count].Corner || (!options.ClosedProfile && i2 == count - 1);
+			const glm::vec2 p0 = startsSharp ? 2.0f * p1 - p2 : point(i1 + count - 1);
+			const glm::vec2 p3 = endsSharp ? 2.0f * p2 - p1 : point(i2 + 1);
+			// and a span that is sharp at both ends is a straight line, which more segments would not change
+			const unsigned int spanSteps = startsSharp && endsSharp ? 1 : steps;
+
+			for (unsigned int s = 0; s < spanSteps; ++s)
+			{
+				const float t = (float)s / spanSteps;
+				const glm::vec2 normal = profileNormal(catmullRomTangent(p0, p1, p2, p3, t));
+				if (s == 0 && !samples.empty())
+				{
+					// the control point ending the previous span: only its outgoing normal comes from this span
+					Sample& joint = samples.back();
+					joint.NormalAfter = normal;
+					joint.Split = points[i1 % count].Corner;
+					if (!joint.Split)
+						joint.NormalBefore = joint.NormalAfter = glm::normalize(joint.NormalBefore + normal);
+					continue;
+				}
+				samples.push_back({ catmullRom(p0, p1, p2, p3, t), normal, normal, false });
+			}
+			const glm::vec2 endNormal = profileNormal(catmullRomTangent(p0, p1, p2, p3, 1.0f));
+			samples.push_back({ p2, endNormal, endNormal, false });
+		}
+
+		// a closed profile ends where it started; the seam takes the start's normals so the rings line up
+		if (options.ClosedProfile)
+		{
+			Sample& seam = samples.back();
+			Sample& start = samples.front();
+			if (points[0].Corner)
+			{
+				start.NormalBefore = seam.NormalBefore;
+				start.Split = true;
+			}
+			else
+				start.NormalBefore = start.NormalAfter = glm::normalize(seam.NormalBefore + start.NormalAfter);
+			seam.NormalBefore = seam.NormalAfter = start.NormalBefore;
+		}
+		return samples;
+	}
+
+	static void appendRing(IndexedMesh& mesh, const glm::vec2& position, const glm::vec2& normal, float v, const LatheOptions& options)
+	{
+		for (unsigned int j = 0; j <= options.RadialSegments; ++j)
+		{
+			const float u = (float)j / options.RadialSegments;
+			const float angle = options.StartAngle + options.SweepAngle * u;
+			const float s = std::sin(angle), c = std::cos(angle);
+			const float vertex[8] = { position.x * s, position.y, position.x * c, normal.x * s, normal.y, normal.x * c, u * options.TextureRepeat, v };
+			mesh.Vertices.insert(mesh.Vertices.end(), vertex, vertex + 8);
+		}
+	}
+
+	static void pushTriangle(IndexedMesh& mesh, unsigned int a, unsigned int b, unsigned int c)
+	{
+		mesh.Indices.push_back(a);
+		mesh.Indices.push_back(b);
+		mesh.Indices.push_back(c);
+	}
+};
+#endif
@@ -0,0 +1,468 @@
+#ifndef LOD_H
+#define LOD_H
+
+#include "meshopt.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// One level of detail: triangles over the vertices of the full-detail mesh, so every level of a chain can
+// share one vertex buffer and differ only in the index range drawn
+struct LodLevel {
+	std::vector<unsigned int> Indices;
+	// Quadric error estimate of how far the level strays from the full-detail surface, in object units: per
+	// simplification step the square root of the worst collapse's quadric cost (summed squared distances to the
+	// planes merged into the kept vertex), added up down the chain. An RMS-style estimate, not a true maximum
+	// distance, so screen-space budgets built on it are approximate.
+	float Error = 0.0f;
+};
+
+// Quadric error metric simplification (Garland & Heckbert) by edge collapse onto existing vertices, and LOD
+// chains built from it. Collapses never move a vertex, so attributes stay exact and no vertex is added.
+// Open borders only collapse along themselves and attribute seams (a position shared by two vertices, e.g. the
+// u = 0/1 column of a lathed mesh) only along the seam, both sides at once, so neither tears; anything more
+// tangled is left in place.
+class MeshSimplifier
+{
+public:
+	// Reduces the triangles to at most targetIndexCount indices, or as close as maxError allows. maxError and
+	// the returned error (the square root of the largest quadric cost of an applied collapse) are relative to
+	// the extent of the mesh (1 = its largest bounding box side); the first three floats of each vertex, every
+	// stride floats, are its position.
+	static std::vector<unsigned int> Simplify(const unsigned int* indices, size_t indexCount, const float* vertices, size_t stride, size_t vertexCount,
+		size_t targetIndexCount, float maxError, float* resultError = NULL)
+	{
+		std::vector<unsigned int> result(indices, indices + indexCount);
+		if (resultError)
+			*resultError = 0.0f;
+
+		// positions scaled into the unit cube so errors compare across meshes
+		std::vector<Vector3> positions(vertexCount);
+		Vector3 minimum = { 3.0e38, 3.0e38, 3.0e38 }, maximum = { -3.0e38, -3.0e38, -3.0e38 };
+		for (size_t v = 0; v < vertexCount; ++v)
+		{
+			const float* p = vertices + v * stride;
+			positions[v] = { p[0], p[1], p[2] };
+			minimum = { std::min(minimum.x, positions[v].x), std::min(minimum.y, positions[v].y), std::min(minimum.z, positions[v].z) };
+			maximum = { std::max(maximum.x, positions[v].x), std::max(maximum.y, positions[v].y), std::max(maximum.z, positions[v].z) };
+		}
+		const double extent = std::max(std::max(maximum.x - minimum.x, maximum.y - minimum.y), std::max(maximum.z - minimum.z, 1e-12));
+		for (Vector3& p : positions)
+			p = { (p.x - minimum.x) / extent, (p.y - minimum.y) / extent, (p.z - minimum.z) / extent };
+
+		std::vector<unsigned int> remap, wedge;
+		buildPositionRemap(vertices, stride, vertexCount, remap, wedge);
+		std::vector<unsigned int> openOut, openIn;
+		findOpenEdges(result, vertexCount, openOut, openIn);
+		std::vector<unsigned char> kinds = classifyVertices(remap, wedge, openOut, openIn);
+
+		// one quadric per position: the planes of its triangles, plus planes standing on its border and seam edges
+		std::vector<Quadric> quadrics(vertexCount);
+		for (size_t t = 0; t + 2 < result.size(); t += 3)
+		{
+			const unsigned int* triangle = &result[t];
+			Quadric q = planeQuadric(positions[triangle[0]], positions[triangle[1]], positions[triangle[2]]);
+			for (int k = 0; k < 3; ++k)
+				quadrics[remap[triangle[k]]].Add(q);
+			for (int k = 0; k < 3; ++k)
+			{
+				const unsigned int a = triangle[k], b = triangle[(k + 1) % 3];
+				if (openOut[a] == b)
+				{
+					// borders are held harder than seams, which have surface on both sides
+					Quadric edge = edgeQuadric(positions[a], positions[b], positions[triangle[(k + 2) % 3]], kinds[remap[a]] == KIND_BORDER ? 10.0 : 1.0);
+					quadrics[remap[a]].Add(edge);
+					quadrics[remap[b]].Add(edge);
+				}
+			}
+		}
+
+		const double errorLimit = (double)maxError * maxError;
+		double worstError = 0.0;
+		std::vector<unsigned int> collapseRemap(vertexCount);
+		std::vector<unsigned char> collapseLocked(vertexCount);
+		std::vector<Collapse> collapses;
+
+		for (bool firstPass = true; result.size() > targetIndexCount; firstPass = false)
+		{
+			// collapses shorten borders and seams, so their open edges move
+			if (!firstPass)
+				findOpenEdges(result, vertexCount, openOut, openIn);
+
+			// every edge once, in the cheaper allowed direction
+			collapses.clear();
+			for (size_t t = 0; t + 2 < result.size(); t += 3)
+			{
+				for (int k = 0; k < 3; ++k)
+				{
+					const unsigned int a = result[t + k], b = result[t + (k + 1) % 3];
+					// interior edges come up twice, once from each side
+					if (kinds[remap[a]] == KIND_MANIFOLD && kinds[remap[b]] == KIND_MANIFOLD && a > b)
+						continue;
+					const bool ab = canCollapse(a, b, remap, kinds, openOut, openIn), ba = canCollapse(b, a, remap, kinds, openOut, openIn);
+					if (!ab && !ba)
+						continue;
+					const double costAB = ab ? quadrics[remap[a]].Evaluate(positions[b]) : 1e30;
+					const double costBA = ba ? quadrics[remap[b]].Evaluate(positions[a]) : 1e30;
+					collapses.push_back(costAB <= costBA ? Collapse{ a, b, costAB } : Collapse{ b, a, costBA });
+				}
+			}
+			if (collapses.empty())
+				break;
+			std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.Cost < y.Cost; });
+
+			std::vector<std::vector<unsigned int>> adjacency = buildAdjacency(result, remap, vertexCount);
+
+			// each collapse removes about two triangles; vertices touched this pass wait for the next one
+			const size_t goal = std::max((result.size() - targetIndexCount) / 6, (size_t)1);
+			size_t applied = 0;
+			for (size_t v = 0; v < vertexCount; ++v)
+				collapseRemap[v] = (unsigned int)v;
+			std::fill(collapseLocked.begin(), collapseLocked.end(), 0);
+
+			for (const Collapse& collapse : collapses)
+			{
+				if (collapse.Cost > errorLimit || applied >= goal)
+					break;
+				const unsigned int r0 = remap[collapse.From], r1 = remap[collapse.To];
+				if (collapseLocked[r0] || collapseLocked[r1])
+					continue;
+				if (flipsTriangles(result, adjacency[r0], remap, positions, r0, r1, collapse.To))
+					continue;
+
+				if (kinds[r0] == KIND_SEAM)
+				{
+					// the other side of the seam follows along the same edge
+					const unsigned int s0 = wedge[collapse.From];
+					const unsigned int s1 = openOut[collapse.From] == collapse.To ? openIn[s0] : openOut[s0];
+					if (s1 >= MANY || remap[s1] != r1)
+						continue;
+					collapseRemap[s0] = s1;
+				}
+				collapseRemap[collapse.From] = collapse.To;
+				quadrics[r1].Add(quadrics[r0]);
+				// the flip test above assumed the rest of these triangles stay put
+				for (unsigned int t : adjacency[r0])
+					for (int k = 0; k < 3; ++k)
+						collapseLocked[remap[result[t + k]]] = 1;
+				worstError = std::max(worstError, collapse.Cost);
+				++applied;
+			}
+			if (applied == 0)
+				break;
+
+			// drop the triangles that lost their area
+			size_t write = 0;
+			for (size_t t = 0; t + 2 < result.size(); t += 3)
+			{
+				const unsigned int a = collapseRemap[result[t]], b = collapseRemap[result[t + 1]], c = collapseRemap[result[t + 2]];
+				if (remap[a] == remap[b] || remap[b] == remap[c] || remap[c] == remap[a])
+					continue;
+				result[write++] = a;
+				result[write++] = b;
+				result[write++] = c;
+			}
+			result.resize(write);
+		}
+
+		if (resultError)
+			*resultError = (float)std::sqrt(worstError);
+		return result;
+	}
+
+	// Level 0 is the mesh itself, every further level keeps about `ratio` of the triangles of the one before.
+	// The chain stops early once a level would not save at least a fifth of the triangles or would exceed
+	// maxError (relative to the mesh extent). Level errors are quadric estimates in object units and grow down
+	// the chain.
+	static std::vector<LodLevel> BuildLodChain(const IndexedMesh& mesh, unsigned int maxLevels, float ratio = 0.5f, float maxError = 0.05f,
+		unsigned int cacheSize = 32)
+	{
+		std::vector<LodLevel> levels(1);
+		levels[0].Indices = mesh.Indices;
+		if (mesh.Vertices.empty())
+			return levels;
+
+		float extent = 0.0f;
+		for (int k = 0; k < 3; ++k)
+		{
+			float low = 3.0e38f, high = -3.0e38f;
+			for (size_t v = 0; v < mesh.VertexCount(); ++v)
+			{
+				low = std::min(low, mesh.Vertices[v * mesh.FloatsPerVertex + k]);
+				high = std::max(high, mesh.Vertices[v * mesh.FloatsPerVertex + k]);
+			}
+			extent = std::max(extent, high - low);
+		}
+
+		while (levels.size() < maxLevels)
+		{
+			const LodLevel& previous = levels.back();
+			const size_t target = (size_t)(previous.Indices.size() / 3 * ratio) * 3;
+			float error = 0.0f;
+			LodLevel level;
+			level.Indices = Simplify(previous.Indices.data(), previous.Indices.size(), mesh.Vertices.data(), mesh.FloatsPerVertex, mesh.VertexCount(),
+				target, maxError, &error);
+			if (level.Indices.empty() || level.Indices.size() * 5 > previous.Indices.size() * 4)
+				break;
+			// each level was simplified from the one before, so their errors add up
+			level.Error = previous.Error + error * extent;
+			if (cacheSize > 0)
+				MeshOptimizer::OptimizeVertexCache(level.Indices.data(), level.Indices.size(), mesh.VertexCount(), cacheSize);
+			levels.push_back(level);
+		}
+		return levels;
+	}
+
+private:
+	enum VertexKind { KIND_MANIFOLD, KIND_BORDER, KIND_SEAM, KIND_LOCKED };
+	// open edge lookups: no such edge, or more than one
+	enum : unsigned int { NONE = ~0u, MANY = ~0u - 1 };
+
+	struct Vector3 {
+		double x, y, z;
+	};
+
+	struct Collapse {
+		unsigned int From;
+		unsigned int To;
+		double Cost;
+	};
+
+	// symmetric 4x4 matrix of weighted plane equations; v^T Q v over the total weight is the mean squared
+	// distance of v from the planes
+	struct Quadric {
+		double a00 = 0, a01 = 0, a02 = 0, a03 = 0, a11 = 0, a12 = 0, a13 = 0, a22 = 0, a23 = 0, a33 = 0;
+		double Weight = 0;
+
+		void AddPlane(double nx, double ny, double nz, double d, double weight)
+		{
+			Weight += weight;
+			a00 += weight * nx * nx; a01 += weight * nx * ny; a02 += weight * nx * nz; a03 += weight * nx * d;
+			a11 += weight * ny * ny; a12 += weight * ny * nz; a13 += weight * ny * d;
+			a22 += weight * nz * nz; a23 += weight * nz * d;
+			a33 += weight * d * d;
+		}
+
+		void Add(const Quadric& q)
+		{
+			a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03; a11 += q.a11;
+			a12 += q.a12; a13 += q.a13; a22 += q.a22; a23 += q.a23; a33 += q.a33;
+			Weight += q.Weight;
+		}
+
+		double Evaluate(const Vector3& v) const
+		{
+			const double x = v.x, y = v.y, z = v.z;
+			const double result = x * x * a00 + y * y * a11 + z * z * a22 + a33 +
+				2.0 * (x * y * a01 + x * z * a02 + y * z * a12 + x * a03 + y * a13 + z * a23);
+			return Weight > 0.0 ? std::max(result, 0.0) / Weight : 0.0;
+		}
+	};
+
+	static Vector3 subtract(const Vector3& a, const Vector3& b)
+	{
+		return { a.x - b.x, a.y - b.y, a.z - b.z };
+	}
+
+	static Vector3 cross(const Vector3& a, const Vector3& b)
+	{
+		return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+	}
+
+	static double dot(const Vector3& a, const Vector3& b)
+	{
+		return a.x * b.x + a.y * b.y + a.z * b.z;
+	}
+
+	// plane of the triangle weighted by its area, so slivers count for little
+	static Quadric planeQuadric(const Vector3& a, const Vector3& b, const Vector3& c)
+	{
+		Vector3 n = cross(subtract(b, a), subtract(c, a));
+		const double length = std::sqrt(dot(n, n));
+		Quadric q;
+		if (length > 0.0)
+		{
+			n = { n.x / length, n.y / length, n.z / length };
+			q.AddPlane(n.x, n.y, n.z, -dot(n, a), length * 0.5);
+		}
+		return q;
+	}
+
+	// plane through the edge a-b perpendicular to its triangle, which holds the edge in place
+	static Quadric edgeQuadric(const Vector3& a, const Vector3& b, const Vector3& c, double weight)
+	{
+		const Vector3 edge = subtract(b, a);
+		Vector3 n = cross(edge, cross(edge, subtract(c, a)));
+		const double length = std::sqrt(dot(n, n));
+		Quadric q;
+		if (length > 0.0)
+		{
+			n = { n.x / length, n.y / length, n.z / length };
+			q.AddPlane(n.x, n.y, n.z, -dot(n, a), weight * dot(edge, edge));
+		}
+		return q;
+	}
+
+	// remap: the first vertex with the same position; wedge: a circular list through the vertices of one position
+	static void buildPositionRemap(const float* vertices, size_t stride, size_t vertexCount, std::vector<unsigned int>& remap, std::vector<unsigned int>& wedge)
+	{
+		std::unordered_map<uint64_t, std::vector<unsigned int>> buckets;
+		remap.resize(vertexCount);
+		wedge.resize(vertexCount);
+		for (size_t v = 0; v < vertexCount; ++v)
+		{
+			const float* p = vertices + v * stride;
+			unsigned int bits[3];
+			std::memcpy(bits, p, sizeof(bits));
+			const uint64_t hash = ((uint64_t)bits[0] * 73856093u) ^ ((uint64_t)bits[1] * 19349663u) ^ ((uint64_t)bits[2] * 83492791u);
+			std::vector<unsigned int>& bucket = buckets[hash];
+			remap[v] = (unsigned int)v;
+			wedge[v] = (unsigned int)v;
+			for (unsigned int other : bucket)
+			{
+				if (std::memcmp(vertices + other * stride, p, 3 * sizeof(float)) == 0)
+				{
+					remap[v] = other;
+					// splice v into the wedge of other
+					wedge[v] = wedge[other];
+					wedge[other] = (unsigned int)v;
+					break;
+				}
+			}
+			if (remap[v] == v)
+				bucket.push_back((unsigned int)v);
+		}
+	}
+
+	// For each vertex the far end of its outgoing and incoming edges that have no twin, NONE or MANY. Edges are
+	// matched by vertex, not position, so attribute seams show up as open edges too.
+	static void findOpenEdges(const std::vector<unsigned int>& indices, size_t vertexCount, std::vector<unsigned int>& openOut, std::vector<unsigned int>& openIn)
+	{
+		std::unordered_set<uint64_t> edges;
+		edges.reserve(indices.size());
+		for (size_t t = 0; t + 2 < indices.size(); t += 3)
+			for (int k = 0; k < 3; ++k)
+				edges.insert(edgeKey(indices[t + k], indices[t + (k + 1) % 3]));
+
+		openOut.assign(vertexCount, NONE);
+		openIn.assign(vertexCount, NONE);
+		for (size_t t = 0; t + 2 < indices.size(); t += 3)
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				const unsigned int a = indices[t + k], b = indices[t + (k + 1) % 3];
+				if (edges.count(edgeKey(b, a)))
+					continue;
+				openOut[a] = openOut[a] == NONE ? b : MANY;
+				openIn[b] = openIn[b] == NONE ? a : MANY;
+			}
+		}
+	}
+
+	static uint64_t edgeKey(unsigned int a, unsigned int b)
+	{
+		return ((uint64_t)a << 32) | b;
+	}
+
+	// kind of every position, stored at its remap vertex
+	static std::vector<unsigned char> classifyVertices(const std::vector<unsigned int>& remap, const std::vector<unsigned int>& wedge,
+		const std::vector<unsigned int>& openOut, const std::vector<unsigned int>& openIn)
+	{
+		std::vector<unsigned char> kinds(remap.size(), KIND_LOCKED);
+		for (size_t v = 0; v < remap.size(); ++v)
+		{
+			if (remap[v] != v)
+				continue;
+			const unsigned int w = wedge[v];
+			if (w == v)
+			{
+				if (openOut[v] == NONE && openIn[v] == NONE)
+					kinds[v] = KIND_MANIFOLD;
+				else if (openOut[v] < MANY && openIn[v] < MANY)
+					kinds[v] = KIND_BORDER;
+			}
+			else if (wedge[w] == v && openOut[v] < MANY && openIn[v] < MANY && openOut[w] < MANY && openIn[w] < MANY)
+			{
+				// a seam runs through both vertices the same way: what leaves one enters the other
+				if (remap[openOut[v]] == remap[openIn[w]] && remap[openIn[v]] == remap[openOut[w]])
+					kinds[v] = KIND_SEAM;
+			}
+		}
+		return kinds;
+	}
+
+	static bool canCollapse(unsigned int from, unsigned int to, const std::vector<unsigned int>& remap, const std::vector<unsigned char>& kinds,
+		const std::vector<unsigned int>& openOut, const std::vector<unsigned int>& openIn)
+	{
+		const unsigned char kind = kinds[remap[from]];
+		if (kind == KIND_MANIFOLD)
+			return true;
+		if (kind == KIND_LOCKED || kinds[remap[to]] != kind)
+			return false;
+		// borders and seams only shorten themselves
+		return openOut[from] == to || openIn[from] == to;
+	}
+
+	// triangles around every position
+	static std::vector<std::vector<unsigned int>> buildAdjacency(const std::vector<unsigned int>& indices, const std::vector<unsigned int>& remap, size_t vertexCount)
+	{
+		std::vector<std::vector<unsigned int>> adjacency(vertexCount);
+		for (size_t t = 0; t + 2 < indices.size(); t += 3)
+			for (int k = 0; k < 3; ++k)
+				adjacency[remap[indices[t + k]]].push_back((unsigned int)t);
+		return adjacency;
+	}
+
+	// true if moving position r0 onto the vertex `to` turns any surviving triangle around r0 too far
+	static bool flipsTriangles(const std::vector<unsigned int>& indices, const std::vector<unsigned int>& triangles, const std::vector<unsigned int>& remap,
+		const std::vector<Vector3>& positions, unsigned int r0, unsigned int r1, unsigned int to)
+	{
+		for (unsigned int t : triangles)
+		{
+			const unsigned int* triangle = &indices[t];
+			Vector3 corners[3], moved[3];
+			bool collapses = false;
+			for (int k = 0; k < 3; ++k)
+			{
+				corners[k] = positions[triangle[k]];
+				moved[k] = remap[triangle[k]] == r0 ? positions[to] : corners[k];
+				collapses = collapses || remap[triangle[k]] == r1;
+			}
+			if (collapses)
+				continue;
+			const Vector3 before = cross(subtract(corners[1], corners[0]), subtract(corners[2], corners[0]));
+			const Vector3 after = cross(subtract(moved[1], moved[0]), subtract(moved[2], moved[0]));
+			// a triangle turning by more than about 75 degrees is as good as folded over
+			if (dot(before, after) < 0.25 * std::sqrt(dot(before, before) * dot(after, after)))
+				return true;
+		}
+		return false;
+	}
+};
+
+// Picks a level from a chain by how large its error shows on screen
+class LodSelector
+{
+public:
+	// The coarsest level whose estimated error covers at most maxPixels at pixelsPerUnit, starting from the level drawn
+	// last time. Refining happens as soon as the current level is over budget, but coarsening waits until the
+	// coarser level is under the budget less the hysteresis fraction, so an object sitting at a threshold
+	// distance does not pop back and forth. errors grow with the level.
+	static unsigned int Select(const float* errors, unsigned int levelCount, float pixelsPerUnit, unsigned int current, float maxPixels, float hysteresis = 0.25f)
+	{
+		if (levelCount == 0)
+			return 0;
+		unsigned int level = std::min(current, levelCount - 1);
+		while (level > 0 && errors[level] * pixelsPerUnit > maxPixels)
+			--level;
+		while (level + 1 < levelCount && errors[level + 1] * pixelsPerUnit <= maxPixels * (1.0f - hysteresis))
+			++level;
+		return level;
+	}
+};
+#endif
@@ -0,0 +1,131 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cstddef>
+#include <iostream>
+
+// A whole file mapped read-only into memory. Pages are read in by the OS on first touch, so
+// handing Data() to glBufferStorage streams the file straight into the buffer with no parsing
+// and no intermediate copy in the application.
+class MappedFile
+{
+public:
+	MappedFile() {}
+	~MappedFile()
+	{
+		Close();
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool Open(const char* path)
+	{
+		Close();
+#if defined(_WIN32)
+		file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			std::cout << "ERROR::MAPPEDFILE::Could not open " << path << std::endl;
+			return false;
+		}
+		LARGE_INTEGER fileSize;
+		GetFileSizeEx(file, &fileSize);
+		size = (size_t)fileSize.QuadPart;
+		if (size > 0)
+		{
+			mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+			data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+		}
+#else
+		descriptor = open(path, O_RDONLY);
+		if (descriptor < 0)
+		{
+			std::cout << "ERROR::MAPPEDFILE::Could not open " << path << std::endl;
+			return false;
+		}
+		struct stat status;
+		fstat(descriptor, &status);
+		size = (size_t)status.st_size;
+		if (size > 0)
+		{
+			data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+			if (data == MAP_FAILED)
+				data = NULL;
+			else
+				madvise(data, size, MADV_SEQUENTIAL);
+		}
+#endif
+		if (size > 0 && data == NULL)
+		{
+			std::cout << "ERROR::MAPPEDFILE::Could not map " << path << std::endl;
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+	void Close()
+	{
+#if defined(_WIN32)
+		if (data)
+			UnmapViewOfFile(data);
+		if (mapping)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+		mapping = NULL;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (data)
+			munmap(data, size);
+		if (descriptor >= 0)
+			close(descriptor);
+		descriptor = -1;
+#endif
+		data = NULL;
+		size = 0;
+	}
+
+	const unsigned char* Data() const
+	{
+		return (const unsigned char*)data;
+	}
+
+	size_t Size() const
+	{
+		return size;
+	}
+
+	bool IsOpen() const
+	{
+#if defined(_WIN32)
+		return file != INVALID_HANDLE_VALUE;
+#else
+		return descriptor >= 0;
+#endif
+	}
+
+private:
+	void* data = NULL;
+	size_t size = 0;
+#if defined(_WIN32)
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+#else
+	int descriptor = -1;
+#endif
+};
+#endif
@@ -7,6 +7,8 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "shader.h"
+#include "meshopt.h"
+#include "vertexformat.h"
 
 #include <string>
 #include <vector>
@@ -31,6 +33,23 @@ struct Texture {
 	string path;
 };
 
+// converts packed position/normal/texCoords vertices (8 floats each), e.g. welded by MeshOptimizer::WeldVertices
+// in meshopt.h, into Mesh vertices; tangent and bitangent are left zero
+inline vector<Vertex> UnpackVertices(const vector<float>& packed)
+{
+	vector<Vertex> vertices(packed.size() / 8);
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		const float* v = &packed[i * 8];
+		vertices[i].Position = glm::vec3(v[0], v[1], v[2]);
+		vertices[i].Normal = glm::vec3(v[3], v[4], v[5]);
+		vertices[i].TexCoords = glm::vec2(v[6], v[7]);
+		vertices[i].Tangent = glm::vec3(0.0f);
+		vertices[i].Bitangent = glm::vec3(0.0f);
+	}
+	return vertices;
+}
+
 class Mesh {
 public:
 	// mesh Data
@@ -39,17 +58,53 @@ public:
 	vector<Texture>      textures;
 	unsigned int VAO;
 
-	// constructor
-	Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+	// layout of the GPU copy; the compact formats need a shader built with VertexDecodeSource(format)
+	VertexFormat format;
+	PositionDequantization dequantization;
+	// GL_UNSIGNED_SHORT whenever every vertex can be addressed with 16 bits
+	GLenum indexType;
+	// what Draw reads from the element buffer; indexOffset is in bytes
+	unsigned int indexCount;
+	size_t indexOffset;
+
+	// constructor; a non-zero vertexCacheSize reorders the triangles for a post-transform cache of that many entries,
+	// then against overdraw, and the vertices into first-use order
+	Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, unsigned int vertexCacheSize = 0,
+		VertexFormat format = VERTEX_FORMAT_FLOAT)
 	{
 		this->vertices = vertices;
 		this->indices = indices;
 		this->textures = textures;
+		this->format = format;
+		this->indexCount = (unsigned int)indices.size();
+		this->indexOffset = 0;
+
+		// loaders building many meshes can run MeshOptimizer::OptimizeVertexCacheParallel on the indices first instead
+		if (vertexCacheSize > 0 && !this->vertices.empty())
+		{
+			MeshOptimizer::OptimizeVertexCache(this->indices.data(), this->indices.size(), this->vertices.size(), vertexCacheSize);
+			MeshOptimizer::OptimizeOverdraw(this->indices.data(), this->indices.size(), &this->vertices[0].Position.x,
+				sizeof(Vertex) / sizeof(float), this->vertices.size(), vertexCacheSize);
+			MeshOptimizer::OptimizeVertexFetch(this->indices, this->vertices);
+		}
 
 		// now that we have all the required data, set the vertex buffers and its attribute pointers.
 		setupMesh();
 	}
 
+	// Wraps geometry already in GPU buffers owned elsewhere, e.g. the mapped binary chunk of a glTF file:
+	// vao has its attributes and element buffer set up. vertices and indices stay empty.
+	Mesh(unsigned int vao, GLenum indexType, size_t indexOffset, unsigned int indexCount, vector<Texture> textures)
+	{
+		this->VAO = vao;
+		this->indexType = indexType;
+		this->indexOffset = indexOffset;
+		this->indexCount = indexCount;
+		this->textures = textures;
+		this->format = VERTEX_FORMAT_FLOAT;
+		VBO = EBO = 0;
+	}
+
 	// render the mesh
 	void Draw(Shader &shader)
 	{
@@ -74,14 +129,21 @@ public:
 				number = std::to_string(heightNr++); // transfer unsigned int to stream
 
 			// now set the sampler to the correct texture unit
-			glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
+			shader.setInt(name + number, i);
 			// and finally bind the texture
 			glBindTexture(GL_TEXTURE_2D, textures[i].id);
 		}
 
+		// compact positions are stored relative to the mesh bounds
+		if (format != VERTEX_FORMAT_FLOAT)
+		{
+			shader.setVec3("positionOffset", dequantization.Offset);
+			shader.setVec3("positionScale", dequantization.Scale);
+		}
+
 		// draw mesh
 		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+		glDrawElements(GL_TRIANGLES, indexCount, indexType, (void*)indexOffset);
 		glBindVertexArray(0);
 
 		// always good practice to set everything back to defaults once configured.
@@ -101,34 +163,113 @@ private:
 		glGenBuffers(1, &EBO);
 
 		glBindVertexArray(VAO);
-		// load data into vertex buffers
-		glBindBuffer(GL_ARRAY_BUFFER, VBO);
-		// A great thing about structs is that their memory layout is sequential for all its items.
-		// The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
-		// again translates to 3/2 floats which translates to a byte array.
-		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+		if (format != VERTEX_FORMAT_FLOAT)
+		{
+			setupCompactAttributes();
+		}
+		else
+		{
+			// load data into vertex buffers
+			glBindBuffer(GL_ARRAY_BUFFER, VBO);
+			// A great thing about structs is that their memory layout is sequential for all its items.
+			// The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
+			// again translates to 3/2 floats which translates to a byte array.
+			glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
 
+			// set the vertex attribute pointers
+			// vertex Positions
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+			// vertex normals
+			glEnableVertexAttribArray(1);
+			glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+			// vertex texture coords
+			glEnableVertexAttribArray(2);
+			glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+			// vertex tangent
+			glEnableVertexAttribArray(3);
+			glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+			// vertex bitangent
+			glEnableVertexAttribArray(4);
+			glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+		}
+
+		// 16-bit indices halve the index buffer whenever the mesh is small enough
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-
-		// set the vertex attribute pointers
-		// vertex Positions
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-		// vertex normals
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-		// vertex texture coords
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-		// vertex tangent
-		glEnableVertexAttribArray(3);
-		glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
-		// vertex bitangent
-		glEnableVertexAttribArray(4);
-		glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+		if (vertices.size() <= 65536)
+		{
+			vector<unsigned short> shortIndices(indices.begin(), indices.end());
+			indexType = GL_UNSIGNED_SHORT;
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, shortIndices.size() * sizeof(unsigned short), shortIndices.data(), GL_STATIC_DRAW);
+		}
+		else
+		{
+			indexType = GL_UNSIGNED_INT;
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+		}
 
 		glBindVertexArray(0);
 	}
+
+	// Quantizes the vertices into the compact format and describes it so vertex fetch does the conversion:
+	// normalized shorts and 10:10:10:2 arrive as floats in [-1, 1], half floats as floats
+	void setupCompactAttributes()
+	{
+		dequantization = VertexQuantizer::ComputeDequantization(&vertices[0].Position.x, sizeof(Vertex) / sizeof(float), vertices.size());
+
+		vector<unsigned char> packed(vertices.size() * VertexQuantizer::Stride(format));
+		for (size_t i = 0; i < vertices.size(); i++)
+		{
+			const Vertex& vertex = vertices[i];
+			glm::vec3 normal = glm::normalize(vertex.Normal);
+			glm::vec3 tangent;
+			float bitangentSign = VertexQuantizer::OrthonormalizeFrame(normal, vertex.Tangent, vertex.Bitangent, tangent);
+			if (format == VERTEX_FORMAT_COMPACT)
+			{
+				CompactVertex* out = (CompactVertex*)&packed[i * sizeof(CompactVertex)];
+				VertexQuantizer::QuantizePosition(vertex.Position, dequantization, out->Position);
+				glm::vec2 octahedral = VertexQuantizer::EncodeOctahedral(normal);
+				out->Normal[0] = (int16_t)VertexQuantizer::QuantizeSnorm(octahedral.x, 16);
+				out->Normal[1] = (int16_t)VertexQuantizer::QuantizeSnorm(octahedral.y, 16);
+				out->Tangent = VertexQuantizer::PackSnorm1010102(tangent.x, tangent.y, tangent.z, bitangentSign);
+				out->TexCoords[0] = VertexQuantizer::FloatToHalf(vertex.TexCoords.x);
+				out->TexCoords[1] = VertexQuantizer::FloatToHalf(vertex.TexCoords.y);
+			}
+			else
+			{
+				QuaternionVertex* out = (QuaternionVertex*)&packed[i * sizeof(QuaternionVertex)];
+				VertexQuantizer::QuantizePosition(vertex.Position, dequantization, out->Position);
+				glm::vec4 frame = VertexQuantizer::FrameToQuaternion(normal, tangent, bitangentSign);
+				for (int k = 0; k < 4; k++)
+					out->Frame[k] = (int16_t)VertexQuantizer::QuantizeSnorm(frame[k], 16);
+				out->TexCoords[0] = VertexQuantizer::FloatToHalf(vertex.TexCoords.x);
+				out->TexCoords[1] = VertexQuantizer::FloatToHalf(vertex.TexCoords.y);
+			}
+		}
+
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBufferData(GL_ARRAY_BUFFER, packed.size(), packed.data(), GL_STATIC_DRAW);
+
+		if (format == VERTEX_FORMAT_COMPACT)
+		{
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 4, GL_SHORT, GL_TRUE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, Position));
+			glEnableVertexAttribArray(1);
+			glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, Normal));
+			glEnableVertexAttribArray(2);
+			glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, TexCoords));
+			glEnableVertexAttribArray(3);
+			glVertexAttribPointer(3, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(CompactVertex), (void*)offsetof(CompactVertex, Tangent));
+		}
+		else
+		{
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 4, GL_SHORT, GL_TRUE, sizeof(QuaternionVertex), (void*)offsetof(QuaternionVertex, Position));
+			glEnableVertexAttribArray(1);
+			glVertexAttribPointer(1, 4, GL_SHORT, GL_TRUE, sizeof(QuaternionVertex), (void*)offsetof(QuaternionVertex, Frame));
+			glEnableVertexAttribArray(2);
+			glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(QuaternionVertex), (void*)offsetof(QuaternionVertex, TexCoords));
+		}
+	}
 };
 #endif
\ No newline at end of file
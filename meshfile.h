@@ -0,0 +1,248 @@
+#ifndef MESHFILE_H
+#define MESHFILE_H
+
+#include "mappedfile.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// One vertex attribute as glVertexAttribFormat takes it
+struct MeshFileAttribute {
+	uint32_t Location;
+	uint32_t Components;
+	uint32_t Type;        // GL type enum, e.g. GL_FLOAT (0x1406)
+	uint32_t Normalized;
+	uint32_t Offset;      // bytes from the start of the vertex
+};
+
+// File header; every offset is from the start of the file and 16-byte aligned
+struct MeshFileHeader {
+	char Magic[4];        // "MSHB"
+	uint32_t Version;
+	uint32_t VertexStride;
+	uint32_t AttributeCount;
+	MeshFileAttribute Attributes[8];
+	uint32_t IndexSize;   // 2 or 4 bytes
+	uint32_t MeshCount;
+	float BoundsMin[3];   // of every mesh together
+	float BoundsMax[3];
+	uint64_t MeshTableOffset;
+	uint64_t VertexDataOffset;
+	uint64_t VertexDataSize;
+	uint64_t IndexDataOffset;
+	uint64_t IndexDataSize;
+};
+
+// One mesh of the file, addressed like a MeshRange: indices are local to the mesh and BaseVertex places them
+struct MeshFileEntry {
+	char Name[32];
+	uint32_t FirstIndex;
+	uint32_t IndexCount;
+	int32_t BaseVertex;
+	uint32_t VertexCount;
+	float BoundsMin[3];
+	float BoundsMax[3];
+	float Error;          // of a simplified level of detail, in object units; 0 for full detail
+};
+
+// Versioned binary mesh container: header with the vertex layout descriptor and bounds, a mesh table,
+// then the vertex and index blobs exactly as the GPU reads them (little-endian). Opening maps the file and
+// validates the header, the alignment of its offsets and the ranges of the mesh table, without touching the
+// blobs, so VertexData() and IndexData() can go straight to glBufferStorage.
+class MeshFile
+{
+public:
+	static const uint32_t VERSION = 2;
+
+	bool Open(const char* path)
+	{
+		if (!file.Open(path))
+			return false;
+
+		const size_t size = file.Size();
+		if (size < sizeof(MeshFileHeader) || std::memcmp(header().Magic, "MSHB", 4) != 0)
+		{
+			std::cout << "ERROR::MESHFILE::" << path << " is not a mesh file" << std::endl;
+			file.Close();
+			return false;
+		}
+		const MeshFileHeader& h = header();
+		if (h.Version != VERSION)
+		{
+			std::cout << "ERROR::MESHFILE::" << path << " has version " << h.Version << ", expected " << VERSION << std::endl;
+			file.Close();
+			return false;
+		}
+		if (h.AttributeCount > 8 || (h.IndexSize != 2 && h.IndexSize != 4) || !fits(h.MeshTableOffset, (uint64_t)h.MeshCount * sizeof(MeshFileEntry), size) ||
+			!fits(h.VertexDataOffset, h.VertexDataSize, size) || !fits(h.IndexDataOffset, h.IndexDataSize, size))
+		{
+			std::cout << "ERROR::MESHFILE::" << path << " is truncated or corrupt" << std::endl;
+			file.Close();
+			return false;
+		}
+		// the mesh table is read in place as MeshFileEntry structs and the blobs go to the GPU as they are
+		if (align(h.MeshTableOffset) != h.MeshTableOffset || align(h.VertexDataOffset) != h.VertexDataOffset ||
+			align(h.IndexDataOffset) != h.IndexDataOffset)
+		{
+			std::cout << "ERROR::MESHFILE::" << path << " has a mesh table or data offset that is not 16-byte aligned" << std::endl;
+			file.Close();
+			return false;
+		}
+		// every mesh has to lie within the blobs, or drawing it would read past the GPU buffers
+		const uint64_t indexCount = h.IndexDataSize / h.IndexSize;
+		const uint64_t vertexCount = h.VertexStride == 0 ? 0 : h.VertexDataSize / h.VertexStride;
+		for (uint32_t i = 0; i < h.MeshCount; ++i)
+		{
+			const MeshFileEntry& mesh = Meshes()[i];
+			if ((uint64_t)mesh.FirstIndex + mesh.IndexCount > indexCount || mesh.BaseVertex < 0 ||
+				(uint64_t)mesh.BaseVertex + mesh.VertexCount > vertexCount)
+			{
+				std::cout << "ERROR::MESHFILE::" << path << " has mesh " << i << " outside its vertex or index data" << std::endl;
+				file.Close();
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void Close()
+	{
+		file.Close();
+	}
+
+	const MeshFileHeader& Header() const
+	{
+		return header();
+	}
+
+	const MeshFileEntry* Meshes() const
+	{
+		return (const MeshFileEntry*)(file.Data() + header().MeshTableOffset);
+	}
+
+	// the mesh with the given name, or NULL
+	const MeshFileEntry* Find(const char* name) const
+	{
+		for (uint32_t i = 0; i < header().MeshCount; ++i)
+		{
+			if (std::strncmp(Meshes()[i].Name, name, sizeof(Meshes()[i].Name)) == 0)
+				return &Meshes()[i];
+		}
+		return NULL;
+	}
+
+	const void* VertexData() const
+	{
+		return file.Data() + header().VertexDataOffset;
+	}
+
+	const void* IndexData() const
+	{
+		return file.Data() + header().IndexDataOffset;
+	}
+
+	// true if the vertices are laid out exactly as described, so a reader can reject files it cannot draw
+	bool HasLayout(uint32_t stride, const MeshFileAttribute* attributes, uint32_t attributeCount) const
+	{
+		const MeshFileHeader& h = header();
+		return h.VertexStride == stride && h.AttributeCount == attributeCount &&
+		       std::memcmp(h.Attributes, attributes, attributeCount * sizeof(MeshFileAttribute)) == 0;
+	}
+
+	// Writes a mesh file. meshes only need Name, FirstIndex, IndexCount, BaseVertex, VertexCount and Error filled in;
+	// their bounds are computed from the float3 positions at positionOffset in every vertex.
+	static bool Write(const char* path, std::vector<MeshFileEntry> meshes, const MeshFileAttribute* attributes, uint32_t attributeCount,
+		uint32_t vertexStride, uint32_t positionOffset, const void* vertices, size_t vertexBytes, const void* indices, size_t indexBytes, uint32_t indexSize)
+	{
+		if (attributeCount > 8)
+		{
+			std::cout << "ERROR::MESHFILE::At most 8 vertex attributes are supported" << std::endl;
+			return false;
+		}
+
+		MeshFileHeader h;
+		std::memset(&h, 0, sizeof(h));
+		std::memcpy(h.Magic, "MSHB", 4);
+		h.Version = VERSION;
+		h.VertexStride = vertexStride;
+		h.AttributeCount = attributeCount;
+		std::copy(attributes, attributes + attributeCount, h.Attributes);
+		h.IndexSize = indexSize;
+		h.MeshCount = (uint32_t)meshes.size();
+		h.MeshTableOffset = align(sizeof(MeshFileHeader));
+		h.VertexDataOffset = align(h.MeshTableOffset + meshes.size() * sizeof(MeshFileEntry));
+		h.VertexDataSize = vertexBytes;
+		h.IndexDataOffset = align(h.VertexDataOffset + vertexBytes);
+		h.IndexDataSize = indexBytes;
+
+		for (int k = 0; k < 3; ++k)
+		{
+			h.BoundsMin[k] = 3.0e38f;
+			h.BoundsMax[k] = -3.0e38f;
+		}
+		for (MeshFileEntry& mesh : meshes)
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				mesh.BoundsMin[k] = 3.0e38f;
+				mesh.BoundsMax[k] = -3.0e38f;
+			}
+			for (uint32_t i = 0; i < mesh.IndexCount; ++i)
+			{
+				uint32_t index = indexSize == 2 ? ((const uint16_t*)indices)[mesh.FirstIndex + i] : ((const uint32_t*)indices)[mesh.FirstIndex + i];
+				float position[3];
+				std::memcpy(position, (const unsigned char*)vertices + (size_t)(mesh.BaseVertex + index) * vertexStride + positionOffset, sizeof(position));
+				for (int k = 0; k < 3; ++k)
+				{
+					mesh.BoundsMin[k] = std::min(mesh.BoundsMin[k], position[k]);
+					mesh.BoundsMax[k] = std::max(mesh.BoundsMax[k], position[k]);
+				}
+			}
+			for (int k = 0; k < 3; ++k)
+			{
+				h.BoundsMin[k] = std::min(h.BoundsMin[k], mesh.BoundsMin[k]);
+				h.BoundsMax[k] = std::max(h.BoundsMax[k], mesh.BoundsMax[k]);
+			}
+		}
+
+		std::ofstream out(path, std::ios::binary);
+		if (!out.is_open())
+		{
+			std::cout << "ERROR::MESHFILE::Failed to open " << path << " for writing" << std::endl;
+			return false;
+		}
+		const char padding[16] = {};
+		out.write((const char*)&h, sizeof(h));
+		out.write(padding, h.MeshTableOffset - sizeof(h));
+		out.write((const char*)meshes.data(), meshes.size() * sizeof(MeshFileEntry));
+		out.write(padding, h.VertexDataOffset - (h.MeshTableOffset + meshes.size() * sizeof(MeshFileEntry)));
+		out.write((const char*)vertices, vertexBytes);
+		out.write(padding, h.IndexDataOffset - (h.VertexDataOffset + vertexBytes));
+		out.write((const char*)indices, indexBytes);
+		return out.good();
+	}
+
+private:
+	MappedFile file;
+
+	const MeshFileHeader& header() const
+	{
+		return *(const MeshFileHeader*)file.Data();
+	}
+
+	static bool fits(uint64_t offset, uint64_t size, size_t fileSize)
+	{
+		return offset <= fileSize && size <= fileSize - offset;
+	}
+
+	static uint64_t align(uint64_t offset)
+	{
+		return (offset + 15) & ~(uint64_t)15;
+	}
+};
+#endif
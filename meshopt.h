@@ -0,0 +1,589 @@
+#ifndef MESHOPT_H
+#define MESHOPT_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <future>
+#include <queue>
+#include <utility>
+#include <vector>
+
+// Vertex and index data of an indexed triangle mesh; every vertex is FloatsPerVertex consecutive floats
+struct IndexedMesh {
+	std::vector<float> Vertices;
+	std::vector<unsigned int> Indices;
+	unsigned int FloatsPerVertex = 8;
+
+	size_t VertexCount() const
+	{
+		return Vertices.size() / FloatsPerVertex;
+	}
+};
+
+// Post-transform cache efficiency of an index buffer
+struct VertexCacheStats {
+	size_t Transforms = 0;  // vertex shader invocations
+	float ACMR = 0.0f;      // transforms per triangle
+	float ATVR = 0.0f;      // transforms per unique vertex
+};
+
+// Load-time mesh processing: welding triangle soups into indexed meshes, reordering them for vertex reuse,
+// overdraw and fetch locality, and measuring the result
+class MeshOptimizer
+{
+public:
+	// Merges bit-identical vertices of a non-indexed triangle list (three vertices per triangle) and
+	// returns the unique vertices in first-use order with an index buffer that reproduces the triangles.
+	// Vertices are compared on their raw floats, so only exact duplicates merge (-0 and +0 count as equal).
+	static IndexedMesh WeldVertices(const float* vertices, size_t vertexCount, unsigned int floatsPerVertex = 8)
+	{
+		IndexedMesh mesh;
+		mesh.FloatsPerVertex = floatsPerVertex;
+		mesh.Indices.resize(vertexCount);
+
+		// open addressing table of unique vertex ids, at most half full
+		size_t tableSize = 1;
+		while (tableSize < vertexCount * 2)
+			tableSize <<= 1;
+		std::vector<unsigned int> table(tableSize, (unsigned int)EMPTY);
+		std::vector<unsigned int> key(floatsPerVertex), existing(floatsPerVertex);
+
+		for (size_t i = 0; i < vertexCount; ++i)
+		{
+			const float* vertex = vertices + i * floatsPerVertex;
+			vertexBits(vertex, floatsPerVertex, key.data());
+
+			size_t slot = hashBits(key.data(), floatsPerVertex) & (tableSize - 1);
+			for (;;)
+			{
+				if (table[slot] == EMPTY)
+				{
+					table[slot] = (unsigned int)mesh.VertexCount();
+					mesh.Vertices.insert(mesh.Vertices.end(), vertex, vertex + floatsPerVertex);
+					break;
+				}
+				vertexBits(&mesh.Vertices[table[slot] * floatsPerVertex], floatsPerVertex, existing.data());
+				if (existing == key)
+					break;
+				slot = (slot + 1) & (tableSize - 1);
+			}
+			mesh.Indices[i] = table[slot];
+		}
+		return mesh;
+	}
+
+	// Vertex shader invocations needed to draw the indices through a FIFO post-transform cache of
+	// cacheSize entries, the model most hardware approximates. Non-indexed draws transform every index.
+	static size_t CountVertexTransforms(const unsigned int* indices, size_t indexCount, size_t vertexCount, unsigned int cacheSize = 32)
+	{
+		// a vertex is in the cache if it was transformed less than cacheSize misses ago
+		std::vector<size_t> transformedAt(vertexCount, 0);
+		size_t transforms = 0;
+		for (size_t i = 0; i < indexCount; ++i)
+		{
+			size_t& stamp = transformedAt[indices[i]];
+			if (stamp == 0 || transforms - stamp >= cacheSize)
+			{
+				++transforms;
+				stamp = transforms;
+			}
+		}
+		return transforms;
+	}
+
+	// Average cache miss ratio (transforms per triangle, 0.5 is the ideal for large regular meshes, 3 the worst)
+	// and average transform to vertex ratio (1 is ideal) of an index buffer under the FIFO cache model
+	static VertexCacheStats AnalyzeVertexCache(const unsigned int* indices, size_t indexCount, size_t vertexCount, unsigned int cacheSize = 32)
+	{
+		VertexCacheStats stats;
+		stats.Transforms = CountVertexTransforms(indices, indexCount, vertexCount, cacheSize);
+		stats.ACMR = indexCount >= 3 ? (float)stats.Transforms / (indexCount / 3) : 0.0f;
+		stats.ATVR = vertexCount > 0 ? (float)stats.Transforms / vertexCount : 0.0f;
+		return stats;
+	}
+
+	// Reorders triangles in place for post-transform cache reuse (Tom Forsyth, "Linear-Speed Vertex Cache
+	// Optimisation"). Each step emits the best-scoring triangle among those touching the simulated LRU cache;
+	// a vertex scores higher the more recently it was used and the fewer triangles still need it. When none of
+	// the cached vertices has triangles left, it restarts from the best-scoring triangle of the whole mesh.
+	static void OptimizeVertexCache(unsigned int* indices, size_t indexCount, size_t vertexCount, unsigned int cacheSize = 32)
+	{
+		const size_t triangleCount = indexCount / 3;
+		if (triangleCount == 0 || cacheSize < 4)
+			return;
+
+		// triangles using each vertex, as ranges into one array
+		std::vector<unsigned int> activeTriangles(vertexCount, 0);
+		for (size_t i = 0; i < triangleCount * 3; ++i)
+			++activeTriangles[indices[i]];
+		std::vector<unsigned int> adjacencyOffset(vertexCount + 1, 0);
+		for (size_t v = 0; v < vertexCount; ++v)
+			adjacencyOffset[v + 1] = adjacencyOffset[v] + activeTriangles[v];
+		std::vector<unsigned int> adjacency(triangleCount * 3);
+		std::vector<unsigned int> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+		for (size_t t = 0; t < triangleCount; ++t)
+			for (int k = 0; k < 3; ++k)
+				adjacency[fill[indices[t * 3 + k]]++] = (unsigned int)t;
+
+		std::vector<int> cachePosition(vertexCount, -1);
+		std::vector<float> vertexScore(vertexCount);
+		for (size_t v = 0; v < vertexCount; ++v)
+			vertexScore[v] = forsythScore(-1, activeTriangles[v], cacheSize);
+
+		std::vector<float> triangleScore(triangleCount);
+		std::vector<bool> emitted(triangleCount, false);
+		for (size_t t = 0; t < triangleCount; ++t)
+			triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+
+		// Restart candidates, highest score first and lowest index among equals (indices are queued inverted). A
+		// restart happens when no cached vertex has triangles left, so every remaining triangle then scores from
+		// uncached vertices alone. A vertex only loses triangles while cached, and that score only rises when it
+		// does; queueing a vertex's triangles again as it leaves the cache makes the first unemitted triangle popped
+		// the best one.
+		auto uncachedScore = [&](unsigned int t) {
+			float score = 0.0f;
+			for (int k = 0; k < 3; ++k)
+				score += forsythScore(-1, activeTriangles[indices[t * 3 + k]], cacheSize);
+			return score;
+		};
+		auto queueRemaining = [&]() {
+			std::vector<std::pair<float, unsigned int>> candidates;
+			for (size_t t = 0; t < triangleCount; ++t)
+				if (!emitted[t])
+					candidates.push_back(std::make_pair(uncachedScore((unsigned int)t), ~(unsigned int)t));
+			return std::priority_queue<std::pair<float, unsigned int>>(std::less<std::pair<float, unsigned int>>(), std::move(candidates));
+		};
+		std::priority_queue<std::pair<float, unsigned int>> restarts = queueRemaining();
+
+		std::vector<unsigned int> output;
+		output.reserve(triangleCount * 3);
+		std::vector<unsigned int> cache, nextCache;
+		cache.reserve(cacheSize + 3);
+		nextCache.reserve(cacheSize + 3);
+
+		size_t best = ~restarts.top().second;
+		while (output.size() < triangleCount * 3)
+		{
+			emitted[best] = true;
+			const unsigned int* triangle = indices + best * 3;
+			output.insert(output.end(), triangle, triangle + 3);
+
+			// the triangle no longer needs its vertices
+			for (int k = 0; k < 3; ++k)
+			{
+				unsigned int v = triangle[k];
+				unsigned int* begin = &adjacency[adjacencyOffset[v]];
+				unsigned int* end = begin + activeTriangles[v];
+				for (unsigned int* it = begin; it != end; ++it)
+					if (*it == best)
+					{
+						*it = *(end - 1);
+						break;
+					}
+				--activeTriangles[v];
+			}
+
+			// its vertices move to the front of the LRU cache
+			nextCache.assign(triangle, triangle + 3);
+			for (unsigned int v : cache)
+				if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+					nextCache.push_back(v);
+			cache.swap(nextCache);
+
+			for (size_t i = 0; i < cache.size(); ++i)
+			{
+				unsigned int v = cache[i];
+				cachePosition[v] = i < cacheSize ? (int)i : -1;
+				vertexScore[v] = forsythScore(cachePosition[v], activeTriangles[v], cacheSize);
+				// leaving the cache: its triangles' restart scores include every change to it until it comes back
+				if (i >= cacheSize)
+					for (unsigned int a = adjacencyOffset[v]; a < adjacencyOffset[v] + activeTriangles[v]; ++a)
+						restarts.push(std::make_pair(uncachedScore(adjacency[a]), ~adjacency[a]));
+			}
+			// superseded entries pile up between restarts; requeue only the live ones once they outnumber them
+			if (restarts.size() > 2 * triangleCount)
+				restarts = queueRemaining();
+			// rescore the triangles of every cached vertex and pick the best one
+			float bestScore = -1.0f;
+			best = triangleCount;
+			for (unsigned int v : cache)
+			{
+				for (unsigned int a = adjacencyOffset[v]; a < adjacencyOffset[v] + activeTriangles[v]; ++a)
+				{
+					unsigned int t = adjacency[a];
+					float score = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+					triangleScore[t] = score;
+					if (score > bestScore)
+					{
+						bestScore = score;
+						best = t;
+					}
+				}
+			}
+			if (cache.size() > cacheSize)
+				cache.resize(cacheSize);
+
+			// nothing left around the cache: restart from the best remaining triangle
+			if (best == triangleCount && output.size() < triangleCount * 3)
+			{
+				while (emitted[~restarts.top().second])
+					restarts.pop();
+				best = ~restarts.top().second;
+				restarts.pop();
+			}
+		}
+		std::copy(output.begin(), output.end(), indices);
+	}
+
+	// Optimizes many meshes at once, one task per mesh, so large imports do not serialize on this pass.
+	// Returns the FIFO statistics before and after for each mesh.
+	static std::vector<std::pair<VertexCacheStats, VertexCacheStats>> OptimizeVertexCacheParallel(std::vector<IndexedMesh>& meshes, unsigned int cacheSize = 32)
+	{
+		std::vector<std::future<std::pair<VertexCacheStats, VertexCacheStats>>> tasks;
+		for (IndexedMesh& mesh : meshes)
+		{
+			IndexedMesh* target = &mesh;
+			tasks.push_back(std::async(std::launch::async, [target, cacheSize]() {
+				std::pair<VertexCacheStats, VertexCacheStats> stats;
+				stats.first = AnalyzeVertexCache(target->Indices.data(), target->Indices.size(), target->VertexCount(), cacheSize);
+				OptimizeVertexCache(target->Indices.data(), target->Indices.size(), target->VertexCount(), cacheSize);
+				stats.second = AnalyzeVertexCache(target->Indices.data(), target->Indices.size(), target->VertexCount(), cacheSize);
+				return stats;
+			}));
+		}
+
+		std::vector<std::pair<VertexCacheStats, VertexCacheStats>> results;
+		for (std::future<std::pair<VertexCacheStats, VertexCacheStats>>& task : tasks)
+			results.push_back(task.get());
+		return results;
+	}
+
+	// Runs function(mesh) on every mesh, one task per mesh
+	template <typename Function>
+	static void ForEachParallel(std::vector<IndexedMesh>& meshes, Function function)
+	{
+		std::vector<std::future<void>> tasks;
+		for (IndexedMesh& mesh : meshes)
+		{
+			IndexedMesh* target = &mesh;
+			tasks.push_back(std::async(std::launch::async, [target, &function]() { function(*target); }));
+		}
+		for (std::future<void>& task : tasks)
+			task.get();
+	}
+
+	// Reorders cache-optimized triangles to reduce overdraw (Sander, Nehab and Barczak, "Fast Triangle Reordering
+	// for Vertex Locality and Reduced Overdraw"). The index buffer is cut into clusters where the cache starts over,
+	// or where the cluster's own ACMR is already within threshold of the whole mesh's, so cache efficiency is mostly kept.
+	// Clusters are then sorted so those far out along their own normal, which tend to occlude the rest from most
+	// view directions, are drawn first. positions points at the first vertex position, stride is in floats.
+	static void OptimizeOverdraw(unsigned int* indices, size_t indexCount, const float* positions, size_t stride, size_t vertexCount,
+		unsigned int cacheSize = 32, float threshold = 1.05f)
+	{
+		const size_t triangleCount = indexCount / 3;
+		if (triangleCount < 2)
+			return;
+
+		// hard boundaries: triangles whose three vertices all miss the FIFO cache, where the order starts over anyway
+		std::vector<size_t> transformedAt(vertexCount, 0);
+		std::vector<size_t> hardStart;
+		size_t transforms = 0;
+		for (size_t t = 0; t < triangleCount; ++t)
+		{
+			if (simulateTriangle(indices + t * 3, transformedAt, transforms, cacheSize) == 3)
+				hardStart.push_back(t);
+		}
+		hardStart.push_back(triangleCount);
+
+		// soft boundaries: replaying each hard cluster from a cold cache, cut as soon as the piece so far
+		// is within threshold of the cluster's ACMR, so reordering the pieces costs little cache efficiency
+		std::vector<size_t> clusterStart;
+		for (size_t h = 0; h + 1 < hardStart.size(); ++h)
+		{
+			const size_t start = hardStart[h], end = hardStart[h + 1];
+			// moving the clock past every stamp empties the cache without touching it
+			transforms += cacheSize + 1;
+			const size_t clockStart = transforms;
+			for (size_t t = start; t < end; ++t)
+				simulateTriangle(indices + t * 3, transformedAt, transforms, cacheSize);
+			const float clusterThreshold = threshold * (transforms - clockStart) / (end - start);
+
+			transforms += cacheSize + 1;
+			clusterStart.push_back(start);
+			size_t pieceStart = start, pieceMisses = 0;
+			for (size_t t = start; t < end; ++t)
+			{
+				pieceMisses += simulateTriangle(indices + t * 3, transformedAt, transforms, cacheSize);
+				if (t + 1 < end && pieceMisses <= clusterThreshold * (t + 1 - pieceStart))
+				{
+					clusterStart.push_back(t + 1);
+					pieceStart = t + 1;
+					pieceMisses = 0;
+					transforms += cacheSize + 1;
+				}
+			}
+		}
+		clusterStart.push_back(triangleCount);
+		const size_t clusterCount = clusterStart.size() - 1;
+		if (clusterCount < 2)
+			return;
+
+		// area-weighted centroid and normal of each cluster and of the whole mesh
+		std::vector<float> clusterCentroid(clusterCount * 3, 0.0f), clusterNormal(clusterCount * 3, 0.0f);
+		float meshCentroid[3] = { 0.0f, 0.0f, 0.0f };
+		float meshArea = 0.0f;
+		for (size_t c = 0; c < clusterCount; ++c)
+		{
+			float area = 0.0f;
+			for (size_t t = clusterStart[c]; t < clusterStart[c + 1]; ++t)
+			{
+				const float* p0 = positions + indices[t * 3] * stride;
+				const float* p1 = positions + indices[t * 3 + 1] * stride;
+				const float* p2 = positions + indices[t * 3 + 2] * stride;
+				float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+				float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+				float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+				float triangleArea = 0.5f * std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+				for (int k = 0; k < 3; ++k)
+				{
+					float centroid = (p0[k] + p1[k] + p2[k]) / 3.0f;
+					clusterCentroid[c * 3 + k] += centroid * triangleArea;
+					clusterNormal[c * 3 + k] += n[k]; // length is twice the area, so larger triangles weigh more
+					meshCentroid[k] += centroid * triangleArea;
+				}
+				area += triangleArea;
+			}
+			for (int k = 0; k < 3; ++k)
+				clusterCentroid[c * 3 + k] /= area > 0.0f ? area : 1.0f;
+			meshArea += area;
+		}
+		for (int k = 0; k < 3; ++k)
+			meshCentroid[k] /= meshArea > 0.0f ? meshArea : 1.0f;
+
+		std::vector<float> sortKey(clusterCount);
+		std::vector<size_t> order(clusterCount);
+		for (size_t c = 0; c < clusterCount; ++c)
+		{
+			const float* n = &clusterNormal[c * 3];
+			float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			float dot = 0.0f;
+			for (int k = 0; k < 3; ++k)
+				dot += (clusterCentroid[c * 3 + k] - meshCentroid[k]) * (length > 0.0f ? n[k] / length : 0.0f);
+			sortKey[c] = dot;
+			order[c] = c;
+		}
+		std::stable_sort(order.begin(), order.end(), [&sortKey](size_t a, size_t b) { return sortKey[a] > sortKey[b]; });
+
+		std::vector<unsigned int> output;
+		output.reserve(triangleCount * 3);
+		for (size_t c : order)
+			output.insert(output.end(), indices + clusterStart[c] * 3, indices + clusterStart[c + 1] * 3);
+		std::copy(output.begin(), output.end(), indices);
+	}
+
+	// Renumbers vertices in the order the index buffer first uses them and returns the old index of each new
+	// vertex, so vertex fetch walks the buffer sequentially; vertices no triangle uses are dropped
+	static std::vector<unsigned int> RemapVertexFetch(unsigned int* indices, size_t indexCount, size_t vertexCount)
+	{
+		std::vector<unsigned int> newIndex(vertexCount, (unsigned int)EMPTY);
+		std::vector<unsigned int> oldIndex;
+		oldIndex.reserve(vertexCount);
+		for (size_t i = 0; i < indexCount; ++i)
+		{
+			unsigned int& remapped = newIndex[indices[i]];
+			if (remapped == EMPTY)
+			{
+				remapped = (unsigned int)oldIndex.size();
+				oldIndex.push_back(indices[i]);
+			}
+			indices[i] = remapped;
+		}
+		return oldIndex;
+	}
+
+	// first-use vertex order for a mesh of packed floats
+	static void OptimizeVertexFetch(IndexedMesh& mesh)
+	{
+		std::vector<unsigned int> oldIndex = RemapVertexFetch(mesh.Indices.data(), mesh.Indices.size(), mesh.VertexCount());
+		std::vector<float> vertices(oldIndex.size() * mesh.FloatsPerVertex);
+		for (size_t v = 0; v < oldIndex.size(); ++v)
+			std::copy(&mesh.Vertices[oldIndex[v] * mesh.FloatsPerVertex], &mesh.Vertices[oldIndex[v] * mesh.FloatsPerVertex] + mesh.FloatsPerVertex, &vertices[v * mesh.FloatsPerVertex]);
+		mesh.Vertices.swap(vertices);
+	}
+
+	// first-use vertex order for a mesh of vertex structs
+	template <typename VertexType>
+	static void OptimizeVertexFetch(std::vector<unsigned int>& indices, std::vector<VertexType>& vertices)
+	{
+		std::vector<unsigned int> oldIndex = RemapVertexFetch(indices.data(), indices.size(), vertices.size());
+		std::vector<VertexType> reordered(oldIndex.size());
+		for (size_t v = 0; v < oldIndex.size(); ++v)
+			reordered[v] = vertices[oldIndex[v]];
+		vertices.swap(reordered);
+	}
+
+	// Overdraw of drawing the triangles in index order, measured with a small software rasterizer: the ratio of
+	// fragments that pass the depth test (and would be shaded) to pixels covered, over viewCount orthographic views
+	// from directions spread evenly over the sphere. Each winding is depth-tested separately, as if drawn with
+	// back-face culling from the view direction and from its opposite. 1 means no pixel is shaded twice.
+	static float MeasureOverdraw(const unsigned int* indices, size_t indexCount, const float* positions, size_t stride, size_t vertexCount,
+		int viewCount = 16, int resolution = 256)
+	{
+		if (vertexCount == 0 || indexCount < 3)
+			return 1.0f;
+
+		// bounding sphere around the box centre
+		float lo[3] = { positions[0], positions[1], positions[2] }, hi[3] = { positions[0], positions[1], positions[2] };
+		for (size_t v = 0; v < vertexCount; ++v)
+			for (int k = 0; k < 3; ++k)
+			{
+				lo[k] = std::min(lo[k], positions[v * stride + k]);
+				hi[k] = std::max(hi[k], positions[v * stride + k]);
+			}
+		float center[3] = { (lo[0] + hi[0]) * 0.5f, (lo[1] + hi[1]) * 0.5f, (lo[2] + hi[2]) * 0.5f };
+		float radius = 0.0f;
+		for (size_t v = 0; v < vertexCount; ++v)
+		{
+			float d[3] = { positions[v * stride] - center[0], positions[v * stride + 1] - center[1], positions[v * stride + 2] - center[2] };
+			radius = std::max(radius, std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]));
+		}
+		if (radius <= 0.0f)
+			return 1.0f;
+
+		std::vector<float> depth(resolution * resolution * 2);
+		std::vector<float> projected(vertexCount * 3);
+		size_t shaded = 0, covered = 0;
+		for (int view = 0; view < viewCount; ++view)
+		{
+			// Fibonacci sphere direction and a basis perpendicular to it
+			float z = 1.0f - 2.0f * (view + 0.5f) / viewCount;
+			float ring = std::sqrt(std::max(0.0f, 1.0f - z * z));
+			float angle = view * 2.39996323f;
+			float dir[3] = { ring * std::cos(angle), ring * std::sin(angle), z };
+			float up[3] = { 0.0f, 0.0f, 0.0f };
+			up[std::fabs(dir[1]) < 0.9f ? 1 : 0] = 1.0f;
+			float right[3] = { up[1] * dir[2] - up[2] * dir[1], up[2] * dir[0] - up[0] * dir[2], up[0] * dir[1] - up[1] * dir[0] };
+			float rightLength = std::sqrt(right[0] * right[0] + right[1] * right[1] + right[2] * right[2]);
+			for (int k = 0; k < 3; ++k)
+				right[k] /= rightLength;
+			float upAxis[3] = { dir[1] * right[2] - dir[2] * right[1], dir[2] * right[0] - dir[0] * right[2], dir[0] * right[1] - dir[1] * right[0] };
+
+			const float scale = 0.5f * resolution / radius;
+			for (size_t v = 0; v < vertexCount; ++v)
+			{
+				float d[3] = { positions[v * stride] - center[0], positions[v * stride + 1] - center[1], positions[v * stride + 2] - center[2] };
+				projected[v * 3] = (d[0] * right[0] + d[1] * right[1] + d[2] * right[2]) * scale + 0.5f * resolution;
+				projected[v * 3 + 1] = (d[0] * upAxis[0] + d[1] * upAxis[1] + d[2] * upAxis[2]) * scale + 0.5f * resolution;
+				projected[v * 3 + 2] = d[0] * dir[0] + d[1] * dir[1] + d[2] * dir[2]; // along the view direction
+			}
+
+			std::fill(depth.begin(), depth.end(), 3.0e38f);
+			for (size_t t = 0; t + 2 < indexCount; t += 3)
+				rasterizeTriangle(&projected[indices[t] * 3], &projected[indices[t + 1] * 3], &projected[indices[t + 2] * 3], depth, resolution, shaded, covered);
+		}
+		return covered > 0 ? (float)shaded / covered : 1.0f;
+	}
+
+private:
+	static const unsigned int EMPTY = ~0u;
+
+	static void vertexBits(const float* vertex, unsigned int floatCount, unsigned int* bits)
+	{
+		for (unsigned int i = 0; i < floatCount; ++i)
+		{
+			float value = vertex[i] == 0.0f ? 0.0f : vertex[i]; // fold -0 into +0
+			std::memcpy(&bits[i], &value, sizeof(float));
+		}
+	}
+
+	// score of a vertex at an LRU cache position (-1 if not cached) with activeTriangles unemitted triangles left
+	static float forsythScore(int cachePosition, unsigned int activeTriangles, unsigned int cacheSize)
+	{
+		if (activeTriangles == 0)
+			return -1.0f; // no triangle needs it any more
+
+		float score = 0.0f;
+		if (cachePosition >= 0)
+		{
+			if (cachePosition < 3)
+				score = 0.75f; // used by the triangle just emitted: fixed score, so strips don't get too eager
+			else
+				score = std::pow(1.0f - (float)(cachePosition - 3) / (cacheSize - 3), 1.5f);
+		}
+		// boost vertices with few triangles left so they get finished and leave the cache
+		return score + 2.0f / std::sqrt((float)activeTriangles);
+	}
+
+	// FIFO cache step for one triangle (see CountVertexTransforms), returns how many of its vertices missed
+	static unsigned int simulateTriangle(const unsigned int* triangle, std::vector<size_t>& transformedAt, size_t& transforms, unsigned int cacheSize)
+	{
+		unsigned int misses = 0;
+		for (int k = 0; k < 3; ++k)
+		{
+			size_t& stamp = transformedAt[triangle[k]];
+			if (stamp == 0 || transforms - stamp >= cacheSize)
+			{
+				++transforms;
+				stamp = transforms;
+				++misses;
+			}
+		}
+		return misses;
+	}
+
+	// depth-tested rasterization of one triangle at pixel centres, counting shaded and newly covered pixels;
+	// depth holds one buffer per winding. Screen x and y are laid out as seen from +dir, so counter-clockwise
+	// triangles face a viewer there, for whom larger z is nearer: their depths are stored negated, and both
+	// buffers keep the same less-than test. The other winding faces the viewer at -dir.
+	static void rasterizeTriangle(const float* a, const float* b, const float* c, std::vector<float>& depth, int resolution, size_t& shaded, size_t& covered)
+	{
+		float area = (b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0]);
+		if (area == 0.0f)
+			return;
+		float* buffer = &depth[area > 0.0f ? 0 : resolution * resolution];
+		const float towardsViewer = area > 0.0f ? -1.0f : 1.0f;
+
+		int minX = std::max(0, (int)std::floor(std::min(a[0], std::min(b[0], c[0]))));
+		int maxX = std::min(resolution - 1, (int)std::ceil(std::max(a[0], std::max(b[0], c[0]))));
+		int minY = std::max(0, (int)std::floor(std::min(a[1], std::min(b[1], c[1]))));
+		int maxY = std::min(resolution - 1, (int)std::ceil(std::max(a[1], std::max(b[1], c[1]))));
+		for (int y = minY; y <= maxY; ++y)
+		{
+			for (int x = minX; x <= maxX; ++x)
+			{
+				float px = x + 0.5f, py = y + 0.5f;
+				// barycentric weights, normalized by the signed area so both windings work
+				float w0 = ((b[0] - px) * (c[1] - py) - (b[1] - py) * (c[0] - px)) / area;
+				float w1 = ((c[0] - px) * (a[1] - py) - (c[1] - py) * (a[0] - px)) / area;
+				float w2 = 1.0f - w0 - w1;
+				if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+					continue;
+
+				float z = towardsViewer * (w0 * a[2] + w1 * b[2] + w2 * c[2]);
+				float& stored = buffer[y * resolution + x];
+				if (z < stored)
+				{
+					if (stored == 3.0e38f)
+						++covered;
+					stored = z;
+					++shaded;
+				}
+			}
+		}
+	}
+
+	// FNV-1a over the float bit patterns
+	static size_t hashBits(const unsigned int* bits, unsigned int count)
+	{
+		unsigned int hash = 2166136261u;
+		for (unsigned int i = 0; i < count; ++i)
+		{
+			hash ^= bits[i];
+			hash *= 16777619u;
+			hash ^= hash >> 15;
+		}
+		return hash;
+	}
+};
+#endif
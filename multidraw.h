@@ -0,0 +1,147 @@
+#ifndef MULTIDRAW_H
+#define MULTIDRAW_H
+
+#include <GL/glew.h>
+
+#include <vector>
+
+#include "vertexarena.h"
+
+// Layout read by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand {
+	GLuint Count;
+	GLuint InstanceCount;
+	GLuint FirstIndex;
+	GLint BaseVertex;
+	GLuint BaseInstance;
+};
+
+// A list of draws from one VertexArena submitted with a single glMultiDrawElementsIndirect call.
+// Every instance of every draw gets a consecutive object index, which the vertex shader receives
+// through an instanced uint attribute: each command's BaseInstance is its first object index, so
+// the attribute (divisor 1) reads BaseInstance + gl_InstanceID from a buffer holding 0, 1, 2, ...
+// Shaders use it to index per-object data in a storage buffer. Unlike gl_DrawID this also works
+// without ARB_shader_draw_parameters and stays correct when draws are instanced.
+class MultiDrawBatch
+{
+public:
+	std::vector<DrawElementsIndirectCommand> Commands;
+
+	GLuint CommandBuffer = 0;
+	GLuint ObjectIndexBuffer = 0;
+
+	void Clear()
+	{
+		Commands.clear();
+		objectCount = 0;
+	}
+
+	// queues instanceCount copies of a mesh and returns the object index of the first one
+	GLuint Add(const MeshRange& range, GLuint instanceCount = 1)
+	{
+		GLuint firstObject = objectCount;
+		Commands.push_back({ (GLuint)range.Count, instanceCount, range.FirstIndex, range.BaseVertex, firstObject });
+		objectCount += instanceCount;
+		return firstObject;
+	}
+
+	GLuint ObjectCount() const
+	{
+		return objectCount;
+	}
+
+	// uploads the commands and feeds the object index into attribute `attrib` of the arena VAO via vertex buffer binding `binding`
+	void Upload(const VertexArena& arena, GLuint attrib, GLuint binding)
+	{
+		if (CommandBuffer == 0)
+			glGenBuffers(1, &CommandBuffer);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, CommandBuffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, Commands.size() * sizeof(DrawElementsIndirectCommand), Commands.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+		// the index buffer only ever grows, it is shared by every batch size up to its capacity
+		if (objectCount > objectIndexCapacity)
+		{
+			std::vector<GLuint> indices(objectCount);
+			for (GLuint i = 0; i < objectCount; ++i)
+				indices[i] = i;
+			if (ObjectIndexBuffer == 0)
+				glGenBuffers(1, &ObjectIndexBuffer);
+			glBindBuffer(GL_ARRAY_BUFFER, ObjectIndexBuffer);
+			glBufferData(GL_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			objectIndexCapacity = objectCount;
+		}
+
+		glBindVertexArray(arena.VAO);
+		glVertexAttribIFormat(attrib, 1, GL_UNSIGNED_INT, 0);
+		glVertexAttribBinding(attrib, binding);
+		glEnableVertexAttribArray(attrib);
+		glBindVertexBuffer(binding, ObjectIndexBuffer, 0, sizeof(GLuint));
+		glVertexBindingDivisor(binding, 1);
+		glBindVertexArray(0);
+	}
+
+	// re-uploads Commands after they were edited in place, e.g. to change instance counts; their number must not change
+	void UpdateCommands()
+	{
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, CommandBuffer);
+		glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, Commands.size() * sizeof(DrawElementsIndirectCommand), Commands.data());
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+	// Points the instance slots from firstSlot on at other objects, so commands can regroup the instances of a mesh
+	// (e.g. by level of detail) without touching the per-object data. The slots stay redirected until set again.
+	void SetObjectOrder(GLuint firstSlot, const GLuint* objects, GLuint count)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, ObjectIndexBuffer);
+		glBufferSubData(GL_ARRAY_BUFFER, firstSlot * sizeof(GLuint), count * sizeof(GLuint), objects);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	// one call for the whole batch; the arena VAO and the program must be bound
+	void Draw() const
+	{
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, CommandBuffer);
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0, (GLsizei)Commands.size(), 0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+	// the same commands as one instanced call per mesh, for drivers or modes without indirect drawing; returns the number of calls
+	unsigned int DrawInstanced() const
+	{
+		unsigned int calls = 0;
+		for (const DrawElementsIndirectCommand& command : Commands)
+		{
+			if (command.InstanceCount == 0)
+				continue;
+			glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, command.Count, GL_UNSIGNED_INT, (const void*)(command.FirstIndex * sizeof(GLuint)),
+				command.InstanceCount, command.BaseVertex, command.BaseInstance);
+			++calls;
+		}
+		return calls;
+	}
+
+	// triangles drawn by the whole batch, counting every instance
+	unsigned int TriangleCount() const
+	{
+		unsigned int triangles = 0;
+		for (const DrawElementsIndirectCommand& command : Commands)
+			triangles += command.Count / 3 * command.InstanceCount;
+		return triangles;
+	}
+
+	void Destroy()
+	{
+		glDeleteBuffers(1, &CommandBuffer);
+		glDeleteBuffers(1, &ObjectIndexBuffer);
+		CommandBuffer = ObjectIndexBuffer = 0;
+		objectIndexCapacity = 0;
+		Clear();
+	}
+
+private:
+	GLuint objectCount = 0;
+	GLuint objectIndexCapacity = 0;
+};
+#endif
@@ -0,0 +1,81 @@
+#ifndef OBJECTID_H
+#define OBJECTID_H
+
+#include <GL/glew.h>
+
+// Reads single pixels of an object id attachment (R32UI) back without stalling the frame. Request copies the
+// pixel into a pixel buffer object, which glReadPixels can do without waiting for the GPU, and sets a fence; Poll
+// maps the buffer once the fence has signalled, a frame or more later. A request made before the previous one
+// arrived replaces it.
+class ObjectIdReadback
+{
+public:
+	void Create()
+	{
+		glGenBuffers(1, &pixelBuffer);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffer);
+		glBufferData(GL_PIXEL_PACK_BUFFER, sizeof(GLuint), NULL, GL_STREAM_READ);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+
+	// starts copying pixel (x, y) of `attachment` of `framebuffer`, counted from the bottom left; the read
+	// framebuffer binding and that framebuffer's read buffer are left as they were
+	void Request(GLuint framebuffer, GLenum attachment, int x, int y)
+	{
+		GLint readFramebuffer = 0, readBuffer = GL_NONE;
+		glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+		glGetIntegerv(GL_READ_BUFFER, &readBuffer);
+		glReadBuffer(attachment);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffer);
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glReadPixels(x, y, 1, 1, GL_RED_INTEGER, GL_UNSIGNED_INT, 0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		glReadBuffer(readBuffer);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+
+		if (fence != 0)
+			glDeleteSync(fence);
+		fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		// without a flush the fence may never reach the GPU, and Poll would not see it signal
+		glFlush();
+	}
+
+	// the id of the last request, once, as soon as the copy has finished; never waits
+	bool Poll(GLuint& objectId)
+	{
+		if (fence == 0)
+			return false;
+		GLint status = GL_UNSIGNALED;
+		glGetSynciv(fence, GL_SYNC_STATUS, 1, NULL, &status);
+		if (status != GL_SIGNALED)
+			return false;
+		glDeleteSync(fence);
+		fence = 0;
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffer);
+		const GLuint* mapped = (const GLuint*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, sizeof(GLuint), GL_MAP_READ_BIT);
+		const bool read = mapped != NULL;
+		if (read)
+		{
+			objectId = *mapped;
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		return read;
+	}
+
+	void Destroy()
+	{
+		if (fence != 0)
+			glDeleteSync(fence);
+		glDeleteBuffers(1, &pixelBuffer);
+		fence = 0;
+		pixelBuffer = 0;
+	}
+
+private:
+	GLuint pixelBuffer = 0;
+	GLsync fence = 0;
+};
+#endif
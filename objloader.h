@@ -0,0 +1,477 @@
+#ifndef OBJLOADER_H
+#define OBJLOADER_H
+
+#include "mappedfile.h"
+#include "meshopt.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// What a load took, for throughput reports
+struct ObjLoadStats {
+	size_t Bytes = 0;
+	double Seconds = 0.0;
+	unsigned int Threads = 0;
+	size_t Triangles = 0;
+	size_t Vertices = 0;
+
+	double MegabytesPerSecond() const
+	{
+		return Seconds > 0.0 ? Bytes / (1024.0 * 1024.0) / Seconds : 0.0;
+	}
+};
+
+// Wavefront OBJ reader for triangle meshes (v, vt, vn and f records; polygons are fanned into triangles,
+// everything else is skipped). The file is mapped, cut into one chunk per thread at line boundaries and
+// every chunk is parsed on its own thread. The position/uv/normal corners are then deduplicated into
+// shared vertices, also in parallel: each chunk buckets its corners by the shard their key hashes to, and
+// each thread then merges the buckets of its own shard only.
+// The result has the 8-float position/normal/uv layout; UnpackVertices in mesh.h turns it into Mesh vertices.
+class ObjLoader
+{
+public:
+	// threadCount 0 uses every hardware thread
+	static bool Load(const char* path, IndexedMesh& mesh, ObjLoadStats* stats = NULL, unsigned int threadCount = 0)
+	{
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		MappedFile file;
+		if (!file.Open(path))
+			return false;
+		const char* text = (const char*)file.Data();
+		const size_t size = file.Size();
+
+		if (threadCount == 0)
+			threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+		// chunks under a megabyte are not worth a thread
+		threadCount = (unsigned int)std::max<size_t>(1, std::min<size_t>(threadCount, size / (1 << 20) + 1));
+
+		// chunk boundaries just after a newline
+		std::vector<size_t> bounds(threadCount + 1, size);
+		bounds[0] = 0;
+		for (unsigned int i = 1; i < threadCount; ++i)
+		{
+			size_t at = std::max(size * i / threadCount, bounds[i - 1]);
+			const void* newline = at < size ? std::memchr(text + at, '\n', size - at) : NULL;
+			bounds[i] = newline ? (const char*)newline - text + 1 : size;
+		}
+
+		std::vector<Chunk> chunks(threadCount);
+		std::vector<std::future<void>> tasks;
+		for (unsigned int i = 0; i < threadCount; ++i)
+			tasks.push_back(std::async(std::launch::async, [&chunks, text, &bounds, i]() { parseChunk(text + bounds[i], text + bounds[i + 1], chunks[i]); }));
+		for (std::future<void>& task : tasks)
+			task.get();
+
+		if (!merge(chunks, mesh, threadCount))
+		{
+			std::cout << "ERROR::OBJLOADER::" << path << " has face indices out of range" << std::endl;
+			return false;
+		}
+
+		if (stats)
+		{
+			stats->Bytes = size;
+			stats->Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			stats->Threads = threadCount;
+			stats->Triangles = mesh.Indices.size() / 3;
+			stats->Vertices = mesh.VertexCount();
+		}
+		return true;
+	}
+
+	// Decimal float in the usual OBJ spellings ([-]digits[.digits][e[-]digits]); returns the character after
+	// it, or NULL if there is no number. Anything unusual (inf, nan, hex, very long mantissas) goes to strtod.
+	static const char* ParseFloat(const char* p, const char* end, float& value)
+	{
+		while (p < end && (*p == ' ' || *p == '\t'))
+			++p;
+		const char* begin = p;
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			negative = *p++ == '-';
+
+		unsigned long long mantissa = 0;
+		int digits = 0, exponent = 0;
+		for (; p < end && *p >= '0' && *p <= '9'; ++p, ++digits)
+			mantissa = mantissa * 10 + (*p - '0');
+		if (p < end && *p == '.')
+		{
+			for (++p; p < end && *p >= '0' && *p <= '9'; ++p, ++digits, --exponent)
+				mantissa = mantissa * 10 + (*p - '0');
+		}
+		if (digits == 0 || digits > 18)
+			return slowFloat(begin, end, value);
+		if (p < end && (*p == 'e' || *p == 'E'))
+		{
+			const char* e = p + 1;
+			bool negativeExponent = false;
+			if (e < end && (*e == '-' || *e == '+'))
+				negativeExponent = *e++ == '-';
+			int power = 0;
+			const char* powerStart = e;
+			for (; e < end && *e >= '0' && *e <= '9' && power < 10000; ++e)
+				power = power * 10 + (*e - '0');
+			if (e == powerStart)
+				return slowFloat(begin, end, value);
+			exponent += negativeExponent ? -power : power;
+			p = e;
+		}
+		if (exponent < -22 || exponent > 22)
+			return slowFloat(begin, end, value);
+
+		static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+		double result = exponent < 0 ? (double)mantissa / powers[-exponent] : (double)mantissa * powers[exponent];
+		value = (float)(negative ? -result : result);
+		return p;
+	}
+
+private:
+	static const int ABSENT = INT_MIN;
+
+	// One face corner with 0-based indices. Negative (relative) OBJ indices depend on how much the chunks
+	// before this one hold, so they are stored relative to the chunk start, flagged in Relative, until merging.
+	struct Corner {
+		int Position;
+		int TexCoord;
+		int Normal;
+		unsigned char Relative;  // bit 0 position, 1 texture coordinates, 2 normal
+	};
+
+	struct Chunk {
+		std::vector<float> Positions;  // 3 per vertex
+		std::vector<float> TexCoords;  // 2 per vertex
+		std::vector<float> Normals;    // 3 per vertex
+		std::vector<Corner> Corners;   // 3 per triangle
+	};
+
+	static const char* slowFloat(const char* p, const char* end, float& value)
+	{
+		char buffer[64];
+		size_t length = std::min<size_t>(end - p, sizeof(buffer) - 1);
+		std::memcpy(buffer, p, length);
+		buffer[length] = '\0';
+		char* after;
+		value = std::strtof(buffer, &after);
+		return after == buffer ? NULL : p + (after - buffer);
+	}
+
+	static const char* parseInt(const char* p, const char* end, int& value)
+	{
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+			negative = *p++ == '-';
+		const char* digits = p;
+		long long result = 0;
+		for (; p < end && *p >= '0' && *p <= '9'; ++p)
+			result = std::min(result * 10 + (*p - '0'), (long long)INT_MAX);
+		if (p == digits)
+			return NULL;
+		value = (int)(negative ? -result : result);
+		return p;
+	}
+
+	// OBJ index (1-based, or negative counting back from the last one parsed) to a 0-based index, relative to
+	// the chunk start for negative ones; 0 is invalid and leaves the attribute absent
+	static int encodeIndex(int index, size_t parsedCount, unsigned char relativeBit, unsigned char& relative)
+	{
+		if (index > 0)
+			return index - 1;
+		if (index < 0)
+		{
+			relative |= relativeBit;
+			return (int)parsedCount + index;
+		}
+		return ABSENT;
+	}
+
+	static void parseFloats(const char* p, const char* end, int count, std::vector<float>& out)
+	{
+		for (int i = 0; i < count; ++i)
+		{
+			float value = 0.0f;
+			const char* next = p ? ParseFloat(p, end, value) : NULL;
+			out.push_back(value);
+			p = next;
+		}
+	}
+
+	static void parseChunk(const char* p, const char* end, Chunk& chunk)
+	{
+		std::vector<Corner> polygon;
+		while (p < end)
+		{
+			const char* lineEnd = (const char*)std::memchr(p, '\n', end - p);
+			if (lineEnd == NULL)
+				lineEnd = end;
+			while (p < lineEnd && (*p == ' ' || *p == '\t'))
+				++p;
+
+			if (lineEnd - p > 2 && p[0] == 'v' && p[1] == ' ')
+				parseFloats(p + 2, lineEnd, 3, chunk.Positions);
+			else if (lineEnd - p > 3 && p[0] == 'v' && p[1] == 't' && p[2] == ' ')
+				parseFloats(p + 3, lineEnd, 2, chunk.TexCoords);
+			else if (lineEnd - p > 3 && p[0] == 'v' && p[1] == 'n' && p[2] == ' ')
+				parseFloats(p + 3, lineEnd, 3, chunk.Normals);
+			else if (lineEnd - p > 2 && p[0] == 'f' && p[1] == ' ')
+			{
+				polygon.clear();
+				const char* q = p + 2;
+				while (true)
+				{
+					while (q < lineEnd && (*q == ' ' || *q == '\t' || *q == '\r'))
+						++q;
+					int index = 0;
+					const char* next = parseInt(q, lineEnd, index);
+					if (next == NULL)
+						break;
+					Corner corner = { ABSENT, ABSENT, ABSENT, 0 };
+					corner.Position = encodeIndex(index, chunk.Positions.size() / 3, 1, corner.Relative);
+					q = next;
+					if (q < lineEnd && *q == '/')
+					{
+						++q;
+						if ((next = parseInt(q, lineEnd, index)) != NULL)
+						{
+							corner.TexCoord = encodeIndex(index, chunk.TexCoords.size() / 2, 2, corner.Relative);
+							q = next;
+						}
+						if (q < lineEnd && *q == '/')
+						{
+							++q;
+							if ((next = parseInt(q, lineEnd, index)) != NULL)
+							{
+								corner.Normal = encodeIndex(index, chunk.Normals.size() / 3, 4, corner.Relative);
+								q = next;
+							}
+						}
+					}
+					polygon.push_back(corner);
+				}
+				for (size_t i = 2; i < polygon.size(); ++i)
+				{
+					chunk.Corners.push_back(polygon[0]);
+					chunk.Corners.push_back(polygon[i - 1]);
+					chunk.Corners.push_back(polygon[i]);
+				}
+			}
+			p = lineEnd + 1;
+		}
+	}
+
+	static bool resolve(int& index, bool relative, size_t base, size_t count)
+	{
+		if (index == ABSENT)
+			return true;
+		long long resolved = relative ? (long long)base + index : index;
+		index = (int)resolved;
+		return resolved >= 0 && (size_t)resolved < count;
+	}
+
+	static size_t hashCorner(const Corner& corner)
+	{
+		size_t hash = 2166136261u;
+		const int values[3] = { corner.Position, corner.TexCoord, corner.Normal };
+		for (int value : values)
+			hash = (hash ^ (unsigned int)value) * 16777619u;
+		return hash ^ (hash >> 15);
+	}
+
+	static bool sameCorner(const Corner& a, const Corner& b)
+	{
+		return a.Position == b.Position && a.TexCoord == b.TexCoord && a.Normal == b.Normal;
+	}
+
+	// Unique corners of one shard, in open addressing like MeshOptimizer::WeldVertices
+	struct Shard {
+		std::vector<Corner> Keys;
+		std::vector<unsigned int> Table;
+
+		unsigned int Insert(const Corner& corner, size_t hash)
+		{
+			if ((Keys.size() + 1) * 2 > Table.size())
+				grow();
+			size_t mask = Table.size() - 1;
+			for (size_t slot = hash & mask;; slot = (slot + 1) & mask)
+			{
+				if (Table[slot] == ~0u)
+				{
+					Table[slot] = (unsigned int)Keys.size();
+					Keys.push_back(corner);
+					return Table[slot];
+				}
+				if (sameCorner(Keys[Table[slot]], corner))
+					return Table[slot];
+			}
+		}
+
+		void grow()
+		{
+			std::vector<unsigned int> old(std::max<size_t>(Table.size() * 2, 1024), ~0u);
+			old.swap(Table);
+			size_t mask = Table.size() - 1;
+			for (unsigned int id = 0; id < Keys.size(); ++id)
+			{
+				size_t slot = hashCorner(Keys[id]) & mask;
+				while (Table[slot] != ~0u)
+					slot = (slot + 1) & mask;
+				Table[slot] = id;
+			}
+		}
+	};
+
+	static bool merge(std::vector<Chunk>& chunks, IndexedMesh& mesh, unsigned int threadCount)
+	{
+		// every chunk's attributes go after those of the chunks before it
+		std::vector<size_t> positionBase(chunks.size() + 1, 0), texCoordBase(chunks.size() + 1, 0), normalBase(chunks.size() + 1, 0), cornerBase(chunks.size() + 1, 0);
+		for (size_t i = 0; i < chunks.size(); ++i)
+		{
+			positionBase[i + 1] = positionBase[i] + chunks[i].Positions.size() / 3;
+			texCoordBase[i + 1] = texCoordBase[i] + chunks[i].TexCoords.size() / 2;
+			normalBase[i + 1] = normalBase[i] + chunks[i].Normals.size() / 3;
+			cornerBase[i + 1] = cornerBase[i] + chunks[i].Corners.size();
+		}
+		const size_t cornerCount = cornerBase.back();
+
+		std::vector<float> positions(positionBase.back() * 3), texCoords(texCoordBase.back() * 2), normals(normalBase.back() * 3);
+		std::vector<Corner> corners(cornerCount);
+		// buckets[chunk * threadCount + shard] holds the chunk's corners of that shard, in file order
+		std::vector<std::vector<unsigned int>> buckets((size_t)chunks.size() * threadCount);
+		std::vector<std::future<bool>> resolveTasks;
+		for (size_t i = 0; i < chunks.size(); ++i)
+		{
+			resolveTasks.push_back(std::async(std::launch::async, [&, i]() {
+				Chunk& chunk = chunks[i];
+				std::copy(chunk.Positions.begin(), chunk.Positions.end(), positions.begin() + positionBase[i] * 3);
+				std::copy(chunk.TexCoords.begin(), chunk.TexCoords.end(), texCoords.begin() + texCoordBase[i] * 2);
+				std::copy(chunk.Normals.begin(), chunk.Normals.end(), normals.begin() + normalBase[i] * 3);
+				bool valid = true;
+				for (size_t c = 0; c < chunk.Corners.size(); ++c)
+				{
+					Corner corner = chunk.Corners[c];
+					valid &= corner.Position != ABSENT && resolve(corner.Position, (corner.Relative & 1) != 0, positionBase[i], positionBase.back()) &&
+						resolve(corner.TexCoord, (corner.Relative & 2) != 0, texCoordBase[i], texCoordBase.back()) &&
+						resolve(corner.Normal, (corner.Relative & 4) != 0, normalBase[i], normalBase.back());
+					corner.Relative = 0;
+					corners[cornerBase[i] + c] = corner;
+					buckets[i * threadCount + (hashCorner(corner) >> 20) % threadCount].push_back((unsigned int)(cornerBase[i] + c));
+				}
+				std::vector<Corner>().swap(chunk.Corners);
+				return valid;
+			}));
+		}
+		bool valid = true;
+		for (std::future<bool>& task : resolveTasks)
+			valid &= task.get();
+		if (!valid)
+			return false;
+
+		// deduplicate: shard s owns the corners whose hash lands on it, so no two threads touch the same key, and
+		// every thread only visits its own buckets
+		std::vector<Shard> shards(threadCount);
+		std::vector<unsigned int> local(cornerCount);
+		std::vector<std::future<void>> tasks;
+		for (unsigned int s = 0; s < threadCount; ++s)
+		{
+			tasks.push_back(std::async(std::launch::async, [&, s]() {
+				for (size_t i = 0; i < chunks.size(); ++i)
+				{
+					for (unsigned int c : buckets[i * threadCount + s])
+						local[c] = shards[s].Insert(corners[c], hashCorner(corners[c]));
+				}
+			}));
+		}
+		for (std::future<void>& task : tasks)
+			task.get();
+
+		std::vector<unsigned int> shardBase(threadCount + 1, 0);
+		for (unsigned int s = 0; s < threadCount; ++s)
+			shardBase[s + 1] = shardBase[s] + (unsigned int)shards[s].Keys.size();
+
+		mesh.FloatsPerVertex = 8;
+		mesh.Indices.resize(cornerCount);
+		mesh.Vertices.assign((size_t)shardBase.back() * 8, 0.0f);
+		std::vector<char> missingNormals(threadCount, 0);
+		tasks.clear();
+		for (unsigned int s = 0; s < threadCount; ++s)
+		{
+			tasks.push_back(std::async(std::launch::async, [&, s]() {
+				for (size_t i = 0; i < chunks.size(); ++i)
+				{
+					for (unsigned int c : buckets[i * threadCount + s])
+						local[c] += shardBase[s];
+				}
+				for (size_t k = 0; k < shards[s].Keys.size(); ++k)
+				{
+					const Corner& key = shards[s].Keys[k];
+					float* vertex = &mesh.Vertices[(shardBase[s] + k) * 8];
+					std::copy(&positions[key.Position * 3], &positions[key.Position * 3] + 3, vertex);
+					if (key.Normal != ABSENT)
+						std::copy(&normals[key.Normal * 3], &normals[key.Normal * 3] + 3, vertex + 3);
+					else
+						missingNormals[s] = 1;
+					if (key.TexCoord != ABSENT)
+						std::copy(&texCoords[key.TexCoord * 2], &texCoords[key.TexCoord * 2] + 2, vertex + 6);
+				}
+			}));
+		}
+		for (std::future<void>& task : tasks)
+			task.get();
+		mesh.Indices.assign(local.begin(), local.end());
+
+		if (std::find(missingNormals.begin(), missingNormals.end(), 1) != missingNormals.end())
+			computeMissingNormals(mesh, corners);
+
+		// back into first-use order, so vertex fetch walks the buffer sequentially
+		MeshOptimizer::OptimizeVertexFetch(mesh);
+		return true;
+	}
+
+	// area-weighted smooth normals for the vertices the file gave none
+	static void computeMissingNormals(IndexedMesh& mesh, const std::vector<Corner>& corners)
+	{
+		std::vector<float>& v = mesh.Vertices;
+		for (size_t t = 0; t + 2 < mesh.Indices.size(); t += 3)
+		{
+			const float* p0 = &v[mesh.Indices[t] * 8];
+			const float* p1 = &v[mesh.Indices[t + 1] * 8];
+			const float* p2 = &v[mesh.Indices[t + 2] * 8];
+			float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+			float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+			float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+			for (int k = 0; k < 3; ++k)
+			{
+				if (corners[t + k].Normal != ABSENT)
+					continue;
+				float* normal = &v[mesh.Indices[t + k] * 8 + 3];
+				normal[0] += n[0];
+				normal[1] += n[1];
+				normal[2] += n[2];
+			}
+		}
+		for (size_t t = 0; t < mesh.Indices.size(); ++t)
+		{
+			if (corners[t].Normal != ABSENT)
+				continue;
+			float* normal = &v[mesh.Indices[t] * 8 + 3];
+			float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+			// shared by several corners, so only the first visit normalizes
+			if (length > 0.0f && std::fabs(length - 1.0f) > 1e-6f)
+			{
+				normal[0] /= length;
+				normal[1] /= length;
+				normal[2] /= length;
+			}
+		}
+	}
+};
+#endif
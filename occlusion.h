@@ -0,0 +1,355 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <glm/glm.hpp>
+
+#include "culling.h"
+#include "workerpool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <thread>
+#include <vector>
+
+// Four pixels per instruction wherever the frustum culler has SSE or AVX
+#if defined(CULLING_AVX) || defined(CULLING_SSE)
+#define OCCLUSION_SSE 1
+#endif
+
+// A small depth buffer of a few large occluders (floor, table top, walls) rasterized on the CPU, and tests of
+// object boxes against it, so hidden objects are dropped before any draw is recorded and without waiting on the GPU.
+//
+// Both sides are conservative. An occluder only writes pixels it covers entirely, at the farthest depth it has
+// inside them. A box is hidden only if its nearest corner is behind the occluders at every pixel its screen
+// rectangle touches. Boxes crossing the camera plane are always visible.
+//
+// Render splits the rows into bands rasterized on worker threads; Cull splits the boxes the same way. Both share
+// one pool of threads that lives as long as the rasterizer.
+class OcclusionRasterizer
+{
+public:
+	enum : unsigned int {
+		ROWS_PER_BAND = 16,       // fewest rows worth a thread of their own
+		OBJECTS_PER_TASK = 512    // fewest boxes worth a thread of their own
+	};
+
+	// depth buffer resolution, independent of the window's; a quarter of it in each direction is plenty
+	void Resize(int width, int height)
+	{
+		this->width = std::max(width, 1);
+		this->height = std::max(height, 1);
+		stride = (this->width + 3) & ~3;
+		depth.assign((size_t)stride * this->height, 1.0f);
+	}
+
+	int Width() const
+	{
+		return width;
+	}
+
+	int Height() const
+	{
+		return height;
+	}
+
+	void ClearOccluders()
+	{
+		occluders.clear();
+	}
+
+	size_t OccluderCount() const
+	{
+		return occluders.size() / 4;
+	}
+
+	// world-space triangle, seen from either side
+	void AddTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+	{
+		AddQuad(a, b, c, c);
+	}
+
+	// flat convex quad, corners in order around it, seen from either side. Rasterized whole: two triangles would
+	// leave the pixels along their shared edge uncovered.
+	void AddQuad(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, const glm::vec3& d)
+	{
+		occluders.push_back(a);
+		occluders.push_back(b);
+		occluders.push_back(c);
+		occluders.push_back(d);
+	}
+
+	// the solid object-space box boundsMin..boundsMax placed by model
+	void AddBox(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& model)
+	{
+		glm::vec3 corners[8];
+		for (int corner = 0; corner < 8; ++corner)
+		{
+			const glm::vec3 local((corner & 1) ? boundsMax.x : boundsMin.x, (corner & 2) ? boundsMax.y : boundsMin.y, (corner & 4) ? boundsMax.z : boundsMin.z);
+			corners[corner] = glm::vec3(model * glm::vec4(local, 1.0f));
+		}
+		AddQuad(corners[0], corners[1], corners[3], corners[2]); // -z
+		AddQuad(corners[4], corners[5], corners[7], corners[6]); // +z
+		AddQuad(corners[0], corners[1], corners[5], corners[4]); // -y
+		AddQuad(corners[2], corners[3], corners[7], corners[6]); // +y
+		AddQuad(corners[0], corners[2], corners[6], corners[4]); // -x
+		AddQuad(corners[1], corners[3], corners[7], corners[5]); // +x
+	}
+
+	// clears the depth buffer and rasterizes every occluder as seen through viewProjection; threadCount 0 uses
+	// every hardware thread
+	void Render(const glm::mat4& viewProjection, unsigned int threadCount = 0)
+	{
+		this->viewProjection = viewProjection;
+		std::fill(depth.begin(), depth.end(), 1.0f);
+		polygons.clear();
+		for (size_t i = 0; i + 3 < occluders.size(); i += 4)
+		{
+			glm::vec4 clip[4];
+			for (int corner = 0; corner < 4; ++corner)
+				clip[corner] = viewProjection * glm::vec4(occluders[i + corner], 1.0f);
+			clipNear(clip);
+		}
+		if (polygons.empty())
+			return;
+
+		if (threadCount == 0)
+			threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+		const int bands = std::max(std::min((int)threadCount, height / (int)ROWS_PER_BAND), 1);
+		pool.Run(bands, [this, bands](int band) { rasterize(height * band / bands, height * (band + 1) / bands); });
+	}
+
+	// false only if the world box boundsMin..boundsMax is behind the occluders everywhere it would be drawn
+	bool IsVisible(const glm::vec3& boundsMin, const glm::vec3& boundsMax) const
+	{
+		const float inf = std::numeric_limits<float>::infinity();
+		glm::vec2 screenMin(inf), screenMax(-inf);
+		float nearest = inf;
+		for (int corner = 0; corner < 8; ++corner)
+		{
+			const glm::vec3 point((corner & 1) ? boundsMax.x : boundsMin.x, (corner & 2) ? boundsMax.y : boundsMin.y, (corner & 4) ? boundsMax.z : boundsMin.z);
+			const glm::vec4 clip = viewProjection * glm::vec4(point, 1.0f);
+			if (clip.w <= 0.0f)
+				return true;
+			const glm::vec3 screen = toScreen(clip);
+			screenMin = glm::min(screenMin, glm::vec2(screen.x, screen.y));
+			screenMax = glm::max(screenMax, glm::vec2(screen.x, screen.y));
+			nearest = std::min(nearest, screen.z);
+		}
+
+		// off screen is left to the frustum test; clamped as floats, corners near the camera plane project far out
+		const int x0 = (int)std::max(std::floor(screenMin.x), 0.0f), x1 = (int)std::min(std::floor(screenMax.x), width - 1.0f);
+		const int y0 = (int)std::max(std::floor(screenMin.y), 0.0f), y1 = (int)std::min(std::floor(screenMax.y), height - 1.0f);
+		if (x0 > x1 || y0 > y1)
+			return true;
+		for (int y = y0; y <= y1; ++y)
+		{
+			const float* row = &depth[(size_t)y * stride];
+			int x = x0;
+#if defined(OCCLUSION_SSE)
+			const __m128 boxDepth = _mm_set1_ps(nearest);
+			for (; x + 4 <= x1 + 1; x += 4)
+			{
+				if (_mm_movemask_ps(_mm_cmple_ps(boxDepth, _mm_loadu_ps(row + x))) != 0)
+					return true;
+			}
+#endif
+			for (; x <= x1; ++x)
+			{
+				if (nearest <= row[x])
+					return true;
+			}
+		}
+		return false;
+	}
+
+	// clears visible[i] for every box hidden by the occluders among those it is set for, where bounds(i, min, max)
+	// gives box i and is called from several threads at once; returns the number cleared
+	template <class BoundsFunction>
+	size_t Cull(size_t count, BoundsFunction bounds, unsigned char* visible, unsigned int threadCount = 0) const
+	{
+		if (threadCount == 0)
+			threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+		const size_t chunks = std::max(std::min((size_t)threadCount, count / OBJECTS_PER_TASK), (size_t)1);
+		auto cullRange = [this, &bounds, visible](size_t first, size_t end) {
+			size_t hidden = 0;
+			glm::vec3 boundsMin, boundsMax;
+			for (size_t i = first; i < end; ++i)
+			{
+				if (!visible[i])
+					continue;
+				bounds(i, boundsMin, boundsMax);
+				if (!IsVisible(boundsMin, boundsMax))
+				{
+					visible[i] = 0;
+					++hidden;
+				}
+			}
+			return hidden;
+		};
+		std::vector<size_t> hiddenPerChunk(chunks, 0);
+		pool.Run((int)chunks, [&](int chunk) { hiddenPerChunk[chunk] = cullRange(count * chunk / chunks, count * (chunk + 1) / chunks); });
+		size_t hidden = 0;
+		for (size_t chunkHidden : hiddenPerChunk)
+			hidden += chunkHidden;
+		return hidden;
+	}
+
+private:
+	enum : int { MAX_EDGES = 5 };   // a quad with one corner cut off by the near plane
+
+	// edge functions a * x + b * y + c, non-negative where a whole pixel centred on (x, y) is inside (unused edges
+	// are all zero), and the depth plane raised to the farthest depth within such a pixel
+	struct ScreenPolygon {
+		float EdgeA[MAX_EDGES], EdgeB[MAX_EDGES], EdgeC[MAX_EDGES];
+		float DepthX, DepthY, Depth0;
+		int MinX, MinY, EndX, EndY;
+	};
+
+	std::vector<glm::vec3> occluders;   // world quads, four corners each; a triangle repeats its last corner
+	std::vector<ScreenPolygon> polygons;
+	std::vector<float> depth;           // window depth (0 near, 1 far) per pixel, rows stride floats apart
+	int width = 0, height = 0, stride = 0;
+	glm::mat4 viewProjection = glm::mat4(1.0f);
+	mutable WorkerPool pool;            // Cull is const but runs on it too
+
+	// pixel x, y with row 0 at the bottom of the viewport, and window depth
+	glm::vec3 toScreen(const glm::vec4& clip) const
+	{
+		const glm::vec3 ndc = glm::vec3(clip) / clip.w;
+		return glm::vec3((ndc.x * 0.5f + 0.5f) * width, (ndc.y * 0.5f + 0.5f) * height, ndc.z * 0.5f + 0.5f);
+	}
+
+	// keeps the part of a clip-space quad in front of the near plane (z >= -w)
+	void clipNear(const glm::vec4 clip[4])
+	{
+		glm::vec4 polygon[MAX_EDGES];
+		int count = 0;
+		for (int i = 0; i < 4; ++i)
+		{
+			const glm::vec4& from = clip[i];
+			const glm::vec4& to = clip[(i + 1) % 4];
+			const float fromDistance = from.z + from.w, toDistance = to.z + to.w;
+			if (fromDistance >= 0.0f)
+				polygon[count++] = from;
+			if ((fromDistance >= 0.0f) != (toDistance >= 0.0f))
+				polygon[count++] = from + (to - from) * (fromDistance / (fromDistance - toDistance));
+		}
+		if (count >= 3)
+			setup(polygon, count);
+	}
+
+	// edges, depth plane and pixel bounds of a convex polygon
+	void setup(const glm::vec4* clip, int count)
+	{
+		glm::vec3 v[MAX_EDGES];
+		for (int i = 0; i < count; ++i)
+			v[i] = toScreen(clip[i]);
+
+		// either winding: flip clockwise polygons so inside is positive
+		float area = 0.0f;
+		for (int i = 0; i < count; ++i)
+			area += v[i].x * v[(i + 1) % count].y - v[(i + 1) % count].x * v[i].y;
+		if (std::fabs(area) < 1e-6f)
+			return;
+		const float sign = area > 0.0f ? 1.0f : -1.0f;
+
+		ScreenPolygon polygon = {};
+		for (int edge = 0; edge < count; ++edge)
+		{
+			const glm::vec3& from = v[edge];
+			const glm::vec3& to = v[(edge + 1) % count];
+			const float a = sign * (from.y - to.y), b = sign * (to.x - from.x), c = sign * (from.x * to.y - from.y * to.x);
+			polygon.EdgeA[edge] = a;
+			polygon.EdgeB[edge] = b;
+			polygon.EdgeC[edge] = c - 0.5f * (std::fabs(a) + std::fabs(b));
+		}
+
+		// the depth plane through the largest triangle of the fan, the best conditioned
+		int apex = 1;
+		float apexArea = 0.0f;
+		for (int i = 1; i + 1 < count; ++i)
+		{
+			const float fanArea = std::fabs((v[i].x - v[0].x) * (v[i + 1].y - v[0].y) - (v[i + 1].x - v[0].x) * (v[i].y - v[0].y));
+			if (fanArea > apexArea)
+			{
+				apex = i;
+				apexArea = fanArea;
+			}
+		}
+		const glm::vec3& p0 = v[0];
+		const glm::vec3& p1 = v[apex];
+		const glm::vec3& p2 = v[apex + 1];
+		const glm::vec3 u = p1 - p0, w = p2 - p0;
+		const float determinant = u.x * w.y - w.x * u.y;
+		if (std::fabs(determinant) < 1e-6f)
+			return;
+		polygon.DepthX = (u.z * w.y - w.z * u.y) / determinant;
+		polygon.DepthY = (w.z * u.x - u.z * w.x) / determinant;
+		polygon.Depth0 = p0.z - polygon.DepthX * p0.x - polygon.DepthY * p0.y + 0.5f * (std::fabs(polygon.DepthX) + std::fabs(polygon.DepthY));
+
+		float minX = v[0].x, maxX = v[0].x, minY = v[0].y, maxY = v[0].y;
+		for (int i = 1; i < count; ++i)
+		{
+			minX = std::min(minX, v[i].x);
+			maxX = std::max(maxX, v[i].x);
+			minY = std::min(minY, v[i].y);
+			maxY = std::max(maxY, v[i].y);
+		}
+		polygon.MinX = (int)std::max(std::floor(minX), 0.0f);
+		polygon.MinY = (int)std::max(std::floor(minY), 0.0f);
+		polygon.EndX = (int)std::min(std::ceil(maxX), (float)width);
+		polygon.EndY = (int)std::min(std::ceil(maxY), (float)height);
+		if (polygon.MinX < polygon.EndX && polygon.MinY < polygon.EndY)
+			polygons.push_back(polygon);
+	}
+
+	// every polygon into rows firstRow..endRow - 1, keeping the nearest depth per pixel
+	void rasterize(int firstRow, int endRow)
+	{
+		for (const ScreenPolygon& p : polygons)
+		{
+			const int rowBegin = std::max(p.MinY, firstRow), rowEnd = std::min(p.EndY, endRow);
+			for (int y = rowBegin; y < rowEnd; ++y)
+			{
+				const float py = y + 0.5f;
+				float* row = &depth[(size_t)y * stride];
+#if defined(OCCLUSION_SSE)
+				__m128 edgeX[MAX_EDGES], rowEdge[MAX_EDGES];
+				for (int edge = 0; edge < MAX_EDGES; ++edge)
+				{
+					edgeX[edge] = _mm_set1_ps(p.EdgeA[edge]);
+					rowEdge[edge] = _mm_set1_ps(p.EdgeB[edge] * py + p.EdgeC[edge]);
+				}
+				const __m128 depthX = _mm_set1_ps(p.DepthX), rowDepth = _mm_set1_ps(p.DepthY * py + p.Depth0);
+				const __m128 laneOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+				// groups of four start on a multiple of four, so the last may reach into the row's padding
+				for (int x = p.MinX & ~3; x < p.EndX; x += 4)
+				{
+					const __m128 px = _mm_add_ps(_mm_set1_ps((float)x), laneOffsets);
+					__m128 nearestEdge = _mm_add_ps(_mm_mul_ps(edgeX[0], px), rowEdge[0]);
+					for (int edge = 1; edge < MAX_EDGES; ++edge)
+						nearestEdge = _mm_min_ps(nearestEdge, _mm_add_ps(_mm_mul_ps(edgeX[edge], px), rowEdge[edge]));
+					const __m128 inside = _mm_cmpge_ps(nearestEdge, _mm_setzero_ps());
+					if (_mm_movemask_ps(inside) == 0)
+						continue;
+					const __m128 stored = _mm_loadu_ps(row + x);
+					const __m128 nearer = _mm_min_ps(stored, _mm_add_ps(_mm_mul_ps(depthX, px), rowDepth));
+					_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, stored)));
+				}
+#else
+				for (int x = p.MinX; x < p.EndX; ++x)
+				{
+					const float px = x + 0.5f;
+					bool inside = true;
+					for (int edge = 0; edge < MAX_EDGES; ++edge)
+						inside = inside && p.EdgeA[edge] * px + p.EdgeB[edge] * py + p.EdgeC[edge] >= 0.0f;
+					if (inside)
+						row[x] = std::min(row[x], p.DepthX * px + p.DepthY * py + p.Depth0);
+				}
+#endif
+			}
+		}
+	}
+};
+#endif
@@ -0,0 +1,212 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// A timed interval on the steady_clock timeline
+struct ProfileEvent {
+	const char* Name;   // must outlive the profiler, string literals in practice
+	long long StartNs;
+	long long DurationNs;
+};
+
+// Fixed-size ring of events recorded by one thread; the oldest events are overwritten when it is full. Only that
+// thread writes events, without a lock: each is stored before Head is advanced past it.
+struct ProfileBuffer {
+	std::vector<ProfileEvent> Events;
+	std::atomic<size_t> Head{ 0 };   // total number of events ever written
+	unsigned int ThreadId = 0;
+	std::string ThreadName;
+	std::mutex Lock;                 // guards ThreadName, which may be set while a trace is being written
+};
+
+// Low-overhead CPU scope profiler. Each thread writes into its own ring buffer, created the first time it records
+// with the profiler enabled, and WriteChromeTrace dumps all of them as Chrome trace JSON (chrome://tracing,
+// ui.perfetto.dev).
+class Profiler
+{
+public:
+	static const size_t EVENTS_PER_THREAD = 1 << 16;
+
+	static long long Now()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// recording is off until enabled, so instrumented code costs a single branch otherwise
+	static void SetEnabled(bool enabled)
+	{
+		enabledFlag().store(enabled, std::memory_order_relaxed);
+	}
+
+	static bool Enabled()
+	{
+		return enabledFlag().load(std::memory_order_relaxed);
+	}
+
+	// names the calling thread in the trace
+	static void SetThreadName(const std::string& name)
+	{
+		ProfileBuffer& buffer = threadBuffer();
+		std::lock_guard<std::mutex> guard(buffer.Lock);
+		buffer.ThreadName = name;
+	}
+
+	// records an interval on the calling thread's timeline
+	static void Record(const char* name, long long startNs, long long endNs)
+	{
+		if (!Enabled())
+			return;
+		record(threadBuffer(), name, startNs, endNs);
+	}
+
+	// records an interval measured on the GPU (already mapped to the steady_clock timeline) on its own track; call
+	// from one thread only, the GPU track has a single writer like the others
+	static void RecordGpu(const char* name, double startMs, double durationMs)
+	{
+		if (!Enabled())
+			return;
+		record(gpuBuffer(), name, (long long)(startMs * 1e6), (long long)((startMs + durationMs) * 1e6));
+	}
+
+	// writes every recorded event as Chrome trace JSON. Threads may keep recording meanwhile; events they overwrite
+	// while a buffer is being copied are left out.
+	static bool WriteChromeTrace(const std::string& path)
+	{
+		FILE* file = fopen(path.c_str(), "w");
+		if (!file)
+		{
+			std::cout << "ERROR::PROFILER::Failed to open " << path << " for writing" << std::endl;
+			return false;
+		}
+
+		fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+		bool first = true;
+
+		std::lock_guard<std::mutex> registryGuard(registryLock());
+		std::vector<ProfileEvent> events;
+		for (const std::shared_ptr<ProfileBuffer>& buffer : registry())
+		{
+			{
+				std::lock_guard<std::mutex> guard(buffer->Lock);
+				if (!buffer->ThreadName.empty())
+				{
+					fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+						first ? "" : ",\n", buffer->ThreadId, buffer->ThreadName.c_str());
+					first = false;
+				}
+			}
+
+			// copy the ring, then drop the oldest copied events if the owner has since come round and overwritten them
+			const size_t size = buffer->Events.size();
+			const size_t head = buffer->Head.load(std::memory_order_acquire);
+			const size_t count = std::min(head, size);
+			events.resize(count);
+			for (size_t i = 0; i < count; ++i)
+				events[i] = buffer->Events[(head - count + i) % size];
+			std::atomic_thread_fence(std::memory_order_acquire);
+			const size_t written = buffer->Head.load(std::memory_order_relaxed) - head;
+			const size_t overwritten = std::min(written > size - count ? written - (size - count) : 0, count);
+
+			for (size_t i = overwritten; i < count; ++i)
+			{
+				const ProfileEvent& event = events[i];
+				fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+					first ? "" : ",\n", event.Name, buffer->ThreadId, event.StartNs / 1000.0, event.DurationNs / 1000.0);
+				first = false;
+			}
+		}
+
+		fprintf(file, "\n]}\n");
+		fclose(file);
+		return true;
+	}
+
+private:
+	static std::atomic<bool>& enabledFlag()
+	{
+		static std::atomic<bool> enabled(false);
+		return enabled;
+	}
+
+	static std::mutex& registryLock()
+	{
+		static std::mutex lock;
+		return lock;
+	}
+
+	static std::vector<std::shared_ptr<ProfileBuffer>>& registry()
+	{
+		static std::vector<std::shared_ptr<ProfileBuffer>> buffers;
+		return buffers;
+	}
+
+	static std::shared_ptr<ProfileBuffer> createBuffer(const std::string& name)
+	{
+		std::shared_ptr<ProfileBuffer> buffer = std::make_shared<ProfileBuffer>();
+		buffer->Events.resize(EVENTS_PER_THREAD);
+		buffer->ThreadName = name;
+
+		std::lock_guard<std::mutex> guard(registryLock());
+		buffer->ThreadId = (unsigned int)registry().size() + 1;
+		registry().push_back(buffer);
+		return buffer;
+	}
+
+	// the registry keeps the buffer alive after its thread exits so its events still make it into the trace
+	static ProfileBuffer& threadBuffer()
+	{
+		thread_local std::shared_ptr<ProfileBuffer> buffer = createBuffer(std::string());
+		return *buffer;
+	}
+
+	static ProfileBuffer& gpuBuffer()
+	{
+		static std::shared_ptr<ProfileBuffer> buffer = createBuffer("GPU");
+		return *buffer;
+	}
+
+	// called only by the thread that owns the buffer
+	static void record(ProfileBuffer& buffer, const char* name, long long startNs, long long endNs)
+	{
+		const size_t head = buffer.Head.load(std::memory_order_relaxed);
+		buffer.Events[head % buffer.Events.size()] = { name, startNs, endNs - startNs };
+		buffer.Head.store(head + 1, std::memory_order_release);
+	}
+};
+
+// Records the lifetime of the enclosing scope
+class ProfileScope
+{
+public:
+	explicit ProfileScope(const char* name) : name(name), start(Profiler::Enabled() ? Profiler::Now() : 0) {}
+
+	~ProfileScope()
+	{
+		if (start != 0)
+			Profiler::Record(name, start, Profiler::Now());
+	}
+
+private:
+	const char* name;
+	long long start;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+// PROFILE_SCOPE("name") times the rest of the enclosing block; define DISABLE_PROFILER to compile it out
+#ifdef DISABLE_PROFILER
+#define PROFILE_SCOPE(name)
+#else
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#endif
+#endif
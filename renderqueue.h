@@ -0,0 +1,153 @@
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <vector>
+
+// Everything needed to issue one draw, independent of the order it was submitted in
+struct DrawPacket {
+	unsigned long long Key;  // sort key, see RenderQueue::MakeKey
+	GLuint Program;
+	GLint ModelLocation;     // location of the model matrix uniform in Program
+	GLuint Texture;          // 0 when the program samples no texture
+	GLuint VAO;
+	GLuint FirstIndex;       // indexed draw, see MeshRange
+	GLsizei Count;
+	GLint BaseVertex;
+	glm::mat4 Model;
+	int Tag;                 // caller-defined, e.g. the object id for per-object timings
+};
+
+// Collects draw packets for a frame and orders them by a packed 64-bit key with an LSD radix sort.
+// Sorting by program, then texture, then vertex array groups draws that share state, and the
+// depth bits order each group front to back so early-z rejects as many hidden fragments as possible.
+class RenderQueue
+{
+public:
+	// key layout, most significant first: program (12 bits) | texture (12) | vertex array (12) | depth (24) | unused (4).
+	// GL names wider than their field only weaken the grouping, the packet still binds the real names.
+	static unsigned long long MakeKey(GLuint program, GLuint texture, GLuint vao, float depth01)
+	{
+		const unsigned long long depthBits = (unsigned long long)(std::min(std::max(depth01, 0.0f), 1.0f) * 0xFFFFFF);
+		return ((unsigned long long)(program & 0xFFF) << 52) |
+		       ((unsigned long long)(texture & 0xFFF) << 40) |
+		       ((unsigned long long)(vao & 0xFFF) << 28) |
+		       (depthBits << 4);
+	}
+
+	void Clear()
+	{
+		packets.clear();
+	}
+
+	void Submit(const DrawPacket& packet)
+	{
+		packets.push_back(packet);
+	}
+
+	const std::vector<DrawPacket>& Packets() const
+	{
+		return packets;
+	}
+
+	// packet indices in draw order, valid after Sort
+	const std::vector<unsigned int>& Order() const
+	{
+		return order;
+	}
+
+	// radix sort of (key, index) pairs, one byte per pass; passes where every key has the same byte are skipped
+	void Sort()
+	{
+		const size_t count = packets.size();
+		keys.resize(count);
+		scratch.resize(count);
+		for (size_t i = 0; i < count; ++i)
+			keys[i] = { packets[i].Key, (unsigned int)i };
+
+		for (int shift = 0; shift < 64; shift += 8)
+		{
+			size_t histogram[256] = {};
+			for (size_t i = 0; i < count; ++i)
+				++histogram[(keys[i].Key >> shift) & 0xFF];
+			if (count == 0 || histogram[(keys[0].Key >> shift) & 0xFF] == count)
+				continue;
+
+			size_t offset = 0;
+			for (int bucket = 0; bucket < 256; ++bucket)
+			{
+				size_t bucketSize = histogram[bucket];
+				histogram[bucket] = offset;
+				offset += bucketSize;
+			}
+			for (size_t i = 0; i < count; ++i)
+				scratch[histogram[(keys[i].Key >> shift) & 0xFF]++] = keys[i];
+			keys.swap(scratch);
+		}
+
+		order.resize(count);
+		for (size_t i = 0; i < count; ++i)
+			order[i] = keys[i].Index;
+	}
+
+private:
+	struct SortKey {
+		unsigned long long Key;
+		unsigned int Index;
+	};
+
+	std::vector<DrawPacket> packets;
+	std::vector<SortKey> keys;
+	std::vector<SortKey> scratch;
+	std::vector<unsigned int> order;
+};
+
+// Remembers the bound program, vertex array and texture so binds that change nothing are never issued
+class RenderStateCache
+{
+public:
+	// forget everything, e.g. at the start of a frame when other code may have touched the state
+	void Reset()
+	{
+		program = vao = texture = ~0u;
+	}
+
+	// each returns true if the GL call was issued
+	bool UseProgram(GLuint id)
+	{
+		if (id == program)
+			return false;
+		glUseProgram(id);
+		program = id;
+		return true;
+	}
+
+	bool BindVertexArray(GLuint id)
+	{
+		if (id == vao)
+			return false;
+		glBindVertexArray(id);
+		vao = id;
+		return true;
+	}
+
+	// binds to GL_TEXTURE_2D of the active texture unit
+	bool BindTexture(GLuint id)
+	{
+		if (id == texture)
+			return false;
+		glBindTexture(GL_TEXTURE_2D, id);
+		texture = id;
+		return true;
+	}
+
+private:
+	GLuint program = ~0u;
+	GLuint vao = ~0u;
+	GLuint texture = ~0u;
+};
+#endif
@@ -0,0 +1,224 @@
+#ifndef TRIANGLEBVH_H
+#define TRIANGLEBVH_H
+
+#include <glm/glm.hpp>
+
+#include "bvh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Four triangles per instruction wherever the frustum culler has SSE or AVX
+#if defined(CULLING_AVX) || defined(CULLING_SSE)
+#define TRIANGLEBVH_SSE 1
+#endif
+
+// Bounding volume hierarchy over the triangles of one mesh, for picking rays. The tree is an ObjectBvh over the
+// triangle boxes; its leaves of up to four triangles are then copied into packets laid out lane by lane, so a ray
+// is tested against a whole leaf at once (Moller-Trumbore). Lanes a leaf does not fill hold degenerate triangles
+// that never hit. Meshes are static: building takes a while on millions of triangles, so it is done once, on demand.
+class TriangleBvh
+{
+public:
+	enum : unsigned int { PACKET_SIZE = 4 };
+
+	// over indices[0..indexCount) into vertices, `stride` floats apart with the position first; threadCount 0 uses
+	// every hardware thread
+	void Build(const float* vertices, size_t stride, const unsigned int* indices, size_t indexCount, unsigned int threadCount = 0)
+	{
+		nodes.clear();
+		packets.clear();
+		triangleCount = indexCount / 3;
+		if (triangleCount == 0)
+			return;
+
+		ObjectBvh bvh;
+		for (size_t triangle = 0; triangle < triangleCount; ++triangle)
+		{
+			const glm::vec3 a = position(vertices, stride, indices[triangle * 3]);
+			const glm::vec3 b = position(vertices, stride, indices[triangle * 3 + 1]);
+			const glm::vec3 c = position(vertices, stride, indices[triangle * 3 + 2]);
+			bvh.Add(glm::min(a, glm::min(b, c)), glm::max(a, glm::max(b, c)));
+		}
+		bvh.Build(threadCount);
+
+		// leaves point at their first packet instead of their first triangle; a leaf the SAH kept larger than
+		// PACKET_SIZE triangles gets several packets in a row
+		nodes = bvh.Nodes();
+		for (BvhNode& node : nodes)
+		{
+			if (!node.IsLeaf())
+				continue;
+			const unsigned int first = node.First;
+			node.First = (unsigned int)packets.size();
+			for (unsigned int offset = 0; offset < node.Count; offset += PACKET_SIZE)
+			{
+				Packet packet = {};
+				for (unsigned int lane = 0; lane < PACKET_SIZE && offset + lane < node.Count; ++lane)
+				{
+					const unsigned int triangle = bvh.Object(first + offset + lane);
+					const glm::vec3 a = position(vertices, stride, indices[triangle * 3]);
+					const glm::vec3 b = position(vertices, stride, indices[triangle * 3 + 1]);
+					const glm::vec3 c = position(vertices, stride, indices[triangle * 3 + 2]);
+					for (int k = 0; k < 3; ++k)
+					{
+						packet.Vertex[k][lane] = a[k];
+						packet.Edge1[k][lane] = b[k] - a[k];
+						packet.Edge2[k][lane] = c[k] - a[k];
+					}
+					packet.Triangles[lane] = triangle;
+				}
+				packets.push_back(packet);
+			}
+		}
+	}
+
+	bool Empty() const
+	{
+		return nodes.empty();
+	}
+
+	size_t TriangleCount() const
+	{
+		return triangleCount;
+	}
+
+	size_t NodeCount() const
+	{
+		return nodes.size();
+	}
+
+	// nearest triangle along origin + t * direction with t <= maxDistance, hit from either side: returns true and
+	// lowers maxDistance to its t, and sets triangle to its index in the mesh (first index / 3)
+	bool Raycast(const glm::vec3& origin, const glm::vec3& direction, float& maxDistance, unsigned int& triangle) const
+	{
+		if (nodes.empty())
+			return false;
+		const glm::vec3 inverse = ObjectBvh::InverseDirection(direction);
+		bool hit = false;
+
+		unsigned int stack[STACK_SIZE];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0)
+		{
+			const BvhNode& node = nodes[stack[--top]];
+			if (ObjectBvh::RayEnters(origin, inverse, node.BoundsMin, node.BoundsMax, maxDistance) > maxDistance)
+				continue;
+			if (node.IsLeaf())
+			{
+				const unsigned int packetCount = (node.Count + PACKET_SIZE - 1) / PACKET_SIZE;
+				for (unsigned int i = node.First; i < node.First + packetCount; ++i)
+					hit = intersect(packets[i], origin, direction, maxDistance, triangle) || hit;
+				continue;
+			}
+			// the nearer child goes on top of the stack
+			const float left = ObjectBvh::RayEnters(origin, inverse, nodes[node.First].BoundsMin, nodes[node.First].BoundsMax, maxDistance);
+			const float right = ObjectBvh::RayEnters(origin, inverse, nodes[node.First + 1].BoundsMin, nodes[node.First + 1].BoundsMax, maxDistance);
+			const unsigned int nearChild = left <= right ? node.First : node.First + 1;
+			if (std::max(left, right) <= maxDistance)
+				stack[top++] = nearChild == node.First ? node.First + 1 : node.First;
+			if (std::min(left, right) <= maxDistance)
+				stack[top++] = nearChild;
+		}
+		return hit;
+	}
+
+private:
+	enum : unsigned int { STACK_SIZE = 128 };   // as deep as ObjectBvh builds
+
+	// PACKET_SIZE triangles as a corner and two edges each, one array per coordinate
+	struct Packet {
+		float Vertex[3][PACKET_SIZE];
+		float Edge1[3][PACKET_SIZE];
+		float Edge2[3][PACKET_SIZE];
+		unsigned int Triangles[PACKET_SIZE];
+	};
+
+	std::vector<BvhNode> nodes;
+	std::vector<Packet> packets;
+	size_t triangleCount = 0;
+
+	static glm::vec3 position(const float* vertices, size_t stride, unsigned int index)
+	{
+		const float* v = vertices + (size_t)index * stride;
+		return glm::vec3(v[0], v[1], v[2]);
+	}
+
+	// the ray against every triangle of a packet; keeps the nearest hit closer than maxDistance
+	static bool intersect(const Packet& packet, const glm::vec3& origin, const glm::vec3& direction, float& maxDistance, unsigned int& triangle)
+	{
+#if defined(TRIANGLEBVH_SSE)
+		const __m128 e1x = _mm_loadu_ps(packet.Edge1[0]), e1y = _mm_loadu_ps(packet.Edge1[1]), e1z = _mm_loadu_ps(packet.Edge1[2]);
+		const __m128 e2x = _mm_loadu_ps(packet.Edge2[0]), e2y = _mm_loadu_ps(packet.Edge2[1]), e2z = _mm_loadu_ps(packet.Edge2[2]);
+		const __m128 dx = _mm_set1_ps(direction.x), dy = _mm_set1_ps(direction.y), dz = _mm_set1_ps(direction.z);
+		// p = direction x edge2, determinant = edge1 . p
+		const __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+		const __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+		const __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+		const __m128 determinant = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+		const __m128 inverse = _mm_div_ps(_mm_set1_ps(1.0f), determinant);
+		// s = origin - vertex, u = s . p / determinant
+		const __m128 sx = _mm_sub_ps(_mm_set1_ps(origin.x), _mm_loadu_ps(packet.Vertex[0]));
+		const __m128 sy = _mm_sub_ps(_mm_set1_ps(origin.y), _mm_loadu_ps(packet.Vertex[1]));
+		const __m128 sz = _mm_sub_ps(_mm_set1_ps(origin.z), _mm_loadu_ps(packet.Vertex[2]));
+		const __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(sx, px), _mm_mul_ps(sy, py)), _mm_mul_ps(sz, pz)), inverse);
+		// q = s x edge1, v = direction . q / determinant, t = edge2 . q / determinant
+		const __m128 qx = _mm_sub_ps(_mm_mul_ps(sy, e1z), _mm_mul_ps(sz, e1y));
+		const __m128 qy = _mm_sub_ps(_mm_mul_ps(sz, e1x), _mm_mul_ps(sx, e1z));
+		const __m128 qz = _mm_sub_ps(_mm_mul_ps(sx, e1y), _mm_mul_ps(sy, e1x));
+		const __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inverse);
+		const __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inverse);
+
+		// comparisons with NaN fail, which takes care of the degenerate lanes
+		const __m128 zero = _mm_setzero_ps();
+		__m128 hits = _mm_cmpneq_ps(determinant, zero);
+		hits = _mm_and_ps(hits, _mm_cmpge_ps(u, zero));
+		hits = _mm_and_ps(hits, _mm_cmpge_ps(v, zero));
+		hits = _mm_and_ps(hits, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+		hits = _mm_and_ps(hits, _mm_cmpge_ps(t, zero));
+		hits = _mm_and_ps(hits, _mm_cmplt_ps(t, _mm_set1_ps(maxDistance)));
+		int mask = _mm_movemask_ps(hits);
+		if (mask == 0)
+			return false;
+		float distances[PACKET_SIZE];
+		_mm_storeu_ps(distances, t);
+		for (int lane = 0; mask != 0; ++lane, mask >>= 1)
+		{
+			if ((mask & 1) && distances[lane] < maxDistance)
+			{
+				maxDistance = distances[lane];
+				triangle = packet.Triangles[lane];
+			}
+		}
+		return true;
+#else
+		bool hit = false;
+		for (unsigned int lane = 0; lane < PACKET_SIZE; ++lane)
+		{
+			const glm::vec3 vertex(packet.Vertex[0][lane], packet.Vertex[1][lane], packet.Vertex[2][lane]);
+			const glm::vec3 edge1(packet.Edge1[0][lane], packet.Edge1[1][lane], packet.Edge1[2][lane]);
+			const glm::vec3 edge2(packet.Edge2[0][lane], packet.Edge2[1][lane], packet.Edge2[2][lane]);
+			const glm::vec3 p = glm::cross(direction, edge2);
+			const float determinant = glm::dot(edge1, p);
+			if (determinant == 0.0f)
+				continue;
+			const float inverse = 1.0f / determinant;
+			const glm::vec3 s = origin - vertex;
+			const float u = glm::dot(s, p) * inverse;
+			const glm::vec3 q = glm::cross(s, edge1);
+			const float v = glm::dot(direction, q) * inverse;
+			const float t = glm::dot(edge2, q) * inverse;
+			if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t >= 0.0f && t < maxDistance)
+			{
+				maxDistance = t;
+				triangle = packet.Triangles[lane];
+				hit = true;
+			}
+		}
+		return hit;
+#endif
+	}
+};
+#endif
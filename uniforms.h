@@ -0,0 +1,80 @@
+#ifndef UNIFORMS_H
+#define UNIFORMS_H
+
+// Include the OpenGL loader used by the including code (GLEW or glad) before this header.
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// An active uniform of a linked program
+struct UniformInfo {
+	std::string Name;
+	GLint Location;
+	GLenum Type;
+	GLint Size;
+};
+
+// Locations of every active uniform of a program, reflected once after linking (glGetActiveUniform).
+// Lookups are a binary search over the sorted names, so no draw ever has to ask the driver.
+class UniformTable
+{
+public:
+	std::vector<UniformInfo> Uniforms;
+
+	UniformTable() {}
+
+	explicit UniformTable(GLuint program)
+	{
+		Reflect(program);
+	}
+
+	void Reflect(GLuint program)
+	{
+		Uniforms.clear();
+
+		GLint count = 0, maxLength = 0;
+		glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+		std::vector<GLchar> name(std::max(maxLength, 1));
+
+		for (GLint i = 0; i < count; ++i)
+		{
+			GLsizei length = 0;
+			GLint size = 0;
+			GLenum type = 0;
+			glGetActiveUniform(program, (GLuint)i, (GLsizei)name.size(), &length, &size, &type, name.data());
+
+			std::string uniformName(name.data(), length);
+			GLint location = glGetUniformLocation(program, uniformName.c_str());
+			if (location < 0)
+				continue; // member of a uniform block, set through its buffer
+
+			// arrays are reported as "name[0]"; register the bare name and every element
+			const std::string arraySuffix = "[0]";
+			if (uniformName.size() > arraySuffix.size() && uniformName.compare(uniformName.size() - arraySuffix.size(), arraySuffix.size(), arraySuffix) == 0)
+			{
+				std::string base = uniformName.substr(0, uniformName.size() - arraySuffix.size());
+				Uniforms.push_back({ base, location, type, size });
+				for (GLint element = 0; element < size; ++element)
+				{
+					std::string elementName = base + "[" + std::to_string(element) + "]";
+					Uniforms.push_back({ elementName, glGetUniformLocation(program, elementName.c_str()), type, 1 });
+				}
+			}
+			else
+				Uniforms.push_back({ uniformName, location, type, size });
+		}
+
+		std::sort(Uniforms.begin(), Uniforms.end(), [](const UniformInfo& a, const UniformInfo& b) { return a.Name < b.Name; });
+	}
+
+	// location of the named uniform, or -1 if the program does not use it (glUniform* ignores -1)
+	GLint Find(const std::string& name) const
+	{
+		std::vector<UniformInfo>::const_iterator it = std::lower_bound(Uniforms.begin(), Uniforms.end(), name,
+			[](const UniformInfo& info, const std::string& key) { return info.Name < key; });
+		return (it != Uniforms.end() && it->Name == name) ? it->Location : -1;
+	}
+};
+#endif
@@ -0,0 +1,157 @@
+#ifndef VERTEXARENA_H
+#define VERTEXARENA_H
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "meshfile.h"
+
+// Triangles of one mesh inside a VertexArena, drawn with
+// glDrawElementsBaseVertex(GL_TRIANGLES, Count, GL_UNSIGNED_INT, FirstIndex * 4, BaseVertex)
+struct MeshRange {
+	GLuint FirstIndex = 0;
+	GLsizei Count = 0;       // number of indices
+	GLint BaseVertex = 0;    // added to every index of the mesh
+	GLsizei VertexCount = 0;
+	float BoundsMin[3] = {};  // object-space box around the mesh's vertices
+	float BoundsMax[3] = {};
+};
+
+// All static meshes packed into one immutable vertex buffer and one index buffer behind a single VAO.
+// Meshes are appended on the CPU, then Upload creates the buffers once with glBufferStorage;
+// the attribute layout is described with ARB_vertex_attrib_binding (core since 4.3).
+// Indices stay local to their mesh, BaseVertex places them in the shared vertex buffer.
+class VertexArena
+{
+public:
+	// position (3), normal (3), texture coordinates (2)
+	static const GLuint FLOATS_PER_VERTEX = 8;
+
+	GLuint VAO = 0;
+	GLuint VBO = 0;
+	GLuint EBO = 0;
+
+	// CPU copy of every vertex and index, kept for queries such as bounds and picking
+	std::vector<float> Vertices;
+	std::vector<GLuint> Indices;
+
+	// appends an indexed mesh of FLOATS_PER_VERTEX floats per vertex and returns where it lives in the arena
+	MeshRange Add(const float* vertices, size_t vertexCount, const GLuint* indices, size_t indexCount)
+	{
+		MeshRange range;
+		range.FirstIndex = (GLuint)Indices.size();
+		range.Count = (GLsizei)indexCount;
+		range.BaseVertex = (GLint)VertexCount();
+		range.VertexCount = (GLsizei)vertexCount;
+		for (int k = 0; k < 3; ++k)
+		{
+			range.BoundsMin[k] = vertexCount > 0 ? 3.0e38f : 0.0f;
+			range.BoundsMax[k] = vertexCount > 0 ? -3.0e38f : 0.0f;
+		}
+		for (size_t v = 0; v < vertexCount; ++v)
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				range.BoundsMin[k] = std::min(range.BoundsMin[k], vertices[v * FLOATS_PER_VERTEX + k]);
+				range.BoundsMax[k] = std::max(range.BoundsMax[k], vertices[v * FLOATS_PER_VERTEX + k]);
+			}
+		}
+		Vertices.insert(Vertices.end(), vertices, vertices + vertexCount * FLOATS_PER_VERTEX);
+		Indices.insert(Indices.end(), indices, indices + indexCount);
+		return range;
+	}
+
+	// appends another index list over the vertices of a mesh already in the arena, e.g. a simplified level of
+	// detail; the returned range shares the mesh's BaseVertex and bounds
+	MeshRange AddIndices(const MeshRange& mesh, const GLuint* indices, size_t indexCount)
+	{
+		MeshRange range = mesh;
+		range.FirstIndex = (GLuint)Indices.size();
+		range.Count = (GLsizei)indexCount;
+		Indices.insert(Indices.end(), indices, indices + indexCount);
+		return range;
+	}
+
+	GLsizei VertexCount() const
+	{
+		return (GLsizei)(Vertices.size() / FLOATS_PER_VERTEX);
+	}
+
+	// the vertex layout as described in mesh files
+	static const MeshFileAttribute* FileLayout()
+	{
+		static const MeshFileAttribute layout[3] = {
+			{ 0, 3, GL_FLOAT, GL_FALSE, 0 },
+			{ 1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float) },
+			{ 2, 2, GL_FLOAT, GL_FALSE, 6 * sizeof(float) },
+		};
+		return layout;
+	}
+	static const uint32_t FILE_ATTRIBUTE_COUNT = 3;
+
+	// creates the GPU buffers and VAO; the arena cannot grow afterwards
+	void Upload()
+	{
+		Upload(Vertices.data(), Vertices.size() * sizeof(float), Indices.data(), Indices.size() * sizeof(GLuint));
+	}
+
+	// Uploads a mapped mesh file as is; the mapping goes straight to glBufferStorage, so nothing is parsed or
+	// copied on the CPU and the CPU copies stay empty. Mesh ranges come from the file's mesh table.
+	bool Upload(const MeshFile& file)
+	{
+		if (!file.HasLayout(FLOATS_PER_VERTEX * sizeof(float), FileLayout(), FILE_ATTRIBUTE_COUNT) || file.Header().IndexSize != sizeof(GLuint))
+		{
+			std::cout << "ERROR::VERTEXARENA::Mesh file vertex layout does not match the arena" << std::endl;
+			return false;
+		}
+		// glBufferStorage rejects empty buffers
+		if (file.Header().VertexDataSize == 0 || file.Header().IndexDataSize == 0)
+		{
+			std::cout << "ERROR::VERTEXARENA::Mesh file has no vertices or indices" << std::endl;
+			return false;
+		}
+		Upload(file.VertexData(), (size_t)file.Header().VertexDataSize, file.IndexData(), (size_t)file.Header().IndexDataSize);
+		return true;
+	}
+
+	// creates the GPU buffers from vertex data in the arena layout and 32-bit indices anywhere in memory
+	void Upload(const void* vertexData, size_t vertexBytes, const void* indexData, size_t indexBytes)
+	{
+		glGenBuffers(1, &VBO);
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBufferStorage(GL_ARRAY_BUFFER, vertexBytes, vertexData, 0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		glGenVertexArrays(1, &VAO);
+		glBindVertexArray(VAO);
+		for (uint32_t i = 0; i < FILE_ATTRIBUTE_COUNT; ++i)
+		{
+			const MeshFileAttribute& attribute = FileLayout()[i];
+			glVertexAttribFormat(attribute.Location, attribute.Components, attribute.Type, (GLboolean)attribute.Normalized, attribute.Offset);
+			glVertexAttribBinding(attribute.Location, 0);
+			glEnableVertexAttribArray(attribute.Location);
+		}
+		glBindVertexBuffer(0, VBO, 0, FLOATS_PER_VERTEX * sizeof(float));
+
+		// the element buffer binding is part of the VAO
+		glGenBuffers(1, &EBO);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		glBufferStorage(GL_ELEMENT_ARRAY_BUFFER, indexBytes, indexData, 0);
+		glBindVertexArray(0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+
+	void Destroy()
+	{
+		glDeleteVertexArrays(1, &VAO);
+		glDeleteBuffers(1, &VBO);
+		glDeleteBuffers(1, &EBO);
+		VAO = VBO = EBO = 0;
+		Vertices.clear();
+		Indices.clear();
+	}
+};
+#endif
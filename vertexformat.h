@@ -0,0 +1,275 @@
+#ifndef VERTEXFORMAT_H
+#define VERTEXFORMAT_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+// GPU vertex layouts a Mesh can be uploaded in. Every attribute of the compact layouts is a type the vertex
+// fetch hardware converts by itself (normalized shorts and 10:10:10:2, half floats), so the shader only adds
+// the dequantization transform and the octahedral or quaternion decode; see VertexDecodeSource.
+enum VertexFormat {
+	VERTEX_FORMAT_FLOAT,              // 56 bytes: float position, normal, uv, tangent and bitangent
+	VERTEX_FORMAT_COMPACT,            // 20 bytes: snorm16 position, octahedral snorm16 normal, 10:10:10:2 tangent, half uv
+	VERTEX_FORMAT_COMPACT_QUATERNION  // 20 bytes: snorm16 position, whole tangent frame as one snorm16 quaternion, half uv
+};
+
+// VERTEX_FORMAT_COMPACT
+struct CompactVertex {
+	int16_t Position[4];   // snorm16 in the mesh bounds, w unused so the next attribute stays 4-byte aligned
+	int16_t Normal[2];     // octahedral, snorm16
+	uint32_t Tangent;      // snorm 10:10:10:2, w is the bitangent sign
+	uint16_t TexCoords[2]; // half float
+};
+
+// VERTEX_FORMAT_COMPACT_QUATERNION
+struct QuaternionVertex {
+	int16_t Position[4];   // snorm16 in the mesh bounds
+	int16_t Frame[4];      // snorm16 quaternion, the sign of w is the bitangent sign
+	uint16_t TexCoords[2]; // half float
+};
+
+// Maps snorm16 positions back into model space: position = Offset + Scale * snorm
+struct PositionDequantization {
+	glm::vec3 Offset = glm::vec3(0.0f);
+	glm::vec3 Scale = glm::vec3(1.0f);
+};
+
+// CPU side of the compact vertex formats: bit packing of the individual attributes
+class VertexQuantizer
+{
+public:
+	static size_t Stride(VertexFormat format)
+	{
+		switch (format)
+		{
+		case VERTEX_FORMAT_COMPACT:
+			return sizeof(CompactVertex);
+		case VERTEX_FORMAT_COMPACT_QUATERNION:
+			return sizeof(QuaternionVertex);
+		default:
+			return 14 * sizeof(float);
+		}
+	}
+
+	// centre and half extent of the bounding box, so the quantized positions use the full snorm range on every axis
+	static PositionDequantization ComputeDequantization(const float* positions, size_t stride, size_t vertexCount)
+	{
+		PositionDequantization dequantization;
+		if (vertexCount == 0)
+			return dequantization;
+
+		glm::vec3 lo(positions[0], positions[1], positions[2]), hi = lo;
+		for (size_t v = 0; v < vertexCount; ++v)
+		{
+			glm::vec3 p(positions[v * stride], positions[v * stride + 1], positions[v * stride + 2]);
+			lo = glm::min(lo, p);
+			hi = glm::max(hi, p);
+		}
+		dequantization.Offset = (lo + hi) * 0.5f;
+		// a flat axis still needs a non-zero scale to divide by
+		dequantization.Scale = glm::max((hi - lo) * 0.5f, glm::vec3(1e-8f));
+		return dequantization;
+	}
+
+	static void QuantizePosition(const glm::vec3& position, const PositionDequantization& dequantization, int16_t* out)
+	{
+		glm::vec3 unit = (position - dequantization.Offset) / dequantization.Scale;
+		out[0] = (int16_t)QuantizeSnorm(unit.x, 16);
+		out[1] = (int16_t)QuantizeSnorm(unit.y, 16);
+		out[2] = (int16_t)QuantizeSnorm(unit.z, 16);
+		out[3] = 0;
+	}
+
+	// rounds v in [-1, 1] to the nearest step of a signed normalized integer of the given width
+	static int QuantizeSnorm(float v, int bits)
+	{
+		const float scale = (float)((1 << (bits - 1)) - 1);
+		v = std::min(std::max(v, -1.0f), 1.0f);
+		return (int)std::lround(v * scale);
+	}
+
+	// unit vector to the octahedral map in [-1, 1]^2 (Meyer et al., "On Floating-Point Normal Vectors")
+	static glm::vec2 EncodeOctahedral(glm::vec3 n)
+	{
+		n /= std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z) + 1e-20f;
+		glm::vec2 e(n.x, n.y);
+		if (n.z < 0.0f)
+			e = glm::vec2((1.0f - std::fabs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f), (1.0f - std::fabs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+		return e;
+	}
+
+	static glm::vec3 DecodeOctahedral(glm::vec2 e)
+	{
+		glm::vec3 n(e.x, e.y, 1.0f - std::fabs(e.x) - std::fabs(e.y));
+		float t = std::max(-n.z, 0.0f);
+		n.x += n.x >= 0.0f ? -t : t;
+		n.y += n.y >= 0.0f ? -t : t;
+		return glm::normalize(n);
+	}
+
+	// GL_INT_2_10_10_10_REV: x in the low bits, w in the top two
+	static uint32_t PackSnorm1010102(float x, float y, float z, float w)
+	{
+		return ((uint32_t)QuantizeSnorm(x, 10) & 0x3FF) |
+		       (((uint32_t)QuantizeSnorm(y, 10) & 0x3FF) << 10) |
+		       (((uint32_t)QuantizeSnorm(z, 10) & 0x3FF) << 20) |
+		       (((uint32_t)QuantizeSnorm(w, 2) & 0x3) << 30);
+	}
+
+	// IEEE 754 half with round to nearest even; out of range values saturate to infinity
+	static uint16_t FloatToHalf(float value)
+	{
+		uint32_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		const uint32_t sign = (bits >> 16) & 0x8000;
+		const uint32_t magnitude = bits & 0x7FFFFFFF;
+
+		if (magnitude >= 0x7F800000) // inf or NaN
+			return (uint16_t)(sign | 0x7C00 | (magnitude > 0x7F800000 ? 0x200 : 0));
+		if (magnitude >= 0x477FF000) // rounds past the largest half
+			return (uint16_t)(sign | 0x7C00);
+		if (magnitude < 0x38800000) // subnormal half, or zero
+		{
+			if (magnitude < 0x33000000)
+				return (uint16_t)sign;
+			const uint32_t mantissa = (magnitude & 0x7FFFFF) | 0x800000;
+			const int shift = 126 - (int)(magnitude >> 23);
+			uint32_t half = mantissa >> shift;
+			const uint32_t rest = mantissa & ((1u << shift) - 1);
+			const uint32_t halfway = 1u << (shift - 1);
+			if (rest > halfway || (rest == halfway && (half & 1)))
+				++half;
+			return (uint16_t)(sign | half);
+		}
+		uint32_t half = ((magnitude - 0x38000000) >> 13);
+		const uint32_t rest = magnitude & 0x1FFF;
+		if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+			++half;
+		return (uint16_t)(sign | half);
+	}
+
+	// Orthonormal tangent frame around n: tangent is t made perpendicular to n (any perpendicular if t is missing
+	// or parallel), and the returned sign says whether b points along cross(n, tangent) or against it
+	static float OrthonormalizeFrame(const glm::vec3& n, const glm::vec3& t, const glm::vec3& b, glm::vec3& tangent)
+	{
+		tangent = t - n * glm::dot(n, t);
+		if (glm::dot(tangent, tangent) < 1e-12f)
+			tangent = std::fabs(n.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) - n * n.x : glm::vec3(0.0f, 1.0f, 0.0f) - n * n.y;
+		tangent = glm::normalize(tangent);
+		return glm::dot(glm::cross(n, tangent), b) < 0.0f ? -1.0f : 1.0f;
+	}
+
+	// Rotation taking x, y, z to tangent, cross(n, tangent) and n. q and -q are the same rotation, so the sign of w
+	// is free to carry the bitangent sign; w is kept at least one snorm16 step away from zero so the sign survives.
+	static glm::vec4 FrameToQuaternion(const glm::vec3& n, const glm::vec3& tangent, float bitangentSign)
+	{
+		const glm::vec3 bitangent = glm::cross(n, tangent);
+		const float m00 = tangent.x, m11 = bitangent.y, m22 = n.z;
+		glm::vec4 q;
+		const float trace = m00 + m11 + m22;
+		if (trace > 0.0f)
+		{
+			float s = 0.5f / std::sqrt(trace + 1.0f);
+			q = glm::vec4((bitangent.z - n.y) * s, (n.x - tangent.z) * s, (tangent.y - bitangent.x) * s, 0.25f / s);
+		}
+		else if (m00 > m11 && m00 > m22)
+		{
+			float s = 2.0f * std::sqrt(1.0f + m00 - m11 - m22);
+			q = glm::vec4(0.25f * s, (bitangent.x + tangent.y) / s, (n.x + tangent.z) / s, (bitangent.z - n.y) / s);
+		}
+		else if (m11 > m22)
+		{
+			float s = 2.0f * std::sqrt(1.0f + m11 - m00 - m22);
+			q = glm::vec4((bitangent.x + tangent.y) / s, 0.25f * s, (n.y + bitangent.z) / s, (n.x - tangent.z) / s);
+		}
+		else
+		{
+			float s = 2.0f * std::sqrt(1.0f + m22 - m00 - m11);
+			q = glm::vec4((n.x + tangent.z) / s, (n.y + bitangent.z) / s, 0.25f * s, (tangent.y - bitangent.x) / s);
+		}
+		q = glm::normalize(q);
+		if (q.w < 0.0f)
+			q = -q;
+		const float bias = 1.0f / 32767.0f;
+		if (q.w < bias)
+		{
+			const float xyzScale = std::sqrt(1.0f - bias * bias) / std::sqrt(q.x * q.x + q.y * q.y + q.z * q.z);
+			q = glm::vec4(q.x * xyzScale, q.y * xyzScale, q.z * xyzScale, bias);
+		}
+		return bitangentSign < 0.0f ? -q : q;
+	}
+};
+
+// GLSL declaring the vertex inputs of a format and
+//     void decodeVertex(out vec3 position, out vec3 normal, out vec2 texCoords, out vec3 tangent, out vec3 bitangent)
+// to be inserted after the #version line of a vertex shader (see the Shader constructor). The compact formats
+// read the dequantization transform from the positionOffset and positionScale uniforms, which Mesh::Draw sets.
+inline const char* VertexDecodeSource(VertexFormat format)
+{
+	switch (format)
+	{
+	case VERTEX_FORMAT_COMPACT:
+		return
+			"layout (location = 0) in vec4 aPackedPosition;\n"
+			"layout (location = 1) in vec2 aPackedNormal;\n"
+			"layout (location = 2) in vec2 aTexCoords;\n"
+			"layout (location = 3) in vec4 aPackedTangent;\n"
+			"uniform vec3 positionOffset;\n"
+			"uniform vec3 positionScale;\n"
+			"vec3 decodeOctahedral(vec2 e)\n"
+			"{\n"
+			"    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));\n"
+			"    float t = max(-n.z, 0.0);\n"
+			"    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);\n"
+			"    return normalize(n);\n"
+			"}\n"
+			"void decodeVertex(out vec3 position, out vec3 normal, out vec2 texCoords, out vec3 tangent, out vec3 bitangent)\n"
+			"{\n"
+			"    position = positionOffset + positionScale * aPackedPosition.xyz;\n"
+			"    normal = decodeOctahedral(aPackedNormal);\n"
+			"    texCoords = aTexCoords;\n"
+			"    tangent = normalize(aPackedTangent.xyz);\n"
+			"    bitangent = cross(normal, tangent) * aPackedTangent.w;\n"
+			"}\n";
+	case VERTEX_FORMAT_COMPACT_QUATERNION:
+		return
+			"layout (location = 0) in vec4 aPackedPosition;\n"
+			"layout (location = 1) in vec4 aTangentFrame;\n"
+			"layout (location = 2) in vec2 aTexCoords;\n"
+			"uniform vec3 positionOffset;\n"
+			"uniform vec3 positionScale;\n"
+			"vec3 rotateByQuaternion(vec4 q, vec3 v)\n"
+			"{\n"
+			"    return v + 2.0 * cross(q.xyz, cross(q.xyz, v) + q.w * v);\n"
+			"}\n"
+			"void decodeVertex(out vec3 position, out vec3 normal, out vec2 texCoords, out vec3 tangent, out vec3 bitangent)\n"
+			"{\n"
+			"    position = positionOffset + positionScale * aPackedPosition.xyz;\n"
+			"    vec4 q = normalize(aTangentFrame);\n"
+			"    normal = rotateByQuaternion(q, vec3(0.0, 0.0, 1.0));\n"
+			"    tangent = rotateByQuaternion(q, vec3(1.0, 0.0, 0.0));\n"
+			"    bitangent = rotateByQuaternion(q, vec3(0.0, 1.0, 0.0)) * (q.w < 0.0 ? -1.0 : 1.0);\n"
+			"    texCoords = aTexCoords;\n"
+			"}\n";
+	default:
+		return
+			"layout (location = 0) in vec3 aPos;\n"
+			"layout (location = 1) in vec3 aNormal;\n"
+			"layout (location = 2) in vec2 aTexCoords;\n"
+			"layout (location = 3) in vec3 aTangent;\n"
+			"layout (location = 4) in vec3 aBitangent;\n"
+			"void decodeVertex(out vec3 position, out vec3 normal, out vec2 texCoords, out vec3 tangent, out vec3 bitangent)\n"
+			"{\n"
+			"    position = aPos;\n"
+			"    normal = aNormal;\n"
+			"    texCoords = aTexCoords;\n"
+			"    tangent = aTangent;\n"
+			"    bitangent = aBitangent;\n"
+			"}\n";
+	}
+}
+#endif
@@ -0,0 +1,94 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Threads kept alive between calls, for work split the same way every frame, where starting threads each time
+// would cost more than the work. Run hands out task indices; the calling thread takes a share of them too, and
+// threads are only started the first time that many are needed.
+class WorkerPool
+{
+public:
+	WorkerPool() = default;
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	~WorkerPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (std::thread& worker : workers)
+			worker.join();
+	}
+
+	// calls task(i) for every i in 0..count-1 across the pool and the calling thread, returning once all have;
+	// one Run at a time
+	void Run(int count, const std::function<void(int)>& task)
+	{
+		if (count <= 1)
+		{
+			if (count == 1)
+				task(0);
+			return;
+		}
+		while ((int)workers.size() < count - 1)
+			workers.emplace_back(&WorkerPool::work, this);
+
+		std::unique_lock<std::mutex> lock(mutex);
+		job = &task;
+		jobCount = count;
+		next = 0;
+		unfinished = count;
+		++generation;
+		wake.notify_all();
+		runTasks(lock);
+		finished.wait(lock, [this]() { return unfinished == 0; });
+		job = nullptr;
+	}
+
+private:
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake, finished;
+	const std::function<void(int)>* job = nullptr;
+	int jobCount = 0, next = 0, unfinished = 0;
+	unsigned int generation = 0;
+	bool stopping = false;
+
+	void work()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		unsigned int seen = generation;
+		for (;;)
+		{
+			wake.wait(lock, [this, seen]() { return stopping || generation != seen; });
+			if (stopping)
+				return;
+			seen = generation;
+			runTasks(lock);
+		}
+	}
+
+	// claims and runs tasks of the current job until none are left; called and returns with the lock held
+	void runTasks(std::unique_lock<std::mutex>& lock)
+	{
+		while (job != nullptr && next < jobCount)
+		{
+			const int index = next++;
+			const std::function<void(int)>& task = *job;
+			lock.unlock();
+			task(index);
+			lock.lock();
+			if (--unfinished == 0)
+				finished.notify_all();
+		}
+	}
+};
+#endif